@@ -47,6 +47,11 @@ public:
   /// Query whether the function requires intialization.
   virtual bool isInitialized() = 0;
 
+  /// Create another instance of the function that shares its compiled code,
+  /// but has its own bindings, temporaries and indices. Instances can be
+  /// bound to different data and run concurrently.
+  virtual Function* clone() const = 0;
+
   // TODO Should these really be an extension to the bind interface?
   //      Per-argument updates/copies.
   //      Don't always write in a new pointer (requires re-JIT), just alert to
@@ -61,6 +66,16 @@ public:
   /// Print the function as machine assembly code to the stream.
   virtual void printMachine(std::ostream &os) const = 0;
 
+  /// Write the function to the stream as a relocatable object file, for
+  /// ahead-of-time compilation. The object defines the C entry points and
+  /// globals declared by writeHeader.
+  virtual void writeObject(std::ostream &os) const = 0;
+
+  /// Write a C header that declares the entry points of the object written by
+  /// writeObject, and the context object struct that holds the externs,
+  /// temporaries and tensor indices of an instance of the function.
+  virtual void writeHeader(std::ostream &os) const = 0;
+
   bool hasArg(std::string arg) const;
   const std::vector<std::string>& getArgs() const;
   const ir::Type& getArgType(std::string arg) const;
@@ -53,6 +53,7 @@ Function* GPUBackend::compile(ir::Func irFunc, const ir::Storage& storage) {
   irFile.close();
 
   this->irFunc = irFunc;
+  this->options = internal::getCompileOptions();
   this->module = createNVVMModule("kernels-module");
   this->dataLayout.reset(new llvm::DataLayout(module));
 
@@ -35,7 +35,8 @@ namespace backend {
 
 class GPUBackend : public LLVMBackend {
 public:
-  GPUBackend() {}
+  // The GPU backend generates code in the global context
+  GPUBackend() : LLVMBackend(nullptr) {}
   ~GPUBackend() {}
 
 protected:
@@ -184,6 +184,7 @@ GPUFunction::SetData GPUFunction::pushSetData(Set* set, const ir::SetType* setTy
     data.endpoints = nullHandle;
     data.startIndex = nullHandle;
     data.nbrIndex = nullHandle;
+    data.edgeLocations = nullHandle;
     return data;
   }
 
@@ -243,6 +244,23 @@ GPUFunction::SetData GPUFunction::pushSetData(Set* set, const ir::SetType* setTy
     data.nbrIndex = nbrIndexHandle;
     // setData.push_back(llvmPtr(LLVM_INT_PTR,
     //                           reinterpret_cast<void*>(*nbrBuffer)));
+
+    // Edge locations
+    const int *edgeLocations = nbrs->getEdgeLocations();
+    size_t edgeLocationsSize = nbrs->getEdgeLocationsSize() * sizeof(int);
+    iassert(edgeLocationsSize != 0)
+        << "Cannot allocate edge set with zero-sized edge location array: "
+        << set->getName();
+    CUdeviceptr *edgeLocationsBuffer = new CUdeviceptr();
+    checkCudaErrors(cuMemAlloc(edgeLocationsBuffer, edgeLocationsSize));
+    checkCudaErrors(cuMemcpyHtoD(*edgeLocationsBuffer, edgeLocations,
+                                 edgeLocationsSize));
+    // Pushed bufs expects non-const pointers, because some are written to.
+    DeviceDataHandle *edgeLocationsHandle = new DeviceDataHandle(
+        const_cast<int*>(edgeLocations), edgeLocationsBuffer,
+        edgeLocationsSize);
+    pushedBufs.push_back(edgeLocationsHandle);
+    data.edgeLocations = edgeLocationsHandle;
   }
 
   // Fields
@@ -441,6 +459,8 @@ llvm::Value *GPUFunction::pushArg(std::string name, ir::Type& argType, Actual* a
           *(pushedData.startIndex->devBuffer))));
       setData.push_back(llvmPtr(LLVM_INT_PTR, reinterpret_cast<void*>(
           *(pushedData.nbrIndex->devBuffer))));
+      setData.push_back(llvmPtr(LLVM_INT_PTR, reinterpret_cast<void*>(
+          *(pushedData.edgeLocations->devBuffer))));
     }
     // Fields
     ir::Type ety = setType->elementType;
@@ -543,8 +563,6 @@ GPUFunction::init() {
   CUlinkState linker;
   CUfunction cudaFunction;
 
-  pe::PathIndexBuilder piBuilder;
-
   // Free any old device data
   for (DeviceDataHandle *handle : pushedBufs) {
     freeArg(handle);
@@ -702,7 +720,7 @@ GPUFunction::init() {
       size_t expectedSize = sizeof(int) // setSize
           + pushedData.fields.size() * sizeof(void*); // fields
       if (setType->getCardinality() > 0) {
-        expectedSize += 3*sizeof(void*); // endpoints and indices arrays
+        expectedSize += 4*sizeof(void*); // endpoints and indices arrays
       }
       void *globalPtrHost = getGlobalHostPtr(
           *cudaModule, bufVar.getName(), expectedSize);
@@ -719,9 +737,13 @@ GPUFunction::init() {
         *(void**)globalPtrHost  = reinterpret_cast<void*>(
             *(pushedData.nbrIndex->devBuffer));
         globalPtrHost = ((void**)globalPtrHost)+1;
+        *(void**)globalPtrHost  = reinterpret_cast<void*>(
+            *(pushedData.edgeLocations->devBuffer));
+        globalPtrHost = ((void**)globalPtrHost)+1;
         handleVec.push_back(pushedData.endpoints);
         handleVec.push_back(pushedData.startIndex);
         handleVec.push_back(pushedData.nbrIndex);
+        handleVec.push_back(pushedData.edgeLocations);
       }
       // NOTE: This code assumes the width of void* is the same as
       // and float*/int* on the GPU.
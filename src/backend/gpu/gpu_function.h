@@ -78,6 +78,7 @@ class GPUFunction : public LLVMFunction {
     DeviceDataHandle *endpoints;
     DeviceDataHandle *startIndex; // row starts
     DeviceDataHandle *nbrIndex; // col indexes
+    DeviceDataHandle *edgeLocations; // neighbor locations of edges
 
     // Fields
     std::vector<DeviceDataHandle*> fields;
@@ -1,9 +1,12 @@
 #include "llvm_backend.h"
 
 #include <cstdint>
+#include <cstdlib>
 #include <iostream>
+#include <sstream>
 #include <stack>
 #include <algorithm>
+#include <mutex>
 
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
@@ -13,6 +16,7 @@
 #include "llvm/IR/Intrinsics.h"
 #include "llvm/IR/Type.h"
 #include "llvm/IR/Function.h"
+#include "llvm/IR/MDBuilder.h"
 #include "llvm/Support/raw_ostream.h"
 
 #if LLVM_MAJOR_VERSION <= 3 && LLVM_MINOR_VERSION <= 4
@@ -22,8 +26,17 @@
 #endif
 
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Triple.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/DynamicLibrary.h"
 #include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/Host.h"
 #include "llvm/ExecutionEngine/MCJIT.h"
+#include "llvm/MC/MCSubtargetInfo.h"
+#include "llvm/MC/SubtargetFeature.h"
+#include "llvm/Support/TargetRegistry.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Transforms/Utils/Cloning.h"
 
 #include "llvm/PassManager.h"
 #include "llvm/Analysis/Passes.h"
@@ -44,11 +57,16 @@
 #include "ir_transforms.h"
 #include "ir_rewriter.h" // TODO: Remove this header
 #include "environment.h"
+#include "compile_options.h"
+#include "field_allocator.h"
+#include "field_layout.h"
 #include "tensor_index.h"
 #include "llvm_function.h"
+#include "llvm_object_cache.h"
 #include "macros.h"
 #include "runtime.h"
 #include "path_expressions.h"
+#include "thread_pool.h"
 #include "util/collections.h"
 
 using namespace std;
@@ -62,19 +80,201 @@ const std::string PTR_SUFFIX(".ptr");
 const std::string LEN_SUFFIX(".len");
 
 // class LLVMBackend
-bool LLVMBackend::llvmInitialized = false;
+static TargetCPU getHostCPU() {
+  TargetCPU host;
+  host.name = std::string(llvm::sys::getHostCPUName());
+
+  // Older LLVM versions only detect the features of some hosts, in which case
+  // the features of the host CPU name are used
+  llvm::StringMap<bool> hostFeatures;
+  if (llvm::sys::getHostCPUFeatures(hostFeatures)) {
+    llvm::SubtargetFeatures features;
+    for (auto& feature : hostFeatures) {
+      features.AddFeature(feature.first(), feature.second);
+    }
+    host.features = features.getString();
+  }
+  return host;
+}
+
+static uint64_t getFeatureBits(const TargetCPU& cpu) {
+  std::string triple = llvm::sys::getProcessTriple();
+  std::string error;
+  const llvm::Target *target = llvm::TargetRegistry::lookupTarget(triple,error);
+  iassert(target != nullptr) << error;
+  std::unique_ptr<llvm::MCSubtargetInfo> info(
+      target->createMCSubtargetInfo(triple, cpu.name, cpu.features));
+  return info->getFeatureBits();
+}
+
+// Returns the feature bits of the instruction set extensions of the process's
+// target (SSE, AVX, FMA, NEON, ...). The other feature bits of a CPU tune the
+// code generated for it (e.g. SlowBTMem), so they do not decide whether the
+// host can run that code. Targets without a list use all the feature bits.
+static uint64_t getISAFeatureBits() {
+  static const uint64_t isaFeatureBits = []() {
+    llvm::StringRef arch =
+        llvm::Triple(llvm::sys::getProcessTriple()).getArchName();
+    std::vector<std::string> features;
+    if (arch == "x86_64" || arch == "i386" || arch == "i486" ||
+        arch == "i586" || arch == "i686") {
+      features = {"mmx", "sse", "sse2", "sse3", "ssse3", "sse4.1", "sse4.2",
+                  "sse4a", "3dnow", "3dnowa", "avx", "avx2", "avx512f",
+                  "avx512cd", "avx512er", "avx512pf", "avx512dq", "avx512bw",
+                  "avx512vl", "fma", "fma4", "xop", "f16c", "popcnt", "aes",
+                  "pclmul", "bmi", "bmi2", "lzcnt", "movbe", "rdrnd", "rdseed",
+                  "cx16", "tbm", "adx", "sha", "hle", "rtm", "prfchw"};
+    }
+    else if (arch.startswith("arm") || arch.startswith("thumb")) {
+      features = {"vfp2", "vfp3", "vfp4", "fp-armv8", "neon", "crypto", "crc",
+                  "hwdiv"};
+    }
+    else if (arch.startswith("aarch64")) {
+      features = {"fp-armv8", "neon", "crypto", "crc"};
+    }
+    else if (arch.startswith("powerpc")) {
+      features = {"altivec", "vsx"};
+    }
+    else {
+      return ~(uint64_t)0;
+    }
+
+    uint64_t bits = 0;
+    for (const std::string& feature : features) {
+      bits |= getFeatureBits({"", "+" + feature});
+    }
+    return bits;
+  }();
+  return isaFeatureBits;
+}
+
+TargetCPU getTargetCPU() {
+  const internal::CompileOptions& options = internal::getCompileOptions();
+  if (!options.forcedTargetCPU.empty()) {
+    return {options.forcedTargetCPU, ""};
+  }
+
+  TargetCPU host = getHostCPU();
+  if (options.targetCPUs.empty()) {
+    return host;
+  }
+
+  uint64_t isaFeatureBits = getISAFeatureBits();
+  uint64_t hostFeatureBits = getFeatureBits(host) & isaFeatureBits;
+  for (const std::string& name : options.targetCPUs) {
+    TargetCPU variant = {name, ""};
+    uint64_t variantFeatureBits = getFeatureBits(variant) & isaFeatureBits;
+    if ((variantFeatureBits & ~hostFeatureBits) == 0) {
+      return variant;
+    }
+  }
+  return host;
+}
 
-shared_ptr<llvm::EngineBuilder> createEngineBuilder(llvm::Module *module) {
+shared_ptr<llvm::EngineBuilder> createEngineBuilder(llvm::Module *module,
+                                                    const TargetCPU& cpu) {
   shared_ptr<llvm::EngineBuilder> engineBuilder(new llvm::EngineBuilder(module));
+  engineBuilder->setMCPU(cpu.name);
+  engineBuilder->setMAttrs(llvm::SubtargetFeatures(cpu.features).getFeatures());
   return engineBuilder;
 }
 
-LLVMBackend::LLVMBackend() : builder(new SimitIRBuilder(LLVM_CTX)) {
-  if (!llvmInitialized) {
+/// Make LLVM print the remarks of the vectorizers to stderr, or stop it.
+static void setVectorizationRemarks(bool enable) {
+  llvm::StringMap<llvm::cl::Option*> options;
+  llvm::cl::getRegisteredOptions(options);
+
+  // A pattern that matches no pass disables the remarks
+  const std::string passes = enable ? "loop-vectorize|slp-vectorizer" : "^$";
+  for (const char *name : {"pass-remarks", "pass-remarks-missed",
+                           "pass-remarks-analysis"}) {
+    if (options.count(name) > 0) {
+      options[name]->addOccurrence(0, name, passes);
+    }
+  }
+}
+
+/// Run LLVM optimization passes on the module, tuned for the target machine.
+static void optimize(llvm::Module *module, llvm::Function *llvmFunc,
+                     llvm::TargetMachine *targetMachine) {
+  // We use the built-in PassManagerBuilder to build the set of passes that
+  // are similar to clang's -O3
+  llvm::FunctionPassManager fpm(module);
+  llvm::PassManager mpm;
+  llvm::PassManagerBuilder pmBuilder;
+
+  pmBuilder.OptLevel = 3;
+
+  pmBuilder.BBVectorize = 1;
+  pmBuilder.LoopVectorize = 1;
+//  pmBuilder.LoadCombine = 1;
+  pmBuilder.SLPVectorize = 1;
+
+  // The target's cost model tells the vectorizers the vector width and
+  // instructions of the target CPU
+  module->setDataLayout(targetMachine->getDataLayout());
+  targetMachine->addAnalysisPasses(fpm);
+  targetMachine->addAnalysisPasses(mpm);
+
+  llvm::DataLayout dataLayout(module);
+#if LLVM_MAJOR_VERSION >= 3 && LLVM_MINOR_VERSION >= 5
+  fpm.add(new llvm::DataLayoutPass(dataLayout));
+#else
+  fpm.add(new llvm::DataLayout(dataLayout));
+#endif
+
+  pmBuilder.populateFunctionPassManager(fpm);
+  pmBuilder.populateModulePassManager(mpm);
+
+  fpm.doInitialization();
+  fpm.run(*llvmFunc);
+  fpm.doFinalization();
+
+  mpm.run(*module);
+}
+
+/// Optimize a copy of the module for `cpu`, and store its object code in the
+/// object cache as the object of the module `moduleIdentifier`.
+static void precompile(llvm::Module *module, llvm::Function *llvmFunc,
+                       const TargetCPU& cpu,
+                       const std::string& moduleIdentifier) {
+  std::unique_ptr<llvm::Module> variant(llvm::CloneModule(module));
+  variant->setModuleIdentifier(moduleIdentifier);
+  std::unique_ptr<llvm::TargetMachine> targetMachine(
+      createEngineBuilder(variant.get(), cpu)->selectTarget());
+  optimize(variant.get(), variant->getFunction(llvmFunc->getName()),
+           targetMachine.get());
+
+  std::string object;
+  if (emitObjectFile(variant.get(), targetMachine.get(), &object)) {
+    LLVMObjectCache::getInstance().addObject(moduleIdentifier,
+                                             object.data(), object.size());
+  }
+  else {
+    LLVMObjectCache::getInstance().releaseModuleIdentifier(moduleIdentifier);
+  }
+}
+
+LLVMBackend::LLVMBackend()
+    : LLVMBackend(std::make_shared<llvm::LLVMContext>()) {
+}
+
+LLVMBackend::LLVMBackend(std::shared_ptr<llvm::LLVMContext> context)
+    : contextArg(nullptr), context(context), inParallelLoop(false),
+      tbaaRoot(nullptr), aliasScopeDomain(nullptr) {
+  static std::once_flag llvmInitialized;
+  std::call_once(llvmInitialized, []() {
     llvm::InitializeNativeTarget();
     llvm::InitializeNativeTargetAsmPrinter();
-    llvmInitialized = true;
-  }
+
+    // Make the thread pool entry point visible to jitted code, also when the
+    // host executable does not export its symbols
+    llvm::sys::DynamicLibrary::AddSymbol("simit_parallel_for",
+                                         (void*)&simit_parallel_for);
+  });
+
+  LLVMContextScope contextScope(context);
+  builder.reset(new SimitIRBuilder(LLVM_CTX));
 }
 
 LLVMBackend::~LLVMBackend() {}
@@ -115,8 +315,81 @@ Func LLVMBackend::makeSystemTensorsGlobal(Func func) {
   return MakeSystemTensorsGlobalRewriter().rewrite(func);
 }
 
+/// Returns a string that determines the code LLVMBackend emits for func, for
+/// use as an object cache key. Literals are hashed by their bytes since the
+/// IR printer rounds floating point values.
+static std::string getCacheKey(const Func& func, const ir::Storage& storage,
+                               const TargetCPU& cpu,
+                               const internal::CompileOptions& options) {
+  class PrintLiteralData : public IRVisitor {
+  public:
+    PrintLiteralData(std::ostream& os) : os(os) {}
+
+  private:
+    std::ostream& os;
+
+    using IRVisitor::visit;
+    void visit(const Literal *op) {
+      os << std::hex;
+      const unsigned char *data = static_cast<const unsigned char*>(op->data);
+      for (size_t i=0; i < op->size; ++i) {
+        os << (unsigned)data[i] << ".";
+      }
+      os << std::dec << endl;
+    }
+  };
+
+  // Bump the version whenever the code generation changes
+  const int cacheVersion = 7;
+
+  stringstream key;
+  key << "version " << cacheVersion << endl
+      << "llvm " << LLVM_MAJOR_VERSION << "." << LLVM_MINOR_VERSION << endl
+      << "target " << llvm::sys::getProcessTriple() << endl
+      << "cpu " << cpu.name << " " << cpu.features << endl
+      << "backend " << options.backend << endl
+      << "floatBytes " << ScalarType::floatBytes << endl
+      << "parallel " << (options.numThreads > 1) << " " << options.schedule
+                     << " " << options.chunkSize << endl
+      << "vectorizeBlocks " << options.vectorizeBlocks << endl
+      << "mapVectorWidth " << options.mapVectorWidth << endl
+      << "fieldLayout " << options.fieldLayout.getTile() << endl
+#ifdef SIMIT_DEBUG
+      << "debug" << endl
+#endif
+      << storage << endl;
+
+  PrintLiteralData printLiteralData(key);
+  for (auto &f : getCallTree(func)) {
+    key << f << endl << f.getStorage() << endl;
+    if (f.getBody().defined()) {
+      f.getBody().accept(&printLiteralData);
+    }
+    for (auto &constant : f.getEnvironment().getConstants()) {
+      constant.second.accept(&printLiteralData);
+    }
+  }
+  return key.str();
+}
+
 Function* LLVMBackend::compile(ir::Func func, const ir::Storage& storage) {
+  LLVMContextScope contextScope(context);
+  options = internal::getCompileOptions();
   this->module = new llvm::Module("simit", LLVM_CTX);
+  TargetCPU cpu = getTargetCPU();
+
+  // Name the module by the hash of everything that determines its code, so
+  // that MCJIT can load its object code from the cache instead of generating
+  // it. A cached object also makes the optimization passes redundant, so it
+  // is read now and MCJIT is given it even if the file goes away meanwhile.
+  LLVMObjectCache& objectCache = LLVMObjectCache::getInstance();
+  bool cached = false;
+  if (objectCache.isEnabled()) {
+    std::string key = getCacheKey(func, storage, cpu, options);
+    std::string moduleIdentifier = objectCache.getModuleIdentifier(key);
+    module->setModuleIdentifier(moduleIdentifier);
+    cached = objectCache.loadObject(moduleIdentifier);
+  }
 
   iassert(func.getBody().defined()) << "cannot compile an undefined function";
 
@@ -125,7 +398,15 @@ Function* LLVMBackend::compile(ir::Func func, const ir::Storage& storage) {
   this->symtable.clear();
   this->buffers.clear();
   this->globals.clear();
+  this->contextLayout = std::make_shared<ContextLayout>();
+  this->bufferSlots.clear();
+  this->contextArg = nullptr;
+  this->loopLocals.clear();
   this->storage = storage;
+  this->tbaaRoot = nullptr;
+  this->tbaaTags.clear();
+  this->aliasScopeDomain = nullptr;
+  this->aliasScopes.clear();
 
   // This backend stores dense tensors and sparse tensors with path expressions
   // as globals.
@@ -159,6 +440,40 @@ Function* LLVMBackend::compile(ir::Func func, const ir::Storage& storage) {
       symtable.insert(global.first, compile(global.second));
     }
 
+    // Remember which variables are declared inside loops before hoisting the
+    // declarations, so that parallel loops can privatize them and vectorized
+    // block loops can keep them in vector lanes
+    if (options.numThreads > 1 || options.vectorizeBlocks ||
+        options.mapVectorWidth > 1) {
+      class CollectLoopLocals : public IRVisitor {
+      public:
+        map<Var, set<Var>> *loopLocals;
+        vector<Var> loops;
+
+        CollectLoopLocals(map<Var, set<Var>> *loopLocals)
+            : loopLocals(loopLocals) {}
+
+        using IRVisitor::visit;
+        void visit(const ForRange *op) {
+          loops.push_back(op->var);
+          op->body.accept(this);
+          loops.pop_back();
+        }
+        void visit(const For *op) {
+          loops.push_back(op->var);
+          op->body.accept(this);
+          loops.pop_back();
+        }
+        void visit(const VarDecl *op) {
+          for (const Var &loop : loops) {
+            (*loopLocals)[loop].insert(op->var);
+          }
+        }
+      };
+      CollectLoopLocals collector(&loopLocals);
+      f.getBody().accept(&collector);
+    }
+
     // LLVM does not de-allocate any stack memory until a function returns, so
     // we must make sure to not allocate stack memory inside a loop. To do this
     // we move all the var decls to the front of the function body
@@ -171,25 +486,28 @@ Function* LLVMBackend::compile(ir::Func func, const ir::Storage& storage) {
   }
   iassert(llvmFunc);
 
-  // Declare malloc and free if necessary
+  // Declare malloc and free if necessary. Temporaries are aligned like fields,
+  // as the code that accesses them assumes.
   llvm::FunctionType *m =
       llvm::FunctionType::get(LLVM_INT8_PTR, {LLVM_INT}, false);
-  llvm::Function *malloc =
-      llvm::cast<llvm::Function>(module->getOrInsertFunction("malloc", m));
+  llvm::Function *malloc = llvm::cast<llvm::Function>(
+      module->getOrInsertFunction("simitAlignedMalloc", m));
   llvm::FunctionType *f =
       llvm::FunctionType::get(LLVM_VOID, {LLVM_INT8_PTR}, false);
   llvm::Function *free =
       llvm::cast<llvm::Function>(module->getOrInsertFunction("free", f));
 
   // Create initialization function
-  emitEmptyFunction(func.getName()+"_init", func.getArguments(),
-                    func.getResults(), true);
+  llvm::Function *initFunc =
+      emitEmptyFunction(func.getName()+"_init", func.getArguments(),
+                        func.getResults(), true);
   for (auto &buffer : buffers) {
     const Var&   bufferVar = buffer.first;
-    llvm::Value* bufferVal = buffer.second;
 
     Type type = bufferVar.getType();
     llvm::Type *ltype = llvmType(type);
+    llvm::Value* bufferVal = emitContextSlot(bufferSlots.at(bufferVar), ltype,
+                                             bufferVar.getName());
 
     iassert(type.isTensor());
     const TensorType *ttype = type.toTensor();
@@ -206,11 +524,14 @@ Function* LLVMBackend::compile(ir::Func func, const ir::Storage& storage) {
 
 
   // Create de-initialization function
-  emitEmptyFunction(func.getName()+"_deinit", func.getArguments(),
-                    func.getResults(), true);
+  llvm::Function *deinitFunc =
+      emitEmptyFunction(func.getName()+"_deinit", func.getArguments(),
+                        func.getResults(), true);
   for (auto &buffer : buffers) {
     Var var = buffer.first;
-    llvm::Value *bufferVal = buffer.second;
+    llvm::Value *bufferVal = emitContextSlot(bufferSlots.at(var),
+                                             llvmType(var.getType()),
+                                             var.getName());
 
     llvm::Value *tmpPtr = builder->CreateLoad(bufferVal);
     tmpPtr = builder->CreateCast(llvm::Instruction::CastOps::BitCast,
@@ -220,44 +541,76 @@ Function* LLVMBackend::compile(ir::Func func, const ir::Storage& storage) {
   builder->CreateRetVoid();
   symtable.clear();
 
+  // Give each argument a slot in the context object, or a slot for each
+  // element of set arguments that are passed as structs, and create the entry
+  // points that read the arguments from them
+  auto llvmArgIt = llvmFunc->arg_begin();
+  for (size_t i = 0; i + 1 < llvmFunc->arg_size(); ++i, ++llvmArgIt) {
+    llvm::Type *type = llvmArgIt->getType();
+    vector<ContextLayout::Slot> slots;
+    if (type->isStructTy()) {
+      llvm::StructType *setType = llvm::cast<llvm::StructType>(type);
+      for (unsigned j = 0; j < setType->getNumElements(); ++j) {
+        llvm::Type *elementType = setType->getElementType(j);
+        slots.push_back({addContextSlot(elementType), elementType});
+      }
+    }
+    else {
+      slots.push_back({addContextSlot(type), type});
+    }
+    contextLayout->arguments.push_back(slots);
+  }
+  emitEntryFunction(initFunc);
+  emitEntryFunction(llvmFunc);
+  emitEntryFunction(deinitFunc);
+  contextArg = nullptr;
+
   iassert(!llvm::verifyModule(*module))
       << "LLVM module does not pass verification";
 
-  auto engineBuilder = createEngineBuilder(module);
+  auto engineBuilder = createEngineBuilder(module, cpu);
 
 #ifndef SIMIT_DEBUG
-  // Run LLVM optimization passes on the function
-  // We use the built-in PassManagerBuilder to build
-  // the set of passes that are similar to clang's -O3
-  llvm::FunctionPassManager fpm(module);
-  llvm::PassManager mpm;
-  llvm::PassManagerBuilder pmBuilder;
-  
-  pmBuilder.OptLevel = 3;
-
-  pmBuilder.BBVectorize = 1;
-  pmBuilder.LoopVectorize = 1;
-//  pmBuilder.LoadCombine = 1;
-  pmBuilder.SLPVectorize = 1;
-
-  llvm::DataLayout dataLayout(module);
-#if LLVM_MAJOR_VERSION >= 3 && LLVM_MINOR_VERSION >= 5
-  fpm.add(new llvm::DataLayoutPass(dataLayout));
-#else
-  fpm.add(new llvm::DataLayout(dataLayout));
-#endif
-
-  pmBuilder.populateFunctionPassManager(fpm);
-  pmBuilder.populateModulePassManager(mpm);
+  // Store the code of the other CPU variants in the object cache, so that a
+  // cache directory populated on one machine serves machines of other kinds
+  if (objectCache.isEnabled()) {
+    for (const std::string& name : options.targetCPUs) {
+      TargetCPU variant = {name, ""};
+      std::string moduleIdentifier =
+          objectCache.getModuleIdentifier(getCacheKey(func, storage, variant,
+                                                      options));
+      if (moduleIdentifier != module->getModuleIdentifier() &&
+          !objectCache.hasObject(moduleIdentifier)) {
+        precompile(module, llvmFunc, variant, moduleIdentifier);
+      }
+      else {
+        objectCache.releaseModuleIdentifier(moduleIdentifier);
+      }
+    }
+  }
 
-  fpm.doInitialization();
-  fpm.run(*llvmFunc);
-  fpm.doFinalization();
-  
-  mpm.run(*module);
+  if (!cached) {
+    std::unique_ptr<llvm::TargetMachine> targetMachine(
+        engineBuilder->selectTarget());
+    // The remarks are enabled through global options, so functions that are
+    // compiled concurrently are reported one at a time
+    static std::mutex reportMutex;
+    std::unique_lock<std::mutex> reportLock(reportMutex, std::defer_lock);
+    if (options.vectorizationReport) {
+      reportLock.lock();
+      setVectorizationRemarks(true);
+      cerr << "Vectorization report of " << func.getName() << ":" << endl;
+    }
+    optimize(module, llvmFunc, targetMachine.get());
+    if (options.vectorizationReport) {
+      setVectorizationRemarks(false);
+    }
+  }
 #endif
 
-  return new LLVMFunction(func, storage, llvmFunc, module, engineBuilder);
+  return new LLVMFunction(func, storage, llvmFunc, module, engineBuilder,
+                          objectCache.isEnabled() ? &objectCache : nullptr,
+                          contextLayout, options.fieldLayout);
 }
 
 void LLVMBackend::compile(const ir::Literal& literal) {
@@ -302,9 +655,18 @@ void LLVMBackend::compile(const ir::Literal& literal) {
     }
   }
   else {
-    // TODO: This should become a reference to a global literal
-    // (unify with GPUBackend).
-    val = llvmPtr(literal);
+    // Emit the literal data as a module global instead of a pointer to the
+    // host literal, so that the generated code is relocatable and can be
+    // cached across processes.
+    llvm::Constant *data = llvm::ConstantDataArray::get(LLVM_CTX,
+        llvm::ArrayRef<uint8_t>(static_cast<const uint8_t*>(literal.data),
+                                literal.size));
+    llvm::GlobalVariable *literalGlobal =
+        new llvm::GlobalVariable(*module, data->getType(), false,
+                                 llvm::GlobalValue::PrivateLinkage, data,
+                                 "_literal");
+    literalGlobal->setAlignment(8);
+    val = builder->CreateBitCast(literalGlobal, llvmType(*type));
   }
   iassert(val);
 }
@@ -345,13 +707,15 @@ void LLVMBackend::compile(const ir::VarExpr& varExpr) {
 
 void LLVMBackend::compile(const ir::Load& load) {
   llvm::Value *buffer = compile(load.buffer);
-  llvm::Value *index = compile(load.index);
+  llvm::Value *index = emitFieldIndex(load.buffer, compile(load.index));
 
   string locName = string(buffer->getName()) + PTR_SUFFIX;
   llvm::Value *bufferLoc = builder->CreateInBoundsGEP(buffer, index, locName);
 
   string valName = string(buffer->getName()) + VAL_SUFFIX;
-  val = builder->CreateLoad(bufferLoc, valName);
+  llvm::LoadInst *loadInst = builder->CreateLoad(bufferLoc, valName);
+  emitAliasMetadata(loadInst, load.buffer);
+  val = loadInst;
 }
 
 void LLVMBackend::compile(const ir::FieldRead& fieldRead) {
@@ -837,6 +1201,9 @@ void LLVMBackend::emitInternalCall(const ir::CallStmt& callStmt) {
     for (Var r : callStmt.results) {
       args.push_back(symtable.get(r));
     }
+    if (contextArg != nullptr) {
+      args.push_back(contextArg);
+    }
 
     llvm::Function* fun = module->getFunction(callStmt.callee.getName());
     builder->CreateCall(fun, args);
@@ -969,10 +1336,23 @@ void LLVMBackend::emitIntrinsicCall(const ir::CallStmt& callStmt) {
     call = emitCall("strcat", args, LLVM_INT8_PTR);
   }
   else if (callStmt.callee == ir::intrinsics::clock()) {
-    call = emitCall("clock", args, llvmFloatType());
+    call = emitCall("simitClock", args, LLVM_DOUBLE);
+    if (ir::ScalarType::singleFloat()) {
+      call = builder->CreateFPTrunc(call, llvmFloatType());
+    }
   }
   else if (callStmt.callee == ir::intrinsics::storeTime()) {
-    call = emitCall("storeTime", args);
+    llvm::Value* time = args[1];
+    if (ir::ScalarType::singleFloat()) {
+      time = builder->CreateFPExt(time, LLVM_DOUBLE);
+    }
+    call = emitCall("simitStoreTime", {args[0], time});
+  }
+  else if (callStmt.callee == ir::intrinsics::startTimer()) {
+    call = emitCall("simitStartTimer", args);
+  }
+  else if (callStmt.callee == ir::intrinsics::stopTimer()) {
+    call = emitCall("simitStopTimer", args);
   }
   else if (callee == ir::intrinsics::det()) {
     iassert(args.size() == 1);
@@ -990,7 +1370,13 @@ void LLVMBackend::emitIntrinsicCall(const ir::CallStmt& callStmt) {
     call = emitCall(fname, args);
   }
   else if (callStmt.callee == ir::intrinsics::solve()) {
-    std::string fname = "cMatSolve" + floatTypeName;
+    // Symmetric matrices only pass the upper block-triangle
+    const Expr& matrix = callStmt.actuals[0];
+    bool symmetric = isa<VarExpr>(matrix) &&
+        storage.hasStorage(to<VarExpr>(matrix)->var) &&
+        storage.getStorage(to<VarExpr>(matrix)->var).isSymmetric();
+    std::string fname = (symmetric ? "cMatSolveSymmetric" : "cMatSolve") +
+                        floatTypeName;
     call = emitCall(fname, args);
   }
   else if (callStmt.callee == ir::intrinsics::complexNorm()) {
@@ -1041,7 +1427,17 @@ void LLVMBackend::compile(const ir::CallStmt& callStmt) {
 
 void LLVMBackend::compile(const ir::Store& store) {
   llvm::Value *buffer = compile(store.buffer);
-  llvm::Value *index = compile(store.index);
+  llvm::Value *index = emitFieldIndex(store.buffer, compile(store.index));
+
+  // Iterations of a parallel loop may add to the same location of a shared
+  // buffer (e.g. when assembling a system matrix), so those adds are atomic
+  if (store.cop == CompoundOperator::Add && isParallelSharedAdd(store.buffer)) {
+    string locName = string(buffer->getName()) + PTR_SUFFIX;
+    llvm::Value *bufferLoc = builder->CreateInBoundsGEP(buffer, index, locName);
+    emitAtomicAdd(bufferLoc, compile(store.value));
+    return;
+  }
+
   llvm::Value *value;
   switch (store.cop) {
     case CompoundOperator::None: {
@@ -1058,7 +1454,23 @@ void LLVMBackend::compile(const ir::Store& store) {
 
   string locName = string(buffer->getName()) + PTR_SUFFIX;
   llvm::Value *bufferLoc = builder->CreateInBoundsGEP(buffer, index, locName);
-  builder->CreateStore(value, bufferLoc);
+  llvm::StoreInst *storeInst = builder->CreateStore(value, bufferLoc);
+  emitAliasMetadata(storeInst, store.buffer);
+}
+
+/// Returns the number of components of the tensors of the set field that
+/// `buffer` reads, if the field is laid out in tiles, and 0 otherwise. Fields
+/// of scalars are laid out the same way in every layout.
+static unsigned getTiledFieldSize(const Expr& buffer) {
+  if (options.fieldLayout.isArrayOfStructures() || !isa<FieldRead>(buffer) ||
+      !to<FieldRead>(buffer)->elementOrSet.type().isSet()) {
+    return 0;
+  }
+  const FieldRead *fieldRead = to<FieldRead>(buffer);
+  const ElementType *elemType =
+      fieldRead->elementOrSet.type().toSet()->elementType.toElement();
+  size_t size = elemType->field(fieldRead->fieldName).type.toTensor()->size();
+  return (size > 1) ? size : 0;
 }
 
 void LLVMBackend::compile(const ir::FieldWrite& fieldWrite) {
@@ -1086,6 +1498,21 @@ void LLVMBackend::compile(const ir::FieldWrite& fieldWrite) {
       // For now we'll assume fields are always dense row major
       llvm::Value *fieldLen =
           emitComputeLen(tensorFieldType, TensorStorage::Dense);
+
+      // Fields laid out in tiles are zeroed to the end of their last tile
+      unsigned blockSize = getTiledFieldSize(
+          FieldRead::make(fieldWrite.elementOrSet, fieldWrite.fieldName));
+      if (blockSize > 0) {
+        llvm::Value *tile = llvmInt(options.fieldLayout.getTile());
+        llvm::Value *numElements =
+            builder->CreateUDiv(fieldLen, llvmInt(blockSize));
+        llvm::Value *numTiles = builder->CreateUDiv(
+            builder->CreateAdd(numElements,
+                               llvmInt(options.fieldLayout.getTile()-1)),
+            tile);
+        fieldLen = builder->CreateMul(builder->CreateMul(numTiles, tile),
+                                      llvmInt(blockSize));
+      }
       unsigned compSize = tensorFieldType->getComponentType().bytes();
       llvm::Value *fieldSize = builder->CreateMul(fieldLen,llvmInt(compSize));
 
@@ -1096,6 +1523,15 @@ void LLVMBackend::compile(const ir::FieldWrite& fieldWrite) {
     }
   }
   else {
+    // Fields laid out in tiles are copied one component at a time, since their
+    // components are in a different order than those of other tensors
+    Expr field = FieldRead::make(fieldWrite.elementOrSet, fieldWrite.fieldName);
+    if (getTiledFieldSize(field) > 0) {
+      emitTiledFieldCopy(to<FieldRead>(field), field, fieldWrite.value,
+                         fieldWrite.cop);
+      return;
+    }
+
     // emit memcpy
     llvm::Value *fieldPtr = emitFieldRead(fieldWrite.elementOrSet,
                                           fieldWrite.fieldName);
@@ -1163,6 +1599,254 @@ void LLVMBackend::compile(const ir::IfThenElse& ifThenElse) {
   builder->SetInsertPoint(exitBlock);
 }
 
+// The most lanes of a vectorized block loop, and the most iterations of the
+// nested loops that are unrolled in its body
+static const int MAX_BLOCK_LANES = 16;
+static const int MAX_BLOCK_UNROLL = 64;
+
+/// Returns true if values of the type are int or float scalars.
+static bool isLaneType(const Type& type) {
+  if (!isScalar(type)) {
+    return false;
+  }
+  ScalarType::Kind kind = type.toTensor()->getComponentType().kind;
+  return kind == ScalarType::Int || kind == ScalarType::Float;
+}
+
+/// Evaluates an integer expression of literals and range lengths.
+static bool getConstant(const Expr& expr, int* value) {
+  if (isa<Literal>(expr)) {
+    const Literal *literal = to<Literal>(expr);
+    if (!isScalar(literal->type) ||
+        literal->type.toTensor()->getComponentType().kind != ScalarType::Int) {
+      return false;
+    }
+    *value = ((int*)literal->data)[0];
+    return true;
+  }
+  if (isa<Length>(expr)) {
+    const IndexSet& indexSet = to<Length>(expr)->indexSet;
+    if (indexSet.getKind() != IndexSet::Range) {
+      return false;
+    }
+    *value = indexSet.getSize();
+    return true;
+  }
+  int a, b;
+  if (isa<Neg>(expr) && getConstant(to<Neg>(expr)->a, &a)) {
+    *value = -a;
+    return true;
+  }
+  if (isa<Add>(expr) && getConstant(to<Add>(expr)->a, &a) &&
+      getConstant(to<Add>(expr)->b, &b)) {
+    *value = a + b;
+    return true;
+  }
+  if (isa<Sub>(expr) && getConstant(to<Sub>(expr)->a, &a) &&
+      getConstant(to<Sub>(expr)->b, &b)) {
+    *value = a - b;
+    return true;
+  }
+  if (isa<Mul>(expr) && getConstant(to<Mul>(expr)->a, &a) &&
+      getConstant(to<Mul>(expr)->b, &b)) {
+    *value = a * b;
+    return true;
+  }
+  return false;
+}
+
+/// An integer index expression as a constant plus variables times constant
+/// coefficients, plus the terms that are not linear in a variable. Forms with
+/// such terms are never equal.
+struct LinearIndex {
+  int constant;
+  map<Var,int> coefficients;
+  vector<Expr> terms;
+
+  LinearIndex() : constant(0) {}
+
+  int getCoefficient(const Var& var) const {
+    return util::contains(coefficients, var) ? coefficients.at(var) : 0;
+  }
+
+  void add(const LinearIndex& other, int scale) {
+    constant += scale * other.constant;
+    for (auto& coefficient : other.coefficients) {
+      coefficients[coefficient.first] += scale * coefficient.second;
+      if (coefficients[coefficient.first] == 0) {
+        coefficients.erase(coefficient.first);
+      }
+    }
+    terms.insert(terms.end(), other.terms.begin(), other.terms.end());
+  }
+
+  bool operator==(const LinearIndex& other) const {
+    return terms.empty() && other.terms.empty() &&
+           constant == other.constant && coefficients == other.coefficients;
+  }
+};
+
+static LinearIndex linearize(const Expr& expr) {
+  LinearIndex index;
+  int constant;
+  if (getConstant(expr, &constant)) {
+    index.constant = constant;
+  }
+  else if (isa<VarExpr>(expr) && isLaneType(expr.type())) {
+    index.coefficients[to<VarExpr>(expr)->var] = 1;
+  }
+  else if (isa<Neg>(expr)) {
+    index.add(linearize(to<Neg>(expr)->a), -1);
+  }
+  else if (isa<Add>(expr)) {
+    index.add(linearize(to<Add>(expr)->a), 1);
+    index.add(linearize(to<Add>(expr)->b), 1);
+  }
+  else if (isa<Sub>(expr)) {
+    index.add(linearize(to<Sub>(expr)->a), 1);
+    index.add(linearize(to<Sub>(expr)->b), -1);
+  }
+  else if (isa<Mul>(expr) && getConstant(to<Mul>(expr)->a, &constant)) {
+    index.add(linearize(to<Mul>(expr)->b), constant);
+  }
+  else if (isa<Mul>(expr) && getConstant(to<Mul>(expr)->b, &constant)) {
+    index.add(linearize(to<Mul>(expr)->a), constant);
+  }
+  else {
+    index.terms.push_back(expr);
+  }
+  return index;
+}
+
+/// Returns the variable, the constant bounds and the body of a loop over a
+/// range of static size.
+static bool getConstantLoop(const Stmt& stmt, Var* var, int* start, int* end,
+                            Stmt* body) {
+  if (isa<ForRange>(stmt)) {
+    const ForRange *loop = to<ForRange>(stmt);
+    *var = loop->var;
+    *body = loop->body;
+    return getConstant(loop->start, start) && getConstant(loop->end, end);
+  }
+  if (isa<For>(stmt)) {
+    const For *loop = to<For>(stmt);
+    if (loop->domain.kind != ForDomain::IndexSet ||
+        loop->domain.indexSet.getKind() != IndexSet::Range) {
+      return false;
+    }
+    *var = loop->var;
+    *body = loop->body;
+    *start = 0;
+    *end = loop->domain.indexSet.getSize();
+    return true;
+  }
+  return false;
+}
+
+/// Identifies the buffer that a load or store accesses: a variable, or the
+/// field of a variable.
+typedef pair<Var,string> BufferKey;
+
+static bool getBufferKey(const Expr& buffer, BufferKey* key) {
+  if (isa<VarExpr>(buffer)) {
+    *key = BufferKey(to<VarExpr>(buffer)->var, "");
+    return true;
+  }
+  if (isa<FieldRead>(buffer) &&
+      isa<VarExpr>(to<FieldRead>(buffer)->elementOrSet)) {
+    const FieldRead *fieldRead = to<FieldRead>(buffer);
+    *key = BufferKey(to<VarExpr>(fieldRead->elementOrSet)->var,
+                     fieldRead->fieldName);
+    return true;
+  }
+  return false;
+}
+
+/// Returns true if the expression refers to any of the variables.
+static bool refersTo(const Expr& expr, const set<Var>& vars) {
+  bool result = false;
+  match(expr,
+    std::function<void(const VarExpr*)>([&](const VarExpr* op) {
+      result |= util::contains(vars, op->var);
+    })
+  );
+  return result;
+}
+
+/// Returns true if an index of a vectorized loop differs between its lanes
+/// other than by a multiple of the loop variable (e.g. an endpoint index), so
+/// that it must be computed in each lane.
+static bool isIndirect(const LinearIndex& index, const Var& loopVar,
+                       const set<Var>& varying) {
+  for (auto& coefficient : index.coefficients) {
+    if (coefficient.first != loopVar &&
+        util::contains(varying, coefficient.first)) {
+      return true;
+    }
+  }
+  for (const Expr& term : index.terms) {
+    if (refersTo(term, varying)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/// Returns true if a tensor declared in a vectorized loop can get a copy per
+/// lane: a dense tensor of static size with int or float components.
+static bool isLaneTensorType(const Type& type, const TensorStorage& storage) {
+  if (!type.isTensor() || isScalar(type) ||
+      storage.getKind() != TensorStorage::Dense) {
+    return false;
+  }
+  const ir::TensorType *tensorType = type.toTensor();
+  ScalarType::Kind kind = tensorType->getComponentType().kind;
+  if (kind != ScalarType::Int && kind != ScalarType::Float) {
+    return false;
+  }
+  for (const IndexDomain& dimension : tensorType->getDimensions()) {
+    for (const IndexSet& indexSet : dimension.getIndexSets()) {
+      if (indexSet.getKind() != IndexSet::Range) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+/// Returns true if the expression is a scalar literal zero.
+static bool isZeroLiteral(const Expr& expr) {
+  if (!isa<Literal>(expr) || !isScalar(expr.type())) {
+    return false;
+  }
+  const Literal *literal = to<Literal>(expr);
+  switch (literal->type.toTensor()->getComponentType().kind) {
+    case ScalarType::Float:
+      return literal->getFloatVal(0) == 0.0;
+    case ScalarType::Int:
+      return ((int*)literal->data)[0] == 0;
+    default:
+      return false;
+  }
+}
+
+/// Returns the LLVM intrinsic that computes a math intrinsic, which LLVM also
+/// computes on vectors.
+static bool getVectorIntrinsic(const Func& func, llvm::Intrinsic::ID *id) {
+  std::map<Func, llvm::Intrinsic::ID> vectorIntrinsics =
+      {{ir::intrinsics::sin(), llvm::Intrinsic::sin},
+       {ir::intrinsics::cos(), llvm::Intrinsic::cos},
+       {ir::intrinsics::sqrt(),llvm::Intrinsic::sqrt},
+       {ir::intrinsics::log(), llvm::Intrinsic::log},
+       {ir::intrinsics::exp(), llvm::Intrinsic::exp},
+       {ir::intrinsics::pow(), llvm::Intrinsic::pow}};
+  if (!util::contains(vectorIntrinsics, func)) {
+    return false;
+  }
+  *id = vectorIntrinsics.at(func);
+  return true;
+}
+
 void LLVMBackend::compile(const ir::ForRange& forLoop) {
   std::string iName = forLoop.var.getName();
   
@@ -1171,9 +1855,29 @@ void LLVMBackend::compile(const ir::ForRange& forLoop) {
   // Loop Header
   llvm::BasicBlock *entryBlock = builder->GetInsertBlock();
 
+  // Loops over small dense blocks run their iterations as vector lanes
+  int start, end;
+  if (options.vectorizeBlocks && getConstant(forLoop.start, &start) &&
+      getConstant(forLoop.end, &end) &&
+      canVectorizeBlock(forLoop.var, end - start, forLoop.body)) {
+    emitVectorBlock(forLoop.var, llvmInt(start), end - start, forLoop.body);
+    return;
+  }
+
   llvm::Value *rangeStart = compile(forLoop.start);
   llvm::Value *rangeEnd = compile(forLoop.end);
 
+  // Loops with constant bounds are small block loops that are better left to
+  // the unroller and the vectorizers
+  std::set<Var> reductions;
+  std::set<string> sharedAdds;
+  if (!(isa<Literal>(forLoop.start) && isa<Literal>(forLoop.end)) &&
+      canParallelize(forLoop.var, forLoop.body, &reductions, &sharedAdds)) {
+    emitParallelLoop(forLoop.var, rangeStart, rangeEnd, forLoop.body,
+                     reductions, sharedAdds);
+    return;
+  }
+
   llvm::BasicBlock *loopBodyStart =
     llvm::BasicBlock::Create(LLVM_CTX, iName+"_loop_body", llvmFunc);
   llvm::BasicBlock *loopEnd = llvm::BasicBlock::Create(LLVM_CTX,
@@ -1229,6 +1933,36 @@ void LLVMBackend::compile(const ir::For& forLoop) {
   }
   iassert(iNum);
 
+  // Loops over small dense blocks run their iterations as vector lanes
+  bool isBlock = (domain.kind == ForDomain::IndexSet &&
+                  domain.indexSet.getKind() == IndexSet::Range);
+  if (options.vectorizeBlocks && isBlock &&
+      canVectorizeBlock(forLoop.var, domain.indexSet.getSize(),
+                        forLoop.body)) {
+    emitVectorBlock(forLoop.var, llvmInt(0), domain.indexSet.getSize(),
+                    forLoop.body);
+    return;
+  }
+
+  // Like loops with constant bounds, block loops are better left to the
+  // unroller and the vectorizers
+  std::set<Var> reductions;
+  std::set<string> sharedAdds;
+  if (!isBlock &&
+      canParallelize(forLoop.var, forLoop.body, &reductions, &sharedAdds)) {
+    emitParallelLoop(forLoop.var, llvmInt(0), iNum, forLoop.body, reductions,
+                     sharedAdds);
+    return;
+  }
+
+  // Map loops run groups of elements as vector lanes, and leave the elements
+  // that do not fill a vector to the scalar loop
+  llvm::Value *rangeStart = llvmInt(0);
+  if (options.mapVectorWidth > 1 && !isBlock &&
+      canVectorizeBlock(forLoop.var, options.mapVectorWidth, forLoop.body)) {
+    rangeStart = emitVectorLoop(forLoop.var, rangeStart, iNum, forLoop.body);
+  }
+
   llvm::Function *llvmFunc = builder->GetInsertBlock()->getParent();
 
   // Loop Header
@@ -1238,12 +1972,12 @@ void LLVMBackend::compile(const ir::For& forLoop) {
       llvm::BasicBlock::Create(LLVM_CTX, iName+"_loop_body", llvmFunc);
   llvm::BasicBlock *loopEnd = llvm::BasicBlock::Create(LLVM_CTX,
                                                        iName+"_loop_end", llvmFunc);
-  llvm::Value *firstCmp = builder->CreateICmpSLT(llvmInt(0), iNum);
+  llvm::Value *firstCmp = builder->CreateICmpSLT(rangeStart, iNum);
   builder->CreateCondBr(firstCmp, loopBodyStart, loopEnd);
   builder->SetInsertPoint(loopBodyStart);
 
   llvm::PHINode *i = builder->CreatePHI(LLVM_INT32, 2, iName);
-  i->addIncoming(builder->getInt32(0), entryBlock);
+  i->addIncoming(rangeStart, entryBlock);
 
   // Loop Body
   symtable.insert(forLoop.var, i);
@@ -1260,20 +1994,1408 @@ void LLVMBackend::compile(const ir::For& forLoop) {
   builder->SetInsertPoint(loopEnd);
 }
 
-void LLVMBackend::compile(const ir::While& whileLoop) {
-  llvm::Function *llvmFunc = builder->GetInsertBlock()->getParent();
-
-  llvm::Value *cond = compile(whileLoop.condition);
-  llvm::Value *condEval = builder->CreateICmpEQ(builder->getTrue(), cond);
+/// Returns the variables that compiling `stmt` may look up in the symbol
+/// table, including those that are only referenced through types (set sizes
+/// and sparse tensor indices).
+static set<Var> getReferencedVars(const Stmt& stmt, const Storage& storage) {
+  set<Var> vars;
+  vector<IndexSet> indexSets;
+  match(stmt,
+    std::function<void(const VarExpr*)>([&](const VarExpr* op) {
+      vars.insert(op->var);
+    }),
+    std::function<void(const AssignStmt*)>([&](const AssignStmt* op) {
+      vars.insert(op->var);
+    }),
+    std::function<void(const CallStmt*)>([&](const CallStmt* op) {
+      vars.insert(op->results.begin(), op->results.end());
+    }),
+    std::function<void(const Length*)>([&](const Length* op) {
+      indexSets.push_back(op->indexSet);
+    })
+  );
+
+  set<Var> typeVars;
+  for (const Var& var : vars) {
+    if (!var.getType().isTensor()) {
+      continue;
+    }
+    for (const IndexDomain& dim : var.getType().toTensor()->getDimensions()) {
+      indexSets.insert(indexSets.end(), dim.getIndexSets().begin(),
+                       dim.getIndexSets().end());
+    }
+    if (storage.hasStorage(var) &&
+        storage.getStorage(var).getKind() == TensorStorage::Indexed) {
+      const TensorIndex& index = storage.getStorage(var).getTensorIndex();
+      typeVars.insert(index.getRowptrArray());
+      typeVars.insert(index.getColidxArray());
+    }
+  }
+  for (const IndexSet& is : indexSets) {
+    if (is.getKind() == IndexSet::Set && isa<VarExpr>(is.getSet())) {
+      typeVars.insert(to<VarExpr>(is.getSet())->var);
+    }
+  }
+  vars.insert(typeVars.begin(), typeVars.end());
+  return vars;
+}
 
+/// Identifies a buffer that the iterations of a parallel loop access.
+static string getBufferName(const Expr& buffer) {
+  stringstream name;
+  name << buffer;
+  return name.str();
+}
 
-  llvm::BasicBlock *bodyBlock = llvm::BasicBlock::Create(LLVM_CTX, "body",
-                                                         llvmFunc);
-  llvm::BasicBlock *checkBlock = llvm::BasicBlock::Create(LLVM_CTX,"check");
-  llvm::BasicBlock *exitBlock = llvm::BasicBlock::Create(LLVM_CTX, "exit");
-  builder->CreateCondBr(condEval, bodyBlock, exitBlock);
+bool LLVMBackend::canParallelize(const Var& loopVar, const Stmt& body,
+                                 std::set<Var>* reductions,
+                                 std::set<string>* sharedAdds) {
+  if (options.numThreads <= 1 || inParallelLoop) {
+    return false;
+  }
 
-  builder->SetInsertPoint(bodyBlock);
+  // Every thread gets its own copy of the variables declared in the loop,
+  // which we can only allocate if their size is known at compile time
+  const set<Var>& locals = loopLocals[loopVar];
+  for (const Var& local : locals) {
+    Type type = local.getType();
+    if (!type.isTensor() || isString(type)) {
+      return false;
+    }
+    if (isScalar(type)) {
+      continue;
+    }
+    if (!storage.hasStorage(local)) {
+      return false;
+    }
+    auto kind = storage.getStorage(local).getKind();
+    if (kind != TensorStorage::Dense && kind != TensorStorage::Diagonal) {
+      return false;
+    }
+    for (const IndexDomain& dim : type.toTensor()->getDimensions()) {
+      for (const IndexSet& is : dim.getIndexSets()) {
+        if (is.getKind() != IndexSet::Range) {
+          return false;
+        }
+      }
+    }
+  }
+
+  // Iterations may only share data in three ways:
+  // - by accumulating scalar += reductions,
+  // - by adding to buffers that no iteration otherwise accesses, or
+  // - by accessing buffers within their own window of locations.
+  // A window is `loopVar*stride + offset`, where the offset is a constant plus
+  // multiples of the variables of inner loops with constant bounds. All
+  // accesses to a buffer must share a stride that is wider than their
+  // offsets vary, so that the windows of two iterations never overlap. Only
+  // the adds to buffers that are not windowed need to be atomic.
+  class CheckIterationsIndependent : public IRVisitor {
+  public:
+    CheckIterationsIndependent(const Var& loopVar, const set<Var>& locals,
+                               const Stmt& body)
+        : independent(true), loopVar(loopVar), locals(locals) {
+      match(body,
+        std::function<void(const ForRange*)>([&](const ForRange* op) {
+          int start, end;
+          if (getConstant(op->start, &start) && getConstant(op->end, &end) &&
+              start < end) {
+            innerRanges[op->var] = {start, end};
+          }
+        }),
+        std::function<void(const For*)>([&](const For* op) {
+          if (op->domain.kind == ForDomain::IndexSet &&
+              op->domain.indexSet.getKind() == IndexSet::Range &&
+              op->domain.indexSet.getSize() > 0) {
+            innerRanges[op->var] = {0, (int)op->domain.indexSet.getSize()};
+          }
+        })
+      );
+      body.accept(this);
+
+      for (auto& buffer : buffers) {
+        const Accesses& accesses = buffer.second;
+        if (!accesses.stored) {
+          continue;
+        }
+        bool windowed = accesses.windowed &&
+                        accesses.maxOffset - accesses.minOffset <
+                            abs(accesses.stride);
+        if (!windowed && accesses.onlyAdds && !accesses.loaded) {
+          sharedAdds.insert(buffer.first);
+          continue;
+        }
+        independent &= windowed;
+      }
+    }
+
+    bool independent;
+    set<Var> reductions;
+    set<string> sharedAdds;
+    set<Var> reads;
+
+  private:
+    const Var& loopVar;
+    const set<Var>& locals;
+
+    /// The constant bounds of the inner loops.
+    map<Var,pair<int,int>> innerRanges;
+
+    /// The accesses to a shared buffer.
+    struct Accesses {
+      Accesses() : stored(false), loaded(false), onlyAdds(true),
+                   windowed(true), stride(0), minOffset(0), maxOffset(0) {}
+      bool stored;
+      bool loaded;
+      bool onlyAdds;
+      bool windowed;
+      int stride;
+      int minOffset;
+      int maxOffset;
+    };
+    map<string,Accesses> buffers;
+
+    /// Records an access to `buffer` at `index`.
+    void access(const Expr& buffer, const Expr& index, bool store,
+                CompoundOperator cop) {
+      if (isa<VarExpr>(buffer) &&
+          util::contains(locals, to<VarExpr>(buffer)->var)) {
+        return;
+      }
+      Accesses& accesses = buffers[getBufferName(buffer)];
+      if (store) {
+        accesses.stored = true;
+        accesses.onlyAdds &= (cop == CompoundOperator::Add);
+      }
+      else {
+        accesses.loaded = true;
+      }
+
+      LinearIndex linearIndex = linearize(index);
+      if (!linearIndex.terms.empty()) {
+        accesses.windowed = false;
+        return;
+      }
+      int stride = linearIndex.getCoefficient(loopVar);
+      int minOffset = linearIndex.constant;
+      int maxOffset = linearIndex.constant;
+      for (auto& term : linearIndex.coefficients) {
+        if (term.first == loopVar) {
+          continue;
+        }
+        if (!util::contains(innerRanges, term.first)) {
+          accesses.windowed = false;
+          return;
+        }
+        pair<int,int> range = innerRanges.at(term.first);
+        int low = term.second * range.first;
+        int high = term.second * (range.second - 1);
+        minOffset += min(low, high);
+        maxOffset += max(low, high);
+      }
+
+      bool first = accesses.stride == 0;
+      if (stride == 0 || (!first && stride != accesses.stride)) {
+        accesses.windowed = false;
+        return;
+      }
+      accesses.stride = stride;
+      accesses.minOffset = first ? minOffset : min(accesses.minOffset,
+                                                   minOffset);
+      accesses.maxOffset = first ? maxOffset : max(accesses.maxOffset,
+                                                   maxOffset);
+    }
+
+    using IRVisitor::visit;
+
+    void visit(const VarExpr* op) {
+      reads.insert(op->var);
+    }
+
+    void visit(const AssignStmt* op) {
+      if (!util::contains(locals, op->var)) {
+        // Scalar += reductions are accumulated per thread and combined after
+        // the loop; any other assignment to a shared variable is a race
+        Type type = op->var.getType();
+        if (op->cop == CompoundOperator::Add && isScalar(type) &&
+            !isString(type) && !isBoolean(type)) {
+          reductions.insert(op->var);
+        }
+        else {
+          independent = false;
+        }
+      }
+      IRVisitor::visit(op);
+    }
+
+    void visit(const Load* op) {
+      access(op->buffer, op->index, false, CompoundOperator::None);
+      IRVisitor::visit(op);
+    }
+
+    void visit(const Store* op) {
+      access(op->buffer, op->index, true, op->cop);
+      if (op->cop == CompoundOperator::Add) {
+        // Shared buffers are added to atomically
+        iassert(op->value.type().isTensor());
+        auto ctype = op->value.type().toTensor()->getComponentType();
+        independent &= (ctype.kind == ScalarType::Int ||
+                        ctype.kind == ScalarType::Float ||
+                        ctype.kind == ScalarType::Complex);
+      }
+      IRVisitor::visit(op);
+    }
+
+    void visit(const CallStmt* op) {
+      // Only pure intrinsics may be called from a parallel loop
+      if (op->callee.getKind() != Func::Intrinsic ||
+          op->callee == intrinsics::free()     ||
+          op->callee == intrinsics::malloc()   ||
+          op->callee == intrinsics::strcmp()   ||
+          op->callee == intrinsics::strlen()   ||
+          op->callee == intrinsics::strcpy()   ||
+          op->callee == intrinsics::strcat()   ||
+          op->callee == intrinsics::clock()    ||
+          op->callee == intrinsics::storeTime()||
+          op->callee == intrinsics::startTimer()||
+          op->callee == intrinsics::stopTimer()||
+          op->callee == intrinsics::solve()) {
+        independent = false;
+      }
+      for (const Var& result : op->results) {
+        independent &= util::contains(locals, result);
+      }
+      IRVisitor::visit(op);
+    }
+
+    void visit(const FieldWrite* op) {
+      independent = false;
+    }
+
+    void visit(const Print* op) {
+      independent = false;
+    }
+  };
+
+  CheckIterationsIndependent check(loopVar, locals, body);
+  if (!check.independent) {
+    return false;
+  }
+
+  // Reduction results must not be read inside the loop, and must be in memory
+  for (const Var& reduction : check.reductions) {
+    if (util::contains(check.reads, reduction) ||
+        !symtable.contains(reduction) ||
+        !symtable.get(reduction)->getType()->isPointerTy()) {
+      return false;
+    }
+  }
+
+  *reductions = check.reductions;
+  *sharedAdds = check.sharedAdds;
+  return true;
+}
+
+void LLVMBackend::emitParallelLoop(const Var& loopVar, llvm::Value* start,
+                                   llvm::Value* end, const Stmt& body,
+                                   const std::set<Var>& reductions,
+                                   const std::set<string>& sharedAdds) {
+  std::string iName = loopVar.getName();
+  const set<Var>& locals = loopLocals[loopVar];
+
+  llvm::Function *llvmFunc = builder->GetInsertBlock()->getParent();
+
+  // Capture the values the body uses that are local to the enclosing
+  // function. Globals and constants can be used by the task as they are.
+  vector<pair<Var,llvm::Value*>> captures;
+  for (const Var& var : getReferencedVars(body, storage)) {
+    if (util::contains(locals, var) || !symtable.contains(var)) {
+      continue;
+    }
+    llvm::Value *value = symtable.get(var);
+    if (llvm::isa<llvm::Instruction>(value) ||
+        llvm::isa<llvm::Argument>(value)) {
+      captures.push_back(pair<Var,llvm::Value*>(var, value));
+    }
+  }
+
+  // Pass the captured values to the task through an array of pointers, and
+  // the context object of the function after them. Values that are not
+  // pointers are spilled to the stack.
+  size_t numSlots = captures.size() + ((contextArg != nullptr) ? 1 : 0);
+  llvm::BasicBlock &funcEntry = llvmFunc->getEntryBlock();
+  llvm::IRBuilder<> entryBuilder(&funcEntry, funcEntry.begin());
+  llvm::Value *context =
+      entryBuilder.CreateAlloca(LLVM_INT8_PTR,
+                                llvmInt(std::max(numSlots, (size_t)1)),
+                                iName+".ctx");
+  for (size_t i = 0; i < captures.size(); ++i) {
+    llvm::Value *value = captures[i].second;
+    if (!value->getType()->isPointerTy()) {
+      llvm::Value *spill = entryBuilder.CreateAlloca(value->getType(), nullptr,
+                                                     value->getName()+".spill");
+      builder->CreateStore(value, spill);
+      value = spill;
+    }
+    builder->CreateStore(builder->CreatePointerCast(value, LLVM_INT8_PTR),
+                         builder->CreateConstInBoundsGEP1_32(context, i));
+  }
+  if (contextArg != nullptr) {
+    builder->CreateStore(contextArg, builder->CreateConstInBoundsGEP1_32(
+        context, captures.size()));
+  }
+
+  // Emit the task function, which executes iterations [start,end)
+  vector<llvm::Type*> taskArgTypes = {LLVM_INT, LLVM_INT,
+                                      LLVM_INT8_PTR->getPointerTo()};
+  llvm::FunctionType *taskType =
+      llvm::FunctionType::get(LLVM_VOID, taskArgTypes, false);
+  llvm::Function *task =
+      llvm::Function::Create(taskType, llvm::Function::InternalLinkage,
+                             string(llvmFunc->getName())+"."+iName+".task",
+                             module);
+  task->setDoesNotThrow();
+  auto taskArgs = task->arg_begin();
+  llvm::Value *taskStart = taskArgs++;
+  llvm::Value *taskEnd = taskArgs++;
+  llvm::Value *taskContext = taskArgs++;
+
+  auto parentInsertPoint = builder->saveIP();
+  builder->SetInsertPoint(llvm::BasicBlock::Create(LLVM_CTX, "entry", task));
+  symtable.scope();
+
+  for (size_t i = 0; i < captures.size(); ++i) {
+    llvm::Type *type = captures[i].second->getType();
+    llvm::Value *slot =
+        builder->CreateLoad(builder->CreateConstInBoundsGEP1_32(taskContext, i));
+    llvm::Value *value = (type->isPointerTy())
+        ? builder->CreatePointerCast(slot, type)
+        : builder->CreateLoad(builder->CreatePointerCast(slot,
+                                                         type->getPointerTo()));
+    value->setName(captures[i].second->getName());
+    symtable.insert(captures[i].first, value);
+  }
+  llvm::Value *parentContextArg = contextArg;
+  if (contextArg != nullptr) {
+    contextArg = builder->CreateLoad(
+        builder->CreateConstInBoundsGEP1_32(taskContext, captures.size()),
+        "context");
+  }
+
+  // Private copies of the variables declared in the loop body
+  std::set<Var> parentGlobals = globals;
+  for (const Var& local : locals) {
+    const TensorType *type = local.getType().toTensor();
+    llvm::Type *ctype = llvmType(type->getComponentType());
+    llvm::Value *len = isScalar(local.getType())
+        ? nullptr : emitComputeLen(type, storage.getStorage(local));
+    symtable.insert(local, builder->CreateAlloca(ctype, len, local.getName()));
+    globals.erase(local);
+  }
+
+  // Per-thread partial results of scalar reductions
+  vector<pair<llvm::Value*,llvm::Value*>> partials;
+  for (const Var& reduction : reductions) {
+    llvm::Value *result = symtable.get(reduction);
+    if (util::contains(globals, reduction)) {
+      result = builder->CreateLoad(result, reduction.getName());
+    }
+
+    llvm::Type *ctype =
+        llvmType(reduction.getType().toTensor()->getComponentType());
+    llvm::Value *partial = builder->CreateAlloca(ctype, nullptr,
+                                                 reduction.getName()+".partial");
+    builder->CreateStore(llvm::Constant::getNullValue(ctype), partial);
+    partials.push_back(pair<llvm::Value*,llvm::Value*>(result, partial));
+    symtable.insert(reduction, partial);
+    globals.erase(reduction);
+  }
+
+  inParallelLoop = true;
+  parallelPrivates = locals;
+  parallelSharedAdds = sharedAdds;
+
+  // Groups of the task's iterations run as vector lanes, and the rest in the
+  // scalar loop. The groups start at a multiple of the vector width, like
+  // those of serial loops, so the scalar loop runs the iterations before and
+  // after them.
+  llvm::Value *vectorStart = nullptr;
+  llvm::Value *vectorEnd = nullptr;
+  if (options.mapVectorWidth > 1 &&
+      canVectorizeBlock(loopVar, options.mapVectorWidth, body)) {
+    llvm::Value *lanes = llvmInt(options.mapVectorWidth);
+    llvm::Value *alignedStart = builder->CreateMul(
+        builder->CreateSDiv(
+            builder->CreateAdd(taskStart, llvmInt(options.mapVectorWidth-1)),
+            lanes),
+        lanes);
+    vectorStart = builder->CreateSelect(
+        builder->CreateICmpSLT(alignedStart, taskEnd), alignedStart, taskEnd,
+        iName+"_vec_start");
+    vectorEnd = emitVectorLoop(loopVar, vectorStart, taskEnd, body);
+    taskStart = builder->CreateSelect(
+        builder->CreateICmpEQ(taskStart, vectorStart), vectorEnd, taskStart);
+  }
+
+  // Loop Header
+  llvm::BasicBlock *entryBlock = builder->GetInsertBlock();
+  llvm::BasicBlock *loopBodyStart =
+      llvm::BasicBlock::Create(LLVM_CTX, iName+"_loop_body", task);
+  llvm::BasicBlock *loopEnd =
+      llvm::BasicBlock::Create(LLVM_CTX, iName+"_loop_end", task);
+  llvm::Value *firstCmp = builder->CreateICmpSLT(taskStart, taskEnd);
+  builder->CreateCondBr(firstCmp, loopBodyStart, loopEnd);
+  builder->SetInsertPoint(loopBodyStart);
+
+  llvm::PHINode *i = builder->CreatePHI(LLVM_INT32, 2, iName);
+  i->addIncoming(taskStart, entryBlock);
+
+  // Loop Body
+  symtable.insert(loopVar, i);
+  compile(body);
+  parallelPrivates.clear();
+  parallelSharedAdds.clear();
+  inParallelLoop = false;
+
+  // Loop Footer, which skips the iterations that ran as vector lanes
+  llvm::BasicBlock *loopBodyEnd = builder->GetInsertBlock();
+  llvm::Value *i_nxt = builder->CreateAdd(i, builder->getInt32(1),
+                                          iName+"_nxt", false, true);
+  if (vectorStart != nullptr) {
+    i_nxt = builder->CreateSelect(builder->CreateICmpEQ(i_nxt, vectorStart),
+                                  vectorEnd, i_nxt);
+  }
+  i->addIncoming(i_nxt, loopBodyEnd);
+
+  llvm::Value *exitCond = builder->CreateICmpSLT(i_nxt, taskEnd, iName+"_cmp");
+  builder->CreateCondBr(exitCond, loopBodyStart, loopEnd);
+  builder->SetInsertPoint(loopEnd);
+
+  // Combine this thread's partial reductions with the shared results
+  for (auto& partial : partials) {
+    emitAtomicAdd(partial.first, builder->CreateLoad(partial.second));
+  }
+  builder->CreateRetVoid();
+  symtable.unscope();
+  globals = parentGlobals;
+  contextArg = parentContextArg;
+  builder->restoreIP(parentInsertPoint);
+
+  // Hand the loop to the thread pool
+  auto schedule = (options.schedule == "dynamic")
+                      ? internal::ThreadPool::Dynamic
+                      : internal::ThreadPool::Static;
+  llvm::Function *parallelFor =
+      getBuiltIn("simit_parallel_for", LLVM_VOID,
+                 {LLVM_INT, LLVM_INT, taskType->getPointerTo(),
+                  LLVM_INT8_PTR->getPointerTo(), LLVM_INT, LLVM_INT});
+  vector<llvm::Value*> args = {start, end, task, context,
+                               llvmInt(schedule), llvmInt(options.chunkSize)};
+  builder->CreateCall(parallelFor, args);
+}
+
+bool LLVMBackend::isParallelSharedAdd(const Expr& buffer) {
+  return inParallelLoop &&
+         !(isa<VarExpr>(buffer) &&
+           util::contains(parallelPrivates, to<VarExpr>(buffer)->var)) &&
+         util::contains(parallelSharedAdds, getBufferName(buffer));
+}
+
+void LLVMBackend::emitAtomicAdd(llvm::Value *ptr, llvm::Value *value) {
+  llvm::Type *type = value->getType();
+  if (type->isIntegerTy()) {
+    builder->CreateAtomicRMW(llvm::AtomicRMWInst::Add, ptr, value,
+                             llvm::Monotonic);
+    return;
+  }
+  // Complex numbers: the real and imaginary parts are added separately
+  if (type->isStructTy()) {
+    emitAtomicAdd(builder->CreateStructGEP(ptr, 0),
+                  builder->ComplexGetReal(value));
+    emitAtomicAdd(builder->CreateStructGEP(ptr, 1),
+                  builder->ComplexGetImag(value));
+    return;
+  }
+  iassert(type->isFloatingPointTy());
+
+  // LLVM does not have an atomic floating point add, so we emit a
+  // compare-and-swap loop on the integer representation of the value
+  unsigned bits = type->getPrimitiveSizeInBits();
+  llvm::IntegerType *intType = llvm::Type::getIntNTy(LLVM_CTX, bits);
+  llvm::Value *intPtr = builder->CreatePointerCast(ptr,
+                                                   intType->getPointerTo());
+  llvm::LoadInst *initial = builder->CreateLoad(intPtr);
+  initial->setAlignment(bits/8);
+  initial->setAtomic(llvm::Monotonic);
+
+  llvm::Function *llvmFunc = builder->GetInsertBlock()->getParent();
+  llvm::BasicBlock *entryBlock = builder->GetInsertBlock();
+  llvm::BasicBlock *casBlock =
+      llvm::BasicBlock::Create(LLVM_CTX, "atomic_add", llvmFunc);
+  llvm::BasicBlock *doneBlock =
+      llvm::BasicBlock::Create(LLVM_CTX, "atomic_add_end", llvmFunc);
+  builder->CreateBr(casBlock);
+  builder->SetInsertPoint(casBlock);
+
+  llvm::PHINode *expected = builder->CreatePHI(intType, 2);
+  expected->addIncoming(initial, entryBlock);
+  llvm::Value *sum = builder->CreateFAdd(
+      builder->CreateBitCast(expected, type), value);
+  llvm::Value *desired = builder->CreateBitCast(sum, intType);
+#if LLVM_MAJOR_VERSION <= 3 && LLVM_MINOR_VERSION <= 4
+  llvm::Value *found = builder->CreateAtomicCmpXchg(intPtr, expected, desired,
+                                                    llvm::Monotonic);
+  llvm::Value *success = builder->CreateICmpEQ(found, expected);
+#else
+  llvm::Value *cmpxchg = builder->CreateAtomicCmpXchg(intPtr, expected,
+                                                      desired, llvm::Monotonic,
+                                                      llvm::Monotonic);
+  llvm::Value *found = builder->CreateExtractValue(cmpxchg, {0});
+  llvm::Value *success = builder->CreateExtractValue(cmpxchg, {1});
+#endif
+  expected->addIncoming(found, casBlock);
+  builder->CreateCondBr(success, doneBlock, casBlock);
+  builder->SetInsertPoint(doneBlock);
+}
+
+bool LLVMBackend::canVectorizeBlock(const ir::Var& loopVar, int lanes,
+                                    const ir::Stmt& body) {
+  if (lanes < 2 || lanes > MAX_BLOCK_LANES) {
+    return false;
+  }
+
+  // The scalars declared in the loop get a value per lane, and its small dense
+  // tensors get a copy per lane
+  set<Var> scalars;
+  set<Var> tensors;
+  for (const Var& local : loopLocals[loopVar]) {
+    if (isLaneType(local.getType())) {
+      scalars.insert(local);
+    }
+    else if (storage.hasStorage(local) &&
+             isLaneTensorType(local.getType(), storage.getStorage(local))) {
+      tensors.insert(local);
+    }
+    else {
+      return false;
+    }
+  }
+
+  // Checks that the body only consists of stores of lane expressions to
+  // buffers, assignments to the loop's scalars and tensors, sums into outer
+  // scalars, branches on lane conditions, and loops to unroll.
+  class CheckVectorBlock {
+  public:
+    CheckVectorBlock(const Var& loopVar, const set<Var>& scalars,
+                     const set<Var>& tensors)
+        : vectorizable(true), loopVar(loopVar), scalars(scalars),
+          tensors(tensors), varying(scalars), masked(false) {
+      varying.insert(tensors.begin(), tensors.end());
+      varying.insert(loopVar);
+    }
+
+    struct Access {
+      LinearIndex index;
+      bool indirect;
+      bool store;
+      CompoundOperator cop;
+    };
+
+    bool vectorizable;
+    set<Var> reductions;
+    set<Var> reads;
+    map<Var,int> nestedVars;
+    map<BufferKey, vector<Access>> accesses;
+
+    void checkStmt(const Stmt& stmt, int unroll) {
+      if (isa<Block>(stmt)) {
+        checkStmt(to<Block>(stmt)->first, unroll);
+        if (to<Block>(stmt)->rest.defined()) {
+          checkStmt(to<Block>(stmt)->rest, unroll);
+        }
+      }
+      else if (isa<Scope>(stmt)) {
+        checkStmt(to<Scope>(stmt)->scopedStmt, unroll);
+      }
+      else if (isa<Comment>(stmt)) {
+        if (to<Comment>(stmt)->commentedStmt.defined()) {
+          checkStmt(to<Comment>(stmt)->commentedStmt, unroll);
+        }
+      }
+      else if (isa<Pass>(stmt)) {
+      }
+      else if (isa<ForRange>(stmt) || isa<For>(stmt)) {
+        Var var;
+        int start, end;
+        Stmt body;
+        if (!getConstantLoop(stmt, &var, &start, &end, &body) ||
+            end <= start || unroll * (end - start) > MAX_BLOCK_UNROLL) {
+          vectorizable = false;
+          return;
+        }
+        nestedVars[var] = end - start;
+        checkStmt(body, unroll * (end - start));
+      }
+      else if (isa<IfThenElse>(stmt)) {
+        // The branches run with the lanes that do not take them masked off, so
+        // the scalars they assign are only defined in the branch
+        const IfThenElse *op = to<IfThenElse>(stmt);
+        checkCondition(op->condition);
+        bool parentMasked = masked;
+        set<Var> parentAssigned = assigned;
+        masked = true;
+        checkStmt(op->thenBody, unroll);
+        assigned = parentAssigned;
+        if (op->elseBody.defined()) {
+          checkStmt(op->elseBody, unroll);
+          assigned = parentAssigned;
+        }
+        masked = parentMasked;
+      }
+      else if (isa<AssignStmt>(stmt)) {
+        const AssignStmt *op = to<AssignStmt>(stmt);
+        if (util::contains(tensors, op->var)) {
+          // Lowered tensor assignments only clear whole tensors
+          vectorizable &= (op->cop == CompoundOperator::None && !masked &&
+                           isZeroLiteral(op->value));
+          return;
+        }
+        checkExpr(op->value);
+        if (util::contains(scalars, op->var)) {
+          // A lane may not read the value of the previous lane
+          vectorizable &= (op->cop == CompoundOperator::None ||
+                           util::contains(assigned, op->var));
+          assigned.insert(op->var);
+        }
+        // Sums into outer scalars add the lanes in order, which only
+        // matches the order of the loop if they are not in a nested loop
+        else if (op->cop == CompoundOperator::Add && unroll == 1 && !masked &&
+                 isLaneType(op->var.getType())) {
+          reductions.insert(op->var);
+        }
+        else {
+          vectorizable = false;
+        }
+      }
+      else if (isa<CallStmt>(stmt)) {
+        // Math intrinsics of floats compute all the lanes at once
+        const CallStmt *op = to<CallStmt>(stmt);
+        llvm::Intrinsic::ID id;
+        if (!getVectorIntrinsic(op->callee, &id) || op->results.size() != 1 ||
+            !util::contains(scalars, op->results[0]) ||
+            !op->results[0].getType().toTensor()->getComponentType().isFloat()) {
+          vectorizable = false;
+          return;
+        }
+        for (const Expr& actual : op->actuals) {
+          checkExpr(actual);
+        }
+        assigned.insert(op->results[0]);
+      }
+      else if (isa<Store>(stmt)) {
+        const Store *op = to<Store>(stmt);
+        if (!isLaneType(op->value.type())) {
+          vectorizable = false;
+          return;
+        }
+        checkExpr(op->value);
+        checkAccess(op->buffer, op->index, true, op->cop);
+      }
+      else {
+        vectorizable = false;
+      }
+    }
+
+    void checkExpr(const Expr& expr) {
+      if (!isLaneType(expr.type())) {
+        vectorizable = false;
+      }
+      else if (isa<Literal>(expr) || isa<Length>(expr)) {
+      }
+      else if (isa<VarExpr>(expr)) {
+        const Var& var = to<VarExpr>(expr)->var;
+        vectorizable &= (!util::contains(scalars, var) ||
+                         util::contains(assigned, var));
+        reads.insert(var);
+      }
+      else if (isa<Load>(expr)) {
+        checkAccess(to<Load>(expr)->buffer, to<Load>(expr)->index, false,
+                    CompoundOperator::None);
+      }
+      else if (isa<Neg>(expr)) {
+        checkExpr(to<Neg>(expr)->a);
+      }
+      else if (isa<Add>(expr) || isa<Sub>(expr) || isa<Mul>(expr) ||
+               (isa<Div>(expr) &&
+                expr.type().toTensor()->getComponentType().isFloat())) {
+        const BinaryExpr *op = static_cast<const BinaryExpr*>(expr.ptr);
+        checkExpr(op->a);
+        checkExpr(op->b);
+      }
+      else {
+        vectorizable = false;
+      }
+    }
+
+  private:
+    Var loopVar;
+    const set<Var>& scalars;
+    const set<Var>& tensors;
+    set<Var> varying;
+    set<Var> assigned;
+    bool masked;
+
+    void checkCondition(const Expr& expr) {
+      if (isa<Eq>(expr) || isa<Ne>(expr) || isa<Gt>(expr) || isa<Lt>(expr) ||
+          isa<Ge>(expr) || isa<Le>(expr)) {
+        const BinaryExpr *op = static_cast<const BinaryExpr*>(expr.ptr);
+        checkExpr(op->a);
+        checkExpr(op->b);
+      }
+      else if (isa<And>(expr) || isa<Or>(expr) || isa<Xor>(expr)) {
+        const BinaryExpr *op = static_cast<const BinaryExpr*>(expr.ptr);
+        checkCondition(op->a);
+        checkCondition(op->b);
+      }
+      else if (isa<Not>(expr)) {
+        checkCondition(to<Not>(expr)->a);
+      }
+      else {
+        vectorizable = false;
+      }
+    }
+
+    void checkAccess(const Expr& buffer, const Expr& index, bool store,
+                     CompoundOperator cop) {
+      Access access = {linearize(index), false, store, cop};
+      access.indirect = isIndirect(access.index, loopVar, varying);
+
+      // The loads in the index are accesses too
+      for (const Expr& term : access.index.terms) {
+        checkExpr(term);
+      }
+
+      // Each lane has its own copy of the loop's tensors
+      if (isa<VarExpr>(buffer) &&
+          util::contains(tensors, to<VarExpr>(buffer)->var)) {
+        vectorizable &= (!access.indirect &&
+                         access.index.getCoefficient(loopVar) == 0);
+        return;
+      }
+      // Literals and the indices of sets (e.g. endpoints) are only read
+      if (isa<Literal>(buffer) || isa<IndexRead>(buffer)) {
+        vectorizable &= !store;
+        return;
+      }
+
+      BufferKey key;
+      if (!getBufferKey(buffer, &key) || util::contains(varying, key.first)) {
+        vectorizable = false;
+        return;
+      }
+      // Every lane must store to its own location, unless it computes where
+      if (store && !access.indirect) {
+        vectorizable &= (access.index.getCoefficient(loopVar) != 0);
+      }
+      accesses[key].push_back(access);
+    }
+  };
+
+  CheckVectorBlock check(loopVar, scalars, tensors);
+  check.checkStmt(body, 1);
+  if (!check.vectorizable) {
+    return false;
+  }
+
+  // Sums must not be read inside the loop, and must be in memory
+  for (const Var& reduction : check.reductions) {
+    if (util::contains(check.reads, reduction) ||
+        util::contains(globals, reduction) ||
+        !symtable.contains(reduction) ||
+        !symtable.get(reduction)->getType()->isPointerTy()) {
+      return false;
+    }
+  }
+
+  // The lanes run each statement in turn, so they must not access what other
+  // lanes store. That holds for buffers that the block only accesses at the
+  // same locations in every lane (e.g. the components of its element's
+  // fields, when nested loops step through fewer locations than separate the
+  // lanes), for buffers that it only writes once per iteration (as lowered
+  // tensor assignments do), and for buffers that it only adds to, since the
+  // lanes add their values one at a time where they may collide.
+  for (auto& buffer : check.accesses) {
+    const vector<CheckVectorBlock::Access>& accesses = buffer.second;
+    bool stored = false;
+    bool sameLocation = true;
+    bool addsOnly = true;
+    for (auto& access : accesses) {
+      stored |= access.store;
+      sameLocation &= (!access.indirect && access.index == accesses[0].index);
+      addsOnly &= (access.store && access.cop == CompoundOperator::Add);
+    }
+    int nestedSpan = 0;
+    for (auto& coefficient : accesses[0].index.coefficients) {
+      if (util::contains(check.nestedVars, coefficient.first)) {
+        nestedSpan += std::abs(coefficient.second) *
+                      (check.nestedVars.at(coefficient.first) - 1);
+      }
+    }
+    sameLocation &=
+        (nestedSpan < std::abs(accesses[0].index.getCoefficient(loopVar)));
+    if (stored && !sameLocation && !addsOnly &&
+        !(accesses.size() == 1 && accesses[0].cop == CompoundOperator::None)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void LLVMBackend::emitVectorBlock(const ir::Var& loopVar, llvm::Value *start,
+                                  unsigned lanes, const ir::Stmt& body) {
+  VectorBlock block;
+  block.var = loopVar;
+  block.start = start;
+  block.lanes = lanes;
+  block.mask = nullptr;
+  block.varying = loopLocals[loopVar];
+  block.varying.insert(loopVar);
+
+  // The lanes' copies of the loop's tensors are allocated once per function
+  llvm::BasicBlock &funcEntry =
+      builder->GetInsertBlock()->getParent()->getEntryBlock();
+  llvm::IRBuilder<> entryBuilder(&funcEntry, funcEntry.begin());
+  for (const Var& local : loopLocals[loopVar]) {
+    if (isLaneType(local.getType())) {
+      continue;
+    }
+    const ir::TensorType *type = local.getType().toTensor();
+    block.buffers[local] =
+        entryBuilder.CreateAlloca(llvmType(type->getComponentType()),
+                                  llvmInt(type->size() * lanes),
+                                  local.getName() + ".lanes");
+  }
+
+  emitVectorStmt(body, &block);
+}
+
+llvm::Value *LLVMBackend::emitVectorLoop(const ir::Var& loopVar,
+                                         llvm::Value *start, llvm::Value *end,
+                                         const ir::Stmt& body) {
+  std::string iName = loopVar.getName();
+  unsigned lanes = options.mapVectorWidth;
+
+  llvm::Function *llvmFunc = builder->GetInsertBlock()->getParent();
+
+  // The iterations [start,vectorEnd) fill whole vectors
+  llvm::Value *numLeft =
+      builder->CreateSRem(builder->CreateSub(end, start), llvmInt(lanes));
+  llvm::Value *vectorEnd = builder->CreateSub(end, numLeft, iName+"_vec_end");
+
+  // Loop Header
+  llvm::BasicBlock *entryBlock = builder->GetInsertBlock();
+  llvm::BasicBlock *loopBodyStart =
+      llvm::BasicBlock::Create(LLVM_CTX, iName+"_vec_loop_body", llvmFunc);
+  llvm::BasicBlock *loopEnd =
+      llvm::BasicBlock::Create(LLVM_CTX, iName+"_vec_loop_end", llvmFunc);
+  llvm::Value *firstCmp = builder->CreateICmpSLT(start, vectorEnd);
+  builder->CreateCondBr(firstCmp, loopBodyStart, loopEnd);
+  builder->SetInsertPoint(loopBodyStart);
+
+  llvm::PHINode *i = builder->CreatePHI(LLVM_INT32, 2, iName);
+  i->addIncoming(start, entryBlock);
+
+  // Loop Body
+  emitVectorBlock(loopVar, i, lanes, body);
+
+  // Loop Footer
+  llvm::BasicBlock *loopBodyEnd = builder->GetInsertBlock();
+  llvm::Value *i_nxt = builder->CreateAdd(i, llvmInt(lanes), iName+"_nxt",
+                                          false, true);
+  i->addIncoming(i_nxt, loopBodyEnd);
+
+  llvm::Value *exitCond = builder->CreateICmpSLT(i_nxt, vectorEnd,
+                                                 iName+"_cmp");
+  builder->CreateCondBr(exitCond, loopBodyStart, loopEnd);
+  builder->SetInsertPoint(loopEnd);
+  return vectorEnd;
+}
+
+void LLVMBackend::emitVectorStmt(const ir::Stmt& stmt, VectorBlock* block) {
+  if (isa<Block>(stmt)) {
+    emitVectorStmt(to<Block>(stmt)->first, block);
+    if (to<Block>(stmt)->rest.defined()) {
+      emitVectorStmt(to<Block>(stmt)->rest, block);
+    }
+  }
+  else if (isa<Scope>(stmt)) {
+    symtable.scope();
+    emitVectorStmt(to<Scope>(stmt)->scopedStmt, block);
+    symtable.unscope();
+  }
+  else if (isa<Comment>(stmt)) {
+    if (to<Comment>(stmt)->commentedStmt.defined()) {
+      emitVectorStmt(to<Comment>(stmt)->commentedStmt, block);
+    }
+  }
+  else if (isa<Pass>(stmt)) {
+  }
+  else if (isa<ForRange>(stmt) || isa<For>(stmt)) {
+    // Nested loops are unrolled, so that their variables are constants
+    Var var;
+    int start, end;
+    Stmt loopBody;
+    getConstantLoop(stmt, &var, &start, &end, &loopBody);
+    for (int i = start; i < end; ++i) {
+      symtable.scope();
+      symtable.insert(var, llvmInt(i));
+      emitVectorStmt(loopBody, block);
+      symtable.unscope();
+    }
+  }
+  else if (isa<IfThenElse>(stmt)) {
+    // Both branches run, with the lanes that do not take them masked off
+    const IfThenElse *op = to<IfThenElse>(stmt);
+    llvm::Value *condition = emitVectorCondition(op->condition, *block);
+    llvm::Value *parentMask = block->mask;
+    block->mask = (parentMask != nullptr)
+        ? builder->CreateAnd(parentMask, condition) : condition;
+    emitVectorStmt(op->thenBody, block);
+    if (op->elseBody.defined()) {
+      llvm::Value *notCondition = builder->CreateNot(condition);
+      block->mask = (parentMask != nullptr)
+          ? builder->CreateAnd(parentMask, notCondition) : notCondition;
+      emitVectorStmt(op->elseBody, block);
+    }
+    block->mask = parentMask;
+  }
+  else if (isa<AssignStmt>(stmt)) {
+    const AssignStmt *op = to<AssignStmt>(stmt);
+    const ir::TensorType *type = op->var.getType().toTensor();
+    bool isFloat = type->getComponentType().isFloat();
+    if (util::contains(block->buffers, op->var)) {
+      unsigned componentSize = type->getComponentType().bytes();
+      llvm::Value *size =
+          llvmInt(type->size() * block->lanes * componentSize);
+      emitMemSet(block->buffers.at(op->var), llvmInt(0,8), size,
+                 componentSize);
+    }
+    else if (util::contains(block->varying, op->var)) {
+      llvm::Value *value = emitVectorExpr(op->value, *block);
+      llvm::Value *previous = util::contains(block->locals, op->var)
+          ? block->locals.at(op->var) : llvm::UndefValue::get(value->getType());
+      if (op->cop == CompoundOperator::Add) {
+        value = isFloat ? builder->CreateFAdd(previous, value)
+                        : builder->CreateAdd(previous, value);
+      }
+      if (block->mask != nullptr) {
+        value = builder->CreateSelect(block->mask, value, previous);
+      }
+      value->setName(op->var.getName() + VAL_SUFFIX);
+      block->locals[op->var] = value;
+    }
+    else {
+      // Sum the lanes in the order of the loop
+      iassert(op->cop == CompoundOperator::Add && block->mask == nullptr);
+      llvm::Value *value = emitVectorExpr(op->value, *block);
+      llvm::Value *sum = compile(VarExpr::make(op->var));
+      for (unsigned lane = 0; lane < block->lanes; ++lane) {
+        llvm::Value *laneValue = builder->CreateExtractElement(value,
+                                                               llvmInt(lane));
+        sum = isFloat ? builder->CreateFAdd(sum, laneValue)
+                      : builder->CreateAdd(sum, laneValue);
+      }
+      builder->CreateStore(sum, symtable.get(op->var));
+    }
+  }
+  else if (isa<CallStmt>(stmt)) {
+    const CallStmt *op = to<CallStmt>(stmt);
+    const Var& result = op->results[0];
+    vector<llvm::Value*> args;
+    for (const Expr& actual : op->actuals) {
+      args.push_back(emitVectorExpr(actual, *block));
+    }
+    llvm::Intrinsic::ID id;
+    getVectorIntrinsic(op->callee, &id);
+    llvm::Function *fun = llvm::Intrinsic::getDeclaration(module, id,
+                                                          {args[0]->getType()});
+    llvm::Value *value = builder->CreateCall(fun, args);
+    if (block->mask != nullptr) {
+      llvm::Value *previous = util::contains(block->locals, result)
+          ? block->locals.at(result) : llvm::UndefValue::get(value->getType());
+      value = builder->CreateSelect(block->mask, value, previous);
+    }
+    value->setName(result.getName() + VAL_SUFFIX);
+    block->locals[result] = value;
+  }
+  else if (isa<Store>(stmt)) {
+    const Store *op = to<Store>(stmt);
+    ScalarType type = op->value.type().toTensor()->getComponentType();
+    llvm::Value *value = emitVectorExpr(op->value, *block);
+
+    // The lanes of a component of the loop's tensors are next to each other
+    if (isa<VarExpr>(op->buffer) &&
+        util::contains(block->buffers, to<VarExpr>(op->buffer)->var)) {
+      llvm::Value *index = builder->CreateMul(
+          emitLaneIndex(op->index, *block, 0), llvmInt(block->lanes));
+      llvm::Value *bufferLoc = builder->CreateBitCast(
+          builder->CreateInBoundsGEP(
+              block->buffers.at(to<VarExpr>(op->buffer)->var), index),
+          value->getType()->getPointerTo());
+      if (op->cop == CompoundOperator::Add || block->mask != nullptr) {
+        llvm::Value *previous =
+            builder->CreateAlignedLoad(bufferLoc, type.bytes());
+        if (op->cop == CompoundOperator::Add) {
+          value = type.isFloat() ? builder->CreateFAdd(previous, value)
+                                 : builder->CreateAdd(previous, value);
+        }
+        if (block->mask != nullptr) {
+          value = builder->CreateSelect(block->mask, value, previous);
+        }
+      }
+      builder->CreateAlignedStore(value, bufferLoc, type.bytes());
+      return;
+    }
+
+    llvm::Value *buffer = compile(op->buffer);
+    string locName = string(buffer->getName()) + PTR_SUFFIX;
+
+    // Adds to shared buffers in parallel loops stay atomic
+    bool atomic = op->cop == CompoundOperator::Add &&
+                  isParallelSharedAdd(op->buffer);
+
+    // Consecutive lanes store to consecutive locations
+    if (isUnitStride(op->buffer, op->index, *block) &&
+        block->mask == nullptr && !atomic) {
+      if (op->cop == CompoundOperator::Add) {
+        llvm::Value *previous =
+            emitVectorExpr(Load::make(op->buffer, op->index), *block);
+        value = type.isFloat() ? builder->CreateFAdd(previous, value)
+                               : builder->CreateAdd(previous, value);
+      }
+      llvm::Value *laneIndex =
+          emitFieldIndex(op->buffer, emitLaneIndex(op->index, *block, 0));
+      llvm::Value *bufferLoc = builder->CreateInBoundsGEP(buffer, laneIndex,
+                                                          locName);
+      llvm::Type *vectorPtrType = value->getType()->getPointerTo(
+          bufferLoc->getType()->getPointerAddressSpace());
+      bufferLoc = builder->CreateBitCast(bufferLoc, vectorPtrType);
+      llvm::StoreInst *storeInst =
+          builder->CreateAlignedStore(value, bufferLoc, type.bytes());
+      emitAliasMetadata(storeInst, op->buffer);
+      return;
+    }
+
+    // Other stores are scattered one lane at a time, so that lanes that add
+    // to the same location (e.g. the shared endpoint of two edges) each add
+    // their value
+    vector<llvm::Value*> indices =
+        emitLaneIndices(op->buffer, op->index, *block);
+    emitLanes(*block, [&](unsigned lane) {
+      llvm::Value *bufferLoc = builder->CreateInBoundsGEP(buffer,
+                                                          indices[lane],
+                                                          locName);
+      llvm::Value *laneValue = builder->CreateExtractElement(value,
+                                                             llvmInt(lane));
+      if (atomic) {
+        emitAtomicAdd(bufferLoc, laneValue);
+        return;
+      }
+      if (op->cop == CompoundOperator::Add) {
+        llvm::LoadInst *previous = builder->CreateLoad(bufferLoc);
+        emitAliasMetadata(previous, op->buffer);
+        laneValue = type.isFloat() ? builder->CreateFAdd(previous, laneValue)
+                                   : builder->CreateAdd(previous, laneValue);
+      }
+      llvm::StoreInst *storeInst = builder->CreateStore(laneValue, bufferLoc);
+      emitAliasMetadata(storeInst, op->buffer);
+    });
+  }
+  else {
+    ierror << "Cannot vectorize " << stmt;
+  }
+}
+
+llvm::Value *LLVMBackend::emitVectorExpr(const ir::Expr& expr,
+                                         const VectorBlock& block) {
+  ScalarType type = expr.type().toTensor()->getComponentType();
+  llvm::Type *vectorType = llvm::VectorType::get(llvmType(type), block.lanes);
+
+  if (isa<VarExpr>(expr) && to<VarExpr>(expr)->var == block.var) {
+    // The loop variable of lane i is start+i
+    vector<llvm::Constant*> laneIds;
+    for (unsigned lane = 0; lane < block.lanes; ++lane) {
+      laneIds.push_back(llvmInt(lane));
+    }
+    return builder->CreateAdd(
+        builder->CreateVectorSplat(block.lanes, block.start),
+        llvm::ConstantVector::get(laneIds), block.var.getName());
+  }
+  if (isa<VarExpr>(expr) && util::contains(block.locals,
+                                           to<VarExpr>(expr)->var)) {
+    return block.locals.at(to<VarExpr>(expr)->var);
+  }
+  if (isa<Literal>(expr) || isa<VarExpr>(expr) || isa<Length>(expr)) {
+    return builder->CreateVectorSplat(block.lanes, compile(expr));
+  }
+  if (isa<Load>(expr)) {
+    const Load *load = to<Load>(expr);
+
+    // The lanes of a component of the loop's tensors are next to each other
+    if (isa<VarExpr>(load->buffer) &&
+        util::contains(block.buffers, to<VarExpr>(load->buffer)->var)) {
+      llvm::Value *index = builder->CreateMul(
+          emitLaneIndex(load->index, block, 0), llvmInt(block.lanes));
+      llvm::Value *bufferLoc = builder->CreateBitCast(
+          builder->CreateInBoundsGEP(
+              block.buffers.at(to<VarExpr>(load->buffer)->var), index),
+          vectorType->getPointerTo());
+      return builder->CreateAlignedLoad(bufferLoc, type.bytes());
+    }
+
+    LinearIndex index = linearize(load->index);
+    bool indirect = isIndirect(index, block.var, block.varying);
+
+    llvm::Value *buffer = compile(load->buffer);
+    string locName = string(buffer->getName()) + PTR_SUFFIX;
+    string valName = string(buffer->getName()) + VAL_SUFFIX;
+
+    // All lanes load the same scalar
+    if (!indirect && index.getCoefficient(block.var) == 0 &&
+        block.mask == nullptr) {
+      llvm::Value *laneIndex =
+          emitFieldIndex(load->buffer, emitLaneIndex(load->index, block, 0));
+      llvm::Value *bufferLoc = builder->CreateInBoundsGEP(buffer, laneIndex,
+                                                          locName);
+      llvm::LoadInst *loadInst = builder->CreateLoad(bufferLoc, valName);
+      emitAliasMetadata(loadInst, load->buffer);
+      return builder->CreateVectorSplat(block.lanes, loadInst);
+    }
+
+    // Consecutive lanes load consecutive scalars
+    if (isUnitStride(load->buffer, load->index, block) &&
+        block.mask == nullptr) {
+      llvm::Value *laneIndex =
+          emitFieldIndex(load->buffer, emitLaneIndex(load->index, block, 0));
+      llvm::Value *bufferLoc = builder->CreateInBoundsGEP(buffer, laneIndex,
+                                                          locName);
+      llvm::Type *vectorPtrType = vectorType->getPointerTo(
+          bufferLoc->getType()->getPointerAddressSpace());
+      bufferLoc = builder->CreateBitCast(bufferLoc, vectorPtrType);
+      llvm::LoadInst *loadInst =
+          builder->CreateAlignedLoad(bufferLoc, type.bytes(), valName);
+      emitAliasMetadata(loadInst, load->buffer);
+      return loadInst;
+    }
+
+    // Other loads, e.g. the columns of row-major blocks and the fields of
+    // endpoints, are gathered one lane at a time
+    vector<llvm::Value*> indices =
+        emitLaneIndices(load->buffer, load->index, block);
+    if (block.mask == nullptr) {
+      llvm::Value *value = llvm::UndefValue::get(vectorType);
+      for (unsigned lane = 0; lane < block.lanes; ++lane) {
+        llvm::Value *bufferLoc = builder->CreateInBoundsGEP(buffer,
+                                                            indices[lane],
+                                                            locName);
+        llvm::LoadInst *loadInst = builder->CreateLoad(bufferLoc, valName);
+        emitAliasMetadata(loadInst, load->buffer);
+        value = builder->CreateInsertElement(value, loadInst, llvmInt(lane));
+      }
+      return value;
+    }
+
+    // Lanes that are masked off may not load, so the lanes that are on load
+    // in branches and gather their values in memory
+    llvm::BasicBlock &funcEntry =
+        builder->GetInsertBlock()->getParent()->getEntryBlock();
+    llvm::IRBuilder<> entryBuilder(&funcEntry, funcEntry.begin());
+    llvm::Value *lanesLoc = entryBuilder.CreateAlloca(llvmType(type),
+                                                      llvmInt(block.lanes),
+                                                      valName + ".lanes");
+    emitLanes(block, [&](unsigned lane) {
+      llvm::Value *bufferLoc = builder->CreateInBoundsGEP(buffer,
+                                                          indices[lane],
+                                                          locName);
+      llvm::LoadInst *loadInst = builder->CreateLoad(bufferLoc, valName);
+      emitAliasMetadata(loadInst, load->buffer);
+      builder->CreateStore(loadInst,
+                           builder->CreateConstInBoundsGEP1_32(lanesLoc, lane));
+    });
+    return builder->CreateAlignedLoad(
+        builder->CreateBitCast(lanesLoc, vectorType->getPointerTo()),
+        type.bytes(), valName);
+  }
+  if (isa<Neg>(expr)) {
+    llvm::Value *a = emitVectorExpr(to<Neg>(expr)->a, block);
+    return type.isFloat() ? builder->CreateFNeg(a) : builder->CreateNeg(a);
+  }
+
+  iassert(isa<Add>(expr) || isa<Sub>(expr) || isa<Mul>(expr) ||
+          isa<Div>(expr)) << "Cannot vectorize " << expr;
+  const BinaryExpr *op = static_cast<const BinaryExpr*>(expr.ptr);
+  llvm::Value *a = emitVectorExpr(op->a, block);
+  llvm::Value *b = emitVectorExpr(op->b, block);
+  if (isa<Add>(expr)) {
+    return type.isFloat() ? builder->CreateFAdd(a, b)
+                          : builder->CreateAdd(a, b);
+  }
+  if (isa<Sub>(expr)) {
+    return type.isFloat() ? builder->CreateFSub(a, b)
+                          : builder->CreateSub(a, b);
+  }
+  if (isa<Mul>(expr)) {
+    return type.isFloat() ? builder->CreateFMul(a, b)
+                          : builder->CreateMul(a, b);
+  }
+  iassert(type.isFloat());
+  return builder->CreateFDiv(a, b);
+}
+
+llvm::Value *LLVMBackend::emitVectorCondition(const ir::Expr& condition,
+                                              const VectorBlock& block) {
+  if (isa<Not>(condition)) {
+    return builder->CreateNot(emitVectorCondition(to<Not>(condition)->a,
+                                                  block));
+  }
+
+  const BinaryExpr *op = static_cast<const BinaryExpr*>(condition.ptr);
+  if (isa<And>(condition) || isa<Or>(condition) || isa<Xor>(condition)) {
+    llvm::Value *a = emitVectorCondition(op->a, block);
+    llvm::Value *b = emitVectorCondition(op->b, block);
+    if (isa<And>(condition)) {
+      return builder->CreateAnd(a, b);
+    }
+    if (isa<Or>(condition)) {
+      return builder->CreateOr(a, b);
+    }
+    return builder->CreateXor(a, b);
+  }
+
+  bool isFloat = op->a.type().toTensor()->getComponentType().isFloat();
+  llvm::Value *a = emitVectorExpr(op->a, block);
+  llvm::Value *b = emitVectorExpr(op->b, block);
+  if (isa<Eq>(condition)) {
+    return isFloat ? builder->CreateFCmpOEQ(a, b) : builder->CreateICmpEQ(a, b);
+  }
+  if (isa<Ne>(condition)) {
+    return isFloat ? builder->CreateFCmpONE(a, b) : builder->CreateICmpNE(a, b);
+  }
+  if (isa<Gt>(condition)) {
+    return isFloat ? builder->CreateFCmpOGT(a, b)
+                   : builder->CreateICmpSGT(a, b);
+  }
+  if (isa<Lt>(condition)) {
+    return isFloat ? builder->CreateFCmpOLT(a, b)
+                   : builder->CreateICmpSLT(a, b);
+  }
+  if (isa<Ge>(condition)) {
+    return isFloat ? builder->CreateFCmpOGE(a, b)
+                   : builder->CreateICmpSGE(a, b);
+  }
+  iassert(isa<Le>(condition)) << "Cannot vectorize " << condition;
+  return isFloat ? builder->CreateFCmpOLE(a, b) : builder->CreateICmpSLE(a, b);
+}
+
+bool LLVMBackend::isUnitStride(const ir::Expr& buffer, const ir::Expr& index,
+                               const VectorBlock& block) {
+  LinearIndex linearIndex = linearize(index);
+  if (isIndirect(linearIndex, block.var, block.varying)) {
+    return false;
+  }
+  unsigned size = getTiledFieldSize(buffer);
+  if (size == 0) {
+    return linearIndex.getCoefficient(block.var) == 1;
+  }
+
+  // The lanes access the same component of consecutive elements, which are
+  // next to each other if they are in the same tile. They are when the lanes
+  // evenly divide the tiles, since the first lane is a multiple of the lanes.
+  int tile = options.fieldLayout.getTile();
+  if (linearIndex.getCoefficient(block.var) != (int)size ||
+      tile % block.lanes != 0) {
+    return false;
+  }
+  symtable.scope();
+  symtable.insert(block.var, llvmInt(0));
+  llvm::Value *component = compile(index);
+  symtable.unscope();
+  llvm::ConstantInt *constant = llvm::dyn_cast<llvm::ConstantInt>(component);
+  return constant != nullptr && constant->getSExtValue() >= 0 &&
+         constant->getSExtValue() < (int64_t)size;
+}
+
+std::vector<llvm::Value*>
+LLVMBackend::emitLaneIndices(const ir::Expr& buffer, const ir::Expr& index,
+                             const VectorBlock& block) {
+  vector<llvm::Value*> indices;
+  if (isIndirect(linearize(index), block.var, block.varying)) {
+    // The index depends on values the lanes compute or load, so it is
+    // computed as a vector. It is computed in all lanes, also in lanes that
+    // are masked off, since only the accesses at the index are masked.
+    llvm::Value *laneIndices = emitVectorExpr(index, block);
+    for (unsigned lane = 0; lane < block.lanes; ++lane) {
+      indices.push_back(builder->CreateExtractElement(laneIndices,
+                                                      llvmInt(lane)));
+    }
+  }
+  else {
+    for (unsigned lane = 0; lane < block.lanes; ++lane) {
+      indices.push_back(emitLaneIndex(index, block, lane));
+    }
+  }
+  for (llvm::Value*& laneIndex : indices) {
+    laneIndex = emitFieldIndex(buffer, laneIndex);
+  }
+  return indices;
+}
+
+llvm::Value *LLVMBackend::emitLaneIndex(const ir::Expr& index,
+                                        const VectorBlock& block,
+                                        unsigned lane) {
+  symtable.scope();
+  symtable.insert(block.var, builder->CreateAdd(block.start, llvmInt(lane)));
+  llvm::Value *value = compile(index);
+  symtable.unscope();
+  return value;
+}
+
+void LLVMBackend::emitLanes(const VectorBlock& block,
+                            std::function<void(unsigned lane)> emitLane) {
+  llvm::Function *llvmFunc = builder->GetInsertBlock()->getParent();
+  for (unsigned lane = 0; lane < block.lanes; ++lane) {
+    if (block.mask == nullptr) {
+      emitLane(lane);
+      continue;
+    }
+    llvm::BasicBlock *laneBlock =
+        llvm::BasicBlock::Create(LLVM_CTX, "lane", llvmFunc);
+    llvm::BasicBlock *nextBlock =
+        llvm::BasicBlock::Create(LLVM_CTX, "lane_end", llvmFunc);
+    builder->CreateCondBr(builder->CreateExtractElement(block.mask,
+                                                        llvmInt(lane)),
+                          laneBlock, nextBlock);
+    builder->SetInsertPoint(laneBlock);
+    emitLane(lane);
+    builder->CreateBr(nextBlock);
+    builder->SetInsertPoint(nextBlock);
+  }
+}
+
+void LLVMBackend::compile(const ir::While& whileLoop) {
+  llvm::Function *llvmFunc = builder->GetInsertBlock()->getParent();
+
+  llvm::Value *cond = compile(whileLoop.condition);
+  llvm::Value *condEval = builder->CreateICmpEQ(builder->getTrue(), cond);
+
+
+  llvm::BasicBlock *bodyBlock = llvm::BasicBlock::Create(LLVM_CTX, "body",
+                                                         llvmFunc);
+  llvm::BasicBlock *checkBlock = llvm::BasicBlock::Create(LLVM_CTX,"check");
+  llvm::BasicBlock *exitBlock = llvm::BasicBlock::Create(LLVM_CTX, "exit");
+  builder->CreateCondBr(condEval, bodyBlock, exitBlock);
+
+  builder->SetInsertPoint(bodyBlock);
   compile(whileLoop.body);
   builder->CreateBr(checkBlock);
   
@@ -1369,8 +3491,112 @@ llvm::Value *LLVMBackend::emitFieldRead(const Expr &elemOrSet,
 
   assert(elemType->hasField(fieldName));
   unsigned fieldLoc = fieldsOffset + elemType->fieldNames.at(fieldName);
-  return builder->CreateExtractValue(setOrElemValue, {fieldLoc},
-                                     setOrElemValue->getName()+"."+fieldName);
+  llvm::Value *fieldPtr =
+      builder->CreateExtractValue(setOrElemValue, {fieldLoc},
+                                  setOrElemValue->getName()+"."+fieldName);
+
+  // The fields of sets are allocated by the field allocator, while the fields
+  // of elements point into them
+  if (elemOrSet.type().isSet()) {
+    emitAlignmentAssumption(fieldPtr);
+  }
+  return fieldPtr;
+}
+
+std::string LLVMBackend::getAliasClass(const Expr& buffer) {
+  if (isa<FieldRead>(buffer)) {
+    const FieldRead *fieldRead = to<FieldRead>(buffer);
+    Type type = fieldRead->elementOrSet.type();
+    const ElementType *elemType = type.isElement()
+        ? type.toElement()
+        : type.toSet()->elementType.toElement();
+    return "field " + elemType->name + "." + fieldRead->fieldName;
+  }
+  if (isa<VarExpr>(buffer) && util::contains(buffers, to<VarExpr>(buffer)->var)) {
+    return "temporary " + to<VarExpr>(buffer)->var.getName();
+  }
+  return "";
+}
+
+llvm::Value *LLVMBackend::emitFieldIndex(const ir::Expr& buffer,
+                                         llvm::Value *index) {
+  unsigned size = getTiledFieldSize(buffer);
+  if (size == 0) {
+    return index;
+  }
+
+  // Component c of element e is at ((e/tile)*size + c)*tile + e%tile
+  llvm::Value *tile = llvmInt(options.fieldLayout.getTile());
+  llvm::Value *element = builder->CreateUDiv(index, llvmInt(size));
+  llvm::Value *component = builder->CreateURem(index, llvmInt(size));
+  llvm::Value *tileStart =
+      builder->CreateMul(builder->CreateUDiv(element, tile), llvmInt(size));
+  return builder->CreateAdd(
+      builder->CreateMul(builder->CreateAdd(tileStart, component), tile),
+      builder->CreateURem(element, tile), "tiled");
+}
+
+void LLVMBackend::emitTiledFieldCopy(const ir::FieldRead *field,
+                                     const ir::Expr& dst, const ir::Expr& src,
+                                     ir::CompoundOperator cop) {
+  Var i("i", Int);
+  Expr len = Mul::make(Length::make(IndexSet(field->elementOrSet)),
+                       (int)getTiledFieldSize(field));
+  compile(ForRange::make(i, 0, len,
+                         Store::make(dst, i, Load::make(src, i), cop)));
+}
+
+void LLVMBackend::emitAliasMetadata(llvm::Instruction *inst,
+                                    const Expr& buffer) {
+  std::string aliasClass = getAliasClass(buffer);
+  if (aliasClass.empty()) {
+    return;
+  }
+
+  // Type-based alias analysis: each alias class is a type of its own
+  llvm::MDBuilder mdBuilder(LLVM_CTX);
+  if (!util::contains(tbaaTags, aliasClass)) {
+    if (tbaaRoot == nullptr) {
+      tbaaRoot = mdBuilder.createTBAARoot("Simit buffers");
+    }
+    llvm::MDNode *type = mdBuilder.createTBAAScalarTypeNode(aliasClass,
+                                                            tbaaRoot);
+    tbaaTags[aliasClass] = mdBuilder.createTBAAStructTagNode(type, type, 0);
+  }
+  inst->setMetadata(llvm::LLVMContext::MD_tbaa, tbaaTags.at(aliasClass));
+
+#if LLVM_MAJOR_VERSION >= 3 && LLVM_MINOR_VERSION >= 6
+  // Alias scopes: each alias class is a scope, and an access does not alias
+  // the scopes of the other classes. Scopes are created as they are first
+  // accessed, which suffices since accesses are compared both ways.
+  if (!util::contains(aliasScopes, aliasClass)) {
+    if (aliasScopeDomain == nullptr) {
+      aliasScopeDomain =
+          mdBuilder.createAnonymousAliasScopeDomain("Simit buffers");
+    }
+    aliasScopes[aliasClass] =
+        mdBuilder.createAnonymousAliasScope(aliasScopeDomain, aliasClass);
+  }
+  std::vector<llvm::Metadata*> noAliasScopes;
+  for (auto& scope : aliasScopes) {
+    if (scope.first != aliasClass) {
+      noAliasScopes.push_back(scope.second);
+    }
+  }
+  inst->setMetadata(llvm::LLVMContext::MD_alias_scope,
+                    llvm::MDNode::get(LLVM_CTX, {aliasScopes.at(aliasClass)}));
+  if (!noAliasScopes.empty()) {
+    inst->setMetadata(llvm::LLVMContext::MD_noalias,
+                      llvm::MDNode::get(LLVM_CTX, noAliasScopes));
+  }
+#endif
+}
+
+void LLVMBackend::emitAlignmentAssumption(llvm::Value *ptr) {
+#if LLVM_MAJOR_VERSION >= 3 && LLVM_MINOR_VERSION >= 6
+  builder->CreateAlignmentAssumption(*dataLayout, ptr,
+                                     internal::FieldAllocator::kAlignment);
+#endif
 }
 
 llvm::Value *LLVMBackend::emitComputeLen(const TensorType *tensorType,
@@ -1522,13 +3748,15 @@ llvm::Function *LLVMBackend::emitEmptyFunction(const string &name,
                                                bool externalLinkage,
                                                bool doesNotThrow,
                                                bool scalarsByValue) {
+  bool hasContext = (contextLayout != nullptr);
   llvm::Function *llvmFunc = createPrototype(name, arguments, results, module,
                                              externalLinkage, doesNotThrow,
-                                             scalarsByValue);
+                                             scalarsByValue, 0, hasContext);
   auto entry = llvm::BasicBlock::Create(LLVM_CTX, "entry", llvmFunc);
   builder->SetInsertPoint(entry);
 
-  iassert(llvmFunc->getArgumentList().size() == arguments.size()+results.size())
+  iassert(llvmFunc->getArgumentList().size() ==
+          arguments.size() + results.size() + (hasContext ? 1 : 0))
       << "Number of arguments to llvm func does not match simit func arguments";
 
   // Add arguments and results to symbol table
@@ -1543,6 +3771,17 @@ llvm::Function *LLVMBackend::emitEmptyFunction(const string &name,
     symtable.insert(*simitResIt, llvmArgIt);
   }
 
+  // Add pointers to the context object slots of the globals to symbol table
+  if (hasContext) {
+    contextArg = llvmArgIt;
+    for (const Var& global : globals) {
+      const ContextLayout::Slot& slot =
+          contextLayout->globals.at(global.getName());
+      symtable.insert(global, emitContextSlot(slot.offset, slot.type,
+                                              global.getName()));
+    }
+  }
+
   return llvmFunc;
 }
 
@@ -1592,40 +3831,89 @@ void LLVMBackend::emitGlobals(const ir::Environment& env) {
   // Emit global constants
   // TODO
 
+  // Functions with a context object store the globals in it, and add pointers
+  // to their slots to the symtable when they are emitted (emitEmptyFunction)
+  auto emitGlobal = [this](const Var& var) {
+    if (contextLayout != nullptr) {
+      // Make sure set structs are packed, so that we can correctly set them
+      Type type = var.getType();
+      llvm::Type* llvmVarType = (type.isSet())
+                                ? llvmType(*type.toSet(), 0, true)
+                                : llvmType(type);
+      contextLayout->globals.insert(
+          {var.getName(), {addContextSlot(llvmVarType), llvmVarType}});
+    }
+    else {
+      llvm::GlobalVariable* ptr =
+          createGlobal(module, var, llvm::GlobalValue::ExternalLinkage,
+                       globalAddrspace());
+      this->symtable.insert(var, ptr);
+    }
+    this->globals.insert(var);
+  };
+
   // Emit global variables (externs and temporaries)
   for (const Var& ext : env.getExternVars()) {
-    llvm::GlobalVariable* ptr = createGlobal(module, ext,
-                                             llvm::GlobalValue::ExternalLinkage,
-                                             globalAddrspace());
-    this->symtable.insert(ext, ptr);
-    this->globals.insert(ext);
+    emitGlobal(ext);
   }
 
   // Emit global temporaries
   for (const Var& tmp : env.getTemporaries()) {
-    llvm::GlobalVariable* ptr = createGlobal(module, tmp,
-                                             llvm::GlobalValue::ExternalLinkage,
-                                             globalAddrspace());
-    this->symtable.insert(tmp, ptr);
-    this->globals.insert(tmp);
+    emitGlobal(tmp);
   }
 
   // Emit global tensor indices
   for (const TensorIndex& tensorIndex : env.getTensorIndices()) {
-    const Var& rowptr = tensorIndex.getRowptrArray();
-    llvm::GlobalVariable* rowptrPtr =
-        createGlobal(module, rowptr, llvm::GlobalValue::ExternalLinkage,
-                     globalAddrspace());
-    this->symtable.insert(rowptr, rowptrPtr);
-    this->globals.insert(rowptr);
+    emitGlobal(tensorIndex.getRowptrArray());
+    emitGlobal(tensorIndex.getColidxArray());
+  }
+}
 
-    const Var& colidx  = tensorIndex.getColidxArray();
-    llvm::GlobalVariable* colidxPtr =
-        createGlobal(module, colidx, llvm::GlobalValue::ExternalLinkage,
-                     globalAddrspace());
-    this->symtable.insert(colidx, colidxPtr);
-    this->globals.insert(colidx);
+size_t LLVMBackend::addContextSlot(llvm::Type *type) {
+  iassert(contextLayout != nullptr);
+  size_t offset = contextLayout->size;
+  contextLayout->size += (dataLayout->getTypeAllocSize(type) + 7) / 8 * 8;
+  return offset;
+}
+
+llvm::Value *LLVMBackend::emitContextSlot(size_t offset, llvm::Type *type,
+                                          const std::string &name) {
+  iassert(contextArg != nullptr);
+  llvm::Value *slot = builder->CreateConstInBoundsGEP1_32(contextArg, offset);
+  return builder->CreatePointerCast(slot, type->getPointerTo(), name);
+}
+
+void LLVMBackend::emitEntryFunction(llvm::Function *func) {
+  llvm::Function *entry =
+      createPrototypeLLVM(string(func->getName()) + "_entry", {"context"},
+                          {LLVM_INT8_PTR}, module, true);
+  builder->SetInsertPoint(llvm::BasicBlock::Create(LLVM_CTX, "entry", entry));
+  contextArg = entry->arg_begin();
+
+  // Load the arguments from their slots, assembling set structs from their
+  // elements
+  vector<llvm::Value*> args;
+  auto llvmArgIt = func->arg_begin();
+  for (const vector<ContextLayout::Slot>& slots : contextLayout->arguments) {
+    llvm::Type *type = (llvmArgIt++)->getType();
+    llvm::Value *arg;
+    if (type->isStructTy()) {
+      arg = llvm::UndefValue::get(type);
+      for (unsigned i = 0; i < slots.size(); ++i) {
+        llvm::Value *element = builder->CreateLoad(
+            emitContextSlot(slots[i].offset, slots[i].type));
+        arg = builder->CreateInsertValue(arg, element, i);
+      }
+    }
+    else {
+      iassert(slots.size() == 1);
+      arg = builder->CreateLoad(emitContextSlot(slots[0].offset, type));
+    }
+    args.push_back(arg);
   }
+  args.push_back(contextArg);
+  builder->CreateCall(func, args);
+  builder->CreateRetVoid();
 }
 
 void LLVMBackend::emitAssign(Var var, const Expr& value) {
@@ -1634,6 +3922,11 @@ void LLVMBackend::emitAssign(Var var, const Expr& value) {
   ///       in the backend. Probably requires copy and memset intrinsics.
 //  iassert(isScalar(value.type()) &&
 //         "assignment non-scalars should have been lowered by now");
+  if (isa<FieldRead>(value) && getTiledFieldSize(value) > 0) {
+    emitTiledFieldCopy(to<FieldRead>(value), VarExpr::make(var), value,
+                       CompoundOperator::None);
+    return;
+  }
   llvm::Value *valuePtr = compile(value);
 
   iassert(var.getType().isTensor() && value.type().isTensor());
@@ -1716,18 +4009,29 @@ llvm::Value *LLVMBackend::makeGlobalTensor(ir::Var var) {
   llvm::Type *ctype = llvmType(var.getType().toTensor()->getComponentType());
   llvm::PointerType *globalType = llvm::PointerType::get(ctype, globalAddrspace());
 
-  llvm::GlobalVariable* buffer =
-      new llvm::GlobalVariable(*module, globalType,
-                               false, llvm::GlobalValue::ExternalLinkage,
-                               llvm::ConstantPointerNull::get(globalType),
-                               var.getName(), nullptr,
-                               llvm::GlobalVariable::NotThreadLocal,
-                               globalAddrspace());
-  buffer->setAlignment(8);
+  llvm::Value* buffer;
+  if (contextLayout != nullptr) {
+    size_t offset = addContextSlot(globalType);
+    bufferSlots.insert(pair<Var, size_t>(var, offset));
+    buffer = emitContextSlot(offset, globalType, var.getName());
+  }
+  else {
+    llvm::GlobalVariable* global =
+        new llvm::GlobalVariable(*module, globalType,
+                                 false, llvm::GlobalValue::ExternalLinkage,
+                                 llvm::ConstantPointerNull::get(globalType),
+                                 var.getName(), nullptr,
+                                 llvm::GlobalVariable::NotThreadLocal,
+                                 globalAddrspace());
+    global->setAlignment(8);
+    buffer = global;
+  }
   buffers.insert(pair<Var, llvm::Value*>(var, buffer));
 
   // Add load to symtable
-  return builder->CreateLoad(buffer, buffer->getName());
+  llvm::Value *bufferPtr = builder->CreateLoad(buffer, buffer->getName());
+  emitAlignmentAssumption(bufferPtr);
+  return bufferPtr;
 }
 
 }}
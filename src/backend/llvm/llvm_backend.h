@@ -1,14 +1,17 @@
 #ifndef SIMIT_LLVM_BACKEND_H
 #define SIMIT_LLVM_BACKEND_H
 
+#include <functional>
 #include <ostream>
 #include <memory>
 #include <set>
+#include <string>
 #include <vector>
 #include <map>
 
 #include "backend/backend_impl.h"
 
+#include "compile_options.h"
 #include "storage.h"
 #include "var.h"
 #include "backend/backend_visitor.h"
@@ -26,6 +29,7 @@ class Constant;
 class Type;
 class Value;
 class Instruction;
+class MDNode;
 class Function;
 class DataLayout;
 }
@@ -35,25 +39,48 @@ namespace simit {
 
 namespace ir {
   class Environment;
+  enum class CompoundOperator;
 }
 
 namespace backend {
 
 class SimitIRBuilder;
+struct ContextLayout;
 
 extern const std::string VAL_SUFFIX;
 extern const std::string PTR_SUFFIX;
 extern const std::string LEN_SUFFIX;
 
-std::shared_ptr<llvm::EngineBuilder> createEngineBuilder(llvm::Module *module);
+/// A CPU to generate code for: an LLVM CPU name (e.g. "haswell") and a
+/// feature string that adjusts the CPU's features (e.g. "+avx2,-avx512f").
+struct TargetCPU {
+  std::string name;
+  std::string features;
+};
+
+/// Returns the CPU that compiled functions run on: the first of the CPUs set
+/// with setTargetCPUs whose instruction set extensions the host supports, or
+/// otherwise the host CPU and its detected features. A CPU set with
+/// setForcedTargetCPU is returned whether or not the host supports it.
+TargetCPU getTargetCPU();
+
+/// Create an engine builder that generates code for `cpu`.
+std::shared_ptr<llvm::EngineBuilder>
+createEngineBuilder(llvm::Module *module, const TargetCPU& cpu=getTargetCPU());
 
 /// Code generator that uses LLVM to compile Simit IR.
 class LLVMBackend : public BackendImpl, protected BackendVisitor<llvm::Value*> {
 public:
+  /// Create a backend that generates code in its own LLVM context, so that
+  /// different backends can compile concurrently.
   LLVMBackend();
   virtual ~LLVMBackend();
 
 protected:
+  /// Create a backend that generates code in the given context, or in the
+  /// global context if it is null.
+  explicit LLVMBackend(std::shared_ptr<llvm::LLVMContext> context);
+
   virtual unsigned globalAddrspace() {return 0;}
 
   util::ScopedMap<simit::ir::Var, llvm::Value*> symtable;
@@ -62,13 +89,54 @@ protected:
   std::map<ir::Var, llvm::Value*> buffers;
 
   std::set<ir::Var> globals;
+
+  /// The layout of the context object of the function being compiled, which
+  /// holds its globals and buffers so that it is reentrant, and the offsets of
+  /// the buffers' slots. The functions take the object as their last argument
+  /// (contextArg). Backends that keep the globals and buffers in module
+  /// globals leave the layout null.
+  std::shared_ptr<ContextLayout> contextLayout;
+  std::map<ir::Var, size_t> bufferSlots;
+  llvm::Value *contextArg;
+
   ir::Storage storage;
   const ir::Environment* environment;
 
+  /// The options of the function being compiled, as they were when its
+  /// compilation started.
+  internal::CompileOptions options;
+
+  /// The context that the backend generates code in. Compiled functions share
+  /// it, since their modules live in it.
+  std::shared_ptr<llvm::LLVMContext> context;
+
   llvm::Module *module;
   std::unique_ptr<llvm::DataLayout> dataLayout;
   std::unique_ptr<SimitIRBuilder> builder;
 
+  /// Variables declared inside the body of each loop, keyed by the loop
+  /// variable. Recorded before the declarations are hoisted to the function
+  /// entry, so that parallel loops can give each thread its own copy and
+  /// vectorized block loops one per lane.
+  std::map<ir::Var, std::set<ir::Var>> loopLocals;
+
+  /// True while compiling the outlined body of a parallel loop.
+  bool inParallelLoop;
+
+  /// Variables that are private to each thread of the current parallel loop.
+  std::set<ir::Var> parallelPrivates;
+
+  /// Buffers that several iterations of the current parallel loop add to, and
+  /// that must therefore be added to atomically (see getBufferName).
+  std::set<std::string> parallelSharedAdds;
+
+  /// Alias metadata of the buffers that never overlap, keyed by alias class
+  /// (see getAliasClass).
+  llvm::MDNode *tbaaRoot;
+  std::map<std::string, llvm::MDNode*> tbaaTags;
+  llvm::MDNode *aliasScopeDomain;
+  std::map<std::string, llvm::MDNode*> aliasScopes;
+
   using BackendImpl::compile;
   virtual Function* compile(ir::Func func, const ir::Storage& storage);
 
@@ -112,6 +180,32 @@ protected:
   /// Get a pointer to the given field
   llvm::Value *emitFieldRead(const ir::Expr &elemOrSet, std::string fieldName);
 
+  /// Returns the location in `buffer` of the component at `index`. The
+  /// lowering indexes the components of fields in row-major order, element
+  /// after element, which is where they are unless the field is laid out in
+  /// tiles (see FieldLayout).
+  llvm::Value *emitFieldIndex(const ir::Expr& buffer, llvm::Value *index);
+
+  /// Copy the components of a tensor to another one of the same type, one at
+  /// a time, where one of them is a field laid out in tiles.
+  void emitTiledFieldCopy(const ir::FieldRead *field, const ir::Expr& dst,
+                          const ir::Expr& src, ir::CompoundOperator cop);
+
+  /// Returns the alias class of a buffer that is loaded from or stored to.
+  /// Buffers of different classes never overlap: the fields of sets are
+  /// classed by element type and field name, and each temporary allocated by
+  /// the init function has its own class. Returns the empty string if the
+  /// buffer may overlap others (e.g. a tensor argument).
+  std::string getAliasClass(const ir::Expr& buffer);
+
+  /// Attach the type-based alias and alias scope metadata of the buffer's
+  /// alias class to a load or store from the buffer.
+  void emitAliasMetadata(llvm::Instruction *inst, const ir::Expr& buffer);
+
+  /// Tell the optimizer that `ptr` is aligned like the buffers of the field
+  /// allocator.
+  void emitAlignmentAssumption(llvm::Value *ptr);
+
   /// Get the number of components in the tensor
   llvm::Value *emitComputeLen(const ir::TensorType*, const ir::TensorStorage &);
 
@@ -147,8 +241,20 @@ protected:
 
   void emitAssign(ir::Var var, const ir::Expr& value);
 
-  /// Produce LLVM globals for everything in `env` and store in `globals`
-  /// and in `symtable` appropriately.
+  /// Add an 8-byte aligned slot of the given type to the context object, and
+  /// return its offset.
+  size_t addContextSlot(llvm::Type *type);
+
+  /// Get a pointer to the context object slot at `offset`.
+  llvm::Value *emitContextSlot(size_t offset, llvm::Type *type,
+                               const std::string &name="");
+
+  /// Emit a function `<name>_entry` that loads the arguments of `func` from
+  /// their context object slots and calls it with the context object.
+  void emitEntryFunction(llvm::Function *func);
+
+  /// Produce LLVM globals (or context object slots) for everything in `env`
+  /// and store in `globals` and in `symtable` appropriately.
   virtual void emitGlobals(const ir::Environment& env);
 
   virtual void emitPrintf(llvm::Value *str, 
@@ -156,6 +262,98 @@ protected:
   virtual void emitPrintf(std::string format, 
                           std::vector<llvm::Value*> args={});
 
+  /// Returns true if the loop over `loopVar` can be executed in parallel. The
+  /// scalars that the loop reduces into with `+=` are returned in `reductions`,
+  /// and the buffers that several iterations add to in `sharedAdds`.
+  bool canParallelize(const ir::Var& loopVar, const ir::Stmt& body,
+                      std::set<ir::Var>* reductions,
+                      std::set<std::string>* sharedAdds);
+
+  /// Outline the loop body into a task function and emit a call that
+  /// executes the iterations [start,end) on the runtime thread pool.
+  void emitParallelLoop(const ir::Var& loopVar, llvm::Value* start,
+                        llvm::Value* end, const ir::Stmt& body,
+                        const std::set<ir::Var>& reductions,
+                        const std::set<std::string>& sharedAdds);
+
+  /// True if `buffer` is added to by several iterations of the current
+  /// parallel loop.
+  bool isParallelSharedAdd(const ir::Expr& buffer);
+
+  /// A loop whose iterations are compiled to vector instructions, with one
+  /// lane per iteration: a loop over a small dense block, or a group of the
+  /// elements of a map.
+  struct VectorBlock {
+    ir::Var var;
+
+    /// The first iteration, which is a multiple of the number of lanes
+    llvm::Value *start;
+    unsigned lanes;
+
+    /// The lanes that run the statements being emitted, or null if all do
+    llvm::Value *mask;
+
+    /// The loop variable and the variables declared in the loop
+    std::set<ir::Var> varying;
+
+    /// The lanes of the scalars declared in the loop, as assigned so far
+    std::map<ir::Var, llvm::Value*> locals;
+
+    /// Storage of the tensors declared in the loop, with the lanes of each
+    /// component next to each other
+    std::map<ir::Var, llvm::Value*> buffers;
+  };
+
+  /// Returns true if `lanes` iterations of the loop over `loopVar` can run as
+  /// the lanes of vector instructions: its body only does arithmetic and math
+  /// intrinsics on scalars loaded from buffers and from small dense tensors it
+  /// declares, stores them and sums them, in branches and in nested loops with
+  /// constant bounds (which are unrolled).
+  bool canVectorizeBlock(const ir::Var& loopVar, int lanes,
+                         const ir::Stmt& body);
+
+  /// Emit iterations [start,start+lanes) of a loop as vector instructions.
+  void emitVectorBlock(const ir::Var& loopVar, llvm::Value *start,
+                       unsigned lanes, const ir::Stmt& body);
+
+  /// Emit a loop that runs the iterations [start,end) of a map in groups of
+  /// options.mapVectorWidth vector lanes, and return the first of the
+  /// iterations that are left over. `start` must be a multiple of the width.
+  llvm::Value *emitVectorLoop(const ir::Var& loopVar, llvm::Value *start,
+                              llvm::Value *end, const ir::Stmt& body);
+
+  /// Emit a statement of a vector block.
+  void emitVectorStmt(const ir::Stmt& stmt, VectorBlock* block);
+
+  /// Emit a vector with the value of a scalar expression in each lane.
+  llvm::Value *emitVectorExpr(const ir::Expr& expr, const VectorBlock& block);
+
+  /// Emit a vector of booleans with the value of a condition in each lane.
+  llvm::Value *emitVectorCondition(const ir::Expr& condition,
+                                   const VectorBlock& block);
+
+  /// Returns true if consecutive lanes access consecutive locations of
+  /// `buffer` at `index`.
+  bool isUnitStride(const ir::Expr& buffer, const ir::Expr& index,
+                    const VectorBlock& block);
+
+  /// Emit the location of `buffer` at `index` in each lane.
+  std::vector<llvm::Value*> emitLaneIndices(const ir::Expr& buffer,
+                                            const ir::Expr& index,
+                                            const VectorBlock& block);
+
+  /// Emit the value of an index expression that is linear in the loop
+  /// variable in one lane.
+  llvm::Value *emitLaneIndex(const ir::Expr& index, const VectorBlock& block,
+                             unsigned lane);
+
+  /// Emit code for each lane of a vector block that is in its mask.
+  void emitLanes(const VectorBlock& block,
+                 std::function<void(unsigned lane)> emitLane);
+
+  /// Atomically add `value` to the scalar that `ptr` points to.
+  void emitAtomicAdd(llvm::Value *ptr, llvm::Value *value);
+
   /// Emit a memcpy instruction
   virtual void emitMemCpy(llvm::Value *dst, llvm::Value *src,
                           llvm::Value *size, unsigned align);
@@ -164,8 +362,8 @@ protected:
   virtual void emitMemSet(llvm::Value *dst, llvm::Value *val,
                           llvm::Value *size, unsigned align);
 
-  /// Allocate a global pointer for a tensor, and add to the symtable
-  /// and list of global buffers
+  /// Allocate a global pointer (or context object slot) for a tensor, and add
+  /// to the symtable and list of global buffers
   virtual llvm::Value *makeGlobalTensor(ir::Var var);
   
   /// Compile a single argument and return its llvm values
@@ -197,9 +395,6 @@ protected:
 
   // TODO: Remove this function, once the old init system has been removed
   ir::Func makeSystemTensorsGlobal(ir::Func func);
-
-private:
-  static bool llvmInitialized;
 };
 
 }}
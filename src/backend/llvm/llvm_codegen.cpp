@@ -165,7 +165,8 @@ llvm::Function* createPrototype(const std::string &name,
                                 bool externalLinkage,
                                 bool doesNotThrow,
                                 bool scalarsByValue,
-                                unsigned addrspace) {
+                                unsigned addrspace,
+                                bool contextArgument) {
   vector<string>      llvmArgNames;
   vector<llvm::Type*> llvmArgTypes;
 
@@ -192,6 +193,11 @@ llvm::Function* createPrototype(const std::string &name,
     llvmArgTypes.push_back(llvmType(res.getType(), addrspace));
   }
 
+  if (contextArgument) {
+    llvmArgNames.push_back("context");
+    llvmArgTypes.push_back(LLVM_INT8_PTR);
+  }
+
   assert(llvmArgNames.size() == llvmArgTypes.size());
 
   return createPrototypeLLVM(name, llvmArgNames, llvmArgTypes,
@@ -59,6 +59,9 @@ llvm::Function *createPrototypeLLVM(const std::string& name,
                                     llvm::Module* module,
                                     bool externalLinkage,
                                     bool doesNotThrow=true);
+
+/// Creates the prototype of a Simit function. If `contextArgument` is true the
+/// function takes an i8* to its context object after the arguments and results.
 llvm::Function* createPrototype(const std::string& name,
                                 const std::vector<ir::Var>& arguments,
                                 const std::vector<ir::Var>& results,
@@ -66,7 +69,8 @@ llvm::Function* createPrototype(const std::string& name,
                                 bool externalLinkage,
                                 bool doesNotThrow=true,
                                 bool scalarsByValue=true,
-                                unsigned addrspace=0);
+                                unsigned addrspace=0,
+                                bool contextArgument=false);
 
 llvm::GlobalVariable* createGlobal(llvm::Module *module, const ir::Var& var,
                                    llvm::GlobalValue::LinkageTypes linkage,
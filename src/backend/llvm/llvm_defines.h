@@ -1,12 +1,36 @@
 #ifndef SIMIT_LLVM_DEFINES_H
 #define SIMIT_LLVM_DEFINES_H
 
+#include <memory>
+
 #include "llvm/IR/LLVMContext.h"
 
-#define LLVM_CTX llvm::getGlobalContext()
+#include "interfaces/uncopyable.h"
+
+#define LLVM_CTX simit::backend::getLLVMContext()
 
 namespace simit {
 namespace backend {
 
+/// Returns the LLVM context that the calling thread generates code in: the
+/// context of the innermost LLVMContextScope, or the global context.
+llvm::LLVMContext& getLLVMContext();
+
+/// Returns the context of the calling thread's innermost LLVMContextScope, or
+/// null if the thread generates code in the global context.
+std::shared_ptr<llvm::LLVMContext> getScopedLLVMContext();
+
+/// Makes the calling thread generate code in a context while in scope. LLVM
+/// contexts are not thread-safe, so threads that compile concurrently must
+/// each use their own. A null context selects the global context.
+class LLVMContextScope : private interfaces::Uncopyable {
+public:
+  explicit LLVMContextScope(std::shared_ptr<llvm::LLVMContext> context);
+  ~LLVMContextScope();
+
+private:
+  std::shared_ptr<llvm::LLVMContext> previous;
+};
+
 }}
 #endif
@@ -1,5 +1,8 @@
 #include "llvm_function.h"
 
+#include <cctype>
+#include <cstring>
+#include <sstream>
 #include <string>
 #include <vector>
 
@@ -7,8 +10,11 @@
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/DataLayout.h"
+#include "llvm/IR/IRBuilder.h"
 #include "llvm/Support/raw_ostream.h"
-#include "llvm/Support/DynamicLibrary.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Transforms/Utils/Cloning.h"
 
 #if LLVM_MAJOR_VERSION <= 3 && LLVM_MINOR_VERSION <= 4
 #include "llvm/Analysis/Verifier.h"
@@ -18,6 +24,7 @@
 
 #include "llvm_types.h"
 #include "llvm_codegen.h"
+#include "llvm_backend.h"
 
 #include "backend/actual.h"
 #include "graph.h"
@@ -34,24 +41,65 @@ using namespace simit::ir;
 namespace simit {
 namespace backend {
 
-typedef void (*FuncPtrType)();
+typedef void (*EntryPtrType)(void*);
 
 LLVMFunction::LLVMFunction(ir::Func func, const ir::Storage &storage,
                            llvm::Function* llvmFunc, llvm::Module* module,
-                           std::shared_ptr<llvm::EngineBuilder> engineBuilder)
-    : Function(func), initialized(false), llvmFunc(llvmFunc), module(module),
-      harnessModule(new llvm::Module("simit_harness", LLVM_CTX)),
-      storage(storage),
+                           std::shared_ptr<llvm::EngineBuilder> engineBuilder,
+                           llvm::ObjectCache* objectCache,
+                           std::shared_ptr<const ContextLayout> contextLayout,
+                           FieldLayout fieldLayout)
+    : Function(func), context(getScopedLLVMContext()), initialized(false),
+      llvmFunc(llvmFunc), module(module), storage(storage), irFunc(func),
       engineBuilder(engineBuilder),
       executionEngine(engineBuilder->setUseMCJIT(true).create()), // MCJIT EE
-      harnessEngineBuilder(new llvm::EngineBuilder(harnessModule)),
-      harnessExecEngine(harnessEngineBuilder->setUseMCJIT(true).create()),
-      deinit(nullptr) {
+      contextLayout(contextLayout), fieldLayout(fieldLayout),
+      deinit(nullptr), initEntry(nullptr),
+      funcEntry(nullptr), deinitEntry(nullptr) {
+
+  // With an object cache, MCJIT loads the module's object code from the cache
+  // if present and otherwise stores the object code it generates there.
+  if (objectCache != nullptr) {
+    executionEngine->setObjectCache(objectCache);
+  }
 
   // Finalize existing module so we can get global pointer hooks
   // from the LLVM memory manager.
   executionEngine->finalizeObject();
 
+  if (contextLayout != nullptr) {
+    const string funcName = string(llvmFunc->getName());
+    auto getEntry = [this](const string& name) {
+      uint64_t addr = executionEngine->getFunctionAddress(name + "_entry");
+      iassert(addr != 0) << "no entry point for " << name;
+      return reinterpret_cast<EntryPtrType>(addr);
+    };
+    initEntry = getEntry(funcName + "_init");
+    funcEntry = getEntry(funcName);
+    deinitEntry = getEntry(funcName + "_deinit");
+  }
+
+  initContextObject();
+}
+
+LLVMFunction::LLVMFunction(const LLVMFunction& function)
+    : Function(function.irFunc), context(function.context),
+      initialized(false), llvmFunc(function.llvmFunc),
+      module(function.module), storage(function.storage),
+      irFunc(function.irFunc), engineBuilder(function.engineBuilder),
+      executionEngine(function.executionEngine),
+      contextLayout(function.contextLayout),
+      fieldLayout(function.fieldLayout), deinit(nullptr),
+      initEntry(function.initEntry), funcEntry(function.funcEntry),
+      deinitEntry(function.deinitEntry) {
+  initContextObject();
+}
+
+void LLVMFunction::initContextObject() {
+  if (contextLayout != nullptr) {
+    contextObject.assign(contextLayout->size / sizeof(uint64_t), 0);
+  }
+
   const Environment& env = getEnvironment();
 
   // Initialize extern pointers
@@ -61,8 +109,7 @@ LLVMFunction::LLVMFunction(ir::Func func, const ir::Storage &storage,
     // Store a pointer to each of the bindable's extern in externPtrs
     vector<void**> extPtrs;
     for (const Var& ext : externMapping.getMappings()) {
-      uint64_t addr = executionEngine->getGlobalValueAddress(ext.getName());
-      void** extPtr = (void**)addr;
+      void** extPtr = (void**)getGlobalAddress(ext.getName());
       *extPtr = nullptr;
       extPtrs.push_back(extPtr);
     }
@@ -74,31 +121,58 @@ LLVMFunction::LLVMFunction(ir::Func func, const ir::Storage &storage,
   for (const Var& tmp : env.getTemporaries()) {
     iassert(tmp.getType().isTensor())
         << "Only support tensor temporaries";
-    // llvm::GlobalValue* llvmTmp = module->getNamedValue(tmp.getName());
-    uint64_t addr = executionEngine->getGlobalValueAddress(tmp.getName());
-    void** tmpPtr = (void**)addr;
+    void** tmpPtr = (void**)getGlobalAddress(tmp.getName());
     *tmpPtr = nullptr;
     temporaryPtrs.insert({tmp.getName(), tmpPtr});
   }
 
   // Initialize tensorIndex ptrs
   for (const TensorIndex& tensorIndex : env.getTensorIndices()) {
-    uint64_t addr;
-    
     const Var& rowptr = tensorIndex.getRowptrArray();
-    addr = executionEngine->getGlobalValueAddress(rowptr.getName());
-    const uint32_t** rowptrPtr = (const uint32_t**)addr;
+    const uint32_t** rowptrPtr =
+        (const uint32_t**)getGlobalAddress(rowptr.getName());
     *rowptrPtr = nullptr;
 
     const Var& colidx = tensorIndex.getColidxArray();
-    addr = executionEngine->getGlobalValueAddress(colidx.getName());
-    const uint32_t** colidxPtr = (const uint32_t**)addr;
+    const uint32_t** colidxPtr =
+        (const uint32_t**)getGlobalAddress(colidx.getName());
     *colidxPtr = nullptr;
 
     const pe::PathExpression& pexpr = tensorIndex.getPathExpression();
-    tensorIndexPtrs.insert({pexpr, {rowptrPtr, colidxPtr}});
+    tensorIndexPtrs.insert({{pexpr, tensorIndex.isSymmetric()},
+                            {rowptrPtr, colidxPtr}});
   }
 
+  // Initialize the argument slots of the entry points
+  if (contextLayout != nullptr) {
+    char* contextPtr = (char*)contextObject.data();
+    vector<string> formals = getArgs();
+    iassert(formals.size() == contextLayout->arguments.size());
+    auto llvmArgIt = llvmFunc->getArgumentList().begin();
+    for (const vector<ContextLayout::Slot>& slots : contextLayout->arguments) {
+      vector<void*> ptrs;
+      for (const ContextLayout::Slot& slot : slots) {
+        ptrs.push_back(contextPtr + slot.offset);
+      }
+      argPtrs.push_back(ptrs);
+      argIsPointer.push_back((llvmArgIt++)->getType()->isPointerTy());
+    }
+  }
+}
+
+void* LLVMFunction::getGlobalAddress(const std::string& name) {
+  if (contextLayout == nullptr) {
+    return (void*)executionEngine->getGlobalValueAddress(name);
+  }
+  iassert(util::contains(contextLayout->globals, name))
+      << "no context object slot for " << name;
+  return (char*)contextObject.data() + contextLayout->globals.at(name).offset;
+}
+
+Function* LLVMFunction::clone() const {
+  uassert(contextLayout != nullptr)
+      << "the backend does not support multiple instances of a function";
+  return new LLVMFunction(*this);
 }
 
 LLVMFunction::~LLVMFunction() {
@@ -112,10 +186,41 @@ LLVMFunction::~LLVMFunction() {
 
 }
 
+/// Returns the buffer of a field to pass to the compiled code. Unlike
+/// Set::getFieldData, it leaves it to bind to mark the field exposed.
+static void* getFieldBuffer(Set* set, const std::string& name) {
+  return set->getFields()[set->getFieldIndex(name)]->data;
+}
+
 void LLVMFunction::bind(const std::string& name, simit::Set* set) {
   iassert(hasBindable(name));
   iassert(getBindableType(name).isSet());
 
+  // The compiled code writes fields through their buffers without changing
+  // their versions, but it does not write the fields its cached assemblies
+  // read
+  const vector<CachedAssembly>& cachedAssemblies =
+      getEnvironment().getCachedAssemblies();
+  for (Set::FieldData* fieldData : set->getFields()) {
+    pair<string,string> field(name, fieldData->name);
+    bool cached = false;
+    for (const CachedAssembly& cachedAssembly : cachedAssemblies) {
+      cached |= util::contains(cachedAssembly.getFields(), field);
+    }
+    fieldData->exposed |= !cached;
+  }
+
+  // The compiled code indexes fields with more than one component in the
+  // layout it was compiled for
+  const ir::SetType* type = getBindableType(name).toSet();
+  for (auto& field : type->elementType.toElement()->fields) {
+    uassert(field.type.toTensor()->size() == 1 ||
+            set->getFieldLayout(field.name) == fieldLayout)
+        << "field " << util::quote(field.name) << " of " << util::quote(name)
+        << " was not added with the field layout the function was compiled"
+        << " for (see setFieldLayout)";
+  }
+
   if (hasArg(name)) {
     arguments[name] = std::unique_ptr<Actual>(new SetActual(set));
     initialized = false;
@@ -132,7 +237,7 @@ void LLVMFunction::bind(const std::string& name, simit::Set* set) {
     // Write field pointers to extern
     void** externFieldsPtr = (void**)(externSizePtr + 1);
     for (auto& field : setType->elementType.toElement()->fields) {
-      *externFieldsPtr = set->getFieldData(field.name);
+      *externFieldsPtr = getFieldBuffer(set, field.name);
       ++externFieldsPtr;
     }
   }
@@ -203,8 +308,9 @@ size_t LLVMFunction::size(const ir::IndexDomain& dimension) {
 }
 
 Function::FuncType LLVMFunction::init() {
-  pe::PathIndexBuilder piBuilder;
+  LLVMContextScope contextScope(context);
 
+  // Rebinding the sets only discards the path indices of sets that changed
   for (auto& pair : arguments) {
     string name = pair.first;
     Actual* actual = pair.second.get();
@@ -219,7 +325,7 @@ Function::FuncType LLVMFunction::init() {
   // Initialize indices
   initIndices(piBuilder, environment);
 
-  // Initialize temporaries
+  // Initialize temporaries. Buffers are reused if their size did not change.
   for (const Var& tmp : environment.getTemporaries()) {
     iassert(util::contains(temporaryPtrs, tmp.getName()));
     const Type& type = tmp.getType();
@@ -229,27 +335,38 @@ Function::FuncType LLVMFunction::init() {
       unsigned order = tensorType->order();
       iassert(order <= 2) << "Higher-order tensors not supported";
 
+      size_t tmpSize = 0;
       if (order == 1) {
         // Vectors are currently always dense
         IndexDomain vecDimension = tensorType->getDimensions()[0];
         Type blockType = tensorType->getBlockType();
         size_t blockSize = blockType.toTensor()->size();
         size_t componentSize = tensorType->getComponentType().bytes();
-        *temporaryPtrs.at(tmp.getName()) =
-            calloc(size(vecDimension) *blockSize, componentSize);
+        tmpSize = size(vecDimension) * blockSize * componentSize;
       }
       else if (order == 2) {
         iassert(environment.hasTensorIndex(tmp))
           << "No tensor index for: " << tmp;
-        const pe::PathExpression& pexpr =
-            environment.getTensorIndex(tmp).getPathExpression();
+        const TensorIndex& tensorIndex = environment.getTensorIndex(tmp);
+        const pe::PathExpression& pexpr = tensorIndex.getPathExpression();
         iassert(util::contains(pathIndices, pexpr));
         Type blockType = tensorType->getBlockType();
         size_t blockSize = blockType.toTensor()->size();
         size_t componentSize = tensorType->getComponentType().bytes();
-        size_t matSize = pathIndices.at(pexpr).numNeighbors() *
-                         blockSize * componentSize;
-        *temporaryPtrs.at(tmp.getName()) = malloc(matSize);
+        size_t numBlocks = tensorIndex.isSymmetric()
+            ? upperIndices.at(pexpr).second.size()
+            : pathIndices.at(pexpr).numNeighbors();
+        tmpSize = numBlocks * blockSize * componentSize;
+      }
+
+      void** tmpPtr = temporaryPtrs.at(tmp.getName());
+      if (*tmpPtr == nullptr || temporarySizes[tmp.getName()] != tmpSize) {
+        free(*tmpPtr);
+        *tmpPtr = malloc(tmpSize);
+        temporarySizes[tmp.getName()] = tmpSize;
+      }
+      if (order == 1) {
+        memset(*tmpPtr, 0, tmpSize);
       }
     }
     else {
@@ -258,132 +375,170 @@ Function::FuncType LLVMFunction::init() {
     }
   }
 
-  // Compile a harness void function without arguments that calls the simit
-  // llvm function with pointers to the arguments.
-  Function::FuncType func;
-  initialized = true;
-  vector<string> formals = getArgs();
-  iassert(formals.size() == llvmFunc->getArgumentList().size());
-  if (llvmFunc->getArgumentList().size() == 0) {
-    llvm::Function *initFunc = getInitFunc();
-    llvm::Function *deinitFunc = getDeinitFunc();
-    uint64_t addr = executionEngine->getFunctionAddress(initFunc->getName());
-    FuncPtrType init = reinterpret_cast<decltype(init)>(addr);
-    init();
-    addr = executionEngine->getFunctionAddress(deinitFunc->getName());
-    FuncPtrType deinitPtr = reinterpret_cast<decltype(deinitPtr)>(addr);
-    deinit = deinitPtr;
-    addr = executionEngine->getFunctionAddress(llvmFunc->getName());
-    FuncPtrType funcPtr = reinterpret_cast<decltype(funcPtr)>(addr);
-    func = funcPtr;
+  // The flags of cached assemblies were zeroed with the other vectors, so the
+  // tensors are assembled from scratch on the next run
+  assemblyCaches.clear();
+  for (const CachedAssembly& cachedAssembly :
+           environment.getCachedAssemblies()) {
+    AssemblyCache cache;
+    cache.flagPtr = temporaryPtrs.at(cachedAssembly.getFlag().getName());
+    cache.generations.resize(cachedAssembly.getSets().size(), 0);
+    cache.versions.resize(cachedAssembly.getSets().size(), 0);
+    cache.fieldVersions.resize(cachedAssembly.getFields().size(), 0);
+    cache.fields.resize(cachedAssembly.getFields().size());
+    assemblyCaches.push_back(cache);
   }
-  else {
-    llvm::SmallVector<llvm::Value*, 8> args;
-    auto llvmArgIt = llvmFunc->getArgumentList().begin();
-    for (const std::string& formal : formals) {
-      iassert(util::contains(arguments, formal));
-
-      llvm::Argument* llvmFormal = llvmArgIt++;
-      Actual* actual = arguments.at(formal).get();
-      ir::Type type = getArgType(formal);
-      iassert(type.kind() == ir::Type::Set || type.kind() == ir::Type::Tensor);
-
-      class InitActual : public ActualVisitor {
-      public:
-        llvm::Value* result;
-        Type type;
-        llvm::Argument* llvmFormal;
-        llvm::Value* init(Actual* a, const Type& t, llvm::Argument* f) {
-          this->type = t;
-          this->llvmFormal = f;
-          a->accept(this);
-          return result;
-        }
 
-        void visit(SetActual* actual) {
-          const ir::SetType *setType = type.toSet();
-          Set *set = actual->getSet();
+  // Release the buffers allocated by the previous initialization
+  if (deinit) {
+    deinit();
+    deinit = nullptr;
+  }
 
-          llvm::StructType *llvmSetType = llvmType(*setType);
+  // Write the arguments to the context object, and get void functions without
+  // arguments that call the entry points with it
+  iassert(contextLayout != nullptr);
+  vector<string> formals = getArgs();
+  for (size_t i = 0; i < formals.size(); ++i) {
+    iassert(util::contains(arguments, formals[i]));
+    Actual* actual = arguments.at(formals[i]).get();
+    ir::Type type = getArgType(formals[i]);
+    iassert(type.kind() == ir::Type::Set || type.kind() == ir::Type::Tensor);
+
+    class WriteActual : public ActualVisitor {
+    public:
+      Type type;
+      const vector<void*>* argPtrs;
+      bool isPointer;
+      void write(Actual* a, const Type& t, const vector<void*>* ptrs,
+                 bool isPtr) {
+        this->type = t;
+        this->argPtrs = ptrs;
+        this->isPointer = isPtr;
+        a->accept(this);
+      }
 
-          vector<llvm::Constant*> setData;
+      void visit(SetActual* actual) {
+        const ir::SetType *setType = type.toSet();
+        Set *set = actual->getSet();
 
-          // Set size
-          setData.push_back(llvmInt(set->getSize()));
+        // The slots hold the elements of the set struct in order
+        auto argPtr = argPtrs->begin();
 
-          // Edge indices (if the set is an edge set)
-          if (setType->endpointSets.size() > 0) {
-            // Endpoints index
-            setData.push_back(llvmPtr(LLVM_INT_PTR, set->getEndpointsData()));
+        // Set size
+        *(int*)*argPtr++ = set->getSize();
 
-            // Edges index
-            // TODO
+        // Edge indices (if the set is an edge set)
+        if (setType->endpointSets.size() > 0) {
+          // Endpoints index
+          *(const int**)*argPtr++ = set->getEndpointsData();
 
-            // Neighbor index
-            const internal::NeighborIndex *nbrs = set->getNeighborIndex();
-            setData.push_back(llvmPtr(LLVM_INT_PTR, nbrs->getStartIndex()));
-            setData.push_back(llvmPtr(LLVM_INT_PTR, nbrs->getNeighborIndex()));
-          }
+          // Edges index
+          // TODO
 
-          // Fields
-          for (auto &field : setType->elementType.toElement()->fields) {
-            assert(field.type.isTensor());
-            setData.push_back(llvmPtr(*field.type.toTensor(),
-                                      set->getFieldData(field.name)));
-          }
+          // Neighbor index
+          const internal::NeighborIndex *nbrs = set->getNeighborIndex();
+          *(const int**)*argPtr++ = nbrs->getStartIndex();
+          *(const int**)*argPtr++ = nbrs->getNeighborIndex();
+          *(const int**)*argPtr++ = nbrs->getEdgeLocations();
+        }
+
+        // Fields
+        for (auto &field : setType->elementType.toElement()->fields) {
+          assert(field.type.isTensor());
+          *(void**)*argPtr++ = getFieldBuffer(set, field.name);
+        }
+        iassert(argPtr == argPtrs->end());
+      }
 
-          result = llvm::ConstantStruct::get(llvmSetType, setData);
+      void visit(TensorActual* actual) {
+        const ir::TensorType* tensorType = type.toTensor();
+        iassert(argPtrs->size() == 1);
+        void* argPtr = (*argPtrs)[0];
+        void* tensorData = actual->getData();
+        // Tensors passed by pointer have a pointer slot, while scalars passed
+        // by value have a slot that holds the scalar
+        if (isPointer) {
+          *(void**)argPtr = tensorData;
         }
+        else {
+          memcpy(argPtr, tensorData, tensorType->getComponentType().bytes());
+        }
+      }
+    };
+    WriteActual().write(actual, type, &argPtrs[i], argIsPointer[i]);
+  }
+
+  void* contextPtr = contextObject.data();
+  initEntry(contextPtr);
+  EntryPtrType deinitPtr = deinitEntry;
+  deinit = [deinitPtr, contextPtr]() {deinitPtr(contextPtr);};
+  EntryPtrType funcPtr = funcEntry;
+  initialized = true;
+  if (assemblyCaches.size() > 0) {
+    return [this, funcPtr, contextPtr]() {
+      invalidateAssemblyCaches();
+      funcPtr(contextPtr);
+    };
+  }
+  return [funcPtr, contextPtr]() {funcPtr(contextPtr);};
+}
+
+Set* LLVMFunction::getBoundSet(const std::string& name) {
+  Actual* actual = util::contains(arguments, name) ? arguments.at(name).get()
+                                                   : globals.at(name).get();
+  iassert(isa<SetActual>(actual)) << util::quote(name) << " is not a set";
+  return to<SetActual>(actual)->getSet();
+}
+
+void LLVMFunction::invalidateAssemblyCaches() {
+  const vector<CachedAssembly>& cachedAssemblies =
+      getEnvironment().getCachedAssemblies();
+  iassert(cachedAssemblies.size() == assemblyCaches.size());
+  for (size_t i = 0; i < assemblyCaches.size(); ++i) {
+    const CachedAssembly& cachedAssembly = cachedAssemblies[i];
+    AssemblyCache& cache = assemblyCaches[i];
+
+    // Field versions are only compared within a set, but the sets of the
+    // fields are among the sets, which are compared by generation
+    bool changed = false;
+    for (size_t j = 0; j < cache.generations.size(); ++j) {
+      Set* set = getBoundSet(cachedAssembly.getSets()[j]);
+      if (set->getGeneration() != cache.generations[j] ||
+          set->getVersion() != cache.versions[j]) {
+        cache.generations[j] = set->getGeneration();
+        cache.versions[j] = set->getVersion();
+        changed = true;
+      }
+    }
+    for (size_t j = 0; j < cache.fields.size(); ++j) {
+      const pair<string,string>& field = cachedAssembly.getFields()[j];
+      Set* set = getBoundSet(field.first);
+      const Set::FieldData* fieldData =
+          set->getFields()[set->getFieldIndex(field.second)];
+      unsigned long version = fieldData->version;
+      if (version != cache.fieldVersions[j]) {
+        cache.fieldVersions[j] = version;
+        changed = true;
+      }
 
-        void visit(TensorActual* actual) {
-          const ir::TensorType* tensorType = type.toTensor();
-          void* tensorData = actual->getData();
-          result = (llvmFormal->getType()->isPointerTy())
-                   ? llvmPtr(*tensorType, tensorData)
-                   : llvmVal(*tensorType, tensorData);
+      // Fields that may be written through pointers to their data are
+      // compared with a copy
+      if (fieldData->exposed) {
+        const char* data = static_cast<const char*>(fieldData->data);
+        size_t size = fieldData->getBufferSize(set->getSize());
+        vector<char>& copy = cache.fields[j];
+        if (copy.size() != size || memcmp(copy.data(), data, size) != 0) {
+          copy.assign(data, data + size);
+          changed = true;
         }
-      };
-      llvm::Value* llvmActual = InitActual().init(actual, type, llvmFormal);
-      args.push_back(llvmActual);
+      }
     }
 
-    const std::string initFuncName = string(llvmFunc->getName())+"_init";
-    const std::string deinitFuncName = string(llvmFunc->getName())+"_deinit";
-    const std::string funcName = llvmFunc->getName();
-
-    // Calling main module functions from the harness requires the
-    // symbols to be loaded into the memory manager ahead of finalization
-    llvm::sys::DynamicLibrary::AddSymbol(
-        initFuncName,
-        (void*) executionEngine->getFunctionAddress(initFuncName));
-    llvm::sys::DynamicLibrary::AddSymbol(
-        deinitFuncName,
-        (void*) executionEngine->getFunctionAddress(deinitFuncName));
-    llvm::sys::DynamicLibrary::AddSymbol(
-        funcName,
-        (void*) executionEngine->getFunctionAddress(funcName));
-
-    // Create Init/deinit function harnesses
-    createHarness(initFuncName, args);
-    createHarness(deinitFuncName, args);
-    createHarness(funcName, args);
-
-    // Finalize harness module
-    harnessExecEngine->finalizeObject();
-
-    // Fetch hard addresses from ExecutionEngine
-    auto init = getHarnessFunctionAddress(initFuncName);
-    init();
-    deinit = getHarnessFunctionAddress(deinitFuncName);
-
-    // Compute function
-    func = getHarnessFunctionAddress(funcName);
-    iassert(!llvm::verifyModule(*module))
-        << "LLVM module does not pass verification";
-    iassert(!llvm::verifyModule(*harnessModule))
-        << "LLVM harness module does not pass verification";
-  }
-  return func;
+    if (changed) {
+      *static_cast<int*>(*cache.flagPtr) = 0;
+    }
+  }
 }
 
 void LLVMFunction::print(std::ostream &os) const {
@@ -394,6 +549,7 @@ void LLVMFunction::print(std::ostream &os) const {
 }
 
 void LLVMFunction::printMachine(std::ostream &os) const {
+  LLVMContextScope contextScope(context);
   // TODO: Make printMachine write to os, instead of stderr
   llvm::TargetMachine *target = engineBuilder->selectTarget();
   target->Options.PrintMachineCode = true;
@@ -402,20 +558,323 @@ void LLVMFunction::printMachine(std::ostream &os) const {
   target->Options.PrintMachineCode = false;
 }
 
+// Ahead-of-time compiled functions prefix the names of their entry points and
+// types, so that they do not clash with the names of the program
+static std::string getAOTName(const std::string& name) {
+  return "simit_" + name;
+}
+
+static std::string getCType(llvm::Type *type) {
+  if (type->isVoidTy()) {
+    return "void";
+  }
+  else if (type->isIntegerTy(1)) {
+    return "bool";
+  }
+  else if (type->isIntegerTy()) {
+    return "int" + to_string(type->getIntegerBitWidth()) + "_t";
+  }
+  else if (type->isFloatTy()) {
+    return "float";
+  }
+  else if (type->isDoubleTy()) {
+    return "double";
+  }
+  else if (type->isPointerTy()) {
+    return getCType(type->getPointerElementType()) + "*";
+  }
+  else if (type->isStructTy()) {
+    llvm::StructType *structType = llvm::cast<llvm::StructType>(type);
+    string cType = structType->isPacked() ? "struct __attribute__((packed)) {"
+                                          : "struct {";
+    for (unsigned i = 0; i < structType->getNumElements(); ++i) {
+      cType += getCType(structType->getElementType(i)) + " f" + to_string(i) +
+               "; ";
+    }
+    return cType + "}";
+  }
+  ierror << "no C type for LLVM type " << type->getTypeID();
+  return "";
+}
+
+// Write a typedef of the struct that holds a set, with the members named after
+// the set's indices and fields
+static void writeSetTypedef(std::ostream &os, const std::string &name,
+                            const ir::SetType *setType, llvm::Type *type) {
+  llvm::StructType *structType = llvm::cast<llvm::StructType>(type);
+  vector<string> memberNames = {"size"};
+  if (setType->endpointSets.size() > 0) {
+    memberNames.insert(memberNames.end(), {"endpoints", "neighbors_start",
+                                           "neighbors", "edge_locations"});
+  }
+  for (const ir::Field& field : setType->elementType.toElement()->fields) {
+    memberNames.push_back(field.name);
+  }
+  iassert(memberNames.size() == structType->getNumElements());
+
+  os << "typedef struct " << (structType->isPacked() ? "__attribute__((packed)) "
+                                                     : "")
+     << "{" << endl;
+  for (unsigned i = 0; i < structType->getNumElements(); ++i) {
+    os << "  " << getCType(structType->getElementType(i)) << " "
+       << memberNames[i] << ";" << endl;
+  }
+  os << "} " << name << ";" << endl;
+}
+
+// Add an entry point that calls `func` with the C calling convention, which
+// passes set structs by pointer
+static void createAOTEntryPoint(llvm::Function *func) {
+  vector<llvm::Type*> paramTypes;
+  for (const llvm::Argument& arg : func->getArgumentList()) {
+    llvm::Type *type = arg.getType();
+    paramTypes.push_back(type->isStructTy() ? type->getPointerTo() : type);
+  }
+  llvm::Function *entry = llvm::Function::Create(
+      llvm::FunctionType::get(LLVM_VOID, paramTypes, false),
+      llvm::GlobalValue::ExternalLinkage, getAOTName(string(func->getName())),
+      func->getParent());
+
+  llvm::IRBuilder<> builder(llvm::BasicBlock::Create(LLVM_CTX, "entry", entry));
+  vector<llvm::Value*> args;
+  auto param = entry->arg_begin();
+  for (const llvm::Argument& arg : func->getArgumentList()) {
+    llvm::Value *value = param++;
+    args.push_back(arg.getType()->isStructTy() ? builder.CreateLoad(value)
+                                               : value);
+  }
+  builder.CreateCall(func, args);
+  builder.CreateRetVoid();
+}
+
+void LLVMFunction::writeObject(std::ostream &os) const {
+  uassert(contextLayout != nullptr)
+      << "the backend does not support ahead-of-time compilation";
+  LLVMContextScope contextScope(context);
+  std::unique_ptr<llvm::Module> aotModule(llvm::CloneModule(module));
+  aotModule->setTargetTriple(llvm::sys::getProcessTriple());
+
+  // Make the compiled functions and globals internal, so that their names
+  // (e.g. main) do not clash with the program's. The state of the function is
+  // in the context object the program passes to the entry points.
+  for (llvm::Function& f : *aotModule) {
+    if (!f.isDeclaration()) {
+      f.setLinkage(llvm::GlobalValue::InternalLinkage);
+    }
+  }
+  for (llvm::GlobalVariable& global : aotModule->getGlobalList()) {
+    if (!global.isDeclaration()) {
+      global.setLinkage(llvm::GlobalValue::InternalLinkage);
+    }
+  }
+
+  const string funcName = string(llvmFunc->getName());
+  for (const string& name : {funcName+"_init", funcName, funcName+"_deinit"}) {
+    llvm::Function *func = aotModule->getFunction(name);
+    iassert(func != nullptr) << "no function " << name;
+    createAOTEntryPoint(func);
+  }
+
+  // Generate position independent code, so that the object can also be
+  // linked into shared libraries
+  auto aotEngineBuilder = createEngineBuilder(aotModule.get());
+  aotEngineBuilder->setRelocationModel(llvm::Reloc::PIC_);
+  aotEngineBuilder->setCodeModel(llvm::CodeModel::Default);
+  std::unique_ptr<llvm::TargetMachine> targetMachine(
+      aotEngineBuilder->selectTarget());
+  aotModule->setDataLayout(targetMachine->getDataLayout());
+
+  string object;
+  uassert(emitObjectFile(aotModule.get(), targetMachine.get(), &object))
+      << "the target machine cannot emit object files";
+  os.write(object.data(), object.size());
+}
+
+void LLVMFunction::writeHeader(std::ostream &os) const {
+  uassert(contextLayout != nullptr)
+      << "the backend does not support ahead-of-time compilation";
+  const Environment& env = getEnvironment();
+  const string funcName = string(llvmFunc->getName());
+  const string initName = getAOTName(funcName + "_init");
+  const string contextName = getAOTName(funcName + "_context_t");
+
+  string guard = "SIMIT_" + funcName + "_H";
+  for (char& c : guard) {
+    c = isalnum(c) ? toupper(c) : '_';
+  }
+
+  os << "// Entry points and context object of the Simit function " << funcName
+     << "." << endl
+     << "// Generated by simit-compile. Do not edit." << endl
+     << "#ifndef " << guard << endl
+     << "#define " << guard << endl << endl
+     << "#include <stdbool.h>" << endl
+     << "#include <stdint.h>" << endl << endl
+     << "#ifdef __cplusplus" << endl
+     << "extern \"C\" {" << endl
+     << "#endif" << endl;
+
+  // The context object holds the globals at the slots of the layout, which
+  // are 8-byte aligned and in the order they are written here, followed by
+  // the internal state of the function
+  llvm::DataLayout dataLayout(module);
+  stringstream fields;
+  size_t fieldsEnd = 0;
+  auto writeGlobal = [&](const Var& var) {
+    iassert(util::contains(contextLayout->globals, var.getName()))
+        << "no context object slot for " << var.getName();
+    const ContextLayout::Slot& slot = contextLayout->globals.at(var.getName());
+    size_t fieldOffset = (fieldsEnd + 7) / 8 * 8;
+    iassert(slot.offset >= fieldOffset)
+        << "context object slots are not in environment order";
+    if (slot.offset > fieldOffset) {
+      fields << "  uint64_t unused" << fieldOffset << "["
+             << (slot.offset - fieldOffset) / 8 << "];" << endl;
+    }
+    fieldsEnd = slot.offset + dataLayout.getTypeAllocSize(slot.type);
+
+    string typeName = getCType(slot.type);
+    if (var.getType().isSet()) {
+      typeName = getAOTName(funcName + "_" + var.getName() + "_t");
+      os << endl;
+      writeSetTypedef(os, typeName, var.getType().toSet(), slot.type);
+    }
+    fields << "  " << typeName << " " << var.getName()
+           << " __attribute__((aligned(8)));" << endl;
+  };
+
+  if (env.getExterns().size() > 0) {
+    fields << "  // Externs, which the program binds before it calls "
+           << initName << "." << endl;
+    for (const VarMapping& externMapping : env.getExterns()) {
+      const Var& bindable = externMapping.getVar();
+      fields << endl << "  // extern " << bindable.getName() << " : "
+             << bindable.getType() << endl;
+      for (const Var& ext : externMapping.getMappings()) {
+        writeGlobal(ext);
+      }
+    }
+    fields << endl;
+  }
+
+  if (env.getTemporaries().size() > 0) {
+    fields << "  // Temporaries, which the program allocates before it calls "
+           << initName << "." << endl
+           << "  // Vectors must be zeroed, and matrices have a component "
+           << "block per entry of" << endl
+           << "  // their tensor index." << endl;
+    for (const Var& tmp : env.getTemporaries()) {
+      fields << endl << "  // " << tmp.getName() << " : " << tmp.getType()
+             << endl;
+      if (env.isCachedAssemblyFlag(tmp)) {
+        fields << "  // Zero it whenever the inputs of the matrix it guards "
+               << "change." << endl;
+      }
+      writeGlobal(tmp);
+    }
+    fields << endl;
+  }
+
+  if (env.getTensorIndices().size() > 0) {
+    fields << "  // Tensor indices in CSR form, which the program builds "
+           << "before it calls" << endl
+           << "  // " << initName << "." << endl;
+    for (const TensorIndex& tensorIndex : env.getTensorIndices()) {
+      fields << endl << "  // " << tensorIndex << endl;
+      writeGlobal(tensorIndex.getRowptrArray());
+      writeGlobal(tensorIndex.getColidxArray());
+    }
+    fields << endl;
+  }
+
+  size_t internalOffset = (fieldsEnd + 7) / 8 * 8;
+  iassert(internalOffset <= contextLayout->size);
+  os << endl
+     << "// The context object of an instance of " << funcName << ". The "
+     << "program zeroes it, and" << endl
+     << "// instances with different context objects can run concurrently."
+     << endl
+     << "typedef struct {" << endl
+     << fields.str();
+  if (internalOffset < contextLayout->size) {
+    os << "  // Internal state" << endl
+       << "  uint64_t internal[" << (contextLayout->size - internalOffset) / 8
+       << "];" << endl;
+  }
+  os << "} " << contextName << ";" << endl;
+
+  // Entry points. The compiled functions take the context object last.
+  os << endl << "// Entry points. " << initName << " allocates the buffers of "
+     << funcName << ", and" << endl
+     << "// " << getAOTName(funcName + "_deinit") << " frees them." << endl;
+  string params;
+  auto argEnd = llvmFunc->getArgumentList().end();
+  --argEnd;
+  for (auto argIt = llvmFunc->getArgumentList().begin(); argIt != argEnd;
+       ++argIt) {
+    const llvm::Argument& arg = *argIt;
+    string argName = string(arg.getName());
+    llvm::Type *type = arg.getType();
+    if (type->isStructTy()) {
+      string typeName = getAOTName(funcName + "_" + argName + "_t");
+      iassert(getArgType(argName).isSet());
+      os << endl;
+      writeSetTypedef(os, typeName, getArgType(argName).toSet(), type);
+      params += typeName + "* " + argName + ", ";
+    }
+    else {
+      params += getCType(type) + " " + argName + ", ";
+    }
+  }
+  params += contextName + "* context";
+  os << endl;
+  for (const string& name : {funcName+"_init", funcName, funcName+"_deinit"}) {
+    os << "void " << getAOTName(name) << "(" << params << ");" << endl;
+  }
+
+  os << endl
+     << "#ifdef __cplusplus" << endl
+     << "}" << endl
+     << "#endif" << endl << endl
+     << "#endif" << endl;
+}
+
 void LLVMFunction::initIndices(pe::PathIndexBuilder& piBuilder,
                                const Environment& environment) {
   // Initialize indices
   for (const TensorIndex& tensorIndex : environment.getTensorIndices()) {
     pe::PathExpression pexpr = tensorIndex.getPathExpression();
     pe::PathIndex pidx = piBuilder.buildSegmented(pexpr, 0);
-    pathIndices.insert({pexpr, pidx});
+    pathIndices[pexpr] = pidx;
 
-    pair<const uint32_t**,const uint32_t**> ptrPair = tensorIndexPtrs.at(pexpr);
+    pair<const uint32_t**,const uint32_t**> ptrPair =
+        tensorIndexPtrs.at({pexpr, tensorIndex.isSymmetric()});
 
     if (isa<pe::SegmentedPathIndex>(pidx)) {
       const pe::SegmentedPathIndex* spidx = to<pe::SegmentedPathIndex>(pidx);
-      *ptrPair.first = spidx->getCoordData();
-      *ptrPair.second = spidx->getSinkData();
+      if (tensorIndex.isSymmetric()) {
+        // Keep the neighbors at or after each element. The rows stay sorted.
+        const uint32_t* coords = spidx->getCoordData();
+        const uint32_t* sinks = spidx->getSinkData();
+        vector<uint32_t>& upperCoords = upperIndices[pexpr].first;
+        vector<uint32_t>& upperSinks = upperIndices[pexpr].second;
+        upperCoords.assign(1, 0);
+        upperSinks.clear();
+        for (uint32_t row = 0; row < spidx->numElements(); ++row) {
+          for (uint32_t k = coords[row]; k < coords[row+1]; ++k) {
+            if (sinks[k] >= row) {
+              upperSinks.push_back(sinks[k]);
+            }
+          }
+          upperCoords.push_back(upperSinks.size());
+        }
+        *ptrPair.first = upperCoords.data();
+        *ptrPair.second = upperSinks.data();
+      }
+      else {
+        *ptrPair.first = spidx->getCoordData();
+        *ptrPair.second = spidx->getSinkData();
+      }
     }
     else {
       not_supported_yet << "doesn't know how to initialize this pathindex type";
@@ -423,48 +882,4 @@ void LLVMFunction::initIndices(pe::PathIndexBuilder& piBuilder,
   }
 }
 
-void LLVMFunction::createHarness(
-    const std::string &name,
-    const llvm::SmallVector<llvm::Value*,8> &args) {
-  // Build prototype in harnass module as an extrnal linkage to the
-  // function in the main module
-  llvm::Function *llvmFunc = module->getFunction(name);
-  std::vector<string> argNames;
-  std::vector<llvm::Type*> argTypes;
-  for (llvm::Argument &arg : llvmFunc->getArgumentList()) {
-    argNames.push_back(arg.getName());
-    argTypes.push_back(arg.getType());
-  }
-  llvm::Function *llvmFuncProto = createPrototypeLLVM(
-      name, argNames, argTypes, harnessModule, true);
-      
-  std::string harnessName = name + "_harness";
-  llvm::Function *harness = createPrototype(
-      harnessName, {}, {}, harnessModule, true);
-  auto entry = llvm::BasicBlock::Create(LLVM_CTX, "entry", harness);
-  llvm::CallInst *call = llvm::CallInst::Create(llvmFuncProto, args, "", entry);
-  call->setCallingConv(llvmFunc->getCallingConv());
-  llvm::ReturnInst::Create(harnessModule->getContext(), entry);
-}
-
-LLVMFunction::FuncType
-LLVMFunction::getHarnessFunctionAddress(const std::string &name) {
-  std::string fullName = name + "_harness";
-  uint64_t addr = harnessExecEngine->getFunctionAddress(fullName);
-  iassert(addr != 0)
-      << "MCJIT prevents modifying the module after ExecutionEngine code "
-      << "generation. Ensure all functions are created before fetching "
-      << "function addresses.";
-  FuncPtrType funcPtr = reinterpret_cast<decltype(funcPtr)>(addr);
-  return funcPtr;
-}
-
-llvm::Function *LLVMFunction::getInitFunc() const {
-  return module->getFunction(string(llvmFunc->getName()) + "_init");
-}
-
-llvm::Function *LLVMFunction::getDeinitFunc() const {
-  return module->getFunction(string(llvmFunc->getName()) + "_deinit");
-}
-
 }} // unnamed namespace
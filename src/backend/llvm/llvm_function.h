@@ -10,7 +10,9 @@
 #include "llvm/ExecutionEngine/ExecutionEngine.h"
 
 #include "backend/backend_function.h"
+#include "field_layout.h"
 #include "ir.h"
+#include "path_indices.h"
 #include "storage.h"
 #include "tensor_data.h"
 
@@ -20,20 +22,46 @@ class ExecutionEngine;
 
 namespace simit {
 
-namespace pe {
-class PathExpression;
-class PathIndex;
-class PathIndexBuilder;
-}
 namespace backend {
 class Actual;
 
+/// The layout of the context object of a compiled function. The object holds
+/// the state of one instance of the function (its externs, temporaries,
+/// tensor indices and buffers, and the arguments of its entry points), so
+/// that instances that share the code can run concurrently. Every slot is
+/// 8-byte aligned.
+struct ContextLayout {
+  struct Slot {
+    size_t offset;
+    llvm::Type* type;
+  };
+
+  /// The slots of the externs, temporaries and tensor indices, by name.
+  std::map<std::string, Slot> globals;
+
+  /// The slots of the arguments of the entry points, with a slot for each
+  /// element of set arguments.
+  std::vector<std::vector<Slot>> arguments;
+
+  /// The size of the object in bytes.
+  size_t size = 0;
+};
+
 /// A Simit function that has been compiled with LLVM.
 class LLVMFunction : public backend::Function {
  public:
+  /// Create a function from a module compiled by LLVMBackend. Functions with a
+  /// context layout take their context object as their last argument, and
+  /// have entry points (named after the function with an "_entry" suffix)
+  /// that read the arguments from the object. Functions without one keep
+  /// their state in module globals. The function accesses the fields of
+  /// bound sets whose tensors have more than one component in `fieldLayout`.
   LLVMFunction(ir::Func func, const ir::Storage &storage,
                llvm::Function* llvmFunc, llvm::Module* module,
-               std::shared_ptr<llvm::EngineBuilder> engineBuilder);
+               std::shared_ptr<llvm::EngineBuilder> engineBuilder,
+               llvm::ObjectCache* objectCache=nullptr,
+               std::shared_ptr<const ContextLayout> contextLayout=nullptr,
+               FieldLayout fieldLayout=FieldLayout());
   virtual ~LLVMFunction();
 
   virtual void bind(const std::string& name, simit::Set* set);
@@ -46,10 +74,19 @@ class LLVMFunction : public backend::Function {
     return initialized;
   }
 
+  virtual Function* clone() const;
+
   virtual void print(std::ostream &os) const;
   virtual void printMachine(std::ostream &os) const;
 
+  virtual void writeObject(std::ostream &os) const;
+  virtual void writeHeader(std::ostream &os) const;
+
  protected:
+  /// The context the function was compiled in (see LLVMContextScope), which
+  /// is kept alive until the function's modules have been destroyed.
+  std::shared_ptr<llvm::LLVMContext> context;
+
   /// Get the number of elements in the index domains.
   size_t size(const ir::IndexDomain &dimension);
 
@@ -60,7 +97,6 @@ class LLVMFunction : public backend::Function {
 
   llvm::Function*                        llvmFunc;
   llvm::Module*                          module;
-  llvm::Module*                          harnessModule;
   ir::Storage storage;
 
   /// Function actual storage
@@ -70,31 +106,74 @@ class LLVMFunction : public backend::Function {
   /// Externs
   std::map<std::string, std::vector<void**>> externPtrs;
 
-  /// TensorIndices
-  std::map<pe::PathExpression,
+  /// TensorIndices, by path expression and whether they are symmetric
+  std::map<std::pair<pe::PathExpression,bool>,
            std::pair<const uint32_t**,const uint32_t**>> tensorIndexPtrs;
   std::map<pe::PathExpression, pe::PathIndex>            pathIndices;
 
+  /// The rowptr and colidx arrays of the upper block-triangles of the path
+  /// indices of symmetric tensor indices.
+  std::map<pe::PathExpression,
+           std::pair<std::vector<uint32_t>,std::vector<uint32_t>>> upperIndices;
+
+  /// Path index builder that is kept between initializations, so that path
+  /// indices over sets that have not changed are reused.
+  pe::PathIndexBuilder piBuilder;
+
  private:
+  /// Create another instance of the function, which shares its code.
+  LLVMFunction(const LLVMFunction& function);
+
+  ir::Func irFunc;
+
   std::shared_ptr<llvm::EngineBuilder>   engineBuilder;
   std::shared_ptr<llvm::ExecutionEngine> executionEngine;
-  std::unique_ptr<llvm::EngineBuilder>    harnessEngineBuilder;
-  std::unique_ptr<llvm::ExecutionEngine> harnessExecEngine;
+
+  /// The context object of this instance, and its layout.
+  std::shared_ptr<const ContextLayout> contextLayout;
+  std::vector<uint64_t> contextObject;
+
+  /// The layout of the fields of bound sets with more than one component.
+  FieldLayout fieldLayout;
 
   /// Temporaries
   std::map<std::string, void**> temporaryPtrs;
+  std::map<std::string, size_t> temporarySizes;
 
   FuncType deinit;
 
-  // MCJIT does not allow module modification after code generation. Instead,
-  // create all harness functions in the harness module first, then fetch
-  // generated addresses using getHarnessFunctionAddress.
-  void createHarness(const std::string& name,
-                     const llvm::SmallVector<llvm::Value*,8>& args);
-  FuncType getHarnessFunctionAddress(const std::string& name);
-
-  llvm::Function* getInitFunc() const;
-  llvm::Function* getDeinitFunc() const;
+  /// The entry points, which call the init, compute and deinit functions with
+  /// the arguments stored in the context object.
+  void (*initEntry)(void*);
+  void (*funcEntry)(void*);
+  void (*deinitEntry)(void*);
+
+  /// Addresses of the context object slots of each formal, in order. Sets
+  /// have a slot for each element of their set struct.
+  std::vector<std::vector<void*>> argPtrs;
+  std::vector<bool> argIsPointer;
+
+  /// The state of a cached assembly (see ir::CachedAssembly): the generations
+  /// and structural versions of the sets, and the versions of the fields, that
+  /// the tensor was assembled from, and copies of the exposed fields.
+  struct AssemblyCache {
+    void** flagPtr;
+    std::vector<unsigned long> generations;
+    std::vector<unsigned long> versions;
+    std::vector<unsigned long> fieldVersions;
+    std::vector<std::vector<char>> fields;
+  };
+  std::vector<AssemblyCache> assemblyCaches;
+
+  /// Point the extern, temporary, tensor index and argument pointers at the
+  /// context object, or at the module globals of functions without one.
+  void initContextObject();
+  void* getGlobalAddress(const std::string& name);
+
+  /// Clear the flags of the cached assemblies whose sets or fields changed
+  /// since they were assembled, so that the next run assembles them again.
+  void invalidateAssemblyCaches();
+  Set* getBoundSet(const std::string& name);
 };
 
 }}
@@ -0,0 +1,261 @@
+#include "llvm_object_cache.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <thread>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "llvm/IR/Module.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include "compile_options.h"
+#include "error.h"
+
+using namespace std;
+
+namespace simit {
+namespace backend {
+
+// Prefix of the identifiers of cacheable modules. Modules with other
+// identifiers (e.g. modules compiled while the cache was disabled) are
+// neither stored nor looked up.
+static const std::string kModulePrefix = "simit-";
+
+// Object files start with this magic string and the size of the key, followed
+// by the key and the object code
+static const std::string kObjectMagic = "simit-object";
+
+// 64-bit FNV-1a hash
+static uint64_t hash(const std::string& str) {
+  uint64_t h = 14695981039346656037ULL;
+  for (unsigned char c : str) {
+    h ^= c;
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+static bool createDirectories(const std::string& path) {
+  for (size_t pos = path.find('/', 1); ; pos = path.find('/', pos+1)) {
+    std::string dir = path.substr(0, pos);
+    if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+      return false;
+    }
+    if (pos == std::string::npos) {
+      break;
+    }
+  }
+  return true;
+}
+
+// class LLVMObjectCache
+LLVMObjectCache& LLVMObjectCache::getInstance() {
+  static LLVMObjectCache instance;
+  return instance;
+}
+
+bool LLVMObjectCache::isEnabled() const {
+  return !internal::getCompileOptions().cacheDir.empty();
+}
+
+std::string LLVMObjectCache::getModuleIdentifier(const std::string& key) {
+  // The key length is included to make collisions less likely
+  stringstream ss;
+  ss << kModulePrefix << hex << setfill('0') << setw(16) << hash(key)
+     << "-" << dec << key.size();
+  std::string moduleIdentifier = ss.str();
+
+  lock_guard<std::mutex> lock(mutex);
+  ModuleKey& moduleKey = keys[moduleIdentifier];
+  moduleKey.key = key;
+  moduleKey.uses++;
+  return moduleIdentifier;
+}
+
+void LLVMObjectCache::releaseModuleIdentifier(
+    const std::string& moduleIdentifier) {
+  lock_guard<std::mutex> lock(mutex);
+  auto it = keys.find(moduleIdentifier);
+  if (it != keys.end() && --it->second.uses == 0) {
+    keys.erase(it);
+  }
+}
+
+bool LLVMObjectCache::hasObject(const std::string& moduleIdentifier) const {
+  std::string path = getObjectPath(moduleIdentifier);
+  std::string key;
+  if (path.empty() || !getKey(moduleIdentifier, &key)) {
+    return false;
+  }
+  ifstream file(path, ios::binary);
+  std::string storedKey;
+  return file && readKey(file, &storedKey) && storedKey == key;
+}
+
+bool LLVMObjectCache::loadObject(const std::string& moduleIdentifier) {
+  std::string data;
+  if (!readObject(moduleIdentifier, &data)) {
+    return false;
+  }
+  lock_guard<std::mutex> lock(mutex);
+  auto it = keys.find(moduleIdentifier);
+  if (it == keys.end()) {
+    return false;
+  }
+  it->second.object = std::move(data);
+  return true;
+}
+
+bool LLVMObjectCache::getKey(const std::string& moduleIdentifier,
+                             std::string* key) const {
+  lock_guard<std::mutex> lock(mutex);
+  auto it = keys.find(moduleIdentifier);
+  if (it == keys.end()) {
+    return false;
+  }
+  *key = it->second.key;
+  return true;
+}
+
+bool LLVMObjectCache::readKey(std::istream& file, std::string* key) {
+  std::string magic;
+  size_t size;
+  if (!(file >> magic >> size) || magic != kObjectMagic ||
+      file.get() != '\n') {
+    return false;
+  }
+  key->resize(size);
+  return size == 0 || file.read(&(*key)[0], size);
+}
+
+void LLVMObjectCache::addObject(const std::string& moduleIdentifier,
+                                const char* data, size_t size) {
+  writeObject(moduleIdentifier, data, size);
+  releaseModuleIdentifier(moduleIdentifier);
+}
+
+std::string
+LLVMObjectCache::getObjectPath(const std::string& moduleIdentifier) const {
+  if (!isEnabled() ||
+      moduleIdentifier.compare(0, kModulePrefix.size(), kModulePrefix) != 0) {
+    return "";
+  }
+  const std::string& cacheDir = internal::getCompileOptions().cacheDir;
+  return cacheDir + "/" + moduleIdentifier + ".o";
+}
+
+#if LLVM_MAJOR_VERSION <= 3 && LLVM_MINOR_VERSION <= 5
+void LLVMObjectCache::notifyObjectCompiled(const llvm::Module* module,
+                                           const llvm::MemoryBuffer* object) {
+  writeObject(module->getModuleIdentifier(),
+              object->getBufferStart(), object->getBufferSize());
+  releaseModuleIdentifier(module->getModuleIdentifier());
+}
+
+// When no object is found MCJIT compiles the module and calls
+// notifyObjectCompiled, which releases the identifier instead
+llvm::MemoryBuffer* LLVMObjectCache::getObject(const llvm::Module* module) {
+  std::string data;
+  if (!readObject(module->getModuleIdentifier(), &data)) {
+    if (!getObjectPath(module->getModuleIdentifier()).empty()) {
+      ++misses;
+    }
+    return nullptr;
+  }
+  ++hits;
+  releaseModuleIdentifier(module->getModuleIdentifier());
+  return llvm::MemoryBuffer::getMemBufferCopy(data,
+                                              module->getModuleIdentifier());
+}
+#else
+void LLVMObjectCache::notifyObjectCompiled(const llvm::Module* module,
+                                           llvm::MemoryBufferRef object) {
+  writeObject(module->getModuleIdentifier(),
+              object.getBufferStart(), object.getBufferSize());
+  releaseModuleIdentifier(module->getModuleIdentifier());
+}
+
+// When no object is found MCJIT compiles the module and calls
+// notifyObjectCompiled, which releases the identifier instead
+std::unique_ptr<llvm::MemoryBuffer>
+LLVMObjectCache::getObject(const llvm::Module* module) {
+  std::string data;
+  if (!readObject(module->getModuleIdentifier(), &data)) {
+    if (!getObjectPath(module->getModuleIdentifier()).empty()) {
+      ++misses;
+    }
+    return nullptr;
+  }
+  ++hits;
+  releaseModuleIdentifier(module->getModuleIdentifier());
+  return llvm::MemoryBuffer::getMemBufferCopy(data,
+                                              module->getModuleIdentifier());
+}
+#endif
+
+void LLVMObjectCache::writeObject(const std::string& moduleIdentifier,
+                                  const char* data, size_t size) {
+  std::string path = getObjectPath(moduleIdentifier);
+  std::string key;
+  if (path.empty() || !getKey(moduleIdentifier, &key) ||
+      !createDirectories(internal::getCompileOptions().cacheDir)) {
+    return;
+  }
+
+  // Write to a temporary file and rename it, so that concurrent processes and
+  // threads never read a partially written object
+  size_t threadID = std::hash<std::thread::id>()(this_thread::get_id());
+  std::string tmpPath = path + ".tmp" + to_string(getpid()) + "-" +
+                        to_string(threadID);
+  {
+    ofstream file(tmpPath, ios::binary | ios::trunc);
+    file << kObjectMagic << " " << key.size() << "\n";
+    if (!file.write(key.data(), key.size()) || !file.write(data, size)) {
+      file.close();
+      remove(tmpPath.c_str());
+      return;
+    }
+  }
+  if (rename(tmpPath.c_str(), path.c_str()) != 0) {
+    remove(tmpPath.c_str());
+  }
+}
+
+bool LLVMObjectCache::readObject(const std::string& moduleIdentifier,
+                                 std::string* data) {
+  std::string key;
+  {
+    // An object read by loadObject is used instead of the file
+    lock_guard<std::mutex> lock(mutex);
+    auto it = keys.find(moduleIdentifier);
+    if (it == keys.end()) {
+      return false;
+    }
+    if (!it->second.object.empty()) {
+      *data = it->second.object;
+      return true;
+    }
+    key = it->second.key;
+  }
+  std::string path = getObjectPath(moduleIdentifier);
+  if (path.empty()) {
+    return false;
+  }
+  ifstream file(path, ios::binary);
+  std::string storedKey;
+  if (!file || !readKey(file, &storedKey) || storedKey != key) {
+    return false;
+  }
+  stringstream ss;
+  ss << file.rdbuf();
+  *data = ss.str();
+  return !data->empty();
+}
+
+}}
@@ -0,0 +1,117 @@
+#ifndef SIMIT_LLVM_OBJECT_CACHE_H
+#define SIMIT_LLVM_OBJECT_CACHE_H
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "llvm/ExecutionEngine/ObjectCache.h"
+
+#include "interfaces/uncopyable.h"
+
+namespace simit {
+namespace backend {
+
+/// A persistent on-disk cache of the object code that MCJIT emits for Simit
+/// modules, stored in the cache directory of the compilation (see setCacheDir,
+/// which defaults to the SIMIT_CACHE_DIR environment variable). The cache is
+/// content addressed: modules are given an identifier that is a hash of
+/// everything that determines their code (see \ref getModuleIdentifier), and
+/// MCJIT loads the object with that identifier instead of generating code when
+/// it exists. Each object file also stores the full key of its module, and an
+/// object is only loaded if its key matches, so that hash collisions are
+/// misses.
+class LLVMObjectCache : public llvm::ObjectCache,
+                        private interfaces::Uncopyable {
+public:
+  static LLVMObjectCache& getInstance();
+
+  /// True iff a cache directory has been set.
+  bool isEnabled() const;
+
+  /// Returns the module identifier of a module whose code is determined by
+  /// `key`, and remembers the key to verify the module's cached object. The
+  /// key is forgotten when the object has been loaded by getObject, stored by
+  /// notifyObjectCompiled or addObject, or released.
+  std::string getModuleIdentifier(const std::string& key);
+
+  /// Forget the key of an identifier returned by getModuleIdentifier, for a
+  /// module whose object is neither loaded nor stored.
+  void releaseModuleIdentifier(const std::string& moduleIdentifier);
+
+  /// True iff the cache contains the object of the module with the given
+  /// identifier, and the object was stored for the module's key.
+  bool hasObject(const std::string& moduleIdentifier) const;
+
+  /// Reads the object of the module with the given identifier, if the cache
+  /// contains one stored for the module's key, and returns true if it did.
+  /// MCJIT is then given the object that was read, even if the object file is
+  /// removed or replaced in the meantime, so that a module that is not
+  /// optimized because its object was found never has its code generated.
+  bool loadObject(const std::string& moduleIdentifier);
+
+  /// Store object code as the object of the module with the given identifier,
+  /// e.g. code generated for another CPU than MCJIT's, and release the
+  /// identifier.
+  void addObject(const std::string& moduleIdentifier,
+                 const char* data, size_t size);
+
+  /// The number of objects that MCJIT loaded from the cache.
+  unsigned long getNumHits() const { return hits; }
+
+  /// The number of objects of cacheable modules that MCJIT looked up and did
+  /// not find, and so generated.
+  unsigned long getNumMisses() const { return misses; }
+
+#if LLVM_MAJOR_VERSION <= 3 && LLVM_MINOR_VERSION <= 5
+  virtual void notifyObjectCompiled(const llvm::Module* module,
+                                    const llvm::MemoryBuffer* object);
+  virtual llvm::MemoryBuffer* getObject(const llvm::Module* module);
+#else
+  virtual void notifyObjectCompiled(const llvm::Module* module,
+                                    llvm::MemoryBufferRef object);
+  virtual std::unique_ptr<llvm::MemoryBuffer>
+  getObject(const llvm::Module* module);
+#endif
+
+private:
+  LLVMObjectCache() : hits(0), misses(0) {}
+
+  /// The lookups of MCJIT that loaded an object, and that found none.
+  std::atomic<unsigned long> hits;
+  std::atomic<unsigned long> misses;
+
+  /// The key of a module identifier, the number of times the identifier was
+  /// handed out by getModuleIdentifier and not yet released, and the object
+  /// read for it by loadObject, if any.
+  struct ModuleKey {
+    std::string key;
+    int uses;
+    std::string object;
+  };
+
+  /// The keys of the module identifiers in use.
+  mutable std::mutex mutex;
+  std::map<std::string,ModuleKey> keys;
+
+  /// Returns the key of the module with the given identifier, or false if the
+  /// identifier was not handed out by getModuleIdentifier.
+  bool getKey(const std::string& moduleIdentifier, std::string* key) const;
+
+  /// Reads the key stored in an object file, leaving the file at the start of
+  /// the object code.
+  static bool readKey(std::istream& file, std::string* key);
+
+  /// Returns the path of the object file of the module, or the empty string if
+  /// the module is not a cacheable Simit module.
+  std::string getObjectPath(const std::string& moduleIdentifier) const;
+
+  void writeObject(const std::string& moduleIdentifier,
+                   const char* data, size_t size);
+  bool readObject(const std::string& moduleIdentifier, std::string* data);
+};
+
+}}
+#endif
@@ -12,28 +12,8 @@ using namespace simit::ir;
 namespace simit {
 namespace backend {
 
-llvm::Type* const LLVM_VOID              = llvm::Type::getVoidTy(LLVM_CTX);
-
-llvm::IntegerType* const LLVM_BOOL       = llvm::Type::getInt1Ty(LLVM_CTX);
-llvm::IntegerType* const LLVM_INT        = llvm::Type::getInt32Ty(LLVM_CTX);
-llvm::IntegerType* const LLVM_INT8       = llvm::Type::getInt8Ty(LLVM_CTX);
-llvm::IntegerType* const LLVM_INT32      = llvm::Type::getInt32Ty(LLVM_CTX);
-llvm::IntegerType* const LLVM_INT64      = llvm::Type::getInt64Ty(LLVM_CTX);
-
-llvm::Type* const LLVM_FLOAT             = llvm::Type::getFloatTy(LLVM_CTX);
-llvm::Type* const LLVM_DOUBLE            = llvm::Type::getDoubleTy(LLVM_CTX);
-
-llvm::PointerType* const LLVM_FLOAT_PTR  = llvm::Type::getFloatPtrTy(LLVM_CTX);
-llvm::PointerType* const LLVM_DOUBLE_PTR = llvm::Type::getDoublePtrTy(LLVM_CTX);
-
-llvm::PointerType* const LLVM_BOOL_PTR   = llvm::Type::getInt1PtrTy(LLVM_CTX);
-llvm::PointerType* const LLVM_INT_PTR    = llvm::Type::getInt32PtrTy(LLVM_CTX);
-llvm::PointerType* const LLVM_INT8_PTR   = llvm::Type::getInt8PtrTy(LLVM_CTX);
-llvm::PointerType* const LLVM_INT32_PTR  = llvm::Type::getInt32PtrTy(LLVM_CTX);
-llvm::PointerType* const LLVM_INT64_PTR  = llvm::Type::getInt64PtrTy(LLVM_CTX);
-
-/// One for endpoints, two for neighbor index
-extern const int NUM_EDGE_INDEX_ELEMENTS = 3;
+/// Endpoints, neighbor index start and neighbors, and edge locations
+extern const int NUM_EDGE_INDEX_ELEMENTS = 4;
 
 
 llvm::Type* llvmType(const Type& type, unsigned addrspace) {
@@ -77,6 +57,9 @@ llvm::StructType *llvmType(const ir::SetType& setType, unsigned addrspace,
     // col indexes (block column)
     llvmFieldTypes.push_back(
         llvm::Type::getInt32PtrTy(LLVM_CTX, addrspace));
+    // edge locations
+    llvmFieldTypes.push_back(
+        llvm::Type::getInt32PtrTy(LLVM_CTX, addrspace));
   }
 
   // Fields
@@ -1,11 +1,36 @@
 #include "llvm_util.h"
+#include "llvm_defines.h"
 
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/FormattedStream.h"
 #include "llvm/IR/Module.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/PassManager.h"
+#include "llvm/Target/TargetMachine.h"
 
 namespace simit {
 namespace backend {
 
+static thread_local std::shared_ptr<llvm::LLVMContext> scopedContext;
+
+llvm::LLVMContext& getLLVMContext() {
+  return (scopedContext != nullptr) ? *scopedContext
+                                    : llvm::getGlobalContext();
+}
+
+std::shared_ptr<llvm::LLVMContext> getScopedLLVMContext() {
+  return scopedContext;
+}
+
+LLVMContextScope::LLVMContextScope(std::shared_ptr<llvm::LLVMContext> context)
+    : previous(scopedContext) {
+  scopedContext = context;
+}
+
+LLVMContextScope::~LLVMContextScope() {
+  scopedContext = previous;
+}
+
 std::ostream &operator<<(std::ostream &os, const llvm::Type &type) {
   std::string str;
   llvm::raw_string_ostream ss(str);
@@ -28,4 +53,21 @@ std::ostream &operator<<(std::ostream &os, const llvm::Module &module) {
   return os;
 }
 
+bool emitObjectFile(llvm::Module *module, llvm::TargetMachine *targetMachine,
+                    std::string *object) {
+  llvm::SmallVector<char, 0> buffer;
+  {
+    llvm::raw_svector_ostream os(buffer);
+    llvm::formatted_raw_ostream fos(os);
+    llvm::PassManager pm;
+    if (targetMachine->addPassesToEmitFile(pm, fos,
+                                           llvm::TargetMachine::CGFT_ObjectFile)){
+      return false;
+    }
+    pm.run(*module);
+  }
+  object->assign(buffer.begin(), buffer.end());
+  return true;
+}
+
 }}
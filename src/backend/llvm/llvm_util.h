@@ -2,11 +2,13 @@
 #define SIMIT_LLVM_UTIL_H
 
 #include <ostream>
+#include <string>
 
 namespace llvm {
 class Type;
 class Value;
 class Module;
+class TargetMachine;
 }
 
 namespace simit {
@@ -16,5 +18,10 @@ std::ostream &operator<<(std::ostream &os, const llvm::Type &);
 std::ostream &operator<<(std::ostream &os, const llvm::Value &);
 std::ostream &operator<<(std::ostream &os, const llvm::Module &);
 
+/// Generate the object code of the module for the target machine. Returns
+/// false if the target machine cannot emit object files.
+bool emitObjectFile(llvm::Module *module, llvm::TargetMachine *targetMachine,
+                    std::string *object);
+
 }}
 #endif
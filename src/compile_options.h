@@ -0,0 +1,60 @@
+#ifndef SIMIT_COMPILE_OPTIONS_H
+#define SIMIT_COMPILE_OPTIONS_H
+
+#include <string>
+#include <vector>
+
+#include "field_layout.h"
+#include "interfaces/uncopyable.h"
+
+namespace simit {
+namespace internal {
+
+/// The options that determine how functions are compiled, which are set with
+/// the functions of init.h. A compilation reads a snapshot of the options that
+/// is taken when it starts, so that options set while it runs, e.g. by the
+/// thread that started an asynchronous compilation, do not affect it.
+struct CompileOptions {
+  std::string backend;
+
+  unsigned numThreads;
+  std::string schedule;
+  unsigned chunkSize;
+
+  std::string cacheDir;
+
+  std::vector<std::string> targetCPUs;
+  std::string forcedTargetCPU;
+
+  bool vectorizationReport;
+
+  bool vectorizeBlocks;
+  unsigned mapVectorWidth;
+  FieldLayout fieldLayout;
+
+  bool matrixFree;
+  bool cacheAssemblies;
+  bool symmetricStorage;
+
+  /// Returns the options as they are currently set.
+  static CompileOptions current();
+};
+
+/// Returns the options of the compilation that runs on the calling thread, or
+/// the options as they are currently set if no compilation runs on it.
+const CompileOptions& getCompileOptions();
+
+/// Makes `options` the options of the compilation that runs on the calling
+/// thread while in scope.
+class CompileOptionsScope : private interfaces::Uncopyable {
+public:
+  explicit CompileOptionsScope(const CompileOptions& options);
+  ~CompileOptionsScope();
+
+private:
+  CompileOptions options;
+  const CompileOptions* previous;
+};
+
+}}
+#endif
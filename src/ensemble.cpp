@@ -0,0 +1,277 @@
+#include "ensemble.h"
+
+#include <cstring>
+
+#include "graph.h"
+#include "error.h"
+#include "util/collections.h"
+#include "util/util.h"
+
+using namespace std;
+
+namespace simit {
+
+// class Ensemble
+struct Ensemble::Binding {
+  std::vector<Set*> instances;
+
+  /// The structural versions of the instances when they were packed.
+  std::vector<unsigned long> versions;
+
+  /// The packed set, and the first element and size of each instance in it.
+  std::unique_ptr<Set> packed;
+  std::vector<int> offsets;
+  std::vector<int> sizes;
+};
+
+Ensemble::Ensemble(Function function)
+    : function(function), numInstances(0), initialized(false) {
+  uassert(function.defined()) << "undefined function";
+}
+
+Ensemble::~Ensemble() {
+}
+
+void Ensemble::bind(const std::string& name,
+                    const std::vector<Set*>& instances) {
+  uassert(instances.size() > 0)
+      << "no instances were bound to " << util::quote(name);
+  uassert(numInstances == 0 || instances.size() == numInstances)
+      << "the ensemble has " << numInstances << " instances, but "
+      << instances.size() << " sets were bound to " << util::quote(name);
+  numInstances = instances.size();
+
+  unique_ptr<Binding> binding(new Binding);
+  binding->instances = instances;
+  bindings[name] = std::move(binding);
+  initialized = false;
+}
+
+void Ensemble::bind(const std::string& name, void* data) {
+  function.bind(name, data);
+}
+
+size_t Ensemble::getNumInstances() const {
+  return numInstances;
+}
+
+int Ensemble::getOffset(const std::string& name, size_t instance) const {
+  uassert(util::contains(bindings, name))
+      << "no sets were bound to " << util::quote(name);
+  const Binding* binding = bindings.at(name).get();
+  uassert(binding->packed != nullptr) << "the ensemble is not initialized";
+  uassert(instance < numInstances) << "no instance " << instance;
+  return binding->offsets[instance];
+}
+
+Set* Ensemble::getPackedSet(const std::string& name) const {
+  uassert(util::contains(bindings, name))
+      << "no sets were bound to " << util::quote(name);
+  return bindings.at(name)->packed.get();
+}
+
+void Ensemble::init() {
+  uassert(numInstances > 0) << "no sets were bound to the ensemble";
+  for (auto& binding : bindings) {
+    binding.second->packed.reset();
+  }
+  for (auto& binding : bindings) {
+    packStructure(binding.first, binding.second.get());
+  }
+  pack();
+  function.init();
+  initialized = true;
+}
+
+void Ensemble::runSafe() {
+  if (!initialized || isStructureChanged()) {
+    init();
+  }
+  else {
+    pack();
+  }
+  function.runSafe();
+  unpack();
+}
+
+/// Copy the tensors of `num` elements of a field, starting at element `src`,
+/// to another field with the same type and layout, starting at element `dst`.
+/// The field and its version are left unchanged if the tensors are equal, so
+/// that copying back a field the function does not write does not invalidate
+/// what is cached from it (e.g. assembled matrices).
+static void copyFieldData(const Set::FieldData* from, int src,
+                          Set::FieldData* to, int dst, int num) {
+  iassert(from->layout == to->layout);
+  const FieldLayout& layout = from->layout;
+  const size_t size = from->type->getSize();
+  if (layout.isArrayOfStructures() || size == 1) {
+    const size_t fieldSize = from->sizeOfType;
+    char* toData = (char*)to->data + dst*fieldSize;
+    const char* fromData = (char*)from->data + src*fieldSize;
+    if (memcmp(toData, fromData, num*fieldSize) != 0) {
+      memcpy(toData, fromData, num*fieldSize);
+      to->markModified();
+    }
+    return;
+  }
+  const size_t compSize = from->sizeOfType / size;
+  bool modified = false;
+  for (int e = 0; e < num; ++e) {
+    for (size_t c = 0; c < size; ++c) {
+      char* toData = (char*)to->data + layout.getOffset(dst+e, c, size)*compSize;
+      const char* fromData =
+          (char*)from->data + layout.getOffset(src+e, c, size)*compSize;
+      if (memcmp(toData, fromData, compSize) != 0) {
+        memcpy(toData, fromData, compSize);
+        modified = true;
+      }
+    }
+  }
+  if (modified) {
+    to->markModified();
+  }
+}
+
+void Ensemble::pack() {
+  for (auto& binding : bindings) {
+    Binding* b = binding.second.get();
+    uassert(b->packed != nullptr) << "the ensemble is not initialized";
+    vector<Set::FieldData*>& packedFields = b->packed->getFields();
+    for (size_t i = 0; i < numInstances; ++i) {
+      vector<Set::FieldData*>& fields = b->instances[i]->getFields();
+      for (size_t j = 0; j < fields.size(); ++j) {
+        copyFieldData(fields[j], 0, packedFields[j], b->offsets[i],
+                      b->sizes[i]);
+      }
+    }
+  }
+}
+
+void Ensemble::unpack() {
+  for (auto& binding : bindings) {
+    Binding* b = binding.second.get();
+    uassert(b->packed != nullptr) << "the ensemble is not initialized";
+    vector<Set::FieldData*>& packedFields = b->packed->getFields();
+    for (size_t i = 0; i < numInstances; ++i) {
+      vector<Set::FieldData*>& fields = b->instances[i]->getFields();
+      for (size_t j = 0; j < fields.size(); ++j) {
+        copyFieldData(packedFields[j], b->offsets[i], fields[j], 0,
+                      b->sizes[i]);
+      }
+    }
+  }
+}
+
+void Ensemble::packStructure(const std::string& name, Binding* binding) {
+  if (binding->packed != nullptr) {
+    return;
+  }
+  Set* first = binding->instances[0];
+  const int cardinality = first->getCardinality();
+
+  // The endpoints of the packed edges are the packed endpoint sets, so pack
+  // them first
+  vector<Binding*> endpointBindings;
+  vector<const Set*> endpointSets;
+  for (int j = 0; j < cardinality; ++j) {
+    Binding* endpointBinding = nullptr;
+    for (auto& other : bindings) {
+      if (other.second->instances[0] == first->getEndpointSet(j)) {
+        packStructure(other.first, other.second.get());
+        endpointBinding = other.second.get();
+        break;
+      }
+    }
+    uassert(endpointBinding != nullptr)
+        << "the endpoints of " << util::quote(name)
+        << " are not bound to the ensemble";
+    endpointBindings.push_back(endpointBinding);
+    endpointSets.push_back(endpointBinding->packed.get());
+  }
+
+  // Check that the instances have the same schema, and lay them out one after
+  // the other
+  const vector<Set::FieldData*>& firstFields = first->getFields();
+  binding->versions.clear();
+  binding->offsets.clear();
+  binding->sizes.clear();
+  int size = 0;
+  for (size_t i = 0; i < numInstances; ++i) {
+    Set* instance = binding->instances[i];
+    for (int j = 0; j < cardinality; ++j) {
+      uassert(instance->getEndpointSet(j) == endpointBindings[j]->instances[i])
+          << "the endpoints of instance " << i << " of " << util::quote(name)
+          << " are not instance " << i << " of its endpoint sets";
+    }
+
+    const vector<Set::FieldData*>& fields = instance->getFields();
+    uassert(fields.size() == firstFields.size())
+        << "the instances of " << util::quote(name) << " have different fields";
+    for (size_t j = 0; j < fields.size(); ++j) {
+      uassert(fields[j]->name == firstFields[j]->name &&
+              fields[j]->type->getComponentType() ==
+                  firstFields[j]->type->getComponentType() &&
+              fields[j]->sizeOfType == firstFields[j]->sizeOfType &&
+              fields[j]->layout == firstFields[j]->layout)
+          << "the instances of " << util::quote(name)
+          << " have different fields";
+    }
+
+    binding->versions.push_back(instance->getVersion());
+    binding->offsets.push_back(size);
+    binding->sizes.push_back(instance->getSize());
+    size += instance->getSize();
+  }
+
+  Set* packed = (cardinality == 0) ? new Set(name)
+                                    : new Set(name, endpointSets);
+  binding->packed.reset(packed);
+  packed->reserve(size);
+  for (const Set::FieldData* field : firstFields) {
+    packed->addFieldData(field->name,
+                         new Set::FieldData::TensorType(*field->type),
+                         field->layout);
+  }
+
+  // Every pack copies all the fields, so the packed fields are compared by
+  // contents rather than by version
+  for (Set::FieldData* field : packed->getFields()) {
+    field->exposed = true;
+  }
+
+  if (cardinality == 0) {
+    packed->addN(size);
+  }
+  else {
+    // Offset the endpoints of each instance's edges to the instance's elements
+    // in the packed endpoint sets
+    vector<int> endpoints;
+    endpoints.reserve(size * cardinality);
+    for (size_t i = 0; i < numInstances; ++i) {
+      const int* instanceEndpoints = binding->instances[i]->getEndpointsData();
+      for (int e = 0; e < binding->sizes[i]; ++e) {
+        for (int j = 0; j < cardinality; ++j) {
+          endpoints.push_back(instanceEndpoints[e*cardinality + j] +
+                              endpointBindings[j]->offsets[i]);
+        }
+      }
+    }
+    packed->addEdges(endpoints.data(), size);
+  }
+
+  function.bind(name, packed);
+}
+
+bool Ensemble::isStructureChanged() const {
+  for (auto& binding : bindings) {
+    const Binding* b = binding.second.get();
+    for (size_t i = 0; i < numInstances; ++i) {
+      if (b->instances[i]->getVersion() != b->versions[i]) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+}
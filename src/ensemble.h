@@ -0,0 +1,98 @@
+#ifndef SIMIT_ENSEMBLE_H
+#define SIMIT_ENSEMBLE_H
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "function.h"
+#include "interfaces/uncopyable.h"
+
+namespace simit {
+class Set;
+
+/// A Simit function that runs over an ensemble of instances of its sets, e.g.
+/// many small meshes that share a schema, in a single call. Binding a set to
+/// each instance with `bind` packs the instances into one concatenated set,
+/// which the function runs over once. This amortizes the cost of binding,
+/// initializing and calling the function over the instances, and the parallel
+/// loops of the function divide the elements of all instances between threads.
+///
+/// The elements of instance i of a set come after the elements of instances
+/// [0,i) in the packed set (see `getOffset`). The endpoints of the instances of
+/// an edge set must be the instances of other bound sets, so that the packed
+/// edges connect the packed elements of the same instance.
+///
+/// Elements of different instances are never connected, so computations over
+/// elements and their neighbors (maps, assemblies and matrix-vector products)
+/// give each instance the results it would get on its own. Computations that
+/// combine all the elements of a set (e.g. reductions to a global scalar, or
+/// the convergence test of an iterative solver) combine all the instances.
+///
+/// The packed sets hold copies of the instances' fields: `pack` copies the
+/// fields of the instances into them and `unpack` copies them back. `runSafe`
+/// does both. Only the fields whose values changed are copied back and marked
+/// modified, so the fields the function does not write keep their versions.
+class Ensemble : private interfaces::Uncopyable {
+public:
+  /// Create an ensemble that runs `function`.
+  explicit Ensemble(Function function);
+  ~Ensemble();
+
+  /// Bind a set to each instance of the set argument or extern with the given
+  /// name. The sets must have the same fields, with the same layouts.
+  void bind(const std::string& name, const std::vector<Set*>& instances);
+
+  /// Bind tensor data that all instances share to the bindable.
+  void bind(const std::string& name, void* data);
+
+  /// Returns the number of instances, or 0 if no sets have been bound.
+  size_t getNumInstances() const;
+
+  /// Returns the index of the first element of an instance in the packed set
+  /// bound to the given name.
+  int getOffset(const std::string& name, size_t instance) const;
+
+  /// Returns the packed set bound to the given name. It is created by `init`.
+  Set* getPackedSet(const std::string& name) const;
+
+  /// Pack the instances and initialize the function. This must be done after
+  /// the instances are bound, and again after elements are added to them.
+  void init();
+
+  /// Run the function over the packed sets. Make sure to init the ensemble
+  /// first, and to pack and unpack the instances' fields as needed.
+  inline void run() {
+    function.run();
+  }
+
+  /// Run the function over all instances. This method packs the instances and
+  /// initializes the function as necessary, and unpacks the results.
+  void runSafe();
+
+  /// Copy the fields of the instances to the packed sets.
+  void pack();
+
+  /// Copy the fields of the packed sets back to the instances.
+  void unpack();
+
+private:
+  struct Binding;
+
+  Function function;
+  std::map<std::string, std::unique_ptr<Binding>> bindings;
+  size_t numInstances;
+  bool initialized;
+
+  /// Create the packed set of a binding, after the packed sets of its
+  /// endpoints, and bind it to the function.
+  void packStructure(const std::string& name, Binding* binding);
+
+  /// Returns true if elements were added to or removed from an instance since
+  /// the instances were packed.
+  bool isStructureChanged() const;
+};
+
+}
+#endif
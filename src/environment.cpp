@@ -20,6 +20,19 @@ std::ostream& operator<<(std::ostream& os, const VarMapping& vm) {
   return os;
 }
 
+// class CachedAssembly
+std::ostream& operator<<(std::ostream& os, const CachedAssembly& ca) {
+  os << "cached " << ca.getTensor() << " if " << ca.getFlag();
+  if (ca.getSets().size() > 0) {
+    os << " (" << util::join(ca.getSets());
+    for (auto& field : ca.getFields()) {
+      os << ", " << field.first << "." << field.second;
+    }
+    os << ")";
+  }
+  return os;
+}
+
 // class Environment
 struct Environment::Content {
   vector<pair<Var, Expr>>        constants;
@@ -31,9 +44,12 @@ struct Environment::Content {
   set<Var>                       temporarySet;
 
   vector<TensorIndex>            tensorIndices;
-  map<pe::PathExpression,size_t> locationOfTensorIndex;
+  map<pair<pe::PathExpression,bool>,size_t> locationOfTensorIndex;
 
   map<Var,TensorIndex>           tensorIndexOfVar;
+
+  vector<CachedAssembly>         cachedAssemblies;
+  set<Var>                       cachedAssemblyFlags;
 };
 
 Environment::Environment() : content(new Content) {
@@ -121,20 +137,24 @@ const std::vector<TensorIndex>& Environment::getTensorIndices() const {
   return content->tensorIndices;
 }
 
-bool Environment::hasTensorIndex(const pe::PathExpression& pexpr) const {
+bool Environment::hasTensorIndex(const pe::PathExpression& pexpr,
+                                 bool symmetric) const {
   if (!pexpr.defined()) {
     return false;
   }
-  return util::contains(content->locationOfTensorIndex, pexpr);
+  return util::contains(content->locationOfTensorIndex,
+                        make_pair(pexpr, symmetric));
 }
 
 const TensorIndex&
-Environment::getTensorIndex(const pe::PathExpression& pexpr) const {
+Environment::getTensorIndex(const pe::PathExpression& pexpr,
+                            bool symmetric) const {
   iassert(pexpr.defined())
       << "Tensors in the environment have defined path expressions";
-  iassert(util::contains(content->locationOfTensorIndex, pexpr))
+  iassert(hasTensorIndex(pexpr, symmetric))
       << "Could not find " << pexpr << " in environment";
-  return content->tensorIndices[content->locationOfTensorIndex.at(pexpr)];
+  size_t loc = content->locationOfTensorIndex.at(make_pair(pexpr, symmetric));
+  return content->tensorIndices[loc];
 }
 
 bool Environment::hasTensorIndex(const Var& var) const {
@@ -146,6 +166,14 @@ const TensorIndex& Environment::getTensorIndex(const Var& var) const {
   return content->tensorIndexOfVar.at(var);
 }
 
+const std::vector<CachedAssembly>& Environment::getCachedAssemblies() const {
+  return content->cachedAssemblies;
+}
+
+bool Environment::isCachedAssemblyFlag(const Var& var) const {
+  return util::contains(content->cachedAssemblyFlags, var);
+}
+
 void Environment::addConstant(const Var& var, const Expr& initializer) {
   content->constants.push_back({var, initializer});
 }
@@ -179,7 +207,7 @@ Var Environment::createTemporary(const Type &type, const std::string name) {
 }
 
 void Environment::addTensorIndex(const pe::PathExpression& pexpr,
-                                 const Var& var) {
+                                 const Var& var, bool symmetric) {
   iassert(pexpr.defined())
       << "Attempting to add tensor " << util::quote(var)
       << " index with an undefined path expression";
@@ -190,13 +218,20 @@ void Environment::addTensorIndex(const pe::PathExpression& pexpr,
 
   // Lazily create a new index if no index with the given pexpr exist.
   // TODO: Maybe rename indices as they get used by multiple tensors
-  if (!hasTensorIndex(pexpr)) {
-    TensorIndex ti(name+"_index", pexpr);
+  if (!hasTensorIndex(pexpr, symmetric)) {
+    string suffix = symmetric ? "_upper_index" : "_index";
+    TensorIndex ti(name+suffix, pexpr, symmetric);
     content->tensorIndices.push_back(ti);
     size_t loc = content->tensorIndices.size() - 1;
-    content->locationOfTensorIndex.insert({pexpr, loc});
+    content->locationOfTensorIndex.insert({make_pair(pexpr, symmetric), loc});
   }
-  content->tensorIndexOfVar.insert({var, getTensorIndex(pexpr)});
+  content->tensorIndexOfVar.insert({var, getTensorIndex(pexpr, symmetric)});
+}
+
+void Environment::addCachedAssembly(const CachedAssembly& cachedAssembly) {
+  addTemporary(cachedAssembly.getFlag());
+  content->cachedAssemblies.push_back(cachedAssembly);
+  content->cachedAssemblyFlags.insert(cachedAssembly.getFlag());
 }
 
 std::ostream& operator<<(std::ostream& os, const Environment& env) {
@@ -259,6 +294,15 @@ std::ostream& operator<<(std::ostream& os, const Environment& env) {
     }
     somethingPrinted = true;
   }
+
+  // Cached assemblies
+  for (auto& cachedAssembly : env.getCachedAssemblies()) {
+    if (somethingPrinted) {
+      os << std::endl;
+    }
+    os << cachedAssembly;
+    somethingPrinted = true;
+  }
   UNUSED(somethingPrinted);
 
   return os;
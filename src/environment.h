@@ -4,6 +4,7 @@
 #include <vector>
 #include <map>
 #include <ostream>
+#include <string>
 #include "var.h"
 #include "macros.h"
 #include "util/name_generator.h"
@@ -35,6 +36,43 @@ private:
 
 std::ostream& operator<<(std::ostream&, const VarMapping&);
 
+/// A CachedAssembly is a tensor that is assembled by a map whose inputs rarely
+/// change between calls of a function, so that the function keeps it from one
+/// call to the next. The compiled code only assembles the tensor while its flag
+/// (an int vector of size one) is zero, and sets the flag when it is done. The
+/// runtime clears the flag before a call if the structure of one of the sets
+/// the map reads, or the data of one of the fields it reads, changed since the
+/// tensor was assembled.
+class CachedAssembly {
+public:
+  CachedAssembly(const Var& tensor, const Var& flag)
+      : tensor(tensor), flag(flag) {}
+
+  const Var& getTensor() const {return tensor;}
+  const Var& getFlag() const {return flag;}
+
+  /// The names of the sets whose structure the assembly reads.
+  const std::vector<std::string>& getSets() const {return sets;}
+
+  /// The fields the assembly reads, as pairs of set and field names.
+  const std::vector<std::pair<std::string,std::string>>& getFields() const {
+    return fields;
+  }
+
+  void addSet(const std::string& set) {sets.push_back(set);}
+  void addField(const std::string& set, const std::string& field) {
+    fields.push_back({set, field});
+  }
+
+private:
+  Var tensor;
+  Var flag;
+  std::vector<std::string> sets;
+  std::vector<std::pair<std::string,std::string>> fields;
+};
+
+std::ostream& operator<<(std::ostream&, const CachedAssembly&);
+
 /// An Environment keeps track of global constants, externs and temporaries.
 /// It also keeps track of the data arrays and shared index arrays of tensors
 /// that have path expressions. (The latter are added to the environment as the
@@ -84,10 +122,14 @@ public:
   const std::vector<TensorIndex>& getTensorIndices() const;
 
   /// True of the environment has a tensor index for the given path expression.
-  bool hasTensorIndex(const pe::PathExpression& pexpr) const;
+  /// Symmetric tensor indices, which only hold the upper block-triangle, are
+  /// kept apart from the full indices of the same path expression.
+  bool hasTensorIndex(const pe::PathExpression& pexpr,
+                      bool symmetric=false) const;
 
   /// Retrieve the tensor index of the given path expression.
-  const TensorIndex& getTensorIndex(const pe::PathExpression& pexpr) const;
+  const TensorIndex& getTensorIndex(const pe::PathExpression& pexpr,
+                                    bool symmetric=false) const;
 
   /// True of the environment contains the tensor index of var.
   bool hasTensorIndex(const Var& var) const;
@@ -95,6 +137,13 @@ public:
   /// Retrieve the tensor index of var.
   const TensorIndex& getTensorIndex(const Var& var) const;
 
+  /// Get the tensors that are kept between calls, and assembled again only
+  /// when their inputs change. Their flags are temporaries.
+  const std::vector<CachedAssembly>& getCachedAssemblies() const;
+
+  /// True if var is the flag of a cached assembly.
+  bool isCachedAssemblyFlag(const Var& var) const;
+
   /// Insert a constant into the environment.
   void addConstant(const Var& var, const Expr& initializer);
 
@@ -116,7 +165,12 @@ public:
 
   /// Add a tensor index described by the given path expression to the
   /// environment, and associate it with var.
-  void addTensorIndex(const pe::PathExpression& pexpr, const Var& var);
+  void addTensorIndex(const pe::PathExpression& pexpr, const Var& var,
+                      bool symmetric=false);
+
+  /// Insert a cached assembly into the environment, and its flag as a
+  /// temporary.
+  void addCachedAssembly(const CachedAssembly& cachedAssembly);
 
 private:
   struct Content;
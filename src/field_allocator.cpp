@@ -0,0 +1,122 @@
+#include "field_allocator.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#include "error.h"
+
+using namespace std;
+
+namespace simit {
+namespace internal {
+
+// Buffers start with a header, padded to a cache line, that holds the
+// capacity class of the buffer
+struct BufferHeader {
+  unsigned capacityClass;
+};
+static_assert(sizeof(BufferHeader) <= FieldAllocator::kAlignment,
+              "buffer header does not fit in a cache line");
+
+// The smallest buffer capacity is one cache line
+static const unsigned kMinCapacityClass = 6;
+static const unsigned kNumCapacityClasses = 48;
+
+// Bound on the bytes kept in the free lists. Freed buffers that would exceed it
+// are returned to the system.
+static const size_t kMaxPooledBytes = size_t(1) << 28;
+
+static unsigned getCapacityClass(size_t size) {
+  unsigned capacityClass = kMinCapacityClass;
+  while ((size_t(1) << capacityClass) < size) {
+    ++capacityClass;
+  }
+  iassert(capacityClass < kNumCapacityClasses);
+  return capacityClass;
+}
+
+static BufferHeader* getHeader(void* ptr) {
+  return reinterpret_cast<BufferHeader*>(static_cast<char*>(ptr) -
+                                         FieldAllocator::kAlignment);
+}
+
+static size_t getCapacity(void* ptr) {
+  return size_t(1) << getHeader(ptr)->capacityClass;
+}
+
+// class FieldAllocator
+FieldAllocator& FieldAllocator::getInstance() {
+  // Never destroyed, since sets with static storage duration may free their
+  // buffers after the allocator would have been destroyed
+  static FieldAllocator* instance = new FieldAllocator();
+  return *instance;
+}
+
+FieldAllocator::FieldAllocator() : freeLists(kNumCapacityClasses),
+                                   pooledBytes(0) {
+}
+
+void* FieldAllocator::allocate(size_t size) {
+  unsigned capacityClass = getCapacityClass(size);
+  size_t capacity = size_t(1) << capacityClass;
+
+  void* ptr = nullptr;
+  {
+    lock_guard<std::mutex> lock(mutex);
+    vector<void*>& freeList = freeLists[capacityClass];
+    if (!freeList.empty()) {
+      ptr = freeList.back();
+      freeList.pop_back();
+      pooledBytes -= capacity;
+    }
+  }
+
+  if (ptr == nullptr) {
+    void* buffer = nullptr;
+    if (posix_memalign(&buffer, kAlignment, kAlignment + capacity) != 0) {
+      ierror << "could not allocate " << capacity << " bytes";
+    }
+    ptr = static_cast<char*>(buffer) + kAlignment;
+    getHeader(ptr)->capacityClass = capacityClass;
+  }
+  memset(ptr, 0, size);
+  return ptr;
+}
+
+void* FieldAllocator::reallocate(void* ptr, size_t oldSize, size_t newSize) {
+  if (ptr == nullptr) {
+    return allocate(newSize);
+  }
+  iassert(oldSize <= newSize);
+  if (newSize <= getCapacity(ptr)) {
+    memset(static_cast<char*>(ptr) + oldSize, 0, newSize - oldSize);
+    return ptr;
+  }
+  void* newPtr = allocate(newSize);
+  memcpy(newPtr, ptr, oldSize);
+  deallocate(ptr);
+  return newPtr;
+}
+
+void FieldAllocator::deallocate(void* ptr) {
+  if (ptr == nullptr) {
+    return;
+  }
+  size_t capacity = getCapacity(ptr);
+  {
+    lock_guard<std::mutex> lock(mutex);
+    if (pooledBytes + capacity <= kMaxPooledBytes) {
+      freeLists[getHeader(ptr)->capacityClass].push_back(ptr);
+      pooledBytes += capacity;
+      return;
+    }
+  }
+  free(getHeader(ptr));
+}
+
+size_t FieldAllocator::getPooledBytes() const {
+  lock_guard<std::mutex> lock(mutex);
+  return pooledBytes;
+}
+
+}}
@@ -0,0 +1,47 @@
+#ifndef SIMIT_FIELD_ALLOCATOR_H
+#define SIMIT_FIELD_ALLOCATOR_H
+
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+#include "interfaces/uncopyable.h"
+
+namespace simit {
+namespace internal {
+
+/// Allocates the field and endpoint buffers of sets. Buffers are zeroed and
+/// aligned to cache lines, and their capacities are rounded up to powers of
+/// two. Freed buffers are kept in per-capacity free lists and reused, so that
+/// sets that are repeatedly created and destroyed do not go back to the system
+/// allocator.
+class FieldAllocator : private interfaces::Uncopyable {
+public:
+  static const size_t kAlignment = 64;
+
+  static FieldAllocator& getInstance();
+
+  /// Allocate a zeroed buffer of at least `size` bytes.
+  void* allocate(size_t size);
+
+  /// Grow `ptr`, of which the first `oldSize` bytes are in use, to at least
+  /// `newSize` bytes. The bytes past `oldSize` are zeroed. `ptr` may be null.
+  void* reallocate(void* ptr, size_t oldSize, size_t newSize);
+
+  /// Return a buffer to the pool. `ptr` may be null.
+  void deallocate(void* ptr);
+
+  /// The number of bytes held in the free lists.
+  size_t getPooledBytes() const;
+
+private:
+  FieldAllocator();
+
+  // Free lists of buffers whose capacity is 2^i bytes
+  std::vector<std::vector<void*>> freeLists;
+  size_t pooledBytes;
+  mutable std::mutex mutex;
+};
+
+}}
+#endif
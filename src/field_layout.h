@@ -0,0 +1,73 @@
+#ifndef SIMIT_FIELD_LAYOUT_H
+#define SIMIT_FIELD_LAYOUT_H
+
+#include <cstddef>
+
+#include "error.h"
+
+namespace simit {
+
+/// The way the tensors of a set field are laid out in the field's buffer. By
+/// default the tensor of each element is stored contiguously, one element after
+/// the other (array of structures). A tiled layout instead groups the elements
+/// into tiles of `tile` elements and stores each tensor component of a tile
+/// contiguously (array of structures of arrays), so that component c of
+/// elements e..e+tile-1 is a unit-stride vector. Loops that read the same
+/// component of consecutive elements then load whole vectors instead of
+/// gathering strided components. Scalar fields are laid out the same way in
+/// either layout.
+class FieldLayout {
+public:
+  /// The default, array of structures, layout.
+  FieldLayout() : tile(1) {}
+
+  /// A layout that stores the components of tiles of `tile` elements together.
+  static FieldLayout tiled(int tile) {
+    uassert(tile >= 1) << "Invalid field layout tile: " << tile;
+    FieldLayout layout;
+    layout.tile = tile;
+    return layout;
+  }
+
+  /// Returns the number of elements whose components are stored together, or
+  /// 1 if the tensor of each element is stored contiguously.
+  int getTile() const {return tile;}
+
+  /// Returns true if the tensor of each element is stored contiguously.
+  bool isArrayOfStructures() const {return tile == 1;}
+
+  /// Returns the offset of component `component` of element `element`'s
+  /// tensor, which has `size` components, in a field's buffer.
+  size_t getOffset(size_t element, size_t component, size_t size) const {
+    if (tile == 1 || size == 1) {
+      return element*size + component;
+    }
+    return ((element/tile)*size + component)*tile + element%tile;
+  }
+
+  /// Returns the distance between consecutive components of an element's
+  /// tensor, which has `size` components.
+  size_t getStride(size_t size) const {
+    return (size == 1) ? 1 : tile;
+  }
+
+  /// Returns the number of element slots a field buffer must hold to store
+  /// `numElements` elements, which is rounded up to a whole number of tiles.
+  size_t getNumSlots(size_t numElements) const {
+    return ((numElements + tile - 1) / tile) * tile;
+  }
+
+  friend bool operator==(const FieldLayout& l, const FieldLayout& r) {
+    return l.tile == r.tile;
+  }
+
+  friend bool operator!=(const FieldLayout& l, const FieldLayout& r) {
+    return !(l == r);
+  }
+
+private:
+  int tile;
+};
+
+}
+#endif
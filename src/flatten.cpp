@@ -1,5 +1,6 @@
 #include "flatten.h"
 
+#include <atomic>
 #include <string>
 #include <vector>
 
@@ -21,7 +22,7 @@ bool overlaps(const std::vector<IndexVar> &as, const std::vector<IndexVar> &bs);
 
 /// Static namegen (hacky: fix later)
 std::string tmpNameGen() {
-  static int i = 0;
+  static std::atomic<int> i(0);
   return "tmp" + std::to_string(i++);
 }
 
@@ -24,8 +24,10 @@ struct FuncContent {
 
   ~FuncContent();
   mutable long ref = 0;
-  friend inline void aquire(FuncContent *c) {++c->ref;}
-  friend inline void release(FuncContent *c) {if (--c->ref==0) delete c;}
+  friend inline void aquire(FuncContent *c) {util::incRef(&c->ref);}
+  friend inline void release(FuncContent *c) {
+    if (util::decRef(&c->ref)==0) delete c;
+  }
 };
 
 /// A Simit Func, which can be passed to the backend to get a runnable Function.
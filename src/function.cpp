@@ -3,6 +3,7 @@
 #include "backend/backend_function.h"
 #include "types_convert.h"
 #include "graph.h"  // TODO: should not need this include
+#include "timers.h"
 
 using namespace std;
 
@@ -12,13 +13,26 @@ namespace simit {
 Function::Function() : Function(nullptr) {
 }
 
-Function::Function(backend::Function* func) : impl(func), funcPtr(nullptr) {
+Function::Function(backend::Function* func) : Function(func, 0, 0) {
+}
+
+Function::Function(backend::Function* func, int timersBegin, int timersEnd)
+    : impl(func), funcPtr(nullptr), timersBegin(timersBegin),
+      timersEnd(timersEnd) {
 }
 
 void Function::clear() {
   impl = nullptr;
 }
 
+Function Function::clone() const {
+  uassert(defined()) << "undefined function";
+  uassert(timersBegin == timersEnd)
+      << "functions compiled with timers cannot be cloned, since the instances "
+      << "would share their timers";
+  return Function(impl->clone(), timersBegin, timersEnd);
+}
+
 void Function::bind(const std::string& name, simit::Set *set) {
 #ifdef SIMIT_ASSERTS
   uassert(defined()) << "undefined function";
@@ -151,6 +165,24 @@ void Function::printMachine(std::ostream& os) const {
   }
 }
 
+void Function::writeObject(std::ostream& os) const {
+  uassert(defined()) << "undefined function";
+  impl->writeObject(os);
+}
+
+void Function::writeHeader(std::ostream& os) const {
+  uassert(defined()) << "undefined function";
+  impl->writeHeader(os);
+}
+
+Profile Function::getProfile() const {
+  return ir::TimerStorage::getInstance().getProfile(timersBegin, timersEnd);
+}
+
+void Function::clearProfile() {
+  ir::TimerStorage::getInstance().clear(timersBegin, timersEnd);
+}
+
 std::ostream& operator<<(std::ostream& os, const Function& f) {
   f.print(os);
   return os;
@@ -4,6 +4,7 @@
 #include <string>
 #include <functional>
 #include "tensor.h"
+#include "profile.h"
 
 namespace simit {
 class Set;
@@ -35,9 +36,19 @@ public:
   /// be created using the backend::Backend::compile methods.
   Function(backend::Function* function);
 
+  /// Create a function from a backend::Function compiled with the timers
+  /// [timersBegin, timersEnd) (see Program::compileWithTimers).
+  Function(backend::Function* function, int timersBegin, int timersEnd);
+
   /// Clear Function of data (makes it undefined).
   void clear();
 
+  /// Create another instance of the function. The instance shares the compiled
+  /// code, but not the bindings, so instances can be bound to different data
+  /// and run concurrently from different threads. Functions compiled with
+  /// timers cannot be cloned, since their timers are not per instance.
+  Function clone() const;
+
   /// Bind the set to the given argument.
   void bind(const std::string& name, simit::Set* set);
 
@@ -87,11 +98,37 @@ public:
   /// Print the function to the stream as machine assembly code.
   void printMachine(std::ostream& os) const;
 
+  /// Write the function to the stream as a relocatable object file that can
+  /// be linked into programs (or shared libraries) without the compiler. The
+  /// code is generated for the target CPU (see setTargetCPUs, and
+  /// setForcedTargetCPU for CPUs the host does not support). Functions loaded
+  /// from the object cache are written unoptimized, so compile functions for
+  /// ahead-of-time use with the object cache disabled.
+  void writeObject(std::ostream& os) const;
+
+  /// Write a C header for the object written by writeObject. It declares the
+  /// init, compute and deinit entry points, and the struct of the context
+  /// object they take. The program zeroes a context object per instance of the
+  /// function and sets its externs, temporaries and tensor indices before it
+  /// calls init.
+  void writeHeader(std::ostream& os) const;
+
+  /// Returns the time, call and iteration counts, and estimated bytes and flops
+  /// of the loops of the function, accumulated over all runs. The profile is
+  /// empty unless the function was compiled with timers.
+  Profile getProfile() const;
+
+  /// Zero the profile measurements, e.g. to leave out warm-up runs.
+  void clearProfile();
+
 private:
   std::shared_ptr<backend::Function> impl;
 
   // To make the run method faster we store the function pointer here.
   std::function<void()> funcPtr;
+
+  int timersBegin;
+  int timersEnd;
 };
 
 /// Write the function to the stream. The output depends on the backend,
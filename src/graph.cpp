@@ -1,5 +1,7 @@
 #include "graph.h"
 
+#include <algorithm>
+#include <atomic>
 #include <iostream>
 #include "graph_indices.h"
 
@@ -7,35 +9,71 @@ using namespace std;
 
 namespace simit {
 
+unsigned long Set::nextGeneration() {
+  static std::atomic<unsigned long> generations(0);
+  return ++generations;
+}
+
 Set::~Set() {
   for (auto f: fields) {
     delete f;
   }
-  free(endpoints);
+  internal::FieldAllocator::getInstance().deallocate(endpoints);
   delete this->neighbors;
 }
 
-void Set::increaseCapacity() {
+void Set::increaseCapacity(int minCapacity) {
+  // Doubling the capacity makes the cost of growing amortized constant per
+  // added element
+  setCapacity(std::max(2*capacity, minCapacity));
+}
+
+void Set::setCapacity(int newCapacity) {
+  iassert(newCapacity >= numElements);
+  internal::FieldAllocator& allocator = internal::FieldAllocator::getInstance();
   for (auto f : fields) {
-    int typeSize = f->sizeOfType;
-    f->data = realloc(f->data, (capacity+capacityIncrement) * typeSize);
-    memset((char*)(f->data)+capacity*typeSize, 0, capacityIncrement*typeSize);
+    f->data = allocator.reallocate(f->data, f->getBufferSize(capacity),
+                                   f->getBufferSize(newCapacity));
 
     for (FieldRefBase *fieldRef : f->fieldReferences) {
       fieldRef->data = f->data;
     }
   }
-  capacity += capacityIncrement;
+  if (getCardinality() > 0) {
+    size_t edgeSize = getCardinality() * sizeof(int);
+    endpoints = (int*)allocator.reallocate(endpoints, capacity*edgeSize,
+                                           newCapacity*edgeSize);
+  }
+  capacity = newCapacity;
+  ++fieldsVersion;
 }
 
 const internal::NeighborIndex *Set::getNeighborIndex() const {
   tassert(isHomogeneous())
       << "neighbor indices are currently only supported for homogeneous sets";
 
-  if (getCardinality() >= 2 && neighbors == nullptr) {
+  if (getCardinality() < 2) {
+    return this->neighbors;
+  }
+
+  const Set *vertexSet = getEndpointSet(0);
+  if (neighbors != nullptr && (neighborsVersion != version ||
+                               neighborsVertexVersion != vertexSet->version)) {
+    if (isAppendedSince(neighborsVersion) &&
+        vertexSet->isAppendedSince(neighborsVertexVersion)) {
+      neighbors->update(*this);
+    }
+    else {
+      delete neighbors;
+      neighbors = nullptr;
+    }
+  }
+  if (neighbors == nullptr) {
     // Cast to non-const since adding a neighbor index does not change the 
     this->neighbors = new internal::NeighborIndex(*this);
   }
+  neighborsVersion = version;
+  neighborsVertexVersion = vertexSet->version;
   return this->neighbors;
 }
 
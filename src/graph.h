@@ -1,6 +1,7 @@
 #ifndef SIMIT_GRAPH_H
 #define SIMIT_GRAPH_H
 
+#include <atomic>
 #include <cstddef>
 #include <cstring>
 #include <vector>
@@ -11,6 +12,8 @@
 
 #include "tensor_type.h"
 #include "error.h"
+#include "field_allocator.h"
+#include "field_layout.h"
 #include "types.h"
 #include "util/variadic.h"
 #include "interfaces/comparable.h"
@@ -18,6 +21,7 @@
 namespace simit {
 
 class Function;
+class Ensemble;
 
 class Set;
 class FieldRefBase;
@@ -93,14 +97,18 @@ class Set {
 public:
   Set(const std::string &name)
       : name(name), numElements(0), endpoints(nullptr),
-        capacity(capacityIncrement), neighbors(nullptr) {}
+        capacity(initialCapacity), generation(nextGeneration()),
+        version(0), rewriteVersion(0),
+        fieldsVersion(0), neighbors(nullptr), neighborsVersion(0),
+        neighborsVertexVersion(0) {}
 
   template <typename ...Sets>
   Set(const char *name, const Sets& ...sets) : Set(std::string(name)) {
     static_assert(util::areSame<Set, Sets...>{},
         "Set constructor takes an optional name followed by zero or more Sets");
     this->endpointSets = {&sets...};
-    this->endpoints    = (int*)calloc(sizeof(int), capacity * getCardinality());
+    this->endpoints    = (int*)internal::FieldAllocator::getInstance().allocate(
+        capacity * getCardinality() * sizeof(int));
   }
 
   template <typename ...Sets>
@@ -118,19 +126,44 @@ public:
   /// have cardinality 0.
   inline int getCardinality() const { return endpointSets.size(); }
 
+  /// Return a number that identifies the set for the lifetime of the process.
+  /// Unlike the set's address, it is not reused by sets created after this
+  /// set is destroyed, so caches keyed on a set should compare it.
+  inline unsigned long getGeneration() const { return generation; }
+
+  /// Return the structural version of the set, which changes whenever
+  /// elements are added or removed or the endpoints are changed.
+  inline unsigned long getVersion() const { return version; }
+
+  /// Returns true if the only structural changes since the set had `version`
+  /// are elements added to the end of the set, so that the existing elements
+  /// and their endpoints are unchanged.
+  inline bool isAppendedSince(unsigned long version) const {
+    return rewriteVersion <= version;
+  }
+
+  /// Return the version of the field buffers, which changes whenever fields
+  /// are added or their buffers are moved.
+  inline unsigned long getFieldsVersion() const { return fieldsVersion; }
+
+  /// Record that the elements or endpoints of the set were changed in place,
+  /// e.g. by reordering them through the endpoint and field pointers.
+  void markRewritten() {
+    rewriteVersion = ++version;
+  }
+
   /// Add a tensor field to the set.  Use the template parameters to specify the
   /// component type and dimension sizes of the tensors.  For example, define a
   /// field of 2x3 matrices containing doubles as follows:
   /// Field<double,2,3> matrix = addField<double,2,3>("mat");
+  /// The tensors are laid out in the field's buffer as given by `layout` (see
+  /// FieldLayout). Field references index either layout the same way.
   template <typename T, int... dimensions>
-  FieldRef<T, dimensions...> addField(const std::string &name) {
+  FieldRef<T, dimensions...> addField(const std::string &name,
+                                      FieldLayout layout=FieldLayout()) {
     FieldData::TensorType *type =
         new FieldData::TensorType(typeOf<T>(), {dimensions...});
-    FieldData *fieldData = new FieldData(name, type, this);
-    fieldData->data = calloc(capacity, fieldData->sizeOfType);
-    fields.push_back(fieldData);
-    fieldNames[name] = fields.size()-1;
-    return FieldRef<T, dimensions...>(fieldData);
+    return FieldRef<T, dimensions...>(addFieldData(name, type, layout));
   }
  
   // Added for reordering
@@ -164,54 +197,82 @@ public:
   ElementRef add(Endpoints... endpoints) {
     iassert(sizeof...(endpoints) == getCardinality()) <<"Wrong number of \
       endpoints.";
-    if (numElements > capacity-1) {
-      increaseEdgeCapacity();
+    if (numElements == capacity) {
+      increaseCapacity(numElements+1);
     }
     addEndpoints(0, endpoints...);
+    ++version;
+    return ElementRef(numElements++);
+  }
 
-    if (numElements > capacity-1) {
-      increaseCapacity();
+  /// Add `num` elements, whose fields are zero, returning the handle of the
+  /// first. The elements get consecutive handles. Only for non-edge sets.
+  ElementRef addN(int num) {
+    uassert(getCardinality() == 0) << "use addEdges to add edges";
+    uassert(num >= 0);
+    if (numElements + num > capacity) {
+      increaseCapacity(numElements + num);
     }
-    return ElementRef(numElements++);
+    ElementRef first(numElements);
+    numElements += num;
+    ++version;
+    return first;
+  }
+
+  /// Add `num` edges, whose fields are zero, returning the handle of the
+  /// first. `endpoints` holds the idents of the endpoints of each edge in
+  /// turn, so its length is `num` times the cardinality of the set.
+  ElementRef addEdges(const int *endpoints, int num) {
+    const int cardinality = getCardinality();
+    uassert(cardinality > 0) << "use addN to add elements to non-edge sets";
+    uassert(num >= 0);
+    for (int i=0; i < num*cardinality; ++i) {
+      uassert(endpoints[i] >= 0 &&
+              endpointSets[i%cardinality]->getSize() > endpoints[i])
+          << "Invalid member of set in addEdges";
+    }
+    if (numElements + num > capacity) {
+      increaseCapacity(numElements + num);
+    }
+    memcpy(&this->endpoints[numElements*cardinality], endpoints,
+           num*cardinality*sizeof(int));
+    ElementRef first(numElements);
+    numElements += num;
+    ++version;
+    return first;
   }
 
-  /// Remove an element from the Set
+  /// Make room for at least `capacity` elements, so that adding elements up
+  /// to that many does not reallocate the fields and endpoints.
+  void reserve(int capacity) {
+    if (capacity > this->capacity) {
+      setCapacity(capacity);
+    }
+  }
+
+  /// Remove an element from the Set. The last element takes its place, so
+  /// indices over the set are rebuilt the next time they are used, rather
+  /// than updated like they are after elements are added.
   void remove(ElementRef element) {
-    for (auto f : fields){
-      switch (f->type->getComponentType()) {
-        case ComponentType::Float: {
-          float* data = (float*)f->data;
-          data[element.ident] = data[numElements-1];
-          break;
-        }
-        case ComponentType::Double: {
-          double* data = (double*)f->data;
-          data[element.ident] = data[numElements-1];
-          break;
-        }
-        case ComponentType::Int: {
-          int* data = (int*)f->data;
-          data[element.ident] = data[numElements-1];
-          break;
-        }
-        case ComponentType::Boolean: {
-          bool* data = (bool*)f->data;
-          data[element.ident] = data[numElements-1];
-          break;
-        }
-        case ComponentType::FloatComplex: {
-          float_complex* data = (float_complex*)f->data;
-          data[element.ident] = data[numElements-1];
-          break;
-        }
-        case ComponentType::DoubleComplex: {
-          double_complex* data = (double_complex*)f->data;
-          data[element.ident] = data[numElements-1];
-          break;
-        }
+    const int last = numElements-1;
+    for (auto f : fields) {
+      // Move each component through the layout, since in a tiled layout the
+      // components of an element are not contiguous
+      const size_t size = f->type->getSize();
+      const size_t compSize = f->sizeOfType / size;
+      char* data = (char*)f->data;
+      for (size_t c = 0; c < size; ++c) {
+        memcpy(data + f->layout.getOffset(element.ident, c, size)*compSize,
+               data + f->layout.getOffset(last, c, size)*compSize, compSize);
       }
     }
+    const int cardinality = getCardinality();
+    for (int i=0; i < cardinality; ++i) {
+      endpoints[element.ident*cardinality + i] =
+          endpoints[last*cardinality + i];
+    }
     numElements--;
+    markRewritten();
   }
 
   /// Iterator that iterates over the elements in a Set
@@ -386,9 +447,20 @@ public:
     return Endpoints(this, edge);
   }
 
+  /// Returns the buffer of the given field. The field is then compared with a
+  /// copy, rather than by version, to tell whether it changed between runs of
+  /// functions that cache assemblies from it (see setCacheAssemblies).
   void *getFieldData(const std::string &fieldName) {
     iassert(fieldNames.find(fieldName) != fieldNames.end());
-    return fields[fieldNames.at(fieldName)]->data;
+    FieldData* fieldData = fields[fieldNames.at(fieldName)];
+    fieldData->exposed = true;
+    return fieldData->data;
+  }
+
+  /// Returns the layout of the tensors in the buffer of the given field.
+  const FieldLayout& getFieldLayout(const std::string &fieldName) const {
+    iassert(fieldNames.find(fieldName) != fieldNames.end());
+    return fields[fieldNames.at(fieldName)]->layout;
   }
 
   /// Get an array containing, for each edge in a set, the elements it connects.
@@ -396,7 +468,9 @@ public:
 
   /// If this set is an edge set with cardinality 2 then return an index that
   /// for each element in the first connected set contains it's neighbors in the
-  /// second connceted set. Otherwise, return nullptr.
+  /// second connceted set. Otherwise, return nullptr. The index is brought up
+  /// to date when the set has changed: edges and vertices added to the end
+  /// are merged into it, while other changes rebuild it.
   const internal::NeighborIndex *getNeighborIndex() const;
 
   void setName(const std::string &name) { this->name = name; }
@@ -437,13 +511,15 @@ public:
       size_t size;
     };
 
-    FieldData(const std::string &name, const TensorType *type, Set *set)
-        : name(name), type(type), set(set), data(nullptr) {
+    FieldData(const std::string &name, const TensorType *type, Set *set,
+              FieldLayout layout=FieldLayout())
+        : name(name), type(type), layout(layout), set(set), data(nullptr),
+          version(0), exposed(false) {
       sizeOfType = componentSize(type->getComponentType()) * type->getSize();
     }
 
     ~FieldData() {
-      free(data);
+      internal::FieldAllocator::getInstance().deallocate(data);
       delete type;
     }
 
@@ -452,6 +528,14 @@ public:
     const TensorType *type;
     size_t sizeOfType;
 
+    /// The layout of the tensors in the buffer.
+    FieldLayout layout;
+
+    /// Returns the size of a buffer that holds `capacity` elements' tensors.
+    size_t getBufferSize(int capacity) const {
+      return layout.getNumSlots(capacity) * sizeOfType;
+    }
+
     // The Set this field is a member of. Used for printing, etc.
     Set *set;
 
@@ -461,6 +545,21 @@ public:
     /// Field references so that we can update their data pointers if we realloc
     /// field data. Avoids two loads on field get/set.
     std::set<FieldRefBase*> fieldReferences;
+
+    /// The version of the data, which changes when the data is written through
+    /// a field reference.
+    std::atomic<unsigned long> version;
+
+    /// True if the data may be written through a pointer to it, without
+    /// changing its version.
+    bool exposed;
+
+    /// Record that the data was written. Writes from several threads may only
+    /// change the version once, which still tells that the data changed.
+    void markModified() {
+      version.store(version.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_relaxed);
+    }
     
   private:
     /// disable copy constructors
@@ -485,18 +584,55 @@ private:
   int* endpoints;                            // the endpoints of edge elements
 
   int capacity;                              // current capacity of the set
-  static const int capacityIncrement = 1024; // increment for capacity increases
+  static const int initialCapacity = 1024;   // capacity of new sets
+
+  unsigned long generation;                  // unique identifier of the set
+  unsigned long version;                     // structural version
+  unsigned long rewriteVersion;              // version of the last non-append
+  unsigned long fieldsVersion;               // version of the field buffers
 
   mutable internal::NeighborIndex *neighbors;// neighbor index (lazily created)
+  mutable unsigned long neighborsVersion;    // version neighbors was built for
+  mutable unsigned long neighborsVertexVersion;
   std::map<std::string, int> fieldNames;     // name to field lookups
   std::vector<FieldData*> fields;            // fields of elements in the set
 
+  /// Returns a new set generation
+  static unsigned long nextGeneration();
+
   /// disable copy constructors
   Set(const Set& s);
   Set& operator=(const Set& s);
 
-  /// increase capacity of all fields
-  void increaseCapacity();
+  /// Create a set whose elements connect elements of `endpointSets`, which
+  /// are only known at runtime.
+  Set(const std::string &name, const std::vector<const Set*> &endpointSets)
+      : Set(name) {
+    this->endpointSets = endpointSets;
+    this->endpoints    = (int*)internal::FieldAllocator::getInstance().allocate(
+        capacity * getCardinality() * sizeof(int));
+  }
+
+  /// Add a field of the given type and layout to the set, which takes
+  /// ownership of the type.
+  FieldData *addFieldData(const std::string &name,
+                          const FieldData::TensorType *type,
+                          FieldLayout layout=FieldLayout()) {
+    FieldData *fieldData = new FieldData(name, type, this, layout);
+    fieldData->data = internal::FieldAllocator::getInstance().allocate(
+        fieldData->getBufferSize(capacity));
+    fields.push_back(fieldData);
+    fieldNames[name] = fields.size()-1;
+    ++fieldsVersion;
+    return fieldData;
+  }
+
+  /// Grow the capacity of the fields and endpoints geometrically, to at least
+  /// `minCapacity` elements.
+  void increaseCapacity(int minCapacity);
+
+  /// Reallocate the fields and endpoints to hold `capacity` elements.
+  void setCapacity(int capacity);
 
   /// helpers for constructing endpoint sets
   template <typename F, typename ...T> std::vector<const Set*>
@@ -512,11 +648,6 @@ private:
   std::vector<const Set*>
   epsMaker(std::vector<const Set*> sofar) {return sofar;}
 
-  void increaseEdgeCapacity() {
-    size_t newSize = (capacity+capacityIncrement)*getCardinality()*sizeof(int);
-    endpoints = (int*)realloc(endpoints, newSize);
-  }
-
   // helper for adding edges
   template <typename F, typename ...T>
   void addEndpoints(int which, F f, T ... eps) {
@@ -562,10 +693,12 @@ private:
       FieldData::TensorType *type =
           new FieldData::TensorType(ctype, dims);
       FieldData *fieldData = new FieldData(field.name, type, this);
-      fieldData->data = calloc(capacity, fieldData->sizeOfType);
+      fieldData->data = internal::FieldAllocator::getInstance().allocate(
+          fieldData->getBufferSize(capacity));
       fields.push_back(fieldData);
       fieldNames[field.name] = fields.size()-1;
     }
+    ++fieldsVersion;
   }
 
   std::ostream &streamOut(std::ostream &os) const {
@@ -601,6 +734,7 @@ private:
 
   friend FieldRefBase;
   friend simit::Function;
+  friend simit::Ensemble;
 };
 
 
@@ -647,12 +781,20 @@ public:
   }
 
   // Return the field's data.  The data is a contigues sequence containing the
-  // tensor of each element in no particular order.  The tensors are currently
-  // laid out in row-major order, but this may change in the future.
+  // tensor of each element in no particular order.  The tensors are laid out in
+  // row-major order, and stored as given by the field's layout (see
+  // getLayout). Like Set::getFieldData, it makes functions that cache
+  // assemblies from the field compare the field with a copy.
   inline void *getData() {
+    fieldData->exposed = true;
     return static_cast<void*>(data);
   }
 
+  /// Returns the layout of the tensors in the field's data.
+  inline const FieldLayout& getLayout() const {
+    return fieldData->layout;
+  }
+
 protected:
   FieldRefBase(void *fieldData)
       : fieldData(static_cast<Set::FieldData*>(fieldData)),
@@ -663,7 +805,8 @@ protected:
   template <typename T>
   inline T *getElemDataPtr(ElementRef element, size_t elementFieldSize) const {
     iassert(sizeof(T) == componentSize(fieldData->type->getComponentType()));
-    return &static_cast<T*>(data)[element.ident * elementFieldSize];
+    return &static_cast<T*>(data)[
+        fieldData->layout.getOffset(element.ident, 0, elementFieldSize)];
   }
 
   Set::FieldData *fieldData;
@@ -677,12 +820,16 @@ private:
 template <typename T, int... dimensions>
 class FieldRefBaseParameterized : public FieldRefBase {
  public:
+  /// Returns a reference to the element's tensor. Writes through the
+  /// reference change the field's version, while reads leave it unchanged.
   TensorRef<T, dimensions...> get(ElementRef element) {
-    return TensorRef<T, dimensions...>(getElemDataPtr(element));
+    return TensorRef<T, dimensions...>(getElemDataPtr(element), getStride(),
+                                       this->fieldData);
   }
 
   const TensorRef<T, dimensions...> get(ElementRef element) const {
-    return TensorRef<T, dimensions...>(getElemDataPtr(element));
+    return TensorRef<T, dimensions...>(getElemDataPtr(element), getStride(),
+                                       this->fieldData);
   }
 
   TensorRef<T, dimensions...> operator()(ElementRef element) {
@@ -697,9 +844,11 @@ class FieldRefBaseParameterized : public FieldRefBase {
     iassert(values.size() == (TensorRef<T,dimensions...>::getSize()))
         << "Incorrect number of init values";
     T *elemData = this->getElemDataPtr(element);
+    this->fieldData->markModified();
+    size_t stride = getStride();
     size_t i=0;
     for (T val : values) {
-      elemData[i++] = val;
+      elemData[stride * i++] = val;
     }
   }
 
@@ -709,9 +858,11 @@ class FieldRefBaseParameterized : public FieldRefBase {
         << "Incorrect number of init values : " << 
         (TensorRef<T,dimensions...>::getSize());
     T *elemData = this->getElemDataPtr(element);
+    this->fieldData->markModified();
+    size_t stride = getStride();
     size_t i=0;
     for (T val : values) {
-      elemData[i++] = val;
+      elemData[stride * i++] = val;
     }
   }
 
@@ -721,6 +872,11 @@ class FieldRefBaseParameterized : public FieldRefBase {
     return FieldRefBase::getElemDataPtr<T>(element, elementFieldSize);
   }
 
+  inline size_t getStride() const {
+    return this->fieldData->layout.getStride(
+        TensorRef<T,dimensions...>::getSize());
+  }
+
   FieldRefBaseParameterized(void *fieldData) : FieldRefBase(fieldData) {}
 };
 
@@ -756,6 +912,7 @@ class FieldRef<T> : public FieldRefBaseParameterized<T> {
  public:
   void set(ElementRef element, T val) {
     (*this->getElemDataPtr(element)) = val;
+    this->fieldData->markModified();
   }
 
   friend std::ostream &operator<<(std::ostream &os, const FieldRef<T> &field) {
@@ -784,6 +941,54 @@ class FieldRef<T> : public FieldRefBaseParameterized<T> {
 
 // Tensor References
 
+/// A reference to a component of a field's tensor, which records writes in the
+/// field's version (see Set::FieldData::version).
+template <typename ComponentType>
+class ComponentRef {
+public:
+  inline operator ComponentType() const {
+    return *data;
+  }
+
+  inline ComponentRef& operator=(ComponentType val) {
+    *data = val;
+    fieldData->markModified();
+    return *this;
+  }
+
+  inline ComponentRef& operator=(const ComponentRef& other) {
+    return *this = (ComponentType)other;
+  }
+
+  inline ComponentRef& operator+=(ComponentType val) {
+    return *this = *data + val;
+  }
+
+  inline ComponentRef& operator-=(ComponentType val) {
+    return *this = *data - val;
+  }
+
+  inline ComponentRef& operator*=(ComponentType val) {
+    return *this = *data * val;
+  }
+
+  inline ComponentRef& operator/=(ComponentType val) {
+    return *this = *data / val;
+  }
+
+  friend std::ostream &operator<<(std::ostream &os, const ComponentRef &c) {
+    return os << (ComponentType)c;
+  }
+
+private:
+  inline ComponentRef(ComponentType *data, Set::FieldData *fieldData)
+      : data(data), fieldData(fieldData) {}
+  ComponentType *data;
+  Set::FieldData *fieldData;
+
+  template <typename T, int... dimensions> friend class TensorRef;
+};
+
 template <typename ComponentType, int... Dimensions>
 class TensorRef
     : public interfaces::Comparable<TensorRef<ComponentType,Dimensions...>> {
@@ -800,6 +1005,7 @@ public:
     static_assert(sizeof...(Dimensions) == 0,
                   "Can only assign scalar values to scalar tensors.");
     data[0] = val;
+    fieldData->markModified();
     return *this;
   }
 
@@ -808,23 +1014,28 @@ public:
     iassert(vals.size() == util::product<Dimensions...>::value);
     size_t i=0;
     for (ComponentType val : vals) {
-      data[i++] = val;
+      data[stride * i++] = val;
     }
+    fieldData->markModified();
     return *this;
   }
 
   template <typename... Indices>
-  inline ComponentType& operator()(Indices... index) {
+  inline ComponentRef<ComponentType> operator()(Indices... index) {
     static_assert(sizeof...(index) == sizeof...(Dimensions),
                   "Incorrect number of indices used to index tensor");
-    return data[util::computeOffset(util::seq<Dimensions...>(), index...)];
+    return ComponentRef<ComponentType>(
+        &data[stride *
+              util::computeOffset(util::seq<Dimensions...>(), index...)],
+        fieldData);
   }
 
   template <typename... Indices> inline
   const ComponentType& operator()(Indices... index) const {
     static_assert(sizeof...(index) == sizeof...(Dimensions),
                   "Incorrect number of indices used to index tensor");
-    return data[util::computeOffset(util::seq<Dimensions...>(), index...)];
+    return data[stride *
+                util::computeOffset(util::seq<Dimensions...>(), index...)];
   }
 
   friend bool operator==(const TensorRef& l, const TensorRef& r){
@@ -836,9 +1047,17 @@ public:
   }
 
 private:
-  inline TensorRef(ComponentType *data) : data(data) {}
+  inline TensorRef(ComponentType *data, size_t stride,
+                   Set::FieldData *fieldData)
+      : data(data), stride(stride), fieldData(fieldData) {}
   ComponentType *data;
 
+  /// The distance between consecutive components in the field's data.
+  size_t stride;
+
+  /// The field whose version writes change.
+  Set::FieldData *fieldData;
+
   friend class FieldRefBaseParameterized<ComponentType, Dimensions...>;
 };
 
@@ -862,6 +1081,7 @@ public:
   inline TensorRef<ComponentType>&
   operator=(ComponentType val) {
     data[0] = val;
+    fieldData->markModified();
     return *this;
   }
 
@@ -874,9 +1094,16 @@ public:
   }
 
 private:
-  inline TensorRef(ComponentType *data) : data(data) {}
+  inline TensorRef(ComponentType *data, size_t stride,
+                   Set::FieldData *fieldData)
+      : data(data), fieldData(fieldData) {
+    iassert(stride == 1);
+  }
   ComponentType* data;
 
+  /// The field whose version writes change.
+  Set::FieldData *fieldData;
+
   friend class FieldRefBaseParameterized<ComponentType>;
 };
 
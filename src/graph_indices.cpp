@@ -1,5 +1,9 @@
 #include "graph_indices.h"
 
+#include <algorithm>
+
+#include "thread_pool.h"
+
 namespace simit {
 namespace internal {
 
@@ -46,45 +50,281 @@ VertexToEdgeIndex::~VertexToEdgeIndex() {
 
 
 // class NeighborIndex
-NeighborIndex::NeighborIndex(const Set &edgeSet) {
-  VertexToEdgeIndex VToE(edgeSet);
+namespace {
+/// Shared state of the parallel passes that build a neighbor index.
+struct NeighborIndexBuilder {
+  const int *endpoints;
+  int cardinality;
+
+  // Vertex to incident edge index, where vertexEdges[vertexEdgesStart[v]:
+  // vertexEdgesStart[v+1]] are the edges v is an endpoint of.
+  std::vector<int> vertexEdgesStart;
+  std::vector<int> vertexEdges;
+
+  int *startIndex;
+  std::vector<int> *neighbors;
+  std::vector<int> *edgeLocations;
+
+  /// Stores the sorted, unique neighbors of v in nbrs.
+  void getNeighbors(int v, std::vector<int> *nbrs) const {
+    nbrs->clear();
+    for (int i = vertexEdgesStart[v]; i < vertexEdgesStart[v+1]; ++i) {
+      const int *eps = &endpoints[vertexEdges[i] * cardinality];
+      nbrs->insert(nbrs->end(), eps, eps + cardinality);
+    }
+    std::sort(nbrs->begin(), nbrs->end());
+    nbrs->erase(std::unique(nbrs->begin(), nbrs->end()), nbrs->end());
+  }
+};
+}
+
+// Stores the number of neighbors of the vertices [start,end) at their
+// start index locations (shifted by one, to prepare the prefix sum)
+static void countNeighborsTask(int start, int end, void **context) {
+  NeighborIndexBuilder *builder = (NeighborIndexBuilder*)context[0];
+  std::vector<int> nbrs;
+  for (int v = start; v < end; ++v) {
+    builder->getNeighbors(v, &nbrs);
+    builder->startIndex[v+1] = nbrs.size();
+  }
+}
+
+static void fillNeighborsTask(int start, int end, void **context) {
+  NeighborIndexBuilder *builder = (NeighborIndexBuilder*)context[0];
+  std::vector<int> nbrs;
+  for (int v = start; v < end; ++v) {
+    builder->getNeighbors(v, &nbrs);
+    std::copy(nbrs.begin(), nbrs.end(),
+              builder->neighbors->begin() + builder->startIndex[v]);
+  }
+}
 
+static void fillEdgeLocationsTask(int start, int end, void **context) {
+  NeighborIndexBuilder *builder = (NeighborIndexBuilder*)context[0];
+  const int cardinality = builder->cardinality;
+  const int *startIndex = builder->startIndex;
+  const std::vector<int>& neighbors = *builder->neighbors;
+  for (int e = start; e < end; ++e) {
+    const int *eps = &builder->endpoints[e * cardinality];
+    int loc = e * cardinality * cardinality;
+    for (int i = 0; i < cardinality; ++i) {
+      auto nbrsBegin = neighbors.begin() + startIndex[eps[i]];
+      auto nbrsEnd = neighbors.begin() + startIndex[eps[i]+1];
+      for (int j = 0; j < cardinality; ++j) {
+        auto nbr = std::lower_bound(nbrsBegin, nbrsEnd, eps[j]);
+        iassert(nbr != nbrsEnd && *nbr == eps[j]);
+        (*builder->edgeLocations)[loc++] = nbr - neighbors.begin();
+      }
+    }
+  }
+}
+
+NeighborIndex::NeighborIndex(const Set &edgeSet) {
   //number of vertices per edge
-  unsigned cardinality = edgeSet.getCardinality();
+  const int cardinality = edgeSet.getCardinality();
+  const int numEdges = edgeSet.getSize();
 
   const Set* vSet = edgeSet.getEndpointSet(0);
-  startIndex = (int*)malloc(sizeof(int) * (vSet->getSize()+1));
-  startIndex[0] = 0;
-  for(auto v : *vSet){
-    std::set<int> edgeNeighbors = VToE.getWhichEdgesForElement(v, *vSet);
-
-    std::vector<int> nbr;
-    for(int eIdx : edgeNeighbors) {
-      for(unsigned jj = 0; jj<cardinality; jj++){
-        int nbrIdx = edgeSet.getEndpoint(ElementRef(eIdx), jj).ident;
-        addNoCollision(nbrIdx, nbr);
+  const int numVertices = vSet->getSize();
+
+  NeighborIndexBuilder builder;
+  this->numVertices = numVertices;
+  this->numEdges = numEdges;
+
+  builder.endpoints = const_cast<Set&>(edgeSet).getEndpointsData();
+  builder.cardinality = cardinality;
+
+  // Build the vertex to edge index with a counting sort of the endpoints.
+  // Only endpoints in vSet make an edge incident to a vertex.
+  std::vector<bool> inVSet(cardinality);
+  for (int i = 0; i < cardinality; ++i) {
+    inVSet[i] = (edgeSet.getEndpointSet(i) == vSet);
+  }
+  builder.vertexEdgesStart.assign(numVertices+1, 0);
+  for (int e = 0; e < numEdges; ++e) {
+    for (int i = 0; i < cardinality; ++i) {
+      if (inVSet[i]) {
+        builder.vertexEdgesStart[builder.endpoints[e*cardinality + i] + 1]++;
+      }
+    }
+  }
+  for (int v = 0; v < numVertices; ++v) {
+    builder.vertexEdgesStart[v+1] += builder.vertexEdgesStart[v];
+  }
+  builder.vertexEdges.resize(builder.vertexEdgesStart[numVertices]);
+  std::vector<int> next(builder.vertexEdgesStart.begin(),
+                        builder.vertexEdgesStart.end()-1);
+  for (int e = 0; e < numEdges; ++e) {
+    for (int i = 0; i < cardinality; ++i) {
+      if (inVSet[i]) {
+        builder.vertexEdges[next[builder.endpoints[e*cardinality + i]]++] = e;
       }
     }
-    neighbors.insert(neighbors.end(), nbr.begin(), nbr.end());
-    startIndex[v.ident+1] = neighbors.size();
   }
 
-  for (int i=0; i < vSet->getSize(); ++i) {
-    std::sort(neighbors.begin()+startIndex[i], neighbors.begin()+startIndex[i+1]);
+  // Count the neighbors of each vertex, compute the row starts with a prefix
+  // sum and then fill in the neighbors. Both passes run in parallel across
+  // vertices.
+  startIndex = (int*)malloc(sizeof(int) * (numVertices+1));
+  startIndex[0] = 0;
+  builder.startIndex = startIndex;
+  builder.neighbors = &neighbors;
+  builder.edgeLocations = &edgeLocations;
+  void *context[] = {&builder};
+
+  ThreadPool& threadPool = ThreadPool::getInstance();
+  threadPool.parallelFor(0, numVertices, countNeighborsTask, context,
+                         ThreadPool::Dynamic, 0);
+  for (int v = 0; v < numVertices; ++v) {
+    startIndex[v+1] += startIndex[v];
   }
+  neighbors.resize(startIndex[numVertices]);
+  threadPool.parallelFor(0, numVertices, fillNeighborsTask, context,
+                         ThreadPool::Dynamic, 0);
+
+  // Precompute the neighbor locations of each edge's endpoint pairs, so that
+  // assembly does not have to search the neighbor lists
+  edgeLocations.resize(numEdges * cardinality * cardinality);
+  threadPool.parallelFor(0, numEdges, fillEdgeLocationsTask, context,
+                         ThreadPool::Static, 0);
 }
 
 NeighborIndex::~NeighborIndex() {
   free(startIndex);
 }
 
-void NeighborIndex::addNoCollision(int x, std::vector<int> & a) {
-  for(unsigned int ii=0 ;ii<a.size();ii++){
-    if(a[ii]==x){
-      return;
+namespace {
+/// Shared state of the parallel pass that updates the edge locations after
+/// new edges were merged into a neighbor index.
+struct NeighborIndexUpdater {
+  const int *endpoints;
+  int cardinality;
+  int numOldEdges;
+
+  const int *oldStartIndex;
+  const int *startIndex;
+  const std::vector<int> *neighbors;
+  std::vector<int> *edgeLocations;
+
+  // Whether the row of each old vertex gained neighbors
+  const std::vector<char> *changedRows;
+};
+}
+
+// Updates the edge locations of the edges [start,end). Locations in rows that
+// did not change only move with their row, while locations in changed rows and
+// of new edges are searched for.
+static void updateEdgeLocationsTask(int start, int end, void **context) {
+  NeighborIndexUpdater *updater = (NeighborIndexUpdater*)context[0];
+  const int cardinality = updater->cardinality;
+  const int *startIndex = updater->startIndex;
+  const std::vector<int>& neighbors = *updater->neighbors;
+  std::vector<int>& edgeLocations = *updater->edgeLocations;
+  for (int e = start; e < end; ++e) {
+    const int *eps = &updater->endpoints[e * cardinality];
+    int loc = e * cardinality * cardinality;
+    for (int i = 0; i < cardinality; ++i) {
+      const int v = eps[i];
+      if (e < updater->numOldEdges && !(*updater->changedRows)[v]) {
+        const int shift = startIndex[v] - updater->oldStartIndex[v];
+        for (int j = 0; j < cardinality; ++j) {
+          edgeLocations[loc++] += shift;
+        }
+        continue;
+      }
+      auto nbrsBegin = neighbors.begin() + startIndex[v];
+      auto nbrsEnd = neighbors.begin() + startIndex[v+1];
+      for (int j = 0; j < cardinality; ++j) {
+        auto nbr = std::lower_bound(nbrsBegin, nbrsEnd, eps[j]);
+        iassert(nbr != nbrsEnd && *nbr == eps[j]);
+        edgeLocations[loc++] = nbr - neighbors.begin();
+      }
     }
   }
-  a.push_back(x);
+}
+
+void NeighborIndex::update(const Set &edgeSet) {
+  const int cardinality = edgeSet.getCardinality();
+  const int newNumEdges = edgeSet.getSize();
+  const Set* vSet = edgeSet.getEndpointSet(0);
+  const int newNumVertices = vSet->getSize();
+  iassert(newNumEdges >= numEdges && newNumVertices >= numVertices);
+  const int *endpoints = const_cast<Set&>(edgeSet).getEndpointsData();
+
+  // Gather the (vertex, neighbor) pairs contributed by the new edges
+  std::vector<std::pair<int,int>> added;
+  for (int e = numEdges; e < newNumEdges; ++e) {
+    const int *eps = &endpoints[e * cardinality];
+    for (int i = 0; i < cardinality; ++i) {
+      if (edgeSet.getEndpointSet(i) != vSet) {
+        continue;
+      }
+      for (int j = 0; j < cardinality; ++j) {
+        added.push_back({eps[i], eps[j]});
+      }
+    }
+  }
+  std::sort(added.begin(), added.end());
+  added.erase(std::unique(added.begin(), added.end()), added.end());
+
+  // Merge the new neighbors into the rows of their vertices
+  int *oldStartIndex = startIndex;
+  std::vector<int> oldNeighbors;
+  oldNeighbors.swap(neighbors);
+  std::vector<char> changedRows(newNumVertices, 0);
+
+  startIndex = (int*)malloc(sizeof(int) * (newNumVertices+1));
+  startIndex[0] = 0;
+  neighbors.reserve(oldNeighbors.size() + added.size());
+  auto next = added.begin();
+  for (int v = 0; v < newNumVertices; ++v) {
+    auto rowBegin = oldNeighbors.begin();
+    auto rowEnd = oldNeighbors.begin();
+    if (v < numVertices) {
+      rowBegin += oldStartIndex[v];
+      rowEnd += oldStartIndex[v+1];
+    }
+    auto addedEnd = next;
+    while (addedEnd != added.end() && addedEnd->first == v) {
+      ++addedEnd;
+    }
+    if (next == addedEnd) {
+      neighbors.insert(neighbors.end(), rowBegin, rowEnd);
+    }
+    else {
+      changedRows[v] = 1;
+      auto row = rowBegin;
+      for (; next != addedEnd; ++next) {
+        for (; row != rowEnd && *row < next->second; ++row) {
+          neighbors.push_back(*row);
+        }
+        if (row == rowEnd || *row != next->second) {
+          neighbors.push_back(next->second);
+        }
+      }
+      neighbors.insert(neighbors.end(), row, rowEnd);
+    }
+    startIndex[v+1] = neighbors.size();
+  }
+
+  NeighborIndexUpdater updater;
+  updater.endpoints = endpoints;
+  updater.cardinality = cardinality;
+  updater.numOldEdges = numEdges;
+  updater.oldStartIndex = oldStartIndex;
+  updater.startIndex = startIndex;
+  updater.neighbors = &neighbors;
+  updater.edgeLocations = &edgeLocations;
+  updater.changedRows = &changedRows;
+  void *context[] = {&updater};
+
+  edgeLocations.resize(newNumEdges * cardinality * cardinality);
+  ThreadPool::getInstance().parallelFor(0, newNumEdges, updateEdgeLocationsTask,
+                                        context, ThreadPool::Static, 0);
+  free(oldStartIndex);
+
+  numVertices = newNumVertices;
+  numEdges = newNumEdges;
 }
 
 }}
@@ -56,6 +56,11 @@ class NeighborIndex {
  public:
   NeighborIndex(const Set &edgeSet);
   ~NeighborIndex();
+
+  /// Bring the index up to date with an edge set that has had edges, and its
+  /// vertex set vertices, added to the end since the index was built. Only the
+  /// rows of the endpoints of the new edges are rebuilt.
+  void update(const Set &edgeSet);
   
   int getNumNeighbors(ElementRef vertex) const {
     return startIndex[vertex.ident+1] - startIndex[vertex.ident];
@@ -73,7 +78,17 @@ class NeighborIndex {
   const int* getStartIndex() const { return startIndex; }
   
   const int* getNeighborIndex() const { return neighbors.data(); }
-  
+
+  /// Get the edge location table. For edge `e` with cardinality `c`, entry
+  /// `e*c*c + i*c + j` is the location of endpoint `j` in the neighbors of
+  /// endpoint `i`, i.e. the offset of the `(i,j)` block of the edge in a
+  /// matrix indexed by this neighbor index.
+  const int* getEdgeLocations() const { return edgeLocations.data(); }
+
+  int getEdgeLocationsSize() const {
+    return edgeLocations.size();
+  }
+
  private:
   /// start index into neighbors array for vertex.
   /// the last index is total size of neighbors array, which is also the number
@@ -83,7 +98,12 @@ class NeighborIndex {
   /// which edges v belongs to
   std::vector<int> neighbors;
 
-  void addNoCollision(int x, std::vector<int> & a);
+  /// neighbor locations of the endpoint pairs of each edge
+  std::vector<int> edgeLocations;
+
+  /// number of vertices and edges the index was built for
+  int numVertices;
+  int numEdges;
 };
 
 }} // simit::internal
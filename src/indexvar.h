@@ -18,8 +18,10 @@ namespace ir {
 
     ~IndexVarContent();
     mutable long ref = 0;
-    friend inline void aquire(IndexVarContent *c) {++c->ref;}
-    friend inline void release(IndexVarContent *c) {if (--c->ref==0) delete c;}
+    friend inline void aquire(IndexVarContent *c) {util::incRef(&c->ref);}
+    friend inline void release(IndexVarContent *c) {
+      if (util::decRef(&c->ref)==0) delete c;
+    }
   };
 // }
 
@@ -5,14 +5,41 @@
 #include <string>
 
 #include "error.h"
+#include "field_layout.h"
 #include "ir.h"
 #include "program.h"
+#include "thread_pool.h"
+#include "solver.h"
 
 namespace simit {
 
 extern const std::vector<std::string> VALID_BACKENDS;
 extern std::string kBackend;
 
+extern const std::vector<std::string> VALID_SCHEDULES;
+extern unsigned kNumThreads;
+extern std::string kSchedule;
+extern unsigned kChunkSize;
+
+extern std::string kCacheDir;
+
+extern internal::SolverOptions kSolverOptions;
+
+extern bool kHardwareCounters;
+
+extern std::vector<std::string> kTargetCPUs;
+extern std::string kForcedTargetCPU;
+
+extern bool kVectorizationReport;
+
+extern bool kVectorizeBlocks;
+extern unsigned kMapVectorWidth;
+extern FieldLayout kFieldLayout;
+
+extern bool kMatrixFree;
+extern bool kCacheAssemblies;
+extern bool kSymmetricStorage;
+
 inline void init(std::string backend="cpu", int floatSize=8) {
   uassert(std::find(VALID_BACKENDS.begin(), VALID_BACKENDS.end(), backend) !=
           VALID_BACKENDS.end()) << "Invalid backend: " << backend;
@@ -20,6 +47,168 @@ inline void init(std::string backend="cpu", int floatSize=8) {
   ir::ScalarType::floatBytes = floatSize;
 }
 
+/// Execute the set loops of functions compiled after this call on
+/// `numThreads` threads of the cpu backend. Loops are scheduled "static"
+/// (each thread gets an equal share up front) or "dynamic" (threads take
+/// chunks from a shared counter), in chunks of `chunkSize` iterations (0 lets
+/// the runtime choose). A single thread compiles loops to serial code.
+inline void setNumThreads(unsigned numThreads, std::string schedule="static",
+                          unsigned chunkSize=0) {
+  uassert(numThreads > 0) << "Invalid number of threads: " << numThreads;
+  uassert(std::find(VALID_SCHEDULES.begin(), VALID_SCHEDULES.end(), schedule)
+          != VALID_SCHEDULES.end()) << "Invalid schedule: " << schedule;
+  kNumThreads = numThreads;
+  kSchedule = schedule;
+  kChunkSize = chunkSize;
+  internal::ThreadPool::getInstance().setNumThreads(numThreads);
+}
+
+/// Cache the machine code of functions compiled by the cpu backend in the
+/// directory `cacheDir`, so that later compilations of the same functions
+/// (also by other processes) skip code generation. The directory defaults to
+/// the SIMIT_CACHE_DIR environment variable, and an empty string disables the
+/// cache.
+inline void setCacheDir(std::string cacheDir) {
+  kCacheDir = cacheDir;
+}
+
+/// Solve the systems of `solve` and `\` with the given method:
+/// "conjugate-gradient" (the default), which is configured by
+/// setSolverOptions, or "direct", a sparse LDL^T factorization for symmetric
+/// matrices. Direct solves compute the fill-reducing ordering and symbolic
+/// factorization of each matrix index once, and only refactorize the values
+/// of later solves with the same index.
+inline void setSolverMethod(std::string method) {
+  kSolverOptions.method = internal::getSolverMethod(method);
+}
+
+/// Configure the conjugate gradient solver behind `solve` and `\`. The
+/// preconditioner is "none", "jacobi", "block-jacobi", "incomplete-cholesky"
+/// or "algebraic-multigrid". The multigrid hierarchy of each matrix index is
+/// built once, and only its values are recomputed by later solves with the
+/// same index. Solves stop when the residual norm falls below `tolerance`
+/// times the norm of the right hand side, or after `maxIterations`
+/// iterations (0 means the number of matrix rows).
+inline void setSolverOptions(std::string preconditioner="block-jacobi",
+                             double tolerance=1e-10,
+                             unsigned maxIterations=0) {
+  uassert(tolerance >= 0.0) << "Invalid solver tolerance: " << tolerance;
+  kSolverOptions.preconditioner = internal::getPreconditioner(preconditioner);
+  kSolverOptions.tolerance = tolerance;
+  kSolverOptions.maxIterations = maxIterations;
+}
+
+/// Returns the iteration count and relative residual of the last solve of
+/// `solve` or `\` that ran on the calling thread, whether it converged, and
+/// whether a direct solve fell back to conjugate gradient.
+/// Solves that do not converge also print a warning.
+inline internal::SolverResult getLastSolverResult() {
+  return internal::getLastSolverResult();
+}
+
+/// Also count the retired instructions and the cache misses of the timed loops
+/// of functions compiled with timers, using Linux perf events. The counters
+/// cover the thread that runs the function, and are left out of profiles if
+/// they are not available.
+inline void setHardwareCounters(bool enable) {
+  kHardwareCounters = enable;
+}
+
+/// Compile the functions of the cpu backend for several CPU variants, given
+/// as LLVM CPU names from the most to the least capable (e.g.
+/// {"skylake-avx512", "haswell", "x86-64"}). Functions run the code of the
+/// first variant that the host supports, or code for the host CPU if it
+/// supports none of them. With an object cache (see setCacheDir), the code of
+/// every variant is stored in the cache, so that a cache directory populated
+/// on one machine serves all the variants. By default code is generated for
+/// the host CPU and its features.
+inline void setTargetCPUs(const std::vector<std::string>& cpus) {
+  kTargetCPUs = cpus;
+}
+
+/// Generate the code of the cpu backend for the given LLVM CPU name, whether
+/// or not the host supports it, instead of choosing a CPU with setTargetCPUs.
+/// This is for compiling functions ahead of time for other machines (see
+/// Function::writeObject); functions compiled for a CPU whose features the
+/// host lacks must not be run. An empty name turns it off (the default).
+inline void setForcedTargetCPU(const std::string& cpu) {
+  kForcedTargetCPU = cpu;
+}
+
+/// Print LLVM's vectorization remarks for the functions compiled by the cpu
+/// backend to stderr: the loops that were vectorized, with their vectorization
+/// and interleave factors, and why the other loops were not. Functions whose
+/// code is loaded from the object cache are not optimized and get no report.
+inline void setVectorizationReport(bool enable) {
+  kVectorizationReport = enable;
+}
+
+/// Compile the loops over small dense blocks (e.g. the tensor[3,3] and
+/// tensor[3] math of element kernels) to LLVM vector instructions, with one
+/// vector lane per iteration of the loop, instead of leaving them to LLVM's
+/// vectorizers. Enabled by default.
+inline void setVectorizeBlocks(bool enable) {
+  kVectorizeBlocks = enable;
+}
+
+/// Compile the set loops of maps to process `width` elements at a time, one
+/// per vector lane, in functions compiled after this call. Endpoint fields are
+/// gathered into the lanes, results are scattered back (adds to shared
+/// locations are safe when lanes collide), and the branches of the map body
+/// are compiled as masked lanes. The elements that do not fill a vector run in
+/// the scalar loop. Loops whose bodies call functions stay scalar. A width of
+/// 1, the default, compiles maps one element at a time.
+inline void setMapVectorWidth(unsigned width) {
+  uassert(width >= 1 && width <= 16) << "Invalid map vector width: " << width;
+  kMapVectorWidth = width;
+}
+
+/// Compile functions, after this call, to access the fields whose tensors have
+/// more than one component in the given layout (see FieldLayout). The sets
+/// bound to the functions must add those fields with the same layout. With a
+/// tile that is a multiple of the map vector width, vectorized maps load and
+/// store each component of consecutive elements as a whole vector. Defaults to
+/// the array of structures layout.
+inline void setFieldLayout(FieldLayout layout) {
+  kFieldLayout = layout;
+}
+
+/// Compile functions, after this call, to multiply the system matrices that
+/// are assembled by a map and only used in matrix-vector products without
+/// assembling them: each product maps the assembly function's element
+/// contributions over the vector instead. This saves the memory and bandwidth
+/// of the matrix at the cost of recomputing the contributions for every
+/// product, which pays off when they are cheap to compute or the matrix is
+/// used in few products. Only the cpu backend supports it. Disabled by
+/// default.
+inline void setMatrixFree(bool enable) {
+  kMatrixFree = enable;
+}
+
+/// Compile functions, after this call, to keep the system matrices that are
+/// assembled by a map from their sets alone (e.g. mass matrices) between runs,
+/// instead of assembling them on every run. Before each run the function
+/// assembles a matrix again if the structure of its sets or a field it was
+/// assembled from changed. Writes with FieldRef::set, and assignments to the
+/// TensorRefs of a FieldRef and to their components, change the fields'
+/// versions, which are compared. Reads leave the versions unchanged. Fields
+/// whose data pointers were taken (FieldRef::getData or Set::getFieldData),
+/// and fields that other functions write, are compared with a copy instead.
+/// Only the cpu backend supports it. Disabled by default.
+inline void setCacheAssemblies(bool enable) {
+  kCacheAssemblies = enable;
+}
+
+/// Compile functions, after this call, to store the system matrices that are
+/// provably symmetric as their upper block-triangle, which halves their memory
+/// and the bandwidth of their products. A matrix is stored this way if it is
+/// assembled by a map over edges whose endpoints are in one set, with an
+/// assembly function that writes every off-diagonal block together with its
+/// transpose, and if it is only multiplied by vectors and solved with
+/// otherwise. Only the cpu backend supports it. Disabled by default.
+inline void setSymmetricStorage(bool enable) {
+  kSymmetricStorage = enable;
+}
 
 }  // namespace simit
 
@@ -166,17 +166,13 @@ Stmt inlineMapFunction(const Map *map, Var lv, MapFunctionRewriter &rewriter) {
                                                        {IndexDomain(cardinality),
                                                         IndexDomain(cardinality)}));
 
-    Expr nbrs_start = IndexRead::make(target, IndexRead::NeighborsStart);
-    Expr nbrs = IndexRead::make(target, IndexRead::Neighbors);
-
-    Var locVar(INTERNAL_PREFIX("locVar"), Int);
-    Stmt locStmt = CallStmt::make({locVar}, intrinsics::loc(),
-                                  {Load::make(eps,i),
-                                   Load::make(eps,j),
-                                   nbrs_start, nbrs});
-
-    Stmt locsInit = Block::make({locStmt,
-                                TensorWrite::make(locs, {i,j}, locVar)});
+    // The locations are precomputed per edge by the neighbor index, so we
+    // read them from its location table instead of searching the neighbors.
+    Expr edgeLocs = IndexRead::make(target, IndexRead::EdgeLocations);
+    Expr edgeLocsLoc = Add::make(Mul::make(Add::make(Mul::make(lv, cardinality),
+                                                     i), cardinality), j);
+    Stmt locsInit = TensorWrite::make(locs, {i,j},
+                                      Load::make(edgeLocs, edgeLocsLoc));
 
     Stmt locsInitLoop = ForRange::make(j, 0, cardinality, locsInit);
     locsInitLoop      = ForRange::make(i, 0, cardinality, locsInitLoop);
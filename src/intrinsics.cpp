@@ -1,6 +1,7 @@
 #include "intrinsics.h"
 
 #include <cassert>
+#include <mutex>
 #include "var.h"
 #include "func.h"
 
@@ -236,6 +237,22 @@ void storeTimeInit() {
                 Func::Intrinsic);
 }
 
+static Func startTimerVar;
+void startTimerInit() {
+  startTimerVar = Func("startTimer",
+                {Var("i", Int)},
+                {},
+                Func::Intrinsic);
+}
+
+static Func stopTimerVar;
+void stopTimerInit() {
+  stopTimerVar = Func("stopTimer",
+                {Var("i", Int), Var("iterations", Int)},
+                {},
+                Func::Intrinsic);
+}
+
 static Func locVar;
 void locInit() {
   locVar = Func("__loc",
@@ -255,280 +272,242 @@ void solveInit() {
 // We lazily initialize all the intrinsics. No need to call all the constructors
 // unless we will use them.
 
-const Func& mod() {
-  if (!modVar.defined()) {
+/// Initialize all the intrinsics once, so that threads that compile functions
+/// concurrently see the same intrinsics.
+static void init() {
+  static std::once_flag initialized;
+  std::call_once(initialized, []() {
     modInit();
-  }
+    sinInit();
+    cosInit();
+    tanInit();
+    asinInit();
+    acosInit();
+    atan2Init();
+    sqrtInit();
+    logInit();
+    expInit();
+    powInit();
+    normInit();
+    dotInit();
+    detInit();
+    invInit();
+    solveInit();
+    locInit();
+    freeInit();
+    mallocInit();
+    strcmpInit();
+    strlenInit();
+    strcpyInit();
+    strcatInit();
+    createComplexInit();
+    complexNormInit();
+    complexGetRealInit();
+    complexGetImagInit();
+    complexConjInit();
+    clockInit();
+    storeTimeInit();
+    startTimerInit();
+    stopTimerInit();
+  });
+}
+
+const Func& mod() {
+  init();
   return modVar;
 }
 
 const Func& sin() {
-  if (!sinVar.defined()) {
-    sinInit();
-  }
+  init();
   return sinVar;
 }
 
 const Func& cos() {
-  if (!cosVar.defined()) {
-    cosInit();
-  }
+  init();
   return cosVar;
 }
 
 const Func& tan() {
-  if (!tanVar.defined()) {
-    tanInit();
-  }
+  init();
   return tanVar;
 }
 
 const Func& asin() {
-  if (!asinVar.defined()) {
-    asinInit();
-  }
+  init();
   return asinVar;
 }
 
 const Func& acos() {
-  if (!acosVar.defined()) {
-    acosInit();
-  }
+  init();
   return acosVar;
 }
 
 const Func& atan2() {
-  if (!atan2Var.defined()) {
-    atan2Init();
-  }
+  init();
   return atan2Var;
 }
 const Func& sqrt() {
-  if (!sqrtVar.defined()) {
-    sqrtInit();
-  }
+  init();
   return sqrtVar;
 }
 
 const Func& log() {
-  if (!logVar.defined()) {
-    logInit();
-  }
+  init();
   return logVar;
 }
 
 const Func& exp() {
-  if (!expVar.defined()) {
-    expInit();
-  }
+  init();
   return expVar;
 }
 
 
 const Func& pow() {
-  if (!powVar.defined()) {
-    powInit();
-  }
+  init();
   return powVar;
 }
 
 const Func& norm() {
-  if (!normVar.defined()) {
-    normInit();
-  }
+  init();
   return normVar;
 }
 
 const Func& dot() {
-  if (!dotVar.defined()) {
-    dotInit();
-  }
+  init();
   return dotVar;
 }
 
 const Func& det() {
-  if (!detVar.defined()) {
-    detInit();
-  }
+  init();
   return detVar;
 }
 
 const Func& inv() {
-  if (!invVar.defined()) {
-    invInit();
-  }
+  init();
   return invVar;
 }
 
 const Func& solve() {
-  if (!solveVar.defined()) {
-    solveInit();
-  }
+  init();
   return solveVar;
 }
 
 const Func& loc() {
-  if (!locVar.defined()) {
-    locInit();
-  }
+  init();
   return locVar;
 }
 
 const Func& free() {
-  if (!freeVar.defined()) {
-    freeInit();
-  }
+  init();
   return freeVar;
 }
 
 const Func& malloc() {
-  if (!mallocVar.defined()) {
-    mallocInit();
-  }
+  init();
   return mallocVar;
 }
 
 const Func& strcmp() {
-  if (!strcmpVar.defined()) {
-    strcmpInit();
-  }
+  init();
   return strcmpVar;
 }
 
 const Func& strlen() {
-  if (!strlenVar.defined()) {
-    strlenInit();
-  }
+  init();
   return strlenVar;
 }
 
 const Func& strcpy() {
-  if (!strcpyVar.defined()) {
-    strcpyInit();
-  }
+  init();
   return strcpyVar;
 }
 
 const Func& strcat() {
-  if (!strcatVar.defined()) {
-    strcatInit();
-  }
+  init();
   return strcatVar;
 }
 
 const Func& createComplex() {
-  if (!createComplexVar.defined()) {
-    createComplexInit();
-  }
+  init();
   return createComplexVar;
 }
 
 const Func& complexNorm() {
-  if (!complexNormVar.defined()) {
-    complexNormInit();
-  }
+  init();
   return complexNormVar;
 }
 
 const Func& complexGetReal() {
-  if (!complexGetRealVar.defined()) {
-    complexGetRealInit();
-  }
+  init();
   return complexGetRealVar;
 }
 
 const Func& complexGetImag() {
-  if (!complexGetImagVar.defined()) {
-    complexGetImagInit();
-  }
+  init();
   return complexGetImagVar;
 }
 
 const Func& complexConj() {
-  if (!complexConjVar.defined()) {
-    complexConjInit();
-  }
+  init();
   return complexConjVar;
 }
 
 const Func& clock() {
-  if (!clockVar.defined()) {
-    clockInit();
-  }
+  init();
   return clockVar;
 }
 
 const Func& storeTime() {
-  if (!storeTimeVar.defined()) {
-    storeTimeInit();
-  }
+  init();
   return storeTimeVar;
 }
 
+const Func& startTimer() {
+  init();
+  return startTimerVar;
+}
+
+const Func& stopTimer() {
+  init();
+  return stopTimerVar;
+}
+
 const std::map<std::string,Func> &byNames() {
-  static std::map<std::string,Func> byNameMap;
-  if (byNameMap.size() == 0) {
-    modInit();
-    sinInit();
-    cosInit();
-    tanInit();
-    asinInit();
-    acosInit();
-    atan2Init();
-    sqrtInit();
-    logInit();
-    expInit();
-    powInit();
-    normInit();
-    dotInit();
-    detInit();
-    invInit();
-    solveInit();
-    locInit();
-    freeInit();
-    mallocInit();
-    strcmpInit();
-    strlenInit();
-    strcpyInit();
-    strcatInit();
-    createComplexInit();
-    complexNormInit();
-    complexGetRealInit();
-    complexGetImagInit();
-    complexConjInit();
-    clockInit();
-    storeTimeInit();
-    byNameMap.insert({{"mod",modVar},
-                      {"sin",sinVar},
-                      {"cos",cosVar},
-                      {"tan",tanVar},
-                      {"asin",asinVar},
-                      {"acos",acosVar},
-                      {"atan2",atan2Var},
-                      {"sqrt",sqrtVar},
-                      {"log",logVar},
-                      {"exp",expVar},
-                      {"pow",powVar},
-                      {"norm",normVar},
-                      {"dot",dotVar},
-                      {"det",detVar},
-                      {"inv",invVar},
-                      {"free", freeVar},
-                      {"malloc", mallocVar},
-                      {"strcmp", strcmpVar},
-                      {"strlen", strlenVar},
-                      {"strcpy", strcpyVar},
-                      {"strcat", strcatVar},
-                      {"createComplex",createComplexVar},
-                      {"complexNorm",complexNormVar},
-                      {"complexGetReal",complexGetRealVar},
-                      {"complexGetImag",complexGetImagVar},
-                      {"complexConj",complexConjVar},
-                      {"clock",clockVar},
-                      {"storeTime",storeTimeVar},
-                      {"__loc", locVar},
-                      {"__solve",solveVar}});
-  }
+  init();
+  static const std::map<std::string,Func> byNameMap = {
+    {"mod",modVar},
+    {"sin",sinVar},
+    {"cos",cosVar},
+    {"tan",tanVar},
+    {"asin",asinVar},
+    {"acos",acosVar},
+    {"atan2",atan2Var},
+    {"sqrt",sqrtVar},
+    {"log",logVar},
+    {"exp",expVar},
+    {"pow",powVar},
+    {"norm",normVar},
+    {"dot",dotVar},
+    {"det",detVar},
+    {"inv",invVar},
+    {"free", freeVar},
+    {"malloc", mallocVar},
+    {"strcmp", strcmpVar},
+    {"strlen", strlenVar},
+    {"strcpy", strcpyVar},
+    {"strcat", strcatVar},
+    {"createComplex",createComplexVar},
+    {"complexNorm",complexNormVar},
+    {"complexGetReal",complexGetRealVar},
+    {"complexGetImag",complexGetImagVar},
+    {"complexConj",complexConjVar},
+    {"clock",clockVar},
+    {"storeTime",storeTimeVar},
+    {"startTimer",startTimerVar},
+    {"stopTimer",stopTimerVar},
+    {"__loc", locVar},
+    {"__solve",solveVar}
+  };
   return byNameMap;
 }
 
@@ -41,6 +41,8 @@ const Func& complexGetReal();
 const Func& complexGetImag();
 const Func& clock();
 const Func& storeTime();
+const Func& startTimer();
+const Func& stopTimer();
 const Func& loc();
 const Func& solve();
 
@@ -10,6 +10,18 @@ template<typename T> void aquire(const T *);
 template<typename T> void release(const T *);
 /// @}
 
+/// Increment and decrement a reference count and return the new count. The
+/// counts are updated atomically, since IR that is shared between functions is
+/// (un)referenced by threads that compile the functions concurrently.
+/// @{
+inline long incRef(long *ref) {
+  return __atomic_add_fetch(ref, 1, __ATOMIC_RELAXED);
+}
+inline long decRef(long *ref) {
+  return __atomic_sub_fetch(ref, 1, __ATOMIC_ACQ_REL);
+}
+/// @}
+
 /// This class provides an intrusive pointer, which is a pointer that stores its
 /// reference count in the managed class.  The managed class must therefore have
 /// a reference count field and provide two functions 'aquire' and 'release'
@@ -18,8 +30,8 @@ template<typename T> void release(const T *);
 /// For example:
 /// struct X {
 ///   mutable long ref = 0;
-///   friend void aquire(const X *x) { ++x->ref; }
-///   friend void release(const X *x) { if (--x->ref ==0) delete x; }
+///   friend void aquire(const X *x) { incRef(&x->ref); }
+///   friend void release(const X *x) { if (decRef(&x->ref)==0) delete x; }
 /// };
 template <class T>
 class IntrusivePtr {
@@ -25,8 +25,10 @@ public:
 
 private:
   mutable long ref = 0;
-  friend void aquire(const IRNode *node) {++node->ref;}
-  friend void release(const IRNode *node) {if (--node->ref == 0) delete node;}
+  friend void aquire(const IRNode *node) {util::incRef(&node->ref);}
+  friend void release(const IRNode *node) {
+    if (util::decRef(&node->ref) == 0) delete node;
+  }
 };
 
 std::ostream &operator<<(std::ostream &os, const IRNode &);
@@ -199,10 +201,11 @@ struct Length : public ExprNode {
 };
 
 /// An IndexRead retrieves an index from an edge set.  An example of an index
-/// is the endpoints of the edges in the set.
+/// is the endpoints of the edges in the set. EdgeLocations is the location
+/// table of the neighbor index (see NeighborIndex::getEdgeLocations).
 /// TODO DEPRECATED: This node has been deprecated with the old lowering pass
 struct IndexRead : public ExprNode {
-  enum Kind { Endpoints=0, NeighborsStart=1, Neighbors=2 };
+  enum Kind { Endpoints=0, NeighborsStart=1, Neighbors=2, EdgeLocations=3 };
   Expr edgeSet;
   Kind kind;
   static Expr make(Expr edgeSet, Kind kind);
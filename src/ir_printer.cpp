@@ -198,6 +198,9 @@ void IRPrinter::visit(const IndexRead *op) {
     case IndexRead::Neighbors:
       os << "neighbors";
       break;
+    case IndexRead::EdgeLocations:
+      os << "neighbors.locations";
+      break;
   }
 }
 
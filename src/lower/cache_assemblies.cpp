@@ -0,0 +1,381 @@
+#include "cache_assemblies.h"
+
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ir_rewriter.h"
+#include "ir_visitor.h"
+#include "path_expressions.h"
+#include "storage.h"
+#include "tensor_index.h"
+#include "util/collections.h"
+
+using namespace std;
+
+namespace simit {
+namespace ir {
+
+/// Returns the variable or field of a tensor write, e.g. `A` in `A(i)(j) = v`.
+static Expr getWrittenTensor(Expr tensor) {
+  while (isa<TensorRead>(tensor)) {
+    tensor = to<TensorRead>(tensor)->tensor;
+  }
+  return tensor;
+}
+
+/// Collects the variables of a function: its arguments, results and
+/// constants, and the variables its body declares or assigns.
+class FunctionVars : public IRVisitor {
+public:
+  FunctionVars(const Func& func) {
+    vars.insert(func.getArguments().begin(), func.getArguments().end());
+    vars.insert(func.getResults().begin(), func.getResults().end());
+    for (auto& constant : func.getEnvironment().getConstants()) {
+      vars.insert(constant.first);
+    }
+    func.getBody().accept(this);
+  }
+
+  std::set<Var> vars;
+
+private:
+  using IRVisitor::visit;
+
+  void visit(const VarDecl* op) {
+    vars.insert(op->var);
+  }
+
+  void visit(const AssignStmt* op) {
+    vars.insert(op->var);
+    IRVisitor::visit(op);
+  }
+
+  void visit(const ForRange* op) {
+    vars.insert(op->var);
+    IRVisitor::visit(op);
+  }
+
+  void visit(const For* op) {
+    vars.insert(op->var);
+    IRVisitor::visit(op);
+  }
+
+  void visit(const CallStmt* op) {
+    vars.insert(op->results.begin(), op->results.end());
+    IRVisitor::visit(op);
+  }
+};
+
+/// Collects the fields an assembly function and the functions it calls read,
+/// by the sets of the mapped elements they belong to. Flags the functions that
+/// read anything else that may change between calls, such as variables of the
+/// caller or fields of sets, and the functions that write fields.
+class AssemblyReads : public IRVisitor {
+public:
+  /// `elementSets` are the element types of the mapped sets and their names.
+  AssemblyReads(const vector<pair<Type,string>>& elementSets)
+      : elementSets(elementSets), supported(true) {}
+
+  void analyze(const Func& func) {
+    if (util::contains(analyzed, func)) {
+      return;
+    }
+    analyzed.insert(func);
+
+    // Intrinsics and external functions only read their arguments
+    if (func.getKind() != Func::Internal) {
+      return;
+    }
+    set<Var> callerVars = vars;
+    vars = FunctionVars(func).vars;
+    func.getBody().accept(this);
+    vars = callerVars;
+  }
+
+  const vector<pair<Type,string>>& elementSets;
+  bool supported;
+
+  /// The fields that are read, as pairs of set and field names.
+  set<pair<string,string>> fields;
+
+private:
+  set<Func> analyzed;
+  set<Var> vars;
+
+  using IRVisitor::visit;
+
+  void visit(const VarExpr* op) {
+    if (!util::contains(vars, op->var)) {
+      supported = false;
+    }
+  }
+
+  void visit(const FieldRead* op) {
+    Type type = op->elementOrSet.type();
+    bool mapped = false;
+    if (type.isElement()) {
+      for (auto& elementSet : elementSets) {
+        if (elementSet.first == type) {
+          fields.insert({elementSet.second, op->fieldName});
+          mapped = true;
+        }
+      }
+    }
+    if (!mapped) {
+      supported = false;
+    }
+    IRVisitor::visit(op);
+  }
+
+  void visit(const FieldWrite* op) {
+    supported = false;
+  }
+
+  void visit(const TensorWrite* op) {
+    if (isa<FieldRead>(getWrittenTensor(op->tensor))) {
+      supported = false;
+    }
+    IRVisitor::visit(op);
+  }
+
+  void visit(const CallStmt* op) {
+    IRVisitor::visit(op);
+    analyze(op->callee);
+  }
+
+  void visit(const Map* op) {
+    supported = false;
+  }
+};
+
+/// Collects the names of the fields that are written by a statement, by the
+/// functions it calls and by the functions it maps.
+class WrittenFields : public IRVisitorCallGraph {
+public:
+  set<string> fields;
+
+private:
+  using IRVisitorCallGraph::visit;
+
+  void visit(const FieldWrite* op) {
+    fields.insert(op->fieldName);
+    IRVisitorCallGraph::visit(op);
+  }
+
+  void visit(const TensorWrite* op) {
+    Expr tensor = getWrittenTensor(op->tensor);
+    if (isa<FieldRead>(tensor)) {
+      fields.insert(to<FieldRead>(tensor)->fieldName);
+    }
+    IRVisitorCallGraph::visit(op);
+  }
+};
+
+/// Counts the statements that write a variable, and the assignments of
+/// literals to it among them.
+class VarWrites : public IRVisitor {
+public:
+  VarWrites(const Var& var) : var(var), numWrites(0), numLiteralAssigns(0) {}
+
+  const Var& var;
+  int numWrites;
+  int numLiteralAssigns;
+
+private:
+  using IRVisitor::visit;
+
+  void visit(const AssignStmt* op) {
+    if (op->var == var) {
+      ++numWrites;
+      if (isa<Literal>(op->value) && op->cop == CompoundOperator::None) {
+        ++numLiteralAssigns;
+      }
+    }
+    IRVisitor::visit(op);
+  }
+
+  void visit(const TensorWrite* op) {
+    Expr tensor = getWrittenTensor(op->tensor);
+    if (isa<VarExpr>(tensor) && to<VarExpr>(tensor)->var == var) {
+      ++numWrites;
+    }
+    IRVisitor::visit(op);
+  }
+
+  void visit(const CallStmt* op) {
+    if (util::contains(op->results, var)) {
+      ++numWrites;
+    }
+    IRVisitor::visit(op);
+  }
+
+  void visit(const Map* op) {
+    if (util::contains(op->vars, var)) {
+      ++numWrites;
+    }
+    IRVisitor::visit(op);
+  }
+};
+
+/// Guards the maps that can be cached with the flags of cached assemblies.
+/// Maps in loops and conditionals are not cached, since they may run a
+/// different number of times per call.
+class CacheAssembliesRewriter : public IRRewriter {
+public:
+  CacheAssembliesRewriter(Func* func) : func(func) {
+    class DeclaredVars : public IRVisitor {
+    public:
+      set<Var>* vars;
+      DeclaredVars(set<Var>* vars) : vars(vars) {}
+      using IRVisitor::visit;
+      void visit(const VarDecl* op) {
+        vars->insert(op->var);
+      }
+    };
+    DeclaredVars declaredVars(&declared);
+    func->getBody().accept(&declaredVars);
+
+    WrittenFields writtenFields;
+    func->getBody().accept(&writtenFields);
+    fieldsWritten = writtenFields.fields;
+  }
+
+private:
+  Func* func;
+  set<Var> declared;
+  set<string> fieldsWritten;
+
+  using IRRewriter::visit;
+
+  void visit(const ForRange* op) {
+    stmt = op;
+  }
+
+  void visit(const For* op) {
+    stmt = op;
+  }
+
+  void visit(const While* op) {
+    stmt = op;
+  }
+
+  void visit(const IfThenElse* op) {
+    stmt = op;
+  }
+
+  void visit(const Kernel* op) {
+    stmt = op;
+  }
+
+  void visit(const Map* op) {
+    stmt = op;
+    if (op->vars.size() != 1 || !isa<VarExpr>(op->target)) {
+      return;
+    }
+
+    // The matrix must be a global temporary of the backend, which keeps its
+    // buffer between calls
+    const Var& matrix = op->vars[0];
+    const Storage& storage = func->getStorage();
+    if (!isSystemTensorType(matrix.getType()) ||
+        matrix.getType().toTensor()->order() != 2 ||
+        !util::contains(declared, matrix) || !storage.hasStorage(matrix) ||
+        storage.getStorage(matrix).getKind() != TensorStorage::Indexed ||
+        !storage.getStorage(matrix).getTensorIndex().getPathExpression()
+            .defined()) {
+      return;
+    }
+    VarWrites matrixWrites(matrix);
+    func->getBody().accept(&matrixWrites);
+    if (matrixWrites.numWrites != 1) {
+      return;
+    }
+
+    // The partial arguments must be the same on every call
+    for (auto& actual : op->partial_actuals) {
+      if (isa<Literal>(actual)) {
+        continue;
+      }
+      if (!isa<VarExpr>(actual)) {
+        return;
+      }
+      const Var& var = to<VarExpr>(actual)->var;
+      bool constant = false;
+      for (auto& global : func->getEnvironment().getConstants()) {
+        if (global.first == var) {
+          constant = true;
+        }
+      }
+      if (constant) {
+        continue;
+      }
+      VarWrites varWrites(var);
+      func->getBody().accept(&varWrites);
+      if (util::contains(func->getArguments(), var) ||
+          util::contains(func->getResults(), var) ||
+          varWrites.numWrites != 1 || varWrites.numLiteralAssigns != 1) {
+        return;
+      }
+    }
+
+    // The assembly must only read the fields of the mapped sets, which must be
+    // bound to the function, and nothing may write those fields
+    vector<pair<Type,string>> elementSets;
+    vector<Expr> sets = {op->target};
+    for (Expr* endpointSet : op->target.type().toSet()->endpointSets) {
+      sets.push_back(*endpointSet);
+    }
+    for (auto& set : sets) {
+      if (!isa<VarExpr>(set)) {
+        return;
+      }
+      const Var& var = to<VarExpr>(set)->var;
+      if (!util::contains(func->getArguments(), var) &&
+          !func->getEnvironment().hasExtern(var.getName())) {
+        return;
+      }
+      elementSets.push_back({set.type().toSet()->elementType, var.getName()});
+    }
+    AssemblyReads reads(elementSets);
+    reads.analyze(op->function);
+    if (!reads.supported) {
+      return;
+    }
+    for (auto& field : reads.fields) {
+      if (util::contains(fieldsWritten, field.second)) {
+        return;
+      }
+    }
+
+    Type flagType = TensorType::make(ScalarType::Int, {IndexDomain(1)});
+    Var flag(INTERNAL_PREFIX(matrix.getName() + "_assembled"), flagType);
+    CachedAssembly cachedAssembly(matrix, flag);
+    for (auto& elementSet : elementSets) {
+      if (!util::contains(cachedAssembly.getSets(), elementSet.second)) {
+        cachedAssembly.addSet(elementSet.second);
+      }
+    }
+    for (auto& field : reads.fields) {
+      cachedAssembly.addField(field.first, field.second);
+    }
+    func->getEnvironment().addCachedAssembly(cachedAssembly);
+    func->getStorage().add(flag, TensorStorage::Kind::Dense);
+
+    Expr assembled = TensorRead::make(flag, {Literal::make(0)});
+    stmt = IfThenElse::make(Eq::make(assembled, Literal::make(0)),
+                            Block::make(op, TensorWrite::make(flag,
+                                {Literal::make(0)}, Literal::make(1))));
+  }
+};
+
+Func cacheAssemblies(Func func) {
+  Stmt body = CacheAssembliesRewriter(&func).rewrite(func.getBody());
+  if (body == func.getBody()) {
+    return func;
+  }
+  return Func(func, body);
+}
+
+}}
@@ -0,0 +1,20 @@
+#ifndef SIMIT_CACHE_ASSEMBLIES_H
+#define SIMIT_CACHE_ASSEMBLIES_H
+
+#include "ir.h"
+
+namespace simit {
+namespace ir {
+
+/// Keep the system matrices that are assembled by a map from a function's
+/// sets alone, such as mass matrices, between calls of the function, and only
+/// assemble them again when the sets they are assembled from change. Each such
+/// map is guarded by the flag of a CachedAssembly added to the environment. A
+/// matrix is cached if its map is not nested in control flow, if nothing else
+/// writes it, if the assembly function only reads the fields of the mapped
+/// elements and constants, if its partial arguments are literals, and if the
+/// function writes none of the fields it reads.
+Func cacheAssemblies(Func func);
+
+}}
+#endif
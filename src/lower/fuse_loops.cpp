@@ -0,0 +1,640 @@
+#include "fuse_loops.h"
+
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "intrinsics.h"
+#include "ir_rewriter.h"
+#include "ir_visitor.h"
+#include "var_replace_rewriter.h"
+#include "util/collections.h"
+
+using namespace std;
+
+namespace simit {
+namespace ir {
+
+// A buffer is a variable, or a field of a set
+typedef pair<Var,string> Buffer;
+
+struct Access {
+  Expr index;  // undefined if the whole buffer is accessed
+  bool write;
+};
+
+static bool getConstant(const Expr& expr, int* value) {
+  if (isa<Literal>(expr)) {
+    Type type = expr.type();
+    if (!isScalar(type) || !type.toTensor()->getComponentType().isInt()) {
+      return false;
+    }
+    *value = ((int*)to<Literal>(expr)->data)[0];
+    return true;
+  }
+  if (isa<Length>(expr)) {
+    const IndexSet& indexSet = to<Length>(expr)->indexSet;
+    if (indexSet.getKind() != IndexSet::Range) {
+      return false;
+    }
+    *value = indexSet.getSize();
+    return true;
+  }
+  int a, b;
+  if (isa<Add>(expr) && getConstant(to<Add>(expr)->a, &a) &&
+      getConstant(to<Add>(expr)->b, &b)) {
+    *value = a + b;
+    return true;
+  }
+  if (isa<Mul>(expr) && getConstant(to<Mul>(expr)->a, &a) &&
+      getConstant(to<Mul>(expr)->b, &b)) {
+    *value = a * b;
+    return true;
+  }
+  return false;
+}
+
+static bool equals(const Expr& a, const Expr& b) {
+  if (a == b) {
+    return true;
+  }
+  if (isa<VarExpr>(a) && isa<VarExpr>(b)) {
+    return to<VarExpr>(a)->var == to<VarExpr>(b)->var;
+  }
+  int aValue, bValue;
+  if (getConstant(a, &aValue) && getConstant(b, &bValue)) {
+    return aValue == bValue;
+  }
+  if (isa<Length>(a) && isa<Length>(b)) {
+    const IndexSet& aSet = to<Length>(a)->indexSet;
+    const IndexSet& bSet = to<Length>(b)->indexSet;
+    return aSet.getKind() == IndexSet::Set && bSet.getKind() == IndexSet::Set &&
+           equals(aSet.getSet(), bSet.getSet());
+  }
+  if ((isa<Add>(a) && isa<Add>(b)) || (isa<Sub>(a) && isa<Sub>(b)) ||
+      (isa<Mul>(a) && isa<Mul>(b))) {
+    return equals(to<BinaryExpr>(a)->a, to<BinaryExpr>(b)->a) &&
+           equals(to<BinaryExpr>(a)->b, to<BinaryExpr>(b)->b);
+  }
+  return false;
+}
+
+static bool isImpure(const Func& callee) {
+  return callee.getKind() != Func::Intrinsic ||
+         callee == intrinsics::free()     ||
+         callee == intrinsics::malloc()   ||
+         callee == intrinsics::strcpy()   ||
+         callee == intrinsics::strcat()   ||
+         callee == intrinsics::clock()    ||
+         callee == intrinsics::storeTime()||
+         callee == intrinsics::startTimer()||
+         callee == intrinsics::stopTimer()||
+         callee == intrinsics::solve();
+}
+
+/// Collects the buffers a statement reads and writes, ignoring the variables
+/// it declares itself. Statements whose effects are not understood (prints,
+/// calls to functions with side effects, and unlowered writes) are barriers
+/// that nothing can be moved across.
+class StmtAccesses : public IRVisitor {
+public:
+  map<Buffer,vector<Access>> accesses;
+  bool barrier = false;
+
+  // Locals that hold the loop variable of the statement
+  set<Var> loopVarCopies;
+
+  // The value ranges of the variables of loops with constant bounds
+  map<Var,pair<int,int>> ranges;
+
+  StmtAccesses(const Stmt& stmt, const Var& loopVar=Var()) {
+    if (loopVar.defined()) {
+      locals.insert(loopVar);
+    }
+    stmt.accept(this);
+    for (auto& assignment : localAssignments) {
+      if (assignment.second.size() == 1 &&
+          isa<VarExpr>(assignment.second[0]) &&
+          to<VarExpr>(assignment.second[0])->var == loopVar) {
+        loopVarCopies.insert(assignment.first);
+      }
+    }
+  }
+
+  /// Records the buffers an expression reads, e.g. the bounds of a loop.
+  void read(const Expr& expr) {
+    if (expr.defined()) {
+      expr.accept(this);
+    }
+  }
+
+  bool isLocal(const Var& var) const {
+    return util::contains(locals, var);
+  }
+
+  bool reads(const Buffer& buffer) const {
+    return accesses.find(buffer) != accesses.end();
+  }
+
+  bool writes(const Buffer& buffer) const {
+    auto it = accesses.find(buffer);
+    if (it != accesses.end()) {
+      for (const Access& access : it->second) {
+        if (access.write) {
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  /// True if the statements conflict, so that they cannot be reordered.
+  bool conflicts(const StmtAccesses& other) const {
+    if (barrier || other.barrier) {
+      return true;
+    }
+    for (auto& buffer : accesses) {
+      if (other.reads(buffer.first) &&
+          (writes(buffer.first) || other.writes(buffer.first))) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+private:
+  set<Var> locals;
+  map<Var,vector<Expr>> localAssignments;
+
+  void access(const Buffer& buffer, const Expr& index, bool write) {
+    if (!util::contains(locals, buffer.first)) {
+      accesses[buffer].push_back({index, write});
+    }
+  }
+
+  // Record an access to the buffer of a Load or Store. Returns false if the
+  // buffer is not a variable or a set field.
+  bool accessBuffer(const Expr& buffer, const Expr& index, bool write) {
+    if (isa<VarExpr>(buffer)) {
+      access(Buffer(to<VarExpr>(buffer)->var, ""), index, write);
+      return true;
+    }
+    if (isa<FieldRead>(buffer)) {
+      const FieldRead* fieldRead = to<FieldRead>(buffer);
+      if (isa<VarExpr>(fieldRead->elementOrSet)) {
+        access(Buffer(to<VarExpr>(fieldRead->elementOrSet)->var,
+                      fieldRead->fieldName), index, write);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  using IRVisitor::visit;
+
+  void visit(const VarExpr* op) {
+    access(Buffer(op->var, ""), Expr(), false);
+  }
+
+  void visit(const FieldRead* op) {
+    if (!accessBuffer(op, Expr(), false)) {
+      IRVisitor::visit(op);
+    }
+  }
+
+  void visit(const Load* op) {
+    if (!accessBuffer(op->buffer, op->index, false)) {
+      op->buffer.accept(this);
+    }
+    op->index.accept(this);
+  }
+
+  void visit(const Store* op) {
+    if (!accessBuffer(op->buffer, op->index, true)) {
+      barrier = true;
+    }
+    if (op->cop != CompoundOperator::None) {
+      accessBuffer(op->buffer, op->index, false);
+    }
+    op->index.accept(this);
+    op->value.accept(this);
+  }
+
+  void visit(const VarDecl* op) {
+    locals.insert(op->var);
+  }
+
+  void visit(const AssignStmt* op) {
+    if (util::contains(locals, op->var)) {
+      localAssignments[op->var].push_back(op->value);
+    }
+    access(Buffer(op->var, ""), Expr(), true);
+    if (op->cop != CompoundOperator::None) {
+      access(Buffer(op->var, ""), Expr(), false);
+    }
+    op->value.accept(this);
+  }
+
+  void visit(const FieldWrite* op) {
+    if (isa<VarExpr>(op->elementOrSet)) {
+      access(Buffer(to<VarExpr>(op->elementOrSet)->var, op->fieldName),
+             Expr(), true);
+    }
+    else {
+      barrier = true;
+    }
+    op->value.accept(this);
+  }
+
+  void visit(const TensorWrite* op) {
+    barrier = true;
+  }
+
+  void visit(const CallStmt* op) {
+    if (isImpure(op->callee)) {
+      barrier = true;
+    }
+    for (const Var& result : op->results) {
+      access(Buffer(result, ""), Expr(), true);
+    }
+    IRVisitor::visit(op);
+  }
+
+  void visit(const Print* op) {
+    barrier = true;
+  }
+
+  void visit(const ForRange* op) {
+    locals.insert(op->var);
+    int start, end;
+    if (getConstant(op->start, &start) && getConstant(op->end, &end) &&
+        start < end) {
+      ranges[op->var] = pair<int,int>(start, end-1);
+    }
+    IRVisitor::visit(op);
+  }
+
+  void visit(const For* op) {
+    locals.insert(op->var);
+    if (op->domain.kind == ForDomain::IndexSet &&
+        op->domain.indexSet.getKind() == IndexSet::Range &&
+        op->domain.indexSet.getSize() > 0) {
+      ranges[op->var] = pair<int,int>(0, op->domain.indexSet.getSize()-1);
+    }
+    IRVisitor::visit(op);
+  }
+
+  void visit(const While* op) {
+    // Loops with unknown trip counts are left in place
+    barrier = true;
+  }
+};
+
+/// Fuses loops in every block of a function.
+class FuseLoops : public IRRewriter {
+public:
+  using IRRewriter::visit;
+
+  void visit(const Block* op) {
+    vector<Stmt> stmts;
+    flatten(op, &stmts);
+    for (Stmt& s : stmts) {
+      s = rewrite(s);
+    }
+    stmt = Block::make(fuse(stmts));
+  }
+
+private:
+  static void flatten(const Stmt& s, vector<Stmt>* stmts) {
+    if (isa<Block>(s)) {
+      const Block* block = to<Block>(s);
+      flatten(block->first, stmts);
+      if (block->rest.defined()) {
+        flatten(block->rest, stmts);
+      }
+    }
+    else if (isa<Comment>(s) && to<Comment>(s)->commentedStmt.defined()) {
+      const Comment* comment = to<Comment>(s);
+      stmts->push_back(Comment::make(comment->comment, Stmt(), false,
+                                     comment->headerSpace));
+      flatten(comment->commentedStmt, stmts);
+    }
+    else {
+      stmts->push_back(s);
+    }
+  }
+
+  static Stmt unwrapScopes(Stmt s) {
+    while (isa<Scope>(s)) {
+      s = to<Scope>(s)->scopedStmt;
+    }
+    return s;
+  }
+
+  // Loops are wrapped in a scope that holds the loop variable. Returns the
+  // loop, or an undefined Stmt if `s` is not a loop.
+  static Stmt getLoop(const Stmt& s) {
+    Stmt loop = unwrapScopes(s);
+    return (isa<For>(loop) || isa<ForRange>(loop)) ? loop : Stmt();
+  }
+
+  static Var getLoopVar(const Stmt& loop) {
+    return isa<For>(loop) ? to<For>(loop)->var : to<ForRange>(loop)->var;
+  }
+
+  static Stmt getLoopBody(const Stmt& loop) {
+    return unwrapScopes(isa<For>(loop) ? to<For>(loop)->body
+                                       : to<ForRange>(loop)->body);
+  }
+
+  // The accesses of a loop body, together with the reads of the loop bounds,
+  // so that statements that change the trip count are not moved above it
+  static StmtAccesses* getLoopAccesses(const Stmt& loop,
+                                       const vector<Stmt>& body) {
+    StmtAccesses* accesses = new StmtAccesses(Block::make(body),
+                                              getLoopVar(loop));
+    if (isa<ForRange>(loop)) {
+      accesses->read(to<ForRange>(loop)->start);
+      accesses->read(to<ForRange>(loop)->end);
+    }
+    else {
+      const ForDomain& domain = to<For>(loop)->domain;
+      if (domain.kind == ForDomain::IndexSet) {
+        if (domain.indexSet.getKind() == IndexSet::Set) {
+          accesses->read(domain.indexSet.getSet());
+        }
+      }
+      else {
+        accesses->read(domain.set);
+      }
+    }
+    return accesses;
+  }
+
+  static bool isSameDomain(const Stmt& a, const Stmt& b) {
+    if (isa<For>(a) && isa<For>(b)) {
+      const ForDomain& aDomain = to<For>(a)->domain;
+      const ForDomain& bDomain = to<For>(b)->domain;
+      if (aDomain.kind != ForDomain::IndexSet ||
+          bDomain.kind != ForDomain::IndexSet) {
+        return false;
+      }
+      const IndexSet& aSet = aDomain.indexSet;
+      const IndexSet& bSet = bDomain.indexSet;
+      if (aSet.getKind() != bSet.getKind()) {
+        return false;
+      }
+      switch (aSet.getKind()) {
+        case IndexSet::Range:
+          return aSet.getSize() == bSet.getSize();
+        case IndexSet::Set:
+          return equals(aSet.getSet(), bSet.getSet());
+        case IndexSet::Dynamic:
+        case IndexSet::Single:
+          return false;
+      }
+    }
+    if (isa<ForRange>(a) && isa<ForRange>(b)) {
+      const ForRange* aRange = to<ForRange>(a);
+      const ForRange* bRange = to<ForRange>(b);
+      return equals(aRange->start, bRange->start) &&
+             equals(aRange->end, bRange->end);
+    }
+    return false;
+  }
+
+  // Computes the range of values of an expression over the iterations of the
+  // inner loops with constant bounds.
+  static bool getRange(const Expr& expr, const StmtAccesses& accesses,
+                       int* lo, int* hi) {
+    int value;
+    if (getConstant(expr, &value)) {
+      *lo = *hi = value;
+      return true;
+    }
+    if (isa<VarExpr>(expr)) {
+      auto it = accesses.ranges.find(to<VarExpr>(expr)->var);
+      if (it == accesses.ranges.end()) {
+        return false;
+      }
+      *lo = it->second.first;
+      *hi = it->second.second;
+      return true;
+    }
+    if (isa<Add>(expr) || isa<Mul>(expr)) {
+      const BinaryExpr* binary = to<BinaryExpr>(expr);
+      int aLo, aHi, bLo, bHi;
+      if (!getRange(binary->a, accesses, &aLo, &aHi) ||
+          !getRange(binary->b, accesses, &bLo, &bHi)) {
+        return false;
+      }
+      if (isa<Add>(expr)) {
+        *lo = aLo + bLo;
+        *hi = aHi + bHi;
+        return true;
+      }
+      if (aLo < 0 || bLo < 0) {
+        return false;
+      }
+      *lo = aLo * bLo;
+      *hi = aHi * bHi;
+      return true;
+    }
+    return false;
+  }
+
+  static bool isLoopVar(const Expr& expr, const Var& loopVar,
+                        const StmtAccesses& accesses) {
+    return isa<VarExpr>(expr) &&
+           (to<VarExpr>(expr)->var == loopVar ||
+            util::contains(accesses.loopVarCopies, to<VarExpr>(expr)->var));
+  }
+
+  // Matches `loopVar` and `loopVar * stride`
+  static bool getStride(const Expr& expr, const Var& loopVar,
+                        const StmtAccesses& accesses, int* stride) {
+    if (isLoopVar(expr, loopVar, accesses)) {
+      *stride = 1;
+      return true;
+    }
+    if (isa<Mul>(expr)) {
+      const Mul* mul = to<Mul>(expr);
+      return (isLoopVar(mul->a, loopVar, accesses) &&
+              getConstant(mul->b, stride)) ||
+             (isLoopVar(mul->b, loopVar, accesses) &&
+              getConstant(mul->a, stride));
+    }
+    return false;
+  }
+
+  /// Splits an index of the form `loopVar*stride + offset`. The offset is
+  /// undefined if it is zero.
+  static bool splitIndex(const Expr& index, const Var& loopVar,
+                         const StmtAccesses& accesses,
+                         int* stride, Expr* offset) {
+    if (!index.defined()) {
+      return false;
+    }
+    *offset = Expr();
+    if (getStride(index, loopVar, accesses, stride)) {
+      return true;
+    }
+    if (isa<Add>(index)) {
+      const Add* add = to<Add>(index);
+      if (getStride(add->a, loopVar, accesses, stride)) {
+        *offset = add->b;
+        return true;
+      }
+      if (getStride(add->b, loopVar, accesses, stride)) {
+        *offset = add->a;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // True if the expression has the same value in every iteration of both loops
+  static bool isInvariant(const Expr& expr, const StmtAccesses& first,
+                          const StmtAccesses& second) {
+    bool invariant = true;
+    match(expr,
+      std::function<void(const VarExpr*)>([&](const VarExpr* op) {
+        Buffer buffer(op->var, "");
+        invariant &= !first.isLocal(op->var) && !second.isLocal(op->var) &&
+                     !first.writes(buffer) && !second.writes(buffer);
+      }),
+      std::function<void(const Load*)>([&](const Load* op) {
+        invariant = false;
+      })
+    );
+    return invariant;
+  }
+
+  // Two loops over the same domain can be fused if every buffer that one of
+  // them writes and the other accesses is only accessed at the elements of
+  // the current iteration. That is, all the accesses to the buffer have
+  // indices `loopVar*stride + offset` with the same stride, and either every
+  // offset is in [0,stride), or the offsets are the same loop invariant.
+  static bool canFuse(const Var& loopVar, const StmtAccesses& first,
+                      const StmtAccesses& second) {
+    if (first.barrier || second.barrier) {
+      return false;
+    }
+    for (auto& buffer : first.accesses) {
+      if (!second.reads(buffer.first) ||
+          (!first.writes(buffer.first) && !second.writes(buffer.first))) {
+        continue;
+      }
+      int stride = 0;
+      bool offsetsInStride = true;
+      bool offsetsInvariant = true;
+      Expr invariantOffset;
+      bool firstAccess = true;
+      for (const StmtAccesses* accesses : {&first, &second}) {
+        for (const Access& access : accesses->accesses.at(buffer.first)) {
+          int accessStride;
+          Expr offset;
+          if (!splitIndex(access.index, loopVar, *accesses, &accessStride,
+                          &offset) ||
+              accessStride <= 0 || (stride != 0 && accessStride != stride)) {
+            return false;
+          }
+          stride = accessStride;
+
+          int lo = 0, hi = 0;
+          offsetsInStride &= !offset.defined() ||
+                             (getRange(offset, *accesses, &lo, &hi) &&
+                              lo >= 0 && hi < stride);
+
+          if (firstAccess) {
+            invariantOffset = offset;
+          }
+          offsetsInvariant &= offset.defined() &&
+                              invariantOffset.defined() &&
+                              equals(offset, invariantOffset) &&
+                              isInvariant(offset, first, second);
+          firstAccess = false;
+        }
+      }
+      if (!offsetsInStride && !offsetsInvariant) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  static Stmt makeLoop(const Stmt& loop, Stmt body) {
+    if (isa<For>(loop)) {
+      const For* forLoop = to<For>(loop);
+      return For::make(forLoop->var, forLoop->domain, body);
+    }
+    const ForRange* forRange = to<ForRange>(loop);
+    return ForRange::make(forRange->var, forRange->start, forRange->end, body);
+  }
+
+  vector<Stmt> fuse(const vector<Stmt>& stmts) {
+    vector<Stmt> fused;
+    size_t i = 0;
+    while (i < stmts.size()) {
+      Stmt loopStmt = stmts[i++];
+      Stmt loop = getLoop(loopStmt);
+      if (!loop.defined()) {
+        fused.push_back(loopStmt);
+        continue;
+      }
+
+      Var loopVar = getLoopVar(loop);
+      vector<Stmt> body;
+      flatten(getLoopBody(loop), &body);
+      unique_ptr<StmtAccesses> loopAccesses(getLoopAccesses(loop, body));
+
+      // Fuse the following loops over the same domain into the loop, moving
+      // the statements in between above it
+      vector<Stmt> hoisted;
+      vector<Stmt> skipped;
+      bool changed = false;
+      for (size_t j = i; j < stmts.size(); ++j) {
+        Stmt next = getLoop(stmts[j]);
+        if (next.defined() && isSameDomain(loop, next)) {
+          Stmt nextBody = replaceVar(getLoopBody(next), getLoopVar(next),
+                                     loopVar);
+          StmtAccesses nextAccesses(nextBody, loopVar);
+          if (canFuse(loopVar, *loopAccesses, nextAccesses)) {
+            flatten(nextBody, &body);
+            loopAccesses.reset(getLoopAccesses(loop, body));
+            hoisted.insert(hoisted.end(), skipped.begin(), skipped.end());
+            skipped.clear();
+            changed = true;
+            i = j + 1;
+            continue;
+          }
+        }
+
+        StmtAccesses stmtAccesses(stmts[j]);
+        if (stmtAccesses.conflicts(*loopAccesses)) {
+          break;
+        }
+        skipped.push_back(stmts[j]);
+      }
+
+      fused.insert(fused.end(), hoisted.begin(), hoisted.end());
+      if (changed) {
+        // The fused bodies may have inner loops to fuse
+        fused.push_back(makeLoop(loop, Block::make(fuse(body))));
+      }
+      else {
+        fused.push_back(loopStmt);
+      }
+    }
+    return fused;
+  }
+};
+
+Func fuseLoops(Func func) {
+  return FuseLoops().rewrite(func);
+}
+
+}}
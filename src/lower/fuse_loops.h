@@ -0,0 +1,17 @@
+#ifndef SIMIT_FUSE_LOOPS_H
+#define SIMIT_FUSE_LOOPS_H
+
+#include "ir.h"
+
+namespace simit {
+namespace ir {
+
+/// Fuse loops over the same domain, so that the data they share is streamed
+/// through the cache once. Two loops in a block are fused when the statements
+/// between them can be moved above the first loop, and when every buffer that
+/// one loop writes and the other accesses is only accessed at the elements
+/// owned by the current iteration (e.g. `x[i*3 + j]` with `j` in `0:3`).
+Func fuseLoops(Func func);
+
+}}
+#endif
@@ -9,6 +9,9 @@
 #include "sig.h"
 #include "path_expressions.h"
 #include "tensor_index.h"
+#include "storage.h"
+#include "symmetry.h"
+#include "macros.h"
 
 using namespace std;
 
@@ -385,8 +388,113 @@ TensorIndex getTensorIndexOfStatement(Stmt stmt, const Storage& storage,
   return tensorIndex;
 }
 
+/// Returns the value of an assignment or a field write, or an undefined Expr.
+static Expr getAssignedValue(Stmt stmt) {
+  if (isa<AssignStmt>(stmt)) {
+    return to<AssignStmt>(stmt)->value;
+  }
+  if (isa<FieldWrite>(stmt)) {
+    return to<FieldWrite>(stmt)->value;
+  }
+  return Expr();
+}
+
+/// True if 'stmt' assigns the product of a matrix that only stores its upper
+/// block-triangle and a vector.
+static bool isSymmetricMatrixVectorProduct(Stmt stmt, const Storage& storage) {
+  Var matrix;
+  Expr vector;
+  return isMatrixVectorProduct(getAssignedValue(stmt), &matrix, &vector) &&
+         storage.hasStorage(matrix) && storage.getStorage(matrix).isSymmetric();
+}
+
+/// Lowers the product of a symmetric matrix, which only stores its upper
+/// block-triangle, and a vector. Each stored block is multiplied into the
+/// result block of its row, and the transposes of the blocks above the
+/// diagonal into the result blocks of their columns, e.g.:
+/// for i in points:
+///   for ij in A_index.coords[i]:A_index.coords[i+1]:
+///     j = A_index.sinks[ij];
+///     y(i) += A(ij) * x(j);
+///     if i != j:
+///       y(j) += A(ij)' * x(i);
+static Stmt lowerSymmetricMatrixVectorProduct(Stmt stmt,
+                                              const Storage& storage) {
+  Expr result;
+  CompoundOperator cop;
+  if (isa<AssignStmt>(stmt)) {
+    result = VarExpr::make(to<AssignStmt>(stmt)->var);
+    cop = to<AssignStmt>(stmt)->cop;
+  }
+  else {
+    const FieldWrite* fieldWrite = to<FieldWrite>(stmt);
+    result = FieldRead::make(fieldWrite->elementOrSet, fieldWrite->fieldName);
+    cop = fieldWrite->cop;
+  }
+
+  Var matrix;
+  Expr vector;
+  bool isProduct = isMatrixVectorProduct(getAssignedValue(stmt), &matrix,
+                                         &vector);
+  iassert(isProduct);
+  UNUSED(isProduct);
+  const IndexExpr* iexpr = to<IndexExpr>(getAssignedValue(stmt));
+  const IndexedTensor* matrixRead = to<IndexedTensor>(to<Mul>(iexpr->value)->a);
+  const IndexVar& iv = matrixRead->indexVars[0];
+  const IndexVar& jv = matrixRead->indexVars[1];
+  const TensorIndex& tensorIndex = storage.getStorage(matrix).getTensorIndex();
+
+  Var i(iv.getName(), Int);
+  Var j(jv.getName(), Int);
+  Var ij(i.getName() + j.getName(), Int);
+
+  // Multiplies the block at ij, or its transpose, into the result block of row
+  std::function<Stmt(Var,Var,bool)> multiplyBlock =
+      [&](Var row, Var col, bool transpose) -> Stmt {
+    Expr block = TensorRead::make(matrix, {ij});
+    if (iv.getNumBlockLevels() == 1) {
+      return TensorWrite::make(result, {row},
+                               Mul::make(block, TensorRead::make(vector,{col})),
+                               CompoundOperator::Add);
+    }
+    iassert(iv.getNumBlockLevels() == 2 && jv.getNumBlockLevels() == 2)
+        << "only one level of blocking is supported";
+    Var bi(i.getName() + "b", Int);
+    Var bj(j.getName() + "b", Int);
+    Expr blockRead = transpose ? TensorRead::make(block, {bj, bi})
+                               : TensorRead::make(block, {bi, bj});
+    Expr vectorRead = TensorRead::make(TensorRead::make(vector, {col}), {bj});
+    Stmt write = TensorWrite::make(TensorRead::make(result, {row}), {bi},
+                                   Mul::make(blockRead, vectorRead),
+                                   CompoundOperator::Add);
+    write = For::make(bj, ForDomain(jv.getDomain().getIndexSets()[1]), write);
+    return For::make(bi, ForDomain(iv.getDomain().getIndexSets()[1]), write);
+  };
+
+  Stmt loopNest = Block::make({
+      AssignStmt::make(j, Load::make(tensorIndex.getColidxArray(), ij)),
+      multiplyBlock(i, j, false),
+      IfThenElse::make(Ne::make(i, j), multiplyBlock(j, i, true))});
+  loopNest = ForRange::make(ij, Load::make(tensorIndex.getRowptrArray(), i),
+                            Load::make(tensorIndex.getRowptrArray(), i+1),
+                            loopNest);
+  loopNest = For::make(i, ForDomain(iv.getDomain().getIndexSets()[0]),
+                       loopNest);
+
+  // Every result block is added to, so results that are not compound assigned
+  // are cleared first
+  if (cop == CompoundOperator::None) {
+    loopNest = Block::make(initializeLhsToZero(stmt), loopNest);
+  }
+  return loopNest;
+}
+
 /// Lowers the given 'stmt' containing an index expression.
 Stmt lowerIndexStatement(Stmt stmt, Environment* environment, Storage storage) {
+  if (isSymmetricMatrixVectorProduct(stmt, storage)) {
+    return lowerSymmetricMatrixVectorProduct(stmt, storage);
+  }
+
   class DiagonalReadsRewriter : private IRRewriter {
   public:
     std::vector<Stmt> liftedStmts;
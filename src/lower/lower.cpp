@@ -9,7 +9,11 @@
 #include "lower_accesses.h"
 #include "lower_prints.h"
 #include "lower_string_ops.h"
+#include "fuse_loops.h"
+#include "matrix_free.h"
+#include "cache_assemblies.h"
 
+#include "compile_options.h"
 #include "storage.h"
 #include "timers.h"
 #include "temps.h"
@@ -27,8 +31,6 @@
 using namespace std;
 
 namespace simit {
-extern std::string kBackend;
-
 namespace ir {
 
 static
@@ -44,7 +46,10 @@ Func rewriteCallGraph(const Func& func, const function<Func(Func)>& rewriter) {
         func = *op;
         return;
       }
+      // Clone the storage, since the function may be shared with concurrent
+      // compilations that add to their own storage
       func = simit::ir::Func(*op, rewrite(op->getBody()));
+      func.setStorage(op->getStorage().clone());
       func = rewriter(func);
     }
   };
@@ -87,9 +92,11 @@ void printCallGraph(string headerText, Func func, bool print) {
 }
 
 Func lower(Func func, bool print, bool time) {
+  const internal::CompileOptions& options = internal::getCompileOptions();
+
 #ifdef GPU
   // Rewrite system assignments
-  if (kBackend == "gpu") {
+  if (options.backend == "gpu") {
     func = rewriteCallGraph(func, rewriteSystemAssigns);
     printCallGraph("Rewrite System Assigns (GPU)", func, print);
   }
@@ -100,6 +107,13 @@ Func lower(Func func, bool print, bool time) {
   func = rewriteCallGraph(func, insertTemporaries);
   printCallGraph("Insert Temporaries and Flatten Index Expressions", func, print);
 
+  // Multiply by the matrices that are only used in products without
+  // assembling them
+  if (options.matrixFree && options.backend == "cpu") {
+    func = rewriteCallGraph(func, rewriteMatrixFreeProducts);
+    printCallGraph("Matrix-Free Products", func, print);
+  }
+
   // Determine Storage
   func = rewriteCallGraph(func, [](Func func) -> Func {
     updateStorage(func, &func.getStorage(), &func.getEnvironment());
@@ -120,6 +134,12 @@ Func lower(Func func, bool print, bool time) {
   func = rewriteCallGraph(func, insertFrees);
   printCallGraph("Insert Frees", func, print);
 
+  // Keep the matrices that are assembled from unchanging inputs between calls
+  if (options.cacheAssemblies && options.backend == "cpu") {
+    func = rewriteCallGraph(func, cacheAssemblies);
+    printCallGraph("Cache Assemblies", func, print);
+  }
+
   func = rewriteCallGraph(func, lowerStringOps);
   func = rewriteCallGraph(func, lowerPrints);
   printCallGraph("Lower String Operations and Prints", func, print);
@@ -139,6 +159,12 @@ Func lower(Func func, bool print, bool time) {
   func = rewriteCallGraph(func, lowerTensorAccesses);
   printCallGraph("Lower Tensor Reads and Writes", func, print);
 
+  // Fuse loops over the same sets, so that each field is streamed once
+  if (options.backend == "cpu") {
+    func = rewriteCallGraph(func, fuseLoops);
+    printCallGraph("Fuse Loops", func, print);
+  }
+
   if (time) {
     printTimedCallGraph("Insert Timers", func, print);
     func = rewriteCallGraph(func, insertTimers);
@@ -147,7 +173,7 @@ Func lower(Func func, bool print, bool time) {
 
   // Lower to GPU Kernels
 #if GPU
-  if (kBackend == "gpu") {
+  if (options.backend == "gpu") {
     func = rewriteCallGraph(func, shardLoops);
     printCallGraph("Shard Loops", func, print);
     func = rewriteCallGraph(func, rewriteVarDecls);
@@ -7,6 +7,7 @@
 #include "inline.h"
 #include "path_expressions.h"
 #include "tensor_index.h"
+#include "util/collections.h"
 
 using namespace std;
 
@@ -32,8 +33,23 @@ inline bool hasSameStorage(std::vector<Var> vars, const Storage &storage) {
 }
 
 class LowerMapFunctionRewriter : public MapFunctionRewriter {
+public:
+  LowerMapFunctionRewriter(const Storage& storage) : storage(storage) {}
+
+private:
+  const Storage& storage;
+
   using MapFunctionRewriter::visit;
 
+  /// True if the map result that the result variable is assembled into only
+  /// stores its upper block-triangle.
+  bool isSymmetricResult(const Var& var) {
+    iassert(util::contains(resultToMapVar, var));
+    const Var& mapVar = resultToMapVar.at(var);
+    return storage.hasStorage(mapVar) &&
+           storage.getStorage(mapVar).isSymmetric();
+  }
+
   void visit(const TensorWrite *op) {
     // Rewrites the tensor write and assigns the result to stmt
     IRRewriter::visit(op);
@@ -64,6 +80,23 @@ class LowerMapFunctionRewriter : public MapFunctionRewriter {
         }
         Expr index = TensorRead::make(locs, indices);
 
+        // Symmetric matrices only store the blocks on or above the diagonal,
+        // which the symmetric assembly function writes along with their
+        // transposes below it. They are located in the upper block-triangle's
+        // index by binary search, since the neighbor locations are those of
+        // the full sparsity.
+        if (isSymmetricResult(targetVar)) {
+          iassert(reduction.getKind() == ReductionOperator::Sum);
+          Expr row = TensorRead::make(endpoints, {indices[0]});
+          Expr col = TensorRead::make(endpoints, {indices[1]});
+          stmt = IfThenElse::make(Le::make(row, col),
+                                  TensorWrite::make(rewrite(op->tensor),
+                                                    {row, col},
+                                                    rewrite(op->value),
+                                                    CompoundOperator::Add));
+          return;
+        }
+
         // Change assignments to result to compound  assignments, using the map
         // reduction operator.
         switch (reduction.getKind()) {
@@ -115,7 +148,7 @@ private:
     iassert(hasStorage(op->vars, *storage))
         << "Every assembled tensor should have a storage descriptor";
 
-    LowerMapFunctionRewriter mapFunctionRewriter;
+    LowerMapFunctionRewriter mapFunctionRewriter(*storage);
     stmt = inlineMap(op, mapFunctionRewriter);
 
     // Add comment
@@ -128,8 +161,9 @@ private:
     for (auto result : op->vars) {
       auto tensorStorage = storage->getStorage(result);
       if (tensorStorage.getKind() == TensorStorage::Indexed) {
-        auto& pexpr = tensorStorage.getTensorIndex().getPathExpression();
-        env->addTensorIndex(pexpr, result);
+        auto& tensorIndex = tensorStorage.getTensorIndex();
+        env->addTensorIndex(tensorIndex.getPathExpression(), result,
+                            tensorIndex.isSymmetric());
       }
     }
 
@@ -0,0 +1,585 @@
+#include "matrix_free.h"
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include "ir_builder.h"
+#include "ir_rewriter.h"
+#include "ir_visitor.h"
+#include "var_replace_rewriter.h"
+#include "util/collections.h"
+
+using namespace std;
+
+namespace simit {
+namespace ir {
+
+/// Returns the vector `x` of a matrix-vector product `(i A(i,+j) * x(+j))`
+/// of `matrix`, or an undefined expression if `expr` is not such a product.
+static Expr getProductVector(const Expr& expr, const Var& matrix) {
+  if (!isa<IndexExpr>(expr)) {
+    return Expr();
+  }
+  const IndexExpr* indexExpr = to<IndexExpr>(expr);
+  if (indexExpr->resultVars.size() != 1 || !isa<Mul>(indexExpr->value)) {
+    return Expr();
+  }
+  const Mul* mul = to<Mul>(indexExpr->value);
+  if (!isa<IndexedTensor>(mul->a) || !isa<IndexedTensor>(mul->b)) {
+    return Expr();
+  }
+  const IndexedTensor* a = to<IndexedTensor>(mul->a);
+  const IndexedTensor* x = to<IndexedTensor>(mul->b);
+  if (!isa<VarExpr>(a->tensor) || to<VarExpr>(a->tensor)->var != matrix ||
+      a->indexVars.size() != 2 || x->indexVars.size() != 1) {
+    return Expr();
+  }
+  const IndexVar& j = a->indexVars[1];
+  if (a->indexVars[0] != indexExpr->resultVars[0] || x->indexVars[0] != j ||
+      !j.isReductionVar() ||
+      j.getOperator().getKind() != ReductionOperator::Sum) {
+    return Expr();
+  }
+  return x->tensor;
+}
+
+/// Returns true if the blocks of `type` are scalars or unnested tensors.
+static bool hasScalarComponentBlocks(const Type& type) {
+  Type blockType = type.toTensor()->getBlockType();
+  for (auto& dimension : blockType.toTensor()->getDimensions()) {
+    if (dimension.getNumIndexSets() != 1) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/// Counts the matrix-vector products of a matrix that are assigned to a
+/// variable or a field, and flags every other use of the matrix.
+class ProductFinder : public IRVisitor {
+public:
+  ProductFinder(const Var& matrix) : matrix(matrix), numProducts(0),
+                                     otherUses(false) {}
+
+  const Var& matrix;
+  int numProducts;
+  bool otherUses;
+
+  /// The vector of the first product.
+  Expr operand;
+
+private:
+  using IRVisitor::visit;
+
+  void visit(const VarExpr* op) {
+    if (op->var == matrix) {
+      otherUses = true;
+    }
+  }
+
+  void visit(const AssignStmt* op) {
+    if (!visitProduct(op->value, op->cop)) {
+      IRVisitor::visit(op);
+    }
+  }
+
+  void visit(const FieldWrite* op) {
+    if (visitProduct(op->value, op->cop)) {
+      op->elementOrSet.accept(this);
+    }
+    else {
+      IRVisitor::visit(op);
+    }
+  }
+
+  void visit(const CallStmt* op) {
+    if (util::contains(op->results, matrix)) {
+      otherUses = true;
+    }
+    IRVisitor::visit(op);
+  }
+
+  void visit(const Map* op) {
+    if (util::contains(op->vars, matrix)) {
+      otherUses = true;
+    }
+    IRVisitor::visit(op);
+  }
+
+  bool visitProduct(const Expr& value, CompoundOperator cop) {
+    Expr x = (cop == CompoundOperator::None) ? getProductVector(value, matrix)
+                                             : Expr();
+    if (!x.defined()) {
+      return false;
+    }
+    if (numProducts == 0) {
+      operand = x;
+    }
+    ++numProducts;
+    x.accept(this);
+    return true;
+  }
+};
+
+/// Collects what an assembly function reads, and flags the assembly functions
+/// that cannot be applied to a vector: those that write fields, read the
+/// result matrix, write it other than by whole blocks, or pass elements to
+/// other functions.
+class AssemblyAnalysis : public IRVisitor {
+public:
+  AssemblyAnalysis(const Var& result) : result(result), supported(true) {}
+
+  const Var& result;
+  bool supported;
+
+  std::set<std::string> fieldsRead;
+  std::set<Var> varsRead;
+
+private:
+  using IRVisitor::visit;
+
+  void visit(const VarExpr* op) {
+    if (op->var == result) {
+      supported = false;
+    }
+    varsRead.insert(op->var);
+  }
+
+  void visit(const FieldRead* op) {
+    fieldsRead.insert(op->fieldName);
+    IRVisitor::visit(op);
+  }
+
+  void visit(const FieldWrite* op) {
+    supported = false;
+  }
+
+  void visit(const TensorWrite* op) {
+    if (isa<VarExpr>(op->tensor) && to<VarExpr>(op->tensor)->var == result) {
+      if (op->indices.size() != 2) {
+        supported = false;
+      }
+      for (auto& index : op->indices) {
+        index.accept(this);
+      }
+      op->value.accept(this);
+      return;
+    }
+    IRVisitor::visit(op);
+  }
+
+  void visit(const AssignStmt* op) {
+    if (op->var == result) {
+      supported = false;
+    }
+    IRVisitor::visit(op);
+  }
+
+  void visit(const CallStmt* op) {
+    for (auto& actual : op->actuals) {
+      if (actual.type().isElement() || actual.type().isTuple()) {
+        supported = false;
+      }
+    }
+    if (util::contains(op->results, result)) {
+      supported = false;
+    }
+    IRVisitor::visit(op);
+  }
+
+  void visit(const Map* op) {
+    supported = false;
+  }
+};
+
+/// Flags statements that may change what an assembly function reads: writes
+/// to the fields or variables it reads, maps that write fields and calls to
+/// functions that may do so.
+class ChangesAssemblyInputs : public IRQuery {
+public:
+  ChangesAssemblyInputs(const std::set<std::string>& fields,
+                        const std::set<Var>& vars)
+      : fields(fields), vars(vars) {}
+
+private:
+  const std::set<std::string>& fields;
+  const std::set<Var>& vars;
+
+  using IRQuery::visit;
+
+  void visit(const FieldWrite* op) {
+    if (!isa<VarExpr>(op->elementOrSet) ||
+        util::contains(fields, op->fieldName)) {
+      result = true;
+    }
+    IRQuery::visit(op);
+  }
+
+  void visit(const TensorWrite* op) {
+    if ((isa<FieldRead>(op->tensor) &&
+         util::contains(fields, to<FieldRead>(op->tensor)->fieldName)) ||
+        (isa<VarExpr>(op->tensor) &&
+         util::contains(vars, to<VarExpr>(op->tensor)->var))) {
+      result = true;
+    }
+    IRQuery::visit(op);
+  }
+
+  void visit(const AssignStmt* op) {
+    if (util::contains(vars, op->var)) {
+      result = true;
+    }
+    IRQuery::visit(op);
+  }
+
+  void visit(const CallStmt* op) {
+    if (op->callee.getKind() == Func::Internal) {
+      result = true;
+    }
+    for (auto& var : op->results) {
+      if (util::contains(vars, var)) {
+        result = true;
+      }
+    }
+    IRQuery::visit(op);
+  }
+
+  void visit(const Map* op) {
+    class WritesFields : public IRQuery {
+      using IRQuery::visit;
+      void visit(const FieldWrite* op) {
+        result = true;
+      }
+      void visit(const CallStmt* op) {
+        if (op->callee.getKind() == Func::Internal) {
+          result = true;
+        }
+        IRQuery::visit(op);
+      }
+    };
+    if (WritesFields().query(op->function.getBody())) {
+      result = true;
+    }
+    for (auto& var : op->vars) {
+      if (util::contains(vars, var)) {
+        result = true;
+      }
+    }
+    IRQuery::visit(op);
+  }
+};
+
+/// Rewrites an assembly function of a matrix `A` to a function that takes an
+/// extra vector argument `x` and adds the contributions `A(i,j)*x(j)` of each
+/// block write `A(i,j) = value` to its result instead.
+class MatrixVectorRewriter : public IRRewriter {
+public:
+  MatrixVectorRewriter(const Var& matrix, const Var& x, const Var& result)
+      : matrix(matrix), x(x), result(result) {}
+
+private:
+  const Var& matrix;
+  const Var& x;
+  const Var& result;
+
+  using IRRewriter::visit;
+
+  void visit(const TensorWrite* op) {
+    if (!isa<VarExpr>(op->tensor) || to<VarExpr>(op->tensor)->var != matrix) {
+      IRRewriter::visit(op);
+      return;
+    }
+    iassert(op->indices.size() == 2);
+    Expr i = rewrite(op->indices[0]);
+    Expr j = rewrite(op->indices[1]);
+    Expr value = rewrite(op->value);
+    Expr xj = TensorRead::make(x, {j});
+
+    // Multiply the block with the vector's block through temporaries, so that
+    // the product stays a flattened index expression. The vector's block is
+    // copied by component, since blocks are only loaded one component at a time
+    Var a(INTERNAL_PREFIX("a"), value.type());
+    if (value.type().toTensor()->order() == 0) {
+      stmt = Block::make({VarDecl::make(a), AssignStmt::make(a, value),
+                          TensorWrite::make(result, {i}, Mul::make(a, xj),
+                                            op->cop)});
+      return;
+    }
+    Var b(INTERNAL_PREFIX("b"), xj.type());
+    Var c(INTERNAL_PREFIX("c"), Int);
+    int size = xj.type().toTensor()->getDimensions()[0].getSize();
+    Stmt copyBlock = ForRange::make(c, 0, size,
+        TensorWrite::make(b, {c}, TensorRead::make(xj, {c})));
+    stmt = Block::make({VarDecl::make(a), AssignStmt::make(a, value),
+                        VarDecl::make(b), copyBlock,
+                        TensorWrite::make(result, {i}, IRBuilder().gemv(a, b),
+                                          op->cop)});
+  }
+};
+
+/// Returns a function that applies the element contributions of a map's
+/// assembly function to a vector of type `xType`, which it takes after the
+/// map's partial arguments. The map inliner assigns the partial arguments in
+/// the scope of each map, so every product gets a function with its own.
+static Func makeMatrixVectorFunc(const Map* assembly, Type xType, Type yType) {
+  const Func& func = assembly->function;
+  const size_t numPartials = assembly->partial_actuals.size();
+  Var x(INTERNAL_PREFIX("x"), xType);
+  Var y(INTERNAL_PREFIX("Ax"), yType);
+  Stmt body = MatrixVectorRewriter(func.getResults()[0], x, y)
+      .rewrite(func.getBody());
+
+  vector<Var> arguments = func.getArguments();
+  for (size_t i = 0; i < numPartials; ++i) {
+    Var partial(arguments[i].getName(), arguments[i].getType());
+    body = replaceVar(body, arguments[i], partial);
+    arguments[i] = partial;
+  }
+  arguments.insert(arguments.begin() + numPartials, x);
+  return Func(func.getName() + "_matvec", arguments, {y}, body,
+              func.getEnvironment());
+}
+
+/// Returns an index expression that copies the vector `vector`.
+static Expr copy(const Expr& vector) {
+  const TensorType* type = vector.type().toTensor();
+  iassert(type->order() == 1);
+  IndexVar i = IndexVarFactory().createIndexVar(type->getDimensions()[0]);
+  return IndexExpr::make({i}, IndexedTensor::make(vector, {i}),
+                         type->isColumnVector);
+}
+
+/// Replaces the matrix-vector products of a matrix with maps of a matrix-free
+/// assembly function.
+class MatrixFreeRewriter : public IRRewriter {
+public:
+  MatrixFreeRewriter(const Map* assembly) : assembly(assembly) {}
+
+private:
+  const Map* assembly;
+
+  using IRRewriter::visit;
+
+  void visit(const VarDecl* op) {
+    stmt = (op->var == assembly->vars[0]) ? Stmt() : op;
+  }
+
+  void visit(const Map* op) {
+    stmt = (op == assembly) ? Stmt() : op;
+  }
+
+  void visit(const AssignStmt* op) {
+    Expr x = (op->cop == CompoundOperator::None)
+             ? getProductVector(op->value, assembly->vars[0]) : Expr();
+    if (!x.defined()) {
+      IRRewriter::visit(op);
+      return;
+    }
+
+    // The map zeroes its result before it reads its arguments, so a vector
+    // multiplied into itself is mapped to a temporary first
+    class ReadsVar : public IRQuery {
+    public:
+      ReadsVar(const Var& var) : var(var) {}
+    private:
+      const Var& var;
+      using IRQuery::visit;
+      void visit(const VarExpr* op) {
+        if (op->var == var) {
+          result = true;
+        }
+      }
+    };
+    if (!ReadsVar(op->var).query(x)) {
+      stmt = multiply(op->var, x);
+      return;
+    }
+    Var tmp(INTERNAL_PREFIX("Ax"), op->var.getType());
+    stmt = Block::make({VarDecl::make(tmp), multiply(tmp, x),
+                        AssignStmt::make(op->var, copy(tmp))});
+  }
+
+  void visit(const FieldWrite* op) {
+    Expr x = (op->cop == CompoundOperator::None)
+             ? getProductVector(op->value, assembly->vars[0]) : Expr();
+    if (!x.defined()) {
+      IRRewriter::visit(op);
+      return;
+    }
+    Var tmp(INTERNAL_PREFIX("Ax"), op->value.type());
+    stmt = Block::make({VarDecl::make(tmp), multiply(tmp, x),
+                        FieldWrite::make(op->elementOrSet, op->fieldName,
+                                         copy(tmp))});
+  }
+
+  Stmt multiply(const Var& y, Expr x) {
+    vector<Stmt> stmts;
+    if (!isa<VarExpr>(x)) {
+      Var tmp(INTERNAL_PREFIX("x"), x.type());
+      stmts.push_back(VarDecl::make(tmp));
+      stmts.push_back(AssignStmt::make(tmp, copy(x)));
+      x = tmp;
+    }
+    vector<Expr> actuals = assembly->partial_actuals;
+    actuals.push_back(x);
+    Func matvec = makeMatrixVectorFunc(assembly, x.type(), y.getType());
+    stmts.push_back(Map::make({y}, matvec, actuals, assembly->target,
+                              assembly->neighbors, ReductionOperator::Sum));
+    return Block::make(stmts);
+  }
+};
+
+static void flattenBlocks(const Stmt& stmt, vector<Stmt>* stmts) {
+  if (isa<Block>(stmt)) {
+    flattenBlocks(to<Block>(stmt)->first, stmts);
+    if (to<Block>(stmt)->rest.defined()) {
+      flattenBlocks(to<Block>(stmt)->rest, stmts);
+    }
+  }
+  else {
+    stmts->push_back(stmt);
+  }
+}
+
+/// Rewrites the products of the matrix assembled by the map `stmts[m]` to
+/// matrix-free maps, if they can be. Returns true if they were rewritten.
+static bool rewriteMatrix(vector<Stmt>* stmts, size_t m) {
+  Stmt mapStmt = (*stmts)[m];
+  const Map* map = to<Map>(mapStmt);
+  const Var& matrix = map->vars[0];
+  const Func& assembly = map->function;
+  if (assembly.getResults().size() != 1) {
+    return false;
+  }
+  const Var& matrixResult = assembly.getResults()[0];
+
+  AssemblyAnalysis analysis(matrixResult);
+  assembly.getBody().accept(&analysis);
+  if (!analysis.supported || !hasScalarComponentBlocks(matrix.getType())) {
+    return false;
+  }
+
+  // The matrix must only be multiplied by vectors after it is assembled
+  size_t last = m;
+  ProductFinder products(matrix);
+  for (size_t i = 0; i < stmts->size(); ++i) {
+    if (i == m) {
+      continue;
+    }
+    int numProducts = products.numProducts;
+    (*stmts)[i].accept(&products);
+    if (products.numProducts != numProducts) {
+      if (i < m) {
+        return false;
+      }
+      last = i;
+    }
+  }
+  if (products.otherUses || products.numProducts == 0) {
+    return false;
+  }
+
+  // The vector's blocks must match the matrix's column blocks
+  Type matrixBlock = matrix.getType().toTensor()->getBlockType();
+  Type vectorBlock = products.operand.type().toTensor()->getBlockType();
+  if (matrixBlock.toTensor()->order() == 0) {
+    if (vectorBlock.toTensor()->order() != 0) {
+      return false;
+    }
+  }
+  else if (matrixBlock.toTensor()->order() != 2 ||
+           vectorBlock.toTensor()->order() != 1 ||
+           matrixBlock.toTensor()->getDimensions()[1] !=
+           vectorBlock.toTensor()->getDimensions()[0]) {
+    return false;
+  }
+
+  // Nothing the assembly reads may change between the map and the last product
+  class CollectVars : public IRVisitor {
+  public:
+    set<Var> vars;
+  private:
+    using IRVisitor::visit;
+    void visit(const VarExpr* op) {
+      vars.insert(op->var);
+    }
+  };
+  CollectVars collectVars;
+  collectVars.vars = analysis.varsRead;
+  for (auto& actual : map->partial_actuals) {
+    actual.accept(&collectVars);
+  }
+  const set<Var>& inputs = collectVars.vars;
+  ChangesAssemblyInputs changesInputs(analysis.fieldsRead, inputs);
+  for (size_t i = m+1; i <= last; ++i) {
+    if (changesInputs.query((*stmts)[i])) {
+      return false;
+    }
+  }
+
+  MatrixFreeRewriter rewriter(map);
+  for (auto& stmt : *stmts) {
+    stmt = rewriter.rewrite(stmt);
+  }
+  return true;
+}
+
+Func rewriteMatrixFreeProducts(Func func) {
+  // Function bodies are scoped blocks
+  Stmt body = func.getBody();
+  bool scoped = isa<Scope>(body);
+  if (scoped) {
+    body = to<Scope>(body)->scopedStmt;
+  }
+  vector<Stmt> stmts;
+  flattenBlocks(body, &stmts);
+
+  bool rewritten = false;
+  set<Var> rejected;
+  while (true) {
+    size_t m = 0;
+    for (; m < stmts.size(); ++m) {
+      if (!stmts[m].defined() || !isa<Map>(stmts[m])) {
+        continue;
+      }
+      const Map* map = to<Map>(stmts[m]);
+      if (map->vars.size() != 1 || util::contains(rejected, map->vars[0]) ||
+          map->reduction.getKind() != ReductionOperator::Sum) {
+        continue;
+      }
+      const Var& var = map->vars[0];
+      if (var.getType().isTensor() &&
+          var.getType().toTensor()->order() == 2 &&
+          isSystemTensorType(var.getType()) &&
+          !util::contains(func.getArguments(), var) &&
+          !util::contains(func.getResults(), var)) {
+        break;
+      }
+    }
+    if (m == stmts.size()) {
+      break;
+    }
+
+    if (rewriteMatrix(&stmts, m)) {
+      rewritten = true;
+    }
+    else {
+      rejected.insert(to<Map>(stmts[m])->vars[0]);
+    }
+  }
+
+  if (!rewritten) {
+    return func;
+  }
+  vector<Stmt> rewrittenStmts;
+  for (auto& stmt : stmts) {
+    if (stmt.defined()) {
+      rewrittenStmts.push_back(stmt);
+    }
+  }
+  body = Block::make(rewrittenStmts);
+  return Func(func, scoped ? Scope::make(body) : body);
+}
+
+}}
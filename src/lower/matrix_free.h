@@ -0,0 +1,21 @@
+#ifndef SIMIT_MATRIX_FREE_H
+#define SIMIT_MATRIX_FREE_H
+
+#include "ir.h"
+
+namespace simit {
+namespace ir {
+
+/// Replace system matrices that are assembled by a map and only multiplied by
+/// vectors, e.g. `A = map f to E reduce +; y = A*x;`, with maps that apply the
+/// element contributions of the assembly function to the vector directly,
+/// e.g. `y = map f_matvec(x) to E reduce +;`. The matrices and their indices
+/// are then never built, at the price of recomputing the contributions for
+/// every product. A matrix is rewritten if its map is not nested in control
+/// flow, if it is only written by whole-block assignments to the assembly
+/// function's result, and if nothing that the assembly reads changes between
+/// the map and the last product.
+Func rewriteMatrixFreeProducts(Func func);
+
+}}
+#endif
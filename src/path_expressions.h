@@ -48,8 +48,10 @@ struct SetContent {
 
   SetContent(std::string name) : name(name) {}
   mutable long ref = 0;
-  friend inline void aquire(const SetContent *v) {++v->ref;}
-  friend inline void release(const SetContent *v) {if (--v->ref==0) delete v;}
+  friend inline void aquire(const SetContent *v) {util::incRef(&v->ref);}
+  friend inline void release(const SetContent *v) {
+    if (util::decRef(&v->ref)==0) delete v;
+  }
 };
 
 class Set : public util::IntrusivePtr<SetContent> {
@@ -66,8 +68,10 @@ struct VarContent {
   std::string name;
   Set set;
   mutable long ref = 0;
-  friend inline void aquire(const VarContent *v) {++v->ref;}
-  friend inline void release(const VarContent *v) {if (--v->ref==0) delete v;}
+  friend inline void aquire(const VarContent *v) {util::incRef(&v->ref);}
+  friend inline void release(const VarContent *v) {
+    if (util::decRef(&v->ref)==0) delete v;
+  }
 };
 
 /// A path expression variable. Variables correspond to elements in sets, which
@@ -125,9 +129,11 @@ public:
   friend bool operator<(const PathExpressionImpl&, const PathExpressionImpl&);
 
   mutable long ref = 0;
-  friend inline void aquire(const PathExpressionImpl *p) {++p->ref;}
+  friend inline void aquire(const PathExpressionImpl *p) {
+    util::incRef(&p->ref);
+  }
   friend inline void release(const PathExpressionImpl *p) {
-    if (--p->ref==0) delete p;
+    if (util::decRef(&p->ref)==0) delete p;
   }
 
 private:
@@ -1,12 +1,16 @@
 #include "path_indices.h"
 
+#include <algorithm>
 #include <iostream>
+#include <iterator>
 #include <stack>
 #include <map>
+#include <set>
 #include <vector>
 
 #include "path_expressions.h"
 #include "graph.h"
+#include "thread_pool.h"
 #include "util/collections.h"
 
 using namespace std;
@@ -145,6 +149,145 @@ void SegmentedPathIndex::print(std::ostream &os) const {
 
 
 // class PathIndexBuilder
+namespace {
+/// The path neighbors of the elements of a path index as sorted rows without
+/// duplicates, in CSR form. Segmented path indices are used in place, while
+/// other path indices are copied.
+class PathRows {
+public:
+  PathRows(const PathIndex &pi) {
+    if (isa<SegmentedPathIndex>(pi)) {
+      const SegmentedPathIndex *spi = to<SegmentedPathIndex>(pi);
+      numElems = spi->numElements();
+      coords = spi->getCoordData();
+      sinks = spi->getSinkData();
+      return;
+    }
+
+    numElems = pi.numElements();
+    coordsStorage.reserve(numElems+1);
+    coordsStorage.push_back(0);
+    for (unsigned elem : pi) {
+      auto rowStart = sinksStorage.end() - sinksStorage.begin();
+      for (unsigned nbr : pi.neighbors(elem)) {
+        sinksStorage.push_back(nbr);
+      }
+      sort(sinksStorage.begin()+rowStart, sinksStorage.end());
+      sinksStorage.erase(unique(sinksStorage.begin()+rowStart,
+                                sinksStorage.end()),
+                         sinksStorage.end());
+      coordsStorage.push_back(sinksStorage.size());
+    }
+    coords = coordsStorage.data();
+    sinks = sinksStorage.data();
+  }
+
+  unsigned numElements() const {return numElems;}
+
+  /// The neighbors of `elem`. Elements past the end have no neighbors.
+  const unsigned *begin(unsigned elem) const {
+    return (elem < numElems) ? sinks + coords[elem] : sinks;
+  }
+  const unsigned *end(unsigned elem) const {
+    return (elem < numElems) ? sinks + coords[elem+1] : sinks;
+  }
+
+private:
+  unsigned numElems;
+  const unsigned *coords;
+  const unsigned *sinks;
+  std::vector<unsigned> coordsStorage;
+  std::vector<unsigned> sinksStorage;
+};
+
+/// Builds the rows of a path index from the rows of its two operands. The
+/// elements are split into blocks that are built in parallel into separate
+/// buffers, which are then concatenated.
+struct PathRowsBuilder {
+  enum Operation {
+    Intersection,  // row i is lhs row i intersected with rhs row i
+    Union,         // row i is the union of lhs row i and rhs row i
+    Composition    // row i is the union of the rhs rows of lhs row i
+  };
+
+  static const unsigned kBlockSize = 1024;
+
+  Operation op;
+  const PathRows *lhs;
+  const PathRows *rhs;
+  unsigned numElements;
+
+  uint32_t *coords;
+  std::vector<std::vector<uint32_t>> blockSinks;
+
+  void buildBlock(unsigned block) {
+    std::vector<uint32_t> &sinks = blockSinks[block];
+    unsigned end = std::min(numElements, (block+1) * kBlockSize);
+    for (unsigned elem = block * kBlockSize; elem < end; ++elem) {
+      size_t rowStart = sinks.size();
+      switch (op) {
+        case Intersection:
+          set_intersection(lhs->begin(elem), lhs->end(elem),
+                           rhs->begin(elem), rhs->end(elem),
+                           back_inserter(sinks));
+          break;
+        case Union:
+          set_union(lhs->begin(elem), lhs->end(elem),
+                    rhs->begin(elem), rhs->end(elem),
+                    back_inserter(sinks));
+          break;
+        case Composition:
+          for (const unsigned *q = lhs->begin(elem); q != lhs->end(elem); ++q) {
+            sinks.insert(sinks.end(), rhs->begin(*q), rhs->end(*q));
+          }
+          sort(sinks.begin()+rowStart, sinks.end());
+          sinks.erase(unique(sinks.begin()+rowStart, sinks.end()),
+                      sinks.end());
+          break;
+      }
+      coords[elem+1] = sinks.size() - rowStart;
+    }
+  }
+
+  /// Build the rows into malloc'ed coordinate and sink arrays.
+  void build(uint32_t **coordsData, uint32_t **sinksData);
+};
+
+void buildPathRowsTask(int start, int end, void **context) {
+  PathRowsBuilder *builder = static_cast<PathRowsBuilder*>(context[0]);
+  for (int block = start; block < end; ++block) {
+    builder->buildBlock(block);
+  }
+}
+
+void PathRowsBuilder::build(uint32_t **coordsData, uint32_t **sinksData) {
+  coords = (uint32_t*)malloc((numElements+1)*sizeof(uint32_t));
+  coords[0] = 0;
+
+  unsigned numBlocks = (numElements + kBlockSize-1) / kBlockSize;
+  blockSinks.resize(numBlocks);
+  void *context[] = {this};
+  internal::ThreadPool::getInstance().parallelFor(
+      0, numBlocks, buildPathRowsTask, context,
+      internal::ThreadPool::Dynamic, 1);
+
+  for (unsigned elem = 0; elem < numElements; ++elem) {
+    coords[elem+1] += coords[elem];
+  }
+  uint32_t *sinks = (uint32_t*)malloc(coords[numElements]*sizeof(uint32_t));
+  for (unsigned block = 0; block < numBlocks; ++block) {
+    const std::vector<uint32_t> &bsinks = blockSinks[block];
+    if (bsinks.size() > 0) {
+      memcpy(&sinks[coords[block * kBlockSize]], bsinks.data(),
+             bsinks.size() * sizeof(uint32_t));
+    }
+  }
+
+  *coordsData = coords;
+  *sinksData = sinks;
+}
+}
+
 PathIndex PathIndexBuilder::buildSegmented(const PathExpression &pe,
                                            unsigned sourceEndpoint){
   /// Interpret the path expression, starting at sourceEndpoint, over the graph.
@@ -158,9 +301,13 @@ PathIndex PathIndexBuilder::buildSegmented(const PathExpression &pe,
     };
     typedef map<Var, vector<Location>> VarToLocationsMap;
 
-    PathNeighborVisitor(PathIndexBuilder *builder) : builder(builder) {}
+    PathNeighborVisitor(PathIndexBuilder *builder)
+        : builder(builder), previous(nullptr) {}
 
-    PathIndex build(const PathExpression &pe) {
+    /// Build a path index for `pe`. If `previous` is not null it is a path
+    /// index for `pe` over the bound sets before elements were added to them.
+    PathIndex build(const PathExpression &pe, const AppendedIndex *previous) {
+      this->previous = previous;
       pe.accept(this);
       PathIndex pit = pi;
       pi = nullptr;
@@ -168,35 +315,22 @@ PathIndex PathIndexBuilder::buildSegmented(const PathExpression &pe,
     }
 
   private:
-    /// Pack neighbor vectors into a segmented vector (contiguous array).
-    PathIndex pack(const map<unsigned, set<unsigned>> &pathNeighbors) {
-      unsigned numNeighbors = 0;
-      for (auto &p : pathNeighbors) {
-        numNeighbors += p.second.size();
-      }
-
-      size_t numElements = pathNeighbors.size();
-      uint32_t* coordsData= (uint32_t*)malloc((numElements+1)*sizeof(uint32_t));
-      uint32_t* sinksData = (uint32_t*)malloc(numNeighbors*sizeof(uint32_t));
-
-      int currNbrsStart = 0;
-      for (auto& p : pathNeighbors) {
-        unsigned elem = p.first;
-        coordsData[elem] = currNbrsStart;
-
-        unsigned pNeighborSize = p.second.size();
-        if (pNeighborSize > 0) {
-          vector<unsigned> pNeighbors(p.second.begin(), p.second.end());
-          sort(pNeighbors.begin(), pNeighbors.end());
-
-          memcpy(&sinksData[currNbrsStart], pNeighbors.data(),
-                 pNeighbors.size() * sizeof(uint32_t));
-
-          currNbrsStart += pNeighborSize;
-        }
-      }
-      coordsData[numElements] = currNbrsStart;
-      return new SegmentedPathIndex(numElements, coordsData, sinksData);;
+    /// Build a segmented path index by combining the rows of two path indices.
+    PathIndex buildRows(PathRowsBuilder::Operation op, const PathIndex &lhs,
+                        const PathIndex &rhs, unsigned numElements) {
+      PathRows lhsRows(lhs);
+      PathRows rhsRows(rhs);
+
+      PathRowsBuilder rowsBuilder;
+      rowsBuilder.op = op;
+      rowsBuilder.lhs = &lhsRows;
+      rowsBuilder.rhs = &rhsRows;
+      rowsBuilder.numElements = numElements;
+
+      uint32_t *coordsData;
+      uint32_t *sinksData;
+      rowsBuilder.build(&coordsData, &sinksData);
+      return new SegmentedPathIndex(numElements, coordsData, sinksData);
     }
 
     void visit(const Link *link) {
@@ -211,25 +345,80 @@ PathIndex PathIndexBuilder::buildSegmented(const PathExpression &pe,
           break;
         }
         case Link::ve: {
-          // add each edge to the neighbor vectors of its endpoints
-          map<unsigned, set<unsigned>> pathNeighbors;
-
-          // create neighbor lists
+          // Add each edge to the neighbor rows of its endpoints with a
+          // counting sort. Edges are visited in order, so rows are sorted.
           const simit::Set& vertexSet =
               *builder->getBinding(link->getVertexSet());
-          for (auto &v : vertexSet) {
-            pathNeighbors.insert({v.getIdent(), set<unsigned>()});
+          const unsigned numVertices = vertexSet.getSize();
+          const unsigned numEdges = edgeSet.getSize();
+          const int cardinality = edgeSet.getCardinality();
+          const int *endpoints =
+              const_cast<simit::Set&>(edgeSet).getEndpointsData();
+
+          // If we have the index from before edges and vertices were added,
+          // then keep its rows and only add the new edges to the ends of the
+          // rows, since new edges come after the old ones.
+          unsigned firstEdge = 0;
+          unsigned numPreviousVertices = 0;
+          const uint32_t *previousCoords = nullptr;
+          const uint32_t *previousSinks = nullptr;
+          if (previous != nullptr &&
+              isa<SegmentedPathIndex>(previous->pathIndex) &&
+              util::contains(previous->setStates,
+                             link->getEdgeSet().getName())) {
+            const SegmentedPathIndex *previousIndex =
+                to<SegmentedPathIndex>(previous->pathIndex);
+            firstEdge =
+                previous->setStates.at(link->getEdgeSet().getName()).size;
+            numPreviousVertices = previousIndex->numElements();
+            previousCoords = previousIndex->getCoordData();
+            previousSinks = previousIndex->getSinkData();
+            iassert(firstEdge <= numEdges);
+            iassert(numPreviousVertices <= numVertices);
+          }
+          auto numPreviousNeighbors = [&](unsigned v) {
+            return (v < numPreviousVertices)
+                   ? previousCoords[v+1] - previousCoords[v] : 0;
+          };
+
+          // An edge is added once even if it has a repeated endpoint
+          auto isRepeated = [&](unsigned e, int i) {
+            const int *eps = &endpoints[e*cardinality];
+            return find(eps, eps+i, eps[i]) != eps+i;
+          };
+
+          uint32_t *coordsData =
+              (uint32_t*)malloc((numVertices+1)*sizeof(uint32_t));
+          fill(coordsData, coordsData+numVertices+1, 0);
+          for (unsigned e = firstEdge; e < numEdges; ++e) {
+            for (int i = 0; i < cardinality; ++i) {
+              int ep = endpoints[e*cardinality + i];
+              iassert(ep >= 0 && (unsigned)ep < numVertices);
+              if (!isRepeated(e, i)) {
+                coordsData[ep+1]++;
+              }
+            }
+          }
+          for (unsigned v = 0; v < numVertices; ++v) {
+            coordsData[v+1] += coordsData[v] + numPreviousNeighbors(v);
           }
 
-          // populate neighbor lists
-          for (auto &e : edgeSet) {
-            iassert(e.getIdent() >= 0);
-            for (auto &ep : edgeSet.getEndpoints(e)) {
-              iassert(ep.getIdent() >= 0);
-              pathNeighbors.at(ep.getIdent()).insert(e.getIdent());
+          uint32_t *sinksData =
+              (uint32_t*)malloc(coordsData[numVertices]*sizeof(uint32_t));
+          vector<uint32_t> next(coordsData, coordsData+numVertices);
+          for (unsigned v = 0; v < numPreviousVertices; ++v) {
+            copy(previousSinks + previousCoords[v],
+                 previousSinks + previousCoords[v+1], &sinksData[next[v]]);
+            next[v] += numPreviousNeighbors(v);
+          }
+          for (unsigned e = firstEdge; e < numEdges; ++e) {
+            for (int i = 0; i < cardinality; ++i) {
+              if (!isRepeated(e, i)) {
+                sinksData[next[endpoints[e*cardinality + i]]++] = e;
+              }
             }
           }
-          pi = pack(pathNeighbors);
+          pi = new SegmentedPathIndex(numVertices, coordsData, sinksData);
           break;
         }
       }
@@ -292,31 +481,16 @@ PathIndex PathIndexBuilder::buildSegmented(const PathExpression &pe,
       PathExpression lhs = f->getLhs();
       PathExpression rhs = f->getRhs();
 
-      map<unsigned, set<unsigned>> pathNeighbors;
       if (!f->isQuantified()) {
         // Build indices from first to second free variable through lhs and rhs
         PathIndex lhsIndex = buildIndex(lhs, freeVars[0], freeVars[1]);
         PathIndex rhsIndex = buildIndex(rhs, freeVars[0], freeVars[1]);
+        iassert(lhsIndex.numElements() >= rhsIndex.numElements());
 
-        // Build a path index that is the intersection of lhsIndex and rhsIndex.
-        // OPT: If path indices supported efficient lookups we could instead:
-        //      for each (elem,nbr) pair in lhs, if it exist in rhs then emit.
-        map<unsigned, set<unsigned>> lhsPathNeighbors;
-        for (unsigned elem : lhsIndex) {
-          lhsPathNeighbors.insert({elem, set<unsigned>()});
-          for (unsigned nbr : lhsIndex.neighbors(elem)) {
-            lhsPathNeighbors.at(elem).insert(nbr);
-          }
-        }
-        for (unsigned elem : rhsIndex) {
-          pathNeighbors.insert({elem, set<unsigned>()});
-          for (unsigned nbr : rhsIndex.neighbors(elem)) {
-            auto &elemNbrs = lhsPathNeighbors.at(elem);
-            if (elemNbrs.find(nbr) != elemNbrs.end()) {
-              pathNeighbors.at(elem).insert(nbr);
-            }
-          }
-        }
+        // Build a path index that is the intersection of lhsIndex and rhsIndex,
+        // by merging their sorted rows.
+        pi = buildRows(PathRowsBuilder::Intersection, lhsIndex, rhsIndex,
+                       rhsIndex.numElements());
       }
       else {
         iassert(f->getQuantifiedVars().size() == 1)
@@ -337,17 +511,12 @@ PathIndex PathIndexBuilder::buildSegmented(const PathExpression &pe,
             buildIndices(lhs, rhs, freeVars[0], qvar.getVar(), freeVars[1]);
 
         // Build a path index from the first free variable to the second free
-        // variable, through the quantified variable.
-        for (unsigned source : sourceToQuantified) {
-          pathNeighbors.insert({source, set<unsigned>()});
-          for (unsigned q : sourceToQuantified.neighbors(source)) {
-            for (unsigned sink : quantifiedToSink.neighbors(q)) {
-              pathNeighbors.at(source).insert(sink);
-            }
-          }
-        }
+        // variable, through the quantified variable. This is the sparsity
+        // pattern of the product of the two indices' adjacency matrices.
+        pi = buildRows(PathRowsBuilder::Composition,
+                       sourceToQuantified, quantifiedToSink,
+                       sourceToQuantified.numElements());
       }
-      pi = pack(pathNeighbors);
     }
 
     void visit(const Or *f) {
@@ -358,25 +527,16 @@ PathIndex PathIndexBuilder::buildSegmented(const PathExpression &pe,
       PathExpression lhs = f->getLhs();
       PathExpression rhs = f->getRhs();
 
-      map<unsigned, set<unsigned>> pathNeighbors;
       if (!f->isQuantified()) {
         // Build indices from first to second free variable through lhs and rhs
         PathIndex lhsIndex = buildIndex(lhs, freeVars[0], freeVars[1]);
         PathIndex rhsIndex = buildIndex(rhs, freeVars[0], freeVars[1]);
+        iassert(lhsIndex.numElements() >= rhsIndex.numElements());
 
-        // Build a path index that is the union of lhsIndex and rhsIndex
-        for (unsigned elem : lhsIndex) {
-          pathNeighbors.insert({elem, set<unsigned>()});
-          for (unsigned nbr : lhsIndex.neighbors(elem)) {
-            pathNeighbors.at(elem).insert(nbr);
-          }
-        }
-        for (unsigned elem : rhsIndex) {
-          iassert(pathNeighbors.find(elem) != pathNeighbors.end());
-          for (unsigned nbr : rhsIndex.neighbors(elem)) {
-            pathNeighbors.at(elem).insert(nbr);
-          }
-        }
+        // Build a path index that is the union of lhsIndex and rhsIndex, by
+        // merging their sorted rows.
+        pi = buildRows(PathRowsBuilder::Union, lhsIndex, rhsIndex,
+                       lhsIndex.numElements());
       }
       else {
         iassert(f->getQuantifiedVars().size() == 1)
@@ -404,32 +564,55 @@ PathIndex PathIndexBuilder::buildSegmented(const PathExpression &pe,
         // quantified variable. Every free variable that can reach any
         // quantified variable gets links to every element of the second
         // variable. Vice versa for the second variable, but jump from the
-        // quantified var.
+        // quantified var. Every row is therefore one of two rows.
         auto sinkSet = builder->getBinding(f->getSet(freeVars[1]));
 
-        for (unsigned source : sourceToQuantified) {
-          pathNeighbors.insert({source, set<unsigned>()});
-          if (sourceToQuantified.numNeighbors(source) > 0) {
-            for (auto &sinkElem : *sinkSet) {
-              unsigned sink = sinkElem.getIdent();
-              pathNeighbors.at(source).insert(sink);
-            }
-          }
+        PathRows quantifiedToSinkRows(quantifiedToSink);
+        vector<uint32_t> reachableSinks;
+        for (unsigned q = 0; q < quantifiedToSinkRows.numElements(); ++q) {
+          reachableSinks.insert(reachableSinks.end(),
+                                quantifiedToSinkRows.begin(q),
+                                quantifiedToSinkRows.end(q));
         }
-
-        for (unsigned quantified : quantifiedToSink) {
-          for (unsigned sink: quantifiedToSink.neighbors(quantified)) {
-            for (unsigned source : sourceToQuantified) {
-              pathNeighbors.at(source).insert(sink);
-            }
-          }
+        sort(reachableSinks.begin(), reachableSinks.end());
+        reachableSinks.erase(unique(reachableSinks.begin(),
+                                    reachableSinks.end()),
+                             reachableSinks.end());
+
+        vector<uint32_t> allSinks;
+        for (auto &sinkElem : *sinkSet) {
+          allSinks.push_back(sinkElem.getIdent());
+        }
+        sort(allSinks.begin(), allSinks.end());
+        vector<uint32_t> connectedSinks;
+        set_union(allSinks.begin(), allSinks.end(),
+                  reachableSinks.begin(), reachableSinks.end(),
+                  back_inserter(connectedSinks));
+
+        const unsigned numElements = sourceToQuantified.numElements();
+        uint32_t *coordsData =
+            (uint32_t*)malloc((numElements+1)*sizeof(uint32_t));
+        coordsData[0] = 0;
+        for (unsigned source = 0; source < numElements; ++source) {
+          coordsData[source+1] = coordsData[source] +
+              ((sourceToQuantified.numNeighbors(source) > 0)
+               ? connectedSinks.size() : reachableSinks.size());
+        }
+        uint32_t *sinksData =
+            (uint32_t*)malloc(coordsData[numElements]*sizeof(uint32_t));
+        for (unsigned source = 0; source < numElements; ++source) {
+          const vector<uint32_t> &row =
+              (sourceToQuantified.numNeighbors(source) > 0)
+              ? connectedSinks : reachableSinks;
+          copy(row.begin(), row.end(), &sinksData[coordsData[source]]);
         }
+        pi = new SegmentedPathIndex(numElements, coordsData, sinksData);
       }
-      pi = pack(pathNeighbors);
     }
 
     PathIndex pi;  // Path index returned from cases
     PathIndexBuilder *builder;
+    const AppendedIndex *previous;
   };
 
   // TODO: Possible optimization is to detect symmetric path expressions, and
@@ -441,13 +624,84 @@ PathIndex PathIndexBuilder::buildSegmented(const PathExpression &pe,
     return pathIndices.at({pe,sourceEndpoint});
   }
 
-  PathIndex pi = PathNeighborVisitor(this).build(pe);
+  // Path indices that were built before elements were added to their sets are
+  // extended instead of rebuilt
+  auto appended = appendedIndices.find({pe,sourceEndpoint});
+  const AppendedIndex *previous =
+      (appended != appendedIndices.end()) ? &appended->second : nullptr;
+
+  PathIndex pi = PathNeighborVisitor(this).build(pe, previous);
+  if (appended != appendedIndices.end()) {
+    appendedIndices.erase(appended);
+  }
   pathIndices.insert({{pe,sourceEndpoint}, pi});
   return pi;
 }
 
+PathIndexBuilder::PathIndexBuilder(
+    std::map<std::string, const simit::Set*> bindings) {
+  for (auto& binding : bindings) {
+    bind(binding.first, binding.second);
+  }
+}
+
+/// Returns the names of the sets that a path expression is evaluated over.
+static std::set<std::string> getSetNames(const PathExpression &pe) {
+  std::set<std::string> setNames;
+  for (auto& varSet : pe.getSets()) {
+    setNames.insert(varSet.second.getName());
+  }
+  return setNames;
+}
+
 void PathIndexBuilder::bind(std::string name, const simit::Set* set) {
-  bindings.insert({name,set});
+  SetState state = {set->getGeneration(), set->getVersion(), set->getSize()};
+
+  auto binding = bindings.find(name);
+  if (binding != bindings.end()) {
+    // A new set may have the address of a destroyed one, so sets are compared
+    // by generation
+    const SetState& boundState = bindingStates.at(name);
+    bool sameSet = boundState.generation == state.generation;
+    if (sameSet && boundState.version == state.version) {
+      return;
+    }
+
+    // Discard the path indices over the set. If elements were only added to
+    // the set, keep them to be extended.
+    bool appended = sameSet && set->isAppendedSince(boundState.version);
+    for (auto it = pathIndices.begin(); it != pathIndices.end();) {
+      std::set<std::string> setNames = getSetNames(it->first.first);
+      if (!util::contains(setNames, name)) {
+        ++it;
+        continue;
+      }
+      if (appended) {
+        AppendedIndex& appendedIndex = appendedIndices[it->first];
+        appendedIndex.pathIndex = it->second;
+        for (const std::string& setName : setNames) {
+          if (util::contains(bindingStates, setName)) {
+            appendedIndex.setStates[setName] = bindingStates.at(setName);
+          }
+        }
+      }
+      it = pathIndices.erase(it);
+    }
+    for (auto it = appendedIndices.begin(); it != appendedIndices.end();) {
+      auto setState = it->second.setStates.find(name);
+      if (setState != it->second.setStates.end() &&
+          !(setState->second.generation == state.generation &&
+            set->isAppendedSince(setState->second.version))) {
+        it = appendedIndices.erase(it);
+      }
+      else {
+        ++it;
+      }
+    }
+  }
+
+  bindings[name] = set;
+  bindingStates[name] = state;
 }
 
 const simit::Set* PathIndexBuilder::getBinding(pe::Set pset) const {
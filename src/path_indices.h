@@ -108,8 +108,10 @@ public:
 
 private:
   mutable long ref = 0;
-  friend inline void aquire(PathIndexImpl *p) {++p->ref;}
-  friend inline void release(PathIndexImpl *p) {if (--p->ref==0) delete p;}
+  friend inline void aquire(PathIndexImpl *p) {util::incRef(&p->ref);}
+  friend inline void release(PathIndexImpl *p) {
+    if (util::decRef(&p->ref)==0) delete p;
+  }
 };
 
 
@@ -228,11 +230,15 @@ inline const PI* to(PathIndex pi) {
 /// The builder memoizes previously computed path indices, and uses these to
 /// accelerate subsequent path index construction (since path expressions can be
 /// recursively constructed from path expressions).
+///
+/// Sets can be rebound, or bound again after they changed. This only discards
+/// the memoized path indices over those sets. If elements were only added to
+/// the end of the sets, the discarded indices are kept as a starting point and
+/// links are extended with the new edges instead of being rebuilt.
 class PathIndexBuilder {
 public:
   PathIndexBuilder() {}
-  PathIndexBuilder(std::map<std::string, const simit::Set*> bindings)
-      : bindings(bindings) {}
+  PathIndexBuilder(std::map<std::string, const simit::Set*> bindings);
 
   // Build a Segmented path index by evaluating the `pe` over the given graph.
   PathIndex buildSegmented(const PathExpression &pe, unsigned sourceEndpoint);
@@ -242,8 +248,26 @@ public:
   const simit::Set* getBinding(pe::Set pset) const;
 
 private:
-  std::map<std::pair<PathExpression,unsigned>, PathIndex> pathIndices;
+  /// The state of a bound set when path indices over it were built.
+  struct SetState {
+    unsigned long generation;
+    unsigned long version;
+    int size;
+  };
+
+  /// A path index over sets that have since had elements added, and the state
+  /// of its sets when it was built.
+  struct AppendedIndex {
+    PathIndex pathIndex;
+    std::map<std::string, SetState> setStates;
+  };
+
+  typedef std::pair<PathExpression,unsigned> PathIndexKey;
+
+  std::map<PathIndexKey, PathIndex> pathIndices;
+  std::map<PathIndexKey, AppendedIndex> appendedIndices;
   std::map<std::string, const simit::Set*> bindings;
+  std::map<std::string, SetState> bindingStates;
 };
 
 }}
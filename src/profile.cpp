@@ -0,0 +1,120 @@
+#include "profile.h"
+
+#include <cstdio>
+#include <iomanip>
+
+using namespace std;
+
+namespace simit {
+
+static string escapeJSON(const string& str) {
+  string escaped;
+  for (char c : str) {
+    switch (c) {
+      case '"':  escaped += "\\\""; break;
+      case '\\': escaped += "\\\\"; break;
+      case '\n': escaped += "\\n";  break;
+      case '\t': escaped += "\\t";  break;
+      default:
+        if ((unsigned char)c < 0x20) {
+          char code[8];
+          snprintf(code, sizeof(code), "\\u%04x", c);
+          escaped += code;
+        }
+        else {
+          escaped += c;
+        }
+    }
+  }
+  return escaped;
+}
+
+static const char* getKindName(KernelProfile::Kind kind) {
+  return (kind == KernelProfile::Loop) ? "loop" : "statement";
+}
+
+// struct KernelProfile
+double KernelProfile::getBandwidth() const {
+  return (time > 0.0) ? bytes / (time * 1e-6) : 0.0;
+}
+
+double KernelProfile::getArithmeticIntensity() const {
+  return (bytes > 0.0) ? flops / bytes : 0.0;
+}
+
+// class Profile
+double Profile::getTotalTime() const {
+  double time = 0.0;
+  for (auto& kernel : kernels) {
+    time += kernel.time;
+  }
+  return time;
+}
+
+void Profile::writeJSON(std::ostream& os) const {
+  os << "{\"kernels\": [";
+  for (size_t i = 0; i < kernels.size(); ++i) {
+    const KernelProfile& kernel = kernels[i];
+    os << ((i == 0) ? "\n" : ",\n");
+    os << "  {\"name\": \"" << escapeJSON(kernel.name) << "\""
+       << ", \"kind\": \"" << getKindName(kernel.kind) << "\""
+       << ", \"calls\": " << kernel.calls
+       << ", \"iterations\": " << kernel.iterations
+       << ", \"time_us\": " << kernel.time
+       << ", \"bytes\": " << kernel.bytes
+       << ", \"flops\": " << kernel.flops;
+    if (kernel.instructions >= 0) {
+      os << ", \"instructions\": " << kernel.instructions
+         << ", \"cache_misses\": " << kernel.cacheMisses;
+    }
+    os << "}";
+  }
+  os << "\n], \"total_time_us\": " << getTotalTime() << "}" << endl;
+}
+
+void Profile::writeChromeTrace(std::ostream& os) const {
+  os << "{\"traceEvents\": [";
+  double timestamp = 0.0;
+  for (size_t i = 0; i < kernels.size(); ++i) {
+    const KernelProfile& kernel = kernels[i];
+    os << ((i == 0) ? "\n" : ",\n");
+    os << "  {\"name\": \"" << escapeJSON(kernel.name) << "\""
+       << ", \"cat\": \"" << getKindName(kernel.kind) << "\""
+       << ", \"ph\": \"X\", \"pid\": 0, \"tid\": 0"
+       << ", \"ts\": " << timestamp
+       << ", \"dur\": " << kernel.time
+       << ", \"args\": {\"calls\": " << kernel.calls
+       << ", \"iterations\": " << kernel.iterations
+       << ", \"bytes\": " << kernel.bytes
+       << ", \"flops\": " << kernel.flops;
+    if (kernel.instructions >= 0) {
+      os << ", \"instructions\": " << kernel.instructions
+         << ", \"cache_misses\": " << kernel.cacheMisses;
+    }
+    os << "}}";
+    timestamp += kernel.time;
+  }
+  os << "\n], \"displayTimeUnit\": \"ms\"}" << endl;
+}
+
+std::ostream& operator<<(std::ostream& os, const Profile& profile) {
+  double totalTime = profile.getTotalTime();
+  streamsize precision = os.precision();
+  os << setw(8) << "time %" << setw(10) << "calls" << setw(12) << "GB/s"
+     << setw(10) << "flop/B" << "  kernel" << endl;
+  for (auto& kernel : profile.getKernels()) {
+    string name = kernel.name.substr(0, kernel.name.find('\n'));
+    os << fixed << setprecision(2)
+       << setw(8) << ((totalTime > 0.0) ? kernel.time*100.0/totalTime : 0.0)
+       << setw(10) << kernel.calls
+       << setw(12) << kernel.getBandwidth() * 1e-9
+       << setw(10) << kernel.getArithmeticIntensity()
+       << "  " << name << endl;
+  }
+  os.unsetf(ios_base::floatfield);
+  os.precision(precision);
+  os << "Total Time: " << totalTime / 1000000.0 << " (seconds)" << endl;
+  return os;
+}
+
+}
@@ -0,0 +1,72 @@
+#ifndef SIMIT_PROFILE_H
+#define SIMIT_PROFILE_H
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace simit {
+
+/// The measurements of one lowered loop, or of one statement outside loops, of
+/// a function compiled with timers. Bytes and flops are estimated from the
+/// lowered IR: every load and store moves its component, and every arithmetic
+/// operation and intrinsic call on floats is one flop. Nested loops with
+/// constant bounds are counted with their trip counts, and other nested loops
+/// (e.g. over neighbors) are counted once per iteration of the timed loop.
+struct KernelProfile {
+  enum Kind {Loop, Statement};
+
+  /// The lowered IR of the loop header or statement.
+  std::string name;
+  Kind kind;
+
+  unsigned long long calls;
+  unsigned long long iterations;
+
+  /// Total time in microseconds.
+  double time;
+
+  double bytes;
+  double flops;
+
+  /// Hardware counter totals of the calling thread, or -1 if the counters were
+  /// not enabled (see setHardwareCounters) or are not available.
+  long long instructions;
+  long long cacheMisses;
+
+  /// Estimated bytes moved per second.
+  double getBandwidth() const;
+
+  /// Estimated flops per byte moved.
+  double getArithmeticIntensity() const;
+};
+
+/// The profile of a function compiled with timers.
+class Profile {
+public:
+  Profile() {}
+  explicit Profile(const std::vector<KernelProfile>& kernels)
+      : kernels(kernels) {}
+
+  const std::vector<KernelProfile>& getKernels() const {return kernels;}
+
+  /// Total time in microseconds.
+  double getTotalTime() const;
+
+  /// Write the profile as a JSON object with a "kernels" array.
+  void writeJSON(std::ostream& os) const;
+
+  /// Write the profile in the Chrome trace event format, as one complete
+  /// event per kernel. The events are laid out back to back, since the
+  /// profile holds totals rather than individual calls.
+  void writeChromeTrace(std::ostream& os) const;
+
+private:
+  std::vector<KernelProfile> kernels;
+};
+
+/// Write the profile as a table.
+std::ostream& operator<<(std::ostream& os, const Profile& profile);
+
+}
+#endif
@@ -1,5 +1,7 @@
 #include "program.h"
 
+#include <cstdlib>
+#include <mutex>
 #include <set>
 #include <vector>
 
@@ -7,10 +9,13 @@
 #include "frontend/frontend.h"
 #include "util/util.h"
 #include "error.h"
+#include "compile_options.h"
+#include "field_layout.h"
 #include "program_context.h"
 #include "storage.h"
 #include "lower/lower.h"
 #include "timers.h"
+#include "solver.h"
 
 #include "backend/backend.h"
 
@@ -26,18 +31,102 @@ const std::vector<std::string> VALID_BACKENDS = {
 };
 std::string kBackend;
 
-static
-Function compile(ir::Func func, backend::Backend *backend, bool addTimers) {
+const std::vector<std::string> VALID_SCHEDULES = {"static", "dynamic"};
+unsigned kNumThreads = 1;
+std::string kSchedule = "static";
+unsigned kChunkSize = 0;
+
+static std::string getEnvironmentVariable(const char *name) {
+  const char *value = getenv(name);
+  return (value != nullptr) ? std::string(value) : std::string();
+}
+std::string kCacheDir = getEnvironmentVariable("SIMIT_CACHE_DIR");
+
+internal::SolverOptions kSolverOptions;
+
+bool kHardwareCounters = false;
+
+std::vector<std::string> kTargetCPUs;
+std::string kForcedTargetCPU;
+
+bool kVectorizationReport = false;
+
+bool kVectorizeBlocks = true;
+unsigned kMapVectorWidth = 1;
+FieldLayout kFieldLayout;
+
+bool kMatrixFree = false;
+bool kCacheAssemblies = false;
+bool kSymmetricStorage = false;
+
+namespace internal {
+
+CompileOptions CompileOptions::current() {
+  CompileOptions options;
+  options.backend = kBackend;
+  options.numThreads = kNumThreads;
+  options.schedule = kSchedule;
+  options.chunkSize = kChunkSize;
+  options.cacheDir = kCacheDir;
+  options.targetCPUs = kTargetCPUs;
+  options.forcedTargetCPU = kForcedTargetCPU;
+  options.vectorizationReport = kVectorizationReport;
+  options.vectorizeBlocks = kVectorizeBlocks;
+  options.mapVectorWidth = kMapVectorWidth;
+  options.fieldLayout = kFieldLayout;
+  options.matrixFree = kMatrixFree;
+  options.cacheAssemblies = kCacheAssemblies;
+  options.symmetricStorage = kSymmetricStorage;
+  return options;
+}
+
+static thread_local const CompileOptions* compileOptions = nullptr;
+
+const CompileOptions& getCompileOptions() {
+  if (compileOptions != nullptr) {
+    return *compileOptions;
+  }
+  static thread_local CompileOptions options;
+  options = CompileOptions::current();
+  return options;
+}
+
+CompileOptionsScope::CompileOptionsScope(const CompileOptions& options)
+    : options(options), previous(compileOptions) {
+  compileOptions = &this->options;
+}
+
+CompileOptionsScope::~CompileOptionsScope() {
+  compileOptions = previous;
+}
+
+}
+
+static Function compile(ir::Func func, backend::Backend *backend,
+                        bool addTimers,
+                        const internal::CompileOptions& options) {
+  internal::CompileOptionsScope optionsScope(options);
   ir::Storage storage;
   // Fill in storage path expressions, etc.
   /// map<Var,pe::PathExpressions> pes = assignPathExpressions(func);
   /// storage.addPathExpressions(pes);
+  // Functions compiled with timers own a contiguous range of timers, so they
+  // are lowered one at a time
+  static std::mutex timersMutex;
+  std::unique_lock<std::mutex> lock(timersMutex, std::defer_lock);
+  if (addTimers) {
+    lock.lock();
+  }
+  int timersBegin = ir::TimerStorage::getInstance().getNumTimers();
   func = lower(func, false, addTimers);
-  return Function(backend->compile(func, storage));
+  int timersEnd = ir::TimerStorage::getInstance().getNumTimers();
+  return Function(backend->compile(func, storage), timersBegin, timersEnd);
 }
 
-static Function compile(ir::Func func, backend::Backend *backend) {
-  return simit::compile(func, backend, false);
+static Function compile(ir::Func func, backend::Backend *backend,
+                        bool addTimers=false) {
+  return simit::compile(func, backend, addTimers,
+                        internal::CompileOptions::current());
 }
 
 // class ProgramContent
@@ -109,6 +198,19 @@ Function Program::compileWithTimers(const std::string &function) {
   return simit::compile(simitFunc, content->backend, true);
 }
 
+std::future<Function> Program::compileAsync(const std::string &function) {
+  ir::Func simitFunc = content->ctx.getFunction(function);
+  uassert(simitFunc.defined()) << "Attempting to compile an unknown function "
+                               << "(" << function << ")";
+  // The options are read now, so that setting them after this call does not
+  // race with the compilation
+  internal::CompileOptions options = internal::CompileOptions::current();
+  return std::async(std::launch::async, [simitFunc, options]() {
+    backend::Backend backend(options.backend);
+    return simit::compile(simitFunc, &backend, false, options);
+  });
+}
+
 int Program::verify() {
   // For each test look up the called function. Grab the actual arguments and
   // run the function with them as input.  Then compare the result to the
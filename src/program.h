@@ -5,6 +5,7 @@
 #include <ostream>
 #include <vector>
 #include <memory>
+#include <future>
 
 #include "function.h"
 #include "init.h"
@@ -48,6 +49,12 @@ public:
   Function compile(const std::string &function);
   Function compileWithTimers(const std::string &function);
 
+  /// Compile a function on a new thread, and return a future of the runnable
+  /// function. Each call compiles with its own backend, so several functions
+  /// compile concurrently. The program must not be changed (e.g. by
+  /// \ref loadString) before the futures are ready.
+  std::future<Function> compileAsync(const std::string &function);
+
   /// Verify the program by executing in-code comment tests.
   int verify();
 
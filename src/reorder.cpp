@@ -91,11 +91,12 @@ namespace simit {
       auto& fields = vertexSet.getFields();
       int fieldIndex = vertexSet.getFieldIndex(vertexSet.getSpatialFieldName());
       double * spatialData = static_cast<double*>(fields[fieldIndex]->data);  
+      const FieldLayout& layout = fields[fieldIndex]->layout;
      
       for (int i = 0; i < numNodes; ++i) {
-        nodes[i].id = i; nodes[i].x = spatialData[i*3+0];
-        nodes[i].y = spatialData[i*3+1];
-        nodes[i].z = spatialData[i*3+2];
+        nodes[i].id = i; nodes[i].x = spatialData[layout.getOffset(i,0,3)];
+        nodes[i].y = spatialData[layout.getOffset(i,1,3)];
+        nodes[i].z = spatialData[layout.getOffset(i,2,3)];
       }
       
       *outNodes = nodes;
@@ -171,30 +172,30 @@ namespace simit {
       switch (f->type->getComponentType()) {
         case ComponentType::Float: {
           float* data = static_cast<float *>(f->data);
-          reorderFieldData(data, ordering, f->sizeOfType);
+          reorderFieldData(data, ordering, f->sizeOfType, f->layout);
           break;
         }
         case ComponentType::Double: {
           double* data = static_cast<double *>(f->data);
-          reorderFieldData(data, ordering, f->sizeOfType);
+          reorderFieldData(data, ordering, f->sizeOfType, f->layout);
           break;
         }
         case ComponentType::Int: {
           int* data = static_cast<int *>(f->data);
-          reorderFieldData(data, ordering, f->sizeOfType);
+          reorderFieldData(data, ordering, f->sizeOfType, f->layout);
           break;
         }
         case ComponentType::Boolean: {
           bool* data = static_cast<bool *>(f->data);
-          reorderFieldData(data, ordering, f->sizeOfType);
+          reorderFieldData(data, ordering, f->sizeOfType, f->layout);
         }
         case ComponentType::DoubleComplex: {
           double_complex* data = static_cast<double_complex *>(f->data);
-          reorderFieldData(data, ordering, f->sizeOfType);
+          reorderFieldData(data, ordering, f->sizeOfType, f->layout);
         }
         case ComponentType::FloatComplex: {
           float_complex* data = static_cast<float_complex *>(f->data);
-          reorderFieldData(data, ordering, f->sizeOfType);
+          reorderFieldData(data, ordering, f->sizeOfType, f->layout);
         }
       }
     }
@@ -222,6 +223,7 @@ namespace simit {
     free(newEndpoints);
     
     reorderFields(edgeSet.getFields(), edgeOrdering);
+    edgeSet.markRewritten();
   }
 
   void reorderEdgeSetByVertexOrdering(Set& edgeSet, const vector<int>& 
@@ -229,6 +231,7 @@ namespace simit {
     for (int i=0; i < edgeSet.getSize() * edgeSet.getCardinality(); ++i) {
       edgeSet.getEndpointsPtr()[i] = 
         vertexOrdering[edgeSet.getEndpointsPtr()[i]]; }
+    edgeSet.markRewritten();
   }
     
   void reorderVertexSet(Set& edgeSet, Set& vertexSet, vector<int>& 
@@ -244,6 +247,7 @@ namespace simit {
     iassert(vertexOrdering.size() == (unsigned int) vertexSet.getSize()) << 
       vertexOrdering.size() << ", " << vertexSet.getSize();
     reorderFields(vertexSet.getFields(), vertexOrdering);
+    vertexSet.markRewritten();
   }
   
   void reorder(Set& edgeSet, Set& vertexSet, vector<int>& edgeOrdering, 
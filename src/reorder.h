@@ -34,19 +34,21 @@ namespace simit {
  
   template<typename T>
   void reorderFieldData(T* data, const std::vector<int>& vertexOrdering, const 
-      int typeSize) {
-    const int capacity = vertexOrdering.size(); T* newData = 
-      static_cast<T*>(malloc(capacity * typeSize));
+      int typeSize, const FieldLayout& layout=FieldLayout()) {
+    const int capacity = vertexOrdering.size();
+    const size_t bufferSize = layout.getNumSlots(capacity) * typeSize;
+    T* newData = static_cast<T*>(malloc(bufferSize));
     int dim = typeSize/sizeof(T);
     assert(dim > 0);
     for (int i=0; i < capacity; ++i) {
       for (int x=0; x < dim; ++x) {
         assert(vertexOrdering[i]*dim + x < capacity * dim);
-        newData[vertexOrdering[i]*dim+x] = data[i*dim+x];
+        newData[layout.getOffset(vertexOrdering[i], x, dim)] =
+            data[layout.getOffset(i, x, dim)];
       }
     }
 
-    memcpy(data, newData, capacity * typeSize); free(newData);
+    memcpy(data, newData, bufferSize); free(newData);
   }
 
   namespace hilbert {
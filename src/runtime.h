@@ -4,6 +4,12 @@
 #include <time.h>
 #include <vector>
 
+#include "solver.h"
+
+namespace simit {
+extern internal::SolverOptions kSolverOptions;
+}
+
 extern "C" {
 
 // appease GCC
@@ -13,6 +19,12 @@ void cMatSolve_f64(int n,  int m,  int* rowPtr, int* colIdx,
 void cMatSolve_f32(int n,  int m,  int* rowPtr, int* colIdx,
                    int nn, int mm, float* A,
                    float* x, float* b);
+void cMatSolveSymmetric_f64(int n,  int m,  int* rowPtr, int* colIdx,
+                            int nn, int mm, double* A,
+                            double* x, double* b);
+void cMatSolveSymmetric_f32(int n,  int m,  int* rowPtr, int* colIdx,
+                            int nn, int mm, float* A,
+                            float* x, float* b);
 int loc(int v0, int v1, int *neighbors_start, int *neighbors);
 
 double atan2_f64(double y, double x);
@@ -31,113 +43,81 @@ double complexNorm_f64(double r, double i);
 float complexNorm_f32(float r, float i);  
 
 
+void* simitAlignedMalloc(int size);
 void simitStoreTime(int i, double value);
 double simitClock();
+void simitStartTimer(int i);
+void simitStopTimer(int i, int iterations);
 
-// If Eigen is not detected, make solves just do a noop.
-// This is not a #else because we will in the future support more
-// solver backends.
-#ifndef EIGEN
+// Solves use the native BCSR solvers. A is a BCSR matrix with n x m components
+// in nn x mm blocks, x is the right hand side and b receives the solution.
+// NOTE: Implementation MUST stay synchronized with cMatSolve_f32
 void cMatSolve_f64(int n,  int m,  int* rowPtr, int* colIdx,
                    int nn, int mm, double* A,
                    double* x, double* b) {
-  return;
+#ifndef SIMIT_EXTERN_SOLVE_NOOP
+  simit::internal::BlockMatrix<double> mat = {n/nn, m/mm, rowPtr, colIdx,
+                                              nn, mm, A};
+  simit::internal::reportSolverResult(
+      simit::internal::blockSolve(mat, x, b, simit::kSolverOptions));
+#endif
 }
 
-void cMatSolve_f32(int n, int m, int* rowPtr, int* colIdx,
+// NOTE: Implementation MUST stay synchronized with cMatSolve_f64
+void cMatSolve_f32(int n,  int m,  int* rowPtr, int* colIdx,
                    int nn, int mm, float* A,
                    float* x, float* b) {
-  return;
-}
+#ifndef SIMIT_EXTERN_SOLVE_NOOP
+  simit::internal::BlockMatrix<float> mat = {n/nn, m/mm, rowPtr, colIdx,
+                                             nn, mm, A};
+  simit::internal::reportSolverResult(
+      simit::internal::blockSolve(mat, x, b, simit::kSolverOptions));
 #endif
-} // extern "C"
-
-
-#ifdef EIGEN
-#include <Eigen/Core>
-#include <Eigen/Dense>
-#include <Eigen/Sparse>
-#include <Eigen/IterativeLinearSolvers>
-
-extern "C" {
-// NOTE: Implementation MUST stay synchronized with cMatSolve_f32
-void cMatSolve_f64(int n,  int m,  int* rowPtr, int* colIdx,
-                   int nn, int mm, double* A,
-                   double* x, double* b) {
-  using namespace Eigen;
-  int nnz = rowPtr[n/nn];
-
-  auto xvec = new Eigen::Map<Eigen::Matrix<double,Dynamic,1>>(x, m);
-  auto cvec = new Eigen::Map<Eigen::Matrix<double,Dynamic,1>>(b, n);
-  
-  // Construct the matrix
-  std::vector<Triplet<double>> tripletList;
-  tripletList.reserve(nnz*nn*mm);
-  for (int i=0; i<n/(nn); i++) {
-    for (int j=rowPtr[i]; j<rowPtr[i+1]; j++) {
-      for (int bi=0; bi<nn; bi++) {
-        for (int bj=0; bj<mm; bj++) {
-          tripletList.push_back(Triplet<double>(i*nn+bi, colIdx[j]*mm+bj,
-                                                A[j*nn*mm+bi*nn+bj]));
-        }
-      }
-    }
-  }
-  SparseMatrix<double> mat(n, m);
-  mat.setFromTriplets(tripletList.begin(), tripletList.end());
+}
 
+// Symmetric solves get the upper block-triangle of a symmetric BCSR matrix.
+// NOTE: Implementation MUST stay synchronized with cMatSolveSymmetric_f32
+void cMatSolveSymmetric_f64(int n,  int m,  int* rowPtr, int* colIdx,
+                            int nn, int mm, double* A,
+                            double* x, double* b) {
 #ifndef SIMIT_EXTERN_SOLVE_NOOP
-  ConjugateGradient<SparseMatrix<double>,Lower,IdentityPreconditioner> solver;
-  solver.setMaxIterations(50);
-  solver.compute(mat);
-  *cvec = solver.solve(*xvec);
+  simit::internal::BlockMatrix<double> mat = {n/nn, m/mm, rowPtr, colIdx,
+                                              nn, mm, A};
+  simit::internal::reportSolverResult(
+      simit::internal::symmetricBlockSolve(mat, x, b, simit::kSolverOptions));
 #endif
 }
 
-// NOTE: Implementation MUST stay synchronized with cMatSolve_f64
-void cMatSolve_f32(int n,  int m,  int* rowPtr, int* colIdx,
-                   int nn, int mm, float* A,
-                   float* x, float* b) {
-  using namespace Eigen;
-  int nnz = rowPtr[n/nn];
-
-  auto xvec = new Eigen::Map<Eigen::Matrix<float,Dynamic,1>>(x, m);
-  auto cvec = new Eigen::Map<Eigen::Matrix<float,Dynamic,1>>(b, n);
-
-  // Construct the matrix
-  std::vector<Triplet<float>> tripletList;
-  tripletList.reserve(nnz*nn*mm);
-  for (int i=0; i<n/(nn); i++) {
-    for (int j=rowPtr[i]; j<rowPtr[i+1]; j++) {
-      for (int bi=0; bi<nn; bi++) {
-        for (int bj=0; bj<mm; bj++) {
-          tripletList.push_back(Triplet<float>(i*nn+bi, colIdx[j]*mm+bj,
-                                               A[j*nn*mm+bi*nn+bj]));
-        }
-      }
-    }
-  }
-  SparseMatrix<float> mat(n, m);
-  mat.setFromTriplets(tripletList.begin(), tripletList.end());
-  
+// NOTE: Implementation MUST stay synchronized with cMatSolveSymmetric_f64
+void cMatSolveSymmetric_f32(int n,  int m,  int* rowPtr, int* colIdx,
+                            int nn, int mm, float* A,
+                            float* x, float* b) {
 #ifndef SIMIT_EXTERN_SOLVE_NOOP
-  ConjugateGradient<SparseMatrix<float>,Lower,IdentityPreconditioner> solver;
-  solver.setMaxIterations(50);
-  solver.compute(mat);
-  *cvec = solver.solve(*xvec);
+  simit::internal::BlockMatrix<float> mat = {n/nn, m/mm, rowPtr, colIdx,
+                                             nn, mm, A};
+  simit::internal::reportSolverResult(
+      simit::internal::symmetricBlockSolve(mat, x, b, simit::kSolverOptions));
 #endif
-  
 }
 } // extern "C"
-#endif // ifdef EIGEN
 
 
 extern "C" {
 
+// Neighbor lists are sorted, so we binary search for v1 in v0's neighbors
 int loc(int v0, int v1, int *neighbors_start, int *neighbors) {
-  int l = neighbors_start[v0];
-  while(neighbors[l] != v1) l++;
-  return l;
+  int lo = neighbors_start[v0];
+  int hi = neighbors_start[v0+1];
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if (neighbors[mid] < v1) {
+      lo = mid + 1;
+    }
+    else {
+      hi = mid;
+    }
+  }
+  return lo;
 }
 
 // atan2 wrapper
@@ -260,12 +240,31 @@ float complexNorm_f32(float r, float i) {
 
 }
 
+#include <stdlib.h>
+#include "field_allocator.h"
+void* simitAlignedMalloc(int size) {
+  void* ptr = nullptr;
+  if (posix_memalign(&ptr, simit::internal::FieldAllocator::kAlignment,
+                     size) != 0) {
+    return nullptr;
+  }
+  return ptr;
+}
+
 #include "timers.h"
 #include "stdio.h"
 void simitStoreTime(int i, double value) {
   simit::ir::TimerStorage::getInstance().storeTime(i, value);
 }
 
+void simitStartTimer(int i) {
+  simit::ir::TimerStorage::getInstance().startTimer(i);
+}
+
+void simitStopTimer(int i, int iterations) {
+  simit::ir::TimerStorage::getInstance().stopTimer(i, iterations);
+}
+
 #include <chrono>
 double simitClock() {
   using namespace std::chrono;
@@ -0,0 +1,1476 @@
+#include "solver.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
+
+#include "error.h"
+#include "thread_pool.h"
+
+using namespace std;
+
+namespace simit {
+namespace internal {
+
+// Vector reductions are split into a fixed number of chunks, so that their
+// results do not depend on the number of threads.
+static const int kReductionChunks = 64;
+
+Preconditioner getPreconditioner(const std::string& name) {
+  static const map<string,Preconditioner> preconditioners = {
+    {"none",                None},
+    {"jacobi",              Jacobi},
+    {"block-jacobi",        BlockJacobi},
+    {"incomplete-cholesky", IncompleteCholesky},
+    {"algebraic-multigrid", AlgebraicMultigrid}
+  };
+  uassert(preconditioners.find(name) != preconditioners.end())
+      << "Invalid preconditioner: " << name;
+  return preconditioners.at(name);
+}
+
+SolverMethod getSolverMethod(const std::string& name) {
+  static const map<string,SolverMethod> methods = {
+    {"conjugate-gradient", ConjugateGradient},
+    {"direct",             Direct}
+  };
+  uassert(methods.find(name) != methods.end())
+      << "Invalid solver method: " << name;
+  return methods.at(name);
+}
+
+static void parallelFor(int start, int end, ThreadPool::Task task,
+                        void **context) {
+  ThreadPool::getInstance().parallelFor(start, end, task, context,
+                                        ThreadPool::Static, 0);
+}
+
+// y = A*x
+template <typename Float>
+static void spmvTask(int start, int end, void **context) {
+  const BlockMatrix<Float>& A = *(const BlockMatrix<Float>*)context[0];
+  const Float *x = (const Float*)context[1];
+  Float *y = (Float*)context[2];
+
+  const int nn = A.blockRows;
+  const int mm = A.blockCols;
+  for (int i = start; i < end; ++i) {
+    Float *yi = &y[i*nn];
+    for (int bi = 0; bi < nn; ++bi) {
+      yi[bi] = 0;
+    }
+    for (int k = A.rowPtr[i]; k < A.rowPtr[i+1]; ++k) {
+      const Float *block = &A.vals[(size_t)k*nn*mm];
+      const Float *xj = &x[A.colIdx[k]*mm];
+      for (int bi = 0; bi < nn; ++bi) {
+        Float sum = 0;
+        for (int bj = 0; bj < mm; ++bj) {
+          sum += block[bi*mm + bj] * xj[bj];
+        }
+        yi[bi] += sum;
+      }
+    }
+  }
+}
+
+template <typename Float>
+void blockSpMV(const BlockMatrix<Float>& A, const Float *x, Float *y) {
+  void *context[] = {(void*)&A, (void*)x, (void*)y};
+  parallelFor(0, A.rows, spmvTask<Float>, context);
+}
+
+// partials[c] = dot(a,b) over chunk c
+template <typename Float>
+static void dotTask(int start, int end, void **context) {
+  const long long n = *(const int*)context[0];
+  const Float *a = (const Float*)context[1];
+  const Float *b = (const Float*)context[2];
+  double *partials = (double*)context[3];
+  for (int c = start; c < end; ++c) {
+    double sum = 0.0;
+    for (long long i = n*c/kReductionChunks; i < n*(c+1)/kReductionChunks; ++i){
+      sum += (double)a[i] * (double)b[i];
+    }
+    partials[c] = sum;
+  }
+}
+
+template <typename Float>
+static double dot(const vector<Float>& a, const vector<Float>& b) {
+  int n = a.size();
+  double partials[kReductionChunks];
+  void *context[] = {&n, (void*)a.data(), (void*)b.data(), partials};
+  parallelFor(0, kReductionChunks, dotTask<Float>, context);
+
+  double sum = 0.0;
+  for (int c = 0; c < kReductionChunks; ++c) {
+    sum += partials[c];
+  }
+  return sum;
+}
+
+// y = a*x + b*y
+template <typename Float>
+static void axpbyTask(int start, int end, void **context) {
+  const Float a = *(const Float*)context[0];
+  const Float *x = (const Float*)context[1];
+  const Float b = *(const Float*)context[2];
+  Float *y = (Float*)context[3];
+  for (int i = start; i < end; ++i) {
+    y[i] = a*x[i] + b*y[i];
+  }
+}
+
+template <typename Float>
+static void axpby(Float a, const vector<Float>& x, Float b, vector<Float>* y) {
+  void *context[] = {&a, (void*)x.data(), &b, y->data()};
+  parallelFor(0, y->size(), axpbyTask<Float>, context);
+}
+
+/// Inverts the n x n matrix a using Gauss-Jordan elimination with partial
+/// pivoting. Returns false if a is singular.
+static bool invert(int n, vector<double>* a, vector<double>* inv) {
+  vector<double>& A = *a;
+  vector<double>& B = *inv;
+  fill(B.begin(), B.end(), 0.0);
+  for (int i = 0; i < n; ++i) {
+    B[i*n + i] = 1.0;
+  }
+  for (int c = 0; c < n; ++c) {
+    int pivot = c;
+    for (int r = c+1; r < n; ++r) {
+      if (fabs(A[r*n + c]) > fabs(A[pivot*n + c])) {
+        pivot = r;
+      }
+    }
+    if (A[pivot*n + c] == 0.0) {
+      return false;
+    }
+    for (int j = 0; j < n; ++j) {
+      swap(A[c*n + j], A[pivot*n + j]);
+      swap(B[c*n + j], B[pivot*n + j]);
+    }
+    double scale = 1.0 / A[c*n + c];
+    for (int j = 0; j < n; ++j) {
+      A[c*n + j] *= scale;
+      B[c*n + j] *= scale;
+    }
+    for (int r = 0; r < n; ++r) {
+      double f = A[r*n + c];
+      if (r == c || f == 0.0) {
+        continue;
+      }
+      for (int j = 0; j < n; ++j) {
+        A[r*n + j] -= f * A[c*n + j];
+        B[r*n + j] -= f * B[c*n + j];
+      }
+    }
+  }
+  return true;
+}
+
+// The number of patterns whose analyses a PatternCache keeps
+static const size_t kMaxCachedPatterns = 16;
+
+/// Caches the analyses (e.g. symbolic factorizations) of the sparsity patterns
+/// of block matrices by the location of the matrices' index arrays, which
+/// belong to their tensor indices. The analyses of different patterns can be
+/// used concurrently, while the users of the same pattern take turns.
+template <typename Float, typename Analysis>
+class PatternCache {
+public:
+  struct Entry {
+    std::mutex mutex;
+    unique_ptr<Analysis> analysis;
+
+    /// Returns the analysis of A's pattern. It is redone if the index arrays
+    /// now hold another pattern. The caller must hold the entry's mutex.
+    Analysis* get(const BlockMatrix<Float>& A) {
+      if (analysis == nullptr || !analysis->hasPattern(A)) {
+        analysis.reset(new Analysis(A));
+      }
+      return analysis.get();
+    }
+  };
+
+  /// Returns the entry of A's index arrays.
+  shared_ptr<Entry> getEntry(const BlockMatrix<Float>& A) {
+    lock_guard<std::mutex> lock(mutex);
+    auto key = make_pair(A.rowPtr, A.colIdx);
+    auto it = entries.find(key);
+    if (it == entries.end()) {
+      if (entries.size() >= kMaxCachedPatterns) {
+        entries.clear();
+      }
+      it = entries.insert({key, make_shared<Entry>()}).first;
+    }
+    return it->second;
+  }
+
+private:
+  std::mutex mutex;
+  map<pair<const int*,const int*>, shared_ptr<Entry>> entries;
+};
+
+/// Approximates the inverse of a block matrix.
+template <typename Float>
+class PreconditionerImpl {
+public:
+  PreconditionerImpl(const BlockMatrix<Float>& A, Preconditioner kind)
+      : kind(kind), blockSize(A.blockRows) {
+    switch (kind) {
+      case None:
+        break;
+      case Jacobi:
+        initJacobi(A);
+        break;
+      case BlockJacobi:
+        initBlockJacobi(A);
+        break;
+      case IncompleteCholesky:
+        initIncompleteCholesky(A);
+        break;
+      case AlgebraicMultigrid:
+        initMultigrid(A);
+        break;
+    }
+  }
+
+  /// z = M^-1 * r
+  void apply(const vector<Float>& r, vector<Float>* z) const {
+    void *context[] = {(void*)this, (void*)r.data(), z->data()};
+    switch (kind) {
+      case None:
+        *z = r;
+        break;
+      case Jacobi:
+        parallelFor(0, r.size(), jacobiTask, context);
+        break;
+      case BlockJacobi:
+        parallelFor(0, r.size()/blockSize, blockJacobiTask, context);
+        break;
+      case IncompleteCholesky:
+        applyIncompleteCholesky(r, z);
+        break;
+      case AlgebraicMultigrid:
+        multigrid->apply(r.data(), z->data());
+        break;
+    }
+  }
+
+private:
+  Preconditioner kind;
+  int blockSize;
+
+  // Inverted diagonal components (Jacobi) or blocks (BlockJacobi)
+  vector<Float> invDiag;
+
+  // Lower triangular incomplete Cholesky factor in scalar CSR format, where
+  // the last entry of each row is the diagonal
+  vector<int> lRowPtr;
+  vector<int> lColIdx;
+  vector<double> lVals;
+
+  // Multigrid hierarchy of A's pattern, which stays locked while it is used
+  typedef PatternCache<Float,AMGHierarchy<Float>> MultigridCache;
+  shared_ptr<typename MultigridCache::Entry> multigridEntry;
+  unique_lock<std::mutex> multigridLock;
+  AMGHierarchy<Float> *multigrid;
+
+  /// Returns the location of the diagonal block of block row i, or -1.
+  static int findDiagonalBlock(const BlockMatrix<Float>& A, int i) {
+    const int *begin = &A.colIdx[A.rowPtr[i]];
+    const int *end = &A.colIdx[A.rowPtr[i+1]];
+    const int *diag = lower_bound(begin, end, i);
+    return (diag != end && *diag == i) ? A.rowPtr[i] + (diag - begin) : -1;
+  }
+
+  void initJacobi(const BlockMatrix<Float>& A) {
+    const int nn = A.blockRows;
+    invDiag.resize(A.rows * nn, 1);
+    for (int i = 0; i < A.rows; ++i) {
+      int k = findDiagonalBlock(A, i);
+      if (k == -1) {
+        continue;
+      }
+      for (int bi = 0; bi < nn; ++bi) {
+        Float d = A.vals[(size_t)k*nn*nn + bi*nn + bi];
+        if (d != 0) {
+          invDiag[i*nn + bi] = 1 / d;
+        }
+      }
+    }
+  }
+
+  void initBlockJacobi(const BlockMatrix<Float>& A) {
+    const int nn = A.blockRows;
+    invDiag.resize((size_t)A.rows * nn * nn, 0);
+    vector<double> block(nn*nn);
+    vector<double> inv(nn*nn);
+    for (int i = 0; i < A.rows; ++i) {
+      Float *invBlock = &invDiag[(size_t)i*nn*nn];
+      int k = findDiagonalBlock(A, i);
+      if (k != -1) {
+        copy(&A.vals[(size_t)k*nn*nn], &A.vals[(size_t)(k+1)*nn*nn],
+             block.begin());
+      }
+      if (k != -1 && invert(nn, &block, &inv)) {
+        copy(inv.begin(), inv.end(), invBlock);
+      }
+      else {
+        // Fall back to Jacobi for singular blocks
+        for (int bi = 0; bi < nn; ++bi) {
+          Float d = (k != -1) ? A.vals[(size_t)k*nn*nn + bi*nn + bi] : 0;
+          invBlock[bi*nn + bi] = (d != 0) ? 1 / d : 1;
+        }
+      }
+    }
+  }
+
+  static void jacobiTask(int start, int end, void **context) {
+    const PreconditionerImpl *M = (const PreconditionerImpl*)context[0];
+    const Float *r = (const Float*)context[1];
+    Float *z = (Float*)context[2];
+    for (int i = start; i < end; ++i) {
+      z[i] = M->invDiag[i] * r[i];
+    }
+  }
+
+  static void blockJacobiTask(int start, int end, void **context) {
+    const PreconditionerImpl *M = (const PreconditionerImpl*)context[0];
+    const Float *r = (const Float*)context[1];
+    Float *z = (Float*)context[2];
+    const int nn = M->blockSize;
+    for (int i = start; i < end; ++i) {
+      const Float *invBlock = &M->invDiag[(size_t)i*nn*nn];
+      for (int bi = 0; bi < nn; ++bi) {
+        Float sum = 0;
+        for (int bj = 0; bj < nn; ++bj) {
+          sum += invBlock[bi*nn + bj] * r[i*nn + bj];
+        }
+        z[i*nn + bi] = sum;
+      }
+    }
+  }
+
+  /// Computes the zero fill-in incomplete Cholesky factor L of the scalar
+  /// matrix, using the lower triangle of A.
+  void initIncompleteCholesky(const BlockMatrix<Float>& A) {
+    const int nn = A.blockRows;
+    const int n = A.rows * nn;
+
+    // Extract the lower triangle of the scalar matrix
+    lRowPtr.resize(n+1);
+    lRowPtr[0] = 0;
+    for (int i = 0; i < A.rows; ++i) {
+      for (int bi = 0; bi < nn; ++bi) {
+        const int row = i*nn + bi;
+        for (int k = A.rowPtr[i]; k < A.rowPtr[i+1]; ++k) {
+          for (int bj = 0; bj < nn; ++bj) {
+            const int col = A.colIdx[k]*nn + bj;
+            if (col > row) {
+              break;
+            }
+            lColIdx.push_back(col);
+            lVals.push_back(A.vals[(size_t)k*nn*nn + bi*nn + bj]);
+          }
+        }
+        if (lColIdx.size() == (size_t)lRowPtr[row] || lColIdx.back() != row) {
+          lColIdx.push_back(row);
+          lVals.push_back(0.0);
+        }
+        lRowPtr[row+1] = lColIdx.size();
+      }
+    }
+
+    // Factorize in place, row by row
+    for (int row = 0; row < n; ++row) {
+      const int diag = lRowPtr[row+1] - 1;
+      for (int e = lRowPtr[row]; e < diag; ++e) {
+        const int col = lColIdx[e];
+        // Sorted merge of L(row,0:col) and L(col,0:col)
+        double sum = lVals[e];
+        int p = lRowPtr[row];
+        int q = lRowPtr[col];
+        const int qend = lRowPtr[col+1] - 1;
+        while (p < e && q < qend) {
+          if (lColIdx[p] < lColIdx[q]) {
+            ++p;
+          }
+          else if (lColIdx[p] > lColIdx[q]) {
+            ++q;
+          }
+          else {
+            sum -= lVals[p++] * lVals[q++];
+          }
+        }
+        lVals[e] = sum / lVals[qend];
+      }
+
+      double d = lVals[diag];
+      for (int e = lRowPtr[row]; e < diag; ++e) {
+        d -= lVals[e] * lVals[e];
+      }
+      // Guard against breakdown on matrices that are not positive definite
+      if (d <= 0.0) {
+        d = (lVals[diag] > 0.0) ? lVals[diag] : 1.0;
+      }
+      lVals[diag] = sqrt(d);
+    }
+  }
+
+  /// Gets the cached multigrid hierarchy of A's pattern and refreshes its
+  /// values.
+  void initMultigrid(const BlockMatrix<Float>& A) {
+    static MultigridCache cache;
+    multigridEntry = cache.getEntry(A);
+    multigridLock = unique_lock<std::mutex>(multigridEntry->mutex);
+    multigrid = multigridEntry->get(A);
+    multigrid->refresh(A);
+  }
+
+  /// Solves L*L^T*z = r
+  void applyIncompleteCholesky(const vector<Float>& r,
+                               vector<Float>* z) const {
+    const int n = r.size();
+    vector<double> y(n);
+    for (int row = 0; row < n; ++row) {
+      const int diag = lRowPtr[row+1] - 1;
+      double sum = r[row];
+      for (int e = lRowPtr[row]; e < diag; ++e) {
+        sum -= lVals[e] * y[lColIdx[e]];
+      }
+      y[row] = sum / lVals[diag];
+    }
+    for (int row = n-1; row >= 0; --row) {
+      const int diag = lRowPtr[row+1] - 1;
+      y[row] /= lVals[diag];
+      for (int e = lRowPtr[row]; e < diag; ++e) {
+        y[lColIdx[e]] -= lVals[e] * y[row];
+      }
+    }
+    for (int row = 0; row < n; ++row) {
+      (*z)[row] = y[row];
+    }
+  }
+};
+
+template <typename Float>
+SolverResult pcgSolve(const BlockMatrix<Float>& A, const Float *b, Float *x,
+                      const SolverOptions& options) {
+  uassert(A.rows == A.cols && A.blockRows == A.blockCols)
+      << "the solver requires a square matrix with square blocks";
+  const int n = A.rows * A.blockRows;
+  const int maxIterations = (options.maxIterations > 0)
+                            ? options.maxIterations : max(n, 1);
+
+  SolverResult result;
+  result.iterations = 0;
+  result.residual = 0.0;
+  result.converged = true;
+  result.fellBack = false;
+
+  vector<Float> r(b, b+n);
+  vector<Float> xs(n, 0);
+  const double bnorm = sqrt(dot(r, r));
+  if (bnorm == 0.0) {
+    copy(xs.begin(), xs.end(), x);
+    return result;
+  }
+
+  PreconditionerImpl<Float> M(A, options.preconditioner);
+  vector<Float> z(n);
+  vector<Float> q(n);
+  M.apply(r, &z);
+  vector<Float> p = z;
+  double rz = dot(r, z);
+
+  result.converged = false;
+  result.residual = 1.0;
+  while (result.iterations < maxIterations) {
+    blockSpMV(A, p.data(), q.data());
+    const double pq = dot(p, q);
+    if (pq == 0.0) {
+      break;
+    }
+    const Float alpha = rz / pq;
+    axpby<Float>(alpha, p, 1, &xs);
+    axpby<Float>(-alpha, q, 1, &r);
+    ++result.iterations;
+
+    result.residual = sqrt(dot(r, r)) / bnorm;
+    if (result.residual <= options.tolerance) {
+      result.converged = true;
+      break;
+    }
+
+    M.apply(r, &z);
+    const double rzNew = dot(r, z);
+    const Float beta = rzNew / rz;
+    rz = rzNew;
+    axpby<Float>(1, z, beta, &p);
+  }
+
+  copy(xs.begin(), xs.end(), x);
+  return result;
+}
+
+/// Returns a minimum degree ordering of the graph with the given adjacency
+/// lists, which must be symmetric and free of self loops. The ordering lists
+/// the nodes in the order they are eliminated.
+static vector<int> minimumDegreeOrdering(vector<vector<int>> adj) {
+  const int n = adj.size();
+
+  // Nodes by degree, and by index to break ties deterministically
+  set<pair<int,int>> queue;
+  for (int i = 0; i < n; ++i) {
+    queue.insert({adj[i].size(), i});
+  }
+
+  // Eliminating a node connects its neighbors to each other. The adjacency
+  // lists only hold the nodes that have not been eliminated.
+  vector<int> ordering;
+  ordering.reserve(n);
+  vector<int> merged;
+  while (!queue.empty()) {
+    const int v = queue.begin()->second;
+    queue.erase(queue.begin());
+    ordering.push_back(v);
+
+    const vector<int>& neighbors = adj[v];
+    for (int u : neighbors) {
+      queue.erase({adj[u].size(), u});
+      merged.clear();
+      set_union(adj[u].begin(), adj[u].end(),
+                neighbors.begin(), neighbors.end(), back_inserter(merged));
+      merged.erase(remove_if(merged.begin(), merged.end(),
+                             [u,v](int w) {return w == u || w == v;}),
+                   merged.end());
+      adj[u].swap(merged);
+      queue.insert({adj[u].size(), u});
+    }
+    vector<int>().swap(adj[v]);
+  }
+  return ordering;
+}
+
+// c = c + alpha*a*b, for n x n blocks
+static void multiplyAdd(int n, double alpha, const double *a, const double *b,
+                        double *c) {
+  for (int i = 0; i < n; ++i) {
+    for (int k = 0; k < n; ++k) {
+      const double aik = alpha * a[i*n + k];
+      for (int j = 0; j < n; ++j) {
+        c[i*n + j] += aik * b[k*n + j];
+      }
+    }
+  }
+}
+
+// c = c + a^T*b, for n x n blocks
+static void transposeMultiplyAdd(int n, const double *a, const double *b,
+                                 double *c) {
+  for (int k = 0; k < n; ++k) {
+    for (int i = 0; i < n; ++i) {
+      const double aki = a[k*n + i];
+      for (int j = 0; j < n; ++j) {
+        c[i*n + j] += aki * b[k*n + j];
+      }
+    }
+  }
+}
+
+// class BlockLDLT
+template <typename Float>
+BlockLDLT<Float>::BlockLDLT(const BlockMatrix<Float>& A)
+    : rows(A.rows), blockSize(A.blockRows),
+      rowPtr(A.rowPtr, A.rowPtr + A.rows + 1),
+      colIdx(A.colIdx, A.colIdx + A.rowPtr[A.rows]) {
+  uassert(A.rows == A.cols && A.blockRows == A.blockCols)
+      << "the solver requires a square matrix with square blocks";
+  const int n = rows;
+
+  // Order the graph of the blocks
+  vector<vector<int>> adj(n);
+  for (int i = 0; i < n; ++i) {
+    for (int k = rowPtr[i]; k < rowPtr[i+1]; ++k) {
+      if (colIdx[k] != i) {
+        adj[i].push_back(colIdx[k]);
+        adj[colIdx[k]].push_back(i);
+      }
+    }
+  }
+  for (vector<int>& neighbors : adj) {
+    sort(neighbors.begin(), neighbors.end());
+    neighbors.erase(unique(neighbors.begin(), neighbors.end()),
+                    neighbors.end());
+  }
+  perm = minimumDegreeOrdering(adj);
+  vector<int> invPerm(n);
+  for (int i = 0; i < n; ++i) {
+    invPerm[perm[i]] = i;
+  }
+
+  // Column k of the upper triangle of P*A*P^T has the blocks
+  // A(perm[k],j)^T = A(j,perm[k]) of the j that are ordered before perm[k]
+  aColPtr.resize(n+1);
+  aColPtr[0] = 0;
+  for (int k = 0; k < n; ++k) {
+    const int row = perm[k];
+    for (int loc = rowPtr[row]; loc < rowPtr[row+1]; ++loc) {
+      const int i = invPerm[colIdx[loc]];
+      if (i <= k) {
+        aRowIdx.push_back(i);
+        aLoc.push_back(loc);
+      }
+    }
+    aColPtr[k+1] = aRowIdx.size();
+  }
+
+  // Compute the elimination tree and the number of blocks in each column of
+  // L. The blocks of row k of L are in the columns on the paths from the
+  // nonzero blocks of column k of the upper triangle up to k.
+  vector<int> parent(n, -1);
+  vector<int> flag(n, -1);
+  vector<int> counts(n, 0);
+  for (int k = 0; k < n; ++k) {
+    flag[k] = k;
+    for (int p = aColPtr[k]; p < aColPtr[k+1]; ++p) {
+      for (int i = aRowIdx[p]; flag[i] != k; i = parent[i]) {
+        if (parent[i] == -1) {
+          parent[i] = k;
+        }
+        ++counts[i];
+        flag[i] = k;
+      }
+    }
+  }
+  lColPtr.resize(n+1);
+  lColPtr[0] = 0;
+  for (int i = 0; i < n; ++i) {
+    lColPtr[i+1] = lColPtr[i] + counts[i];
+  }
+  lRowIdx.resize(lColPtr[n]);
+
+  // Lay out the blocks of each row of L in topological order, so that the
+  // numeric factorization computes the blocks of a row after the blocks they
+  // depend on
+  vector<int> next(lColPtr.begin(), lColPtr.end()-1);
+  vector<int> pattern(n);
+  vector<int> path(n);
+  fill(flag.begin(), flag.end(), -1);
+  lRowPtr.resize(n+1);
+  lRowPtr[0] = 0;
+  lRowCols.reserve(lColPtr[n]);
+  lRowLocs.reserve(lColPtr[n]);
+  for (int k = 0; k < n; ++k) {
+    flag[k] = k;
+    int top = n;
+    for (int p = aColPtr[k]; p < aColPtr[k+1]; ++p) {
+      int len = 0;
+      for (int i = aRowIdx[p]; flag[i] != k; i = parent[i]) {
+        path[len++] = i;
+        flag[i] = k;
+      }
+      while (len > 0) {
+        pattern[--top] = path[--len];
+      }
+    }
+    for (; top < n; ++top) {
+      const int i = pattern[top];
+      lRowIdx[next[i]] = k;
+      lRowCols.push_back(i);
+      lRowLocs.push_back(next[i]++);
+    }
+    lRowPtr[k+1] = lRowCols.size();
+  }
+}
+
+template <typename Float>
+bool BlockLDLT<Float>::hasPattern(const BlockMatrix<Float>& A) const {
+  return A.rows == rows && A.cols == rows && A.blockRows == blockSize &&
+         A.blockCols == blockSize &&
+         equal(rowPtr.begin(), rowPtr.end(), A.rowPtr) &&
+         equal(colIdx.begin(), colIdx.end(), A.colIdx);
+}
+
+template <typename Float>
+bool BlockLDLT<Float>::factorize(const BlockMatrix<Float>& A) {
+  iassert(hasPattern(A));
+  const int n = rows;
+  const int nn = blockSize;
+  const int bs = nn*nn;
+  lVals.resize((size_t)lRowIdx.size() * bs);
+  dInv.resize((size_t)n * bs);
+
+  // The factorization computes L and D one block row at a time. For row k it
+  // solves for W_i = D_i*L(k,i)^T in the columns i of the row's blocks, which
+  // it accumulates in the dense block vector y, and then L(k,i) = W_i^T*D_i^-1
+  // and D_k = A(k,k) - sum_i L(k,i)*W_i.
+  vector<double> y((size_t)n * bs, 0.0);
+  vector<double> d(bs);
+  vector<double> inv(bs);
+  for (int k = 0; k < n; ++k) {
+    for (int p = aColPtr[k]; p < aColPtr[k+1]; ++p) {
+      double *yi = &y[(size_t)aRowIdx[p] * bs];
+      const Float *block = &A.vals[(size_t)aLoc[p] * bs];
+      for (int r = 0; r < nn; ++r) {
+        for (int c = 0; c < nn; ++c) {
+          yi[r*nn + c] += block[c*nn + r];
+        }
+      }
+    }
+    double *yk = &y[(size_t)k * bs];
+    copy(yk, yk + bs, d.begin());
+    fill(yk, yk + bs, 0.0);
+
+    for (int t = lRowPtr[k]; t < lRowPtr[k+1]; ++t) {
+      const int i = lRowCols[t];
+      const int loc = lRowLocs[t];
+      double *w = &y[(size_t)i * bs];
+
+      // Remove W_i from the rows below i that come before k
+      for (int p = lColPtr[i]; p < loc; ++p) {
+        multiplyAdd(nn, -1.0, &lVals[(size_t)p * bs], w,
+                    &y[(size_t)lRowIdx[p] * bs]);
+      }
+
+      double *lki = &lVals[(size_t)loc * bs];
+      const double *di = &dInv[(size_t)i * bs];
+      for (int r = 0; r < nn; ++r) {
+        for (int c = 0; c < nn; ++c) {
+          double sum = 0.0;
+          for (int j = 0; j < nn; ++j) {
+            sum += w[j*nn + r] * di[j*nn + c];
+          }
+          lki[r*nn + c] = sum;
+        }
+      }
+      multiplyAdd(nn, -1.0, lki, w, d.data());
+      fill(w, w + bs, 0.0);
+    }
+
+    if (!invert(nn, &d, &inv)) {
+      return false;
+    }
+    copy(inv.begin(), inv.end(), &dInv[(size_t)k * bs]);
+  }
+  return true;
+}
+
+template <typename Float>
+void BlockLDLT<Float>::solve(const Float *b, Float *x) const {
+  const int n = rows;
+  const int nn = blockSize;
+  const int bs = nn*nn;
+
+  vector<double> y((size_t)n * nn);
+  for (int i = 0; i < n; ++i) {
+    for (int c = 0; c < nn; ++c) {
+      y[i*nn + c] = b[perm[i]*nn + c];
+    }
+  }
+
+  // L*z = P*b
+  for (int i = 0; i < n; ++i) {
+    const double *yi = &y[i*nn];
+    for (int p = lColPtr[i]; p < lColPtr[i+1]; ++p) {
+      const double *block = &lVals[(size_t)p * bs];
+      double *yr = &y[lRowIdx[p]*nn];
+      for (int r = 0; r < nn; ++r) {
+        for (int c = 0; c < nn; ++c) {
+          yr[r] -= block[r*nn + c] * yi[c];
+        }
+      }
+    }
+  }
+
+  // D*w = z
+  vector<double> yi(nn);
+  for (int i = 0; i < n; ++i) {
+    const double *block = &dInv[(size_t)i * bs];
+    copy(&y[i*nn], &y[(i+1)*nn], yi.begin());
+    for (int r = 0; r < nn; ++r) {
+      double sum = 0.0;
+      for (int c = 0; c < nn; ++c) {
+        sum += block[r*nn + c] * yi[c];
+      }
+      y[i*nn + r] = sum;
+    }
+  }
+
+  // L^T*P*x = w
+  for (int i = n-1; i >= 0; --i) {
+    double *xi = &y[i*nn];
+    for (int p = lColPtr[i]; p < lColPtr[i+1]; ++p) {
+      const double *block = &lVals[(size_t)p * bs];
+      const double *xr = &y[lRowIdx[p]*nn];
+      for (int r = 0; r < nn; ++r) {
+        for (int c = 0; c < nn; ++c) {
+          xi[c] -= block[r*nn + c] * xr[r];
+        }
+      }
+    }
+  }
+
+  for (int i = 0; i < n; ++i) {
+    for (int c = 0; c < nn; ++c) {
+      x[perm[i]*nn + c] = y[i*nn + c];
+    }
+  }
+}
+
+// Multigrid hierarchies stop coarsening at this many block rows, or at this
+// many levels
+static const int kCoarsestRows = 256;
+static const size_t kMaxLevels = 10;
+
+// The number of smoothing sweeps before and after each coarse correction
+static const int kSmoothingSweeps = 2;
+
+/// A block CSR matrix of n x n blocks that owns its arrays.
+struct BlockCSR {
+  int rows;
+  int cols;
+  vector<int> rowPtr;
+  vector<int> colIdx;
+  vector<double> vals;
+
+  BlockMatrix<double> view(int n) const {
+    return {rows, cols, rowPtr.data(), colIdx.data(), n, n, vals.data()};
+  }
+};
+
+/// Groups the nodes of the graph with the given adjacency pattern (which may
+/// include self loops) into aggregates of nodes and their neighbors, and
+/// returns the number of aggregates.
+static int aggregateNodes(const BlockCSR& graph, vector<int>* aggregates) {
+  const int n = graph.rows;
+  vector<int>& aggregate = *aggregates;
+  aggregate.assign(n, -1);
+  int numAggregates = 0;
+
+  // Nodes whose neighbors are all free start aggregates with them
+  for (int i = 0; i < n; ++i) {
+    bool free = (aggregate[i] == -1);
+    for (int k = graph.rowPtr[i]; free && k < graph.rowPtr[i+1]; ++k) {
+      free = (aggregate[graph.colIdx[k]] == -1);
+    }
+    if (!free) {
+      continue;
+    }
+    aggregate[i] = numAggregates;
+    for (int k = graph.rowPtr[i]; k < graph.rowPtr[i+1]; ++k) {
+      aggregate[graph.colIdx[k]] = numAggregates;
+    }
+    ++numAggregates;
+  }
+
+  // The other nodes join the aggregate of a neighbor, which they all have
+  // since they were not free
+  const vector<int> started = aggregate;
+  for (int i = 0; i < n; ++i) {
+    for (int k = graph.rowPtr[i]; aggregate[i] == -1 &&
+                                  k < graph.rowPtr[i+1]; ++k) {
+      aggregate[i] = started[graph.colIdx[k]];
+    }
+    iassert(aggregate[i] != -1);
+  }
+  return numAggregates;
+}
+
+/// Computes the pattern of c = a*b.
+static void multiplyPatterns(const BlockCSR& a, const BlockCSR& b,
+                             BlockCSR* c) {
+  c->rows = a.rows;
+  c->cols = b.cols;
+  c->rowPtr.assign(1, 0);
+  c->colIdx.clear();
+  vector<int> marker(b.cols, -1);
+  for (int i = 0; i < a.rows; ++i) {
+    const size_t rowStart = c->colIdx.size();
+    for (int k = a.rowPtr[i]; k < a.rowPtr[i+1]; ++k) {
+      const int j = a.colIdx[k];
+      for (int l = b.rowPtr[j]; l < b.rowPtr[j+1]; ++l) {
+        if (marker[b.colIdx[l]] != i) {
+          marker[b.colIdx[l]] = i;
+          c->colIdx.push_back(b.colIdx[l]);
+        }
+      }
+    }
+    sort(c->colIdx.begin() + rowStart, c->colIdx.end());
+    c->rowPtr.push_back(c->colIdx.size());
+  }
+}
+
+/// Computes the values of c = a*b, whose pattern was computed by
+/// multiplyPatterns.
+static void multiplyValues(int n, const BlockCSR& a, const BlockCSR& b,
+                           BlockCSR* c) {
+  const int bs = n*n;
+  c->vals.assign(c->colIdx.size() * bs, 0.0);
+  vector<int> loc(c->cols, -1);
+  for (int i = 0; i < a.rows; ++i) {
+    for (int p = c->rowPtr[i]; p < c->rowPtr[i+1]; ++p) {
+      loc[c->colIdx[p]] = p;
+    }
+    for (int k = a.rowPtr[i]; k < a.rowPtr[i+1]; ++k) {
+      const int j = a.colIdx[k];
+      for (int l = b.rowPtr[j]; l < b.rowPtr[j+1]; ++l) {
+        multiplyAdd(n, 1.0, &a.vals[(size_t)k * bs], &b.vals[(size_t)l * bs],
+                    &c->vals[(size_t)loc[b.colIdx[l]] * bs]);
+      }
+    }
+  }
+}
+
+template <typename Float>
+struct AMGHierarchy<Float>::Level {
+  BlockCSR A;
+
+  // The smoother, x = x + omega*D^-1*(b - A*x), where D is the block diagonal
+  // of A
+  vector<int> diagLoc;
+  vector<double> invDiag;
+  double omega;
+
+  // The prolongator from the next coarser level, P = (I - omega*D^-1*A)*T. The
+  // tentative prolongator T maps the block of each aggregate to the blocks of
+  // the aggregate's rows, scaled by 1/sqrt(aggregate size).
+  vector<int> aggregates;
+  vector<double> aggregateScales;
+  BlockCSR P;
+
+  // A*P, and the restriction P^T by rows, as the locations of its blocks in P
+  BlockCSR AP;
+  vector<int> rRowPtr;
+  vector<int> rColIdx;
+  vector<int> rLoc;
+
+  // The right hand side, solution and residual of the level in a V-cycle
+  vector<double> b;
+  vector<double> x;
+  vector<double> r;
+};
+
+// class AMGHierarchy
+template <typename Float>
+AMGHierarchy<Float>::AMGHierarchy(const BlockMatrix<Float>& A)
+    : blockSize(A.blockRows), coarseFactorized(false) {
+  uassert(A.rows == A.cols && A.blockRows == A.blockCols)
+      << "the solver requires a square matrix with square blocks";
+  const int nn = blockSize;
+
+  Level *finest = new Level;
+  levels.emplace_back(finest);
+  finest->A.rows = A.rows;
+  finest->A.cols = A.cols;
+  finest->A.rowPtr.assign(A.rowPtr, A.rowPtr + A.rows + 1);
+  finest->A.colIdx.assign(A.colIdx, A.colIdx + A.rowPtr[A.rows]);
+
+  while (true) {
+    Level *fine = levels.back().get();
+    const int n = fine->A.rows;
+    fine->diagLoc.assign(n, -1);
+    for (int i = 0; i < n; ++i) {
+      for (int k = fine->A.rowPtr[i]; k < fine->A.rowPtr[i+1]; ++k) {
+        if (fine->A.colIdx[k] == i) {
+          fine->diagLoc[i] = k;
+        }
+      }
+    }
+    fine->b.resize((size_t)n * nn);
+    fine->x.resize((size_t)n * nn);
+    fine->r.resize((size_t)n * nn);
+
+    if (n <= kCoarsestRows || levels.size() == kMaxLevels) {
+      break;
+    }
+    const int numAggregates = aggregateNodes(fine->A, &fine->aggregates);
+    if (numAggregates == n) {
+      break;
+    }
+
+    // P has a block in the aggregate of each of A's blocks
+    vector<int> sizes(numAggregates, 0);
+    for (int i = 0; i < n; ++i) {
+      ++sizes[fine->aggregates[i]];
+    }
+    fine->aggregateScales.resize(numAggregates);
+    for (int c = 0; c < numAggregates; ++c) {
+      fine->aggregateScales[c] = 1.0 / sqrt((double)sizes[c]);
+    }
+    BlockCSR T;
+    T.rows = n;
+    T.cols = numAggregates;
+    T.rowPtr.resize(n+1);
+    T.colIdx.resize(n);
+    for (int i = 0; i <= n; ++i) {
+      T.rowPtr[i] = i;
+    }
+    for (int i = 0; i < n; ++i) {
+      T.colIdx[i] = fine->aggregates[i];
+    }
+    multiplyPatterns(fine->A, T, &fine->P);
+    multiplyPatterns(fine->A, fine->P, &fine->AP);
+
+    // P^T by rows
+    fine->rRowPtr.assign(numAggregates+1, 0);
+    for (int c : fine->P.colIdx) {
+      ++fine->rRowPtr[c+1];
+    }
+    for (int c = 0; c < numAggregates; ++c) {
+      fine->rRowPtr[c+1] += fine->rRowPtr[c];
+    }
+    fine->rColIdx.resize(fine->P.colIdx.size());
+    fine->rLoc.resize(fine->P.colIdx.size());
+    vector<int> next(fine->rRowPtr.begin(), fine->rRowPtr.end()-1);
+    for (int i = 0; i < n; ++i) {
+      for (int p = fine->P.rowPtr[i]; p < fine->P.rowPtr[i+1]; ++p) {
+        const int t = next[fine->P.colIdx[p]]++;
+        fine->rColIdx[t] = i;
+        fine->rLoc[t] = p;
+      }
+    }
+
+    // The coarse matrix P^T*A*P
+    Level *coarse = new Level;
+    levels.emplace_back(coarse);
+    BlockCSR R;
+    R.rows = numAggregates;
+    R.cols = n;
+    R.rowPtr = fine->rRowPtr;
+    R.colIdx = fine->rColIdx;
+    multiplyPatterns(R, fine->AP, &coarse->A);
+  }
+
+  coarseSolver.reset(new BlockLDLT<double>(levels.back()->A.view(nn)));
+}
+
+template <typename Float>
+AMGHierarchy<Float>::~AMGHierarchy() {
+}
+
+template <typename Float>
+bool AMGHierarchy<Float>::hasPattern(const BlockMatrix<Float>& A) const {
+  const BlockCSR& finest = levels[0]->A;
+  return A.rows == finest.rows && A.cols == finest.cols &&
+         A.blockRows == blockSize && A.blockCols == blockSize &&
+         equal(finest.rowPtr.begin(), finest.rowPtr.end(), A.rowPtr) &&
+         equal(finest.colIdx.begin(), finest.colIdx.end(), A.colIdx);
+}
+
+template <typename Float>
+void AMGHierarchy<Float>::refresh(const BlockMatrix<Float>& A) {
+  iassert(hasPattern(A));
+  const int nn = blockSize;
+  const int bs = nn*nn;
+  levels[0]->A.vals.assign(A.vals, A.vals + levels[0]->A.colIdx.size() * bs);
+
+  vector<double> block(bs);
+  vector<double> inv(bs);
+  vector<double> scaled(bs);
+  for (size_t l = 0; l < levels.size(); ++l) {
+    Level *level = levels[l].get();
+    const BlockCSR& Al = level->A;
+    const int n = Al.rows;
+
+    // Invert the diagonal blocks, falling back to the diagonal components for
+    // singular blocks
+    level->invDiag.assign((size_t)n * bs, 0.0);
+    for (int i = 0; i < n; ++i) {
+      double *invBlock = &level->invDiag[(size_t)i * bs];
+      const int k = level->diagLoc[i];
+      if (k != -1) {
+        copy(&Al.vals[(size_t)k * bs], &Al.vals[(size_t)(k+1) * bs],
+             block.begin());
+      }
+      if (k != -1 && invert(nn, &block, &inv)) {
+        copy(inv.begin(), inv.end(), invBlock);
+      }
+      else {
+        for (int bi = 0; bi < nn; ++bi) {
+          double d = (k != -1) ? Al.vals[(size_t)k * bs + bi*nn + bi] : 0.0;
+          invBlock[bi*nn + bi] = (d != 0.0) ? 1.0 / d : 1.0;
+        }
+      }
+    }
+
+    // Weigh the smoother by an upper bound of the spectral radius of D^-1*A,
+    // its largest absolute row sum
+    double radius = 0.0;
+    for (int i = 0; i < n; ++i) {
+      vector<double> rowSums(nn, 0.0);
+      for (int k = Al.rowPtr[i]; k < Al.rowPtr[i+1]; ++k) {
+        fill(scaled.begin(), scaled.end(), 0.0);
+        multiplyAdd(nn, 1.0, &level->invDiag[(size_t)i * bs],
+                    &Al.vals[(size_t)k * bs], scaled.data());
+        for (int bi = 0; bi < nn; ++bi) {
+          for (int bj = 0; bj < nn; ++bj) {
+            rowSums[bi] += fabs(scaled[bi*nn + bj]);
+          }
+        }
+      }
+      radius = max(radius, *max_element(rowSums.begin(), rowSums.end()));
+    }
+    level->omega = (radius > 0.0) ? 4.0 / (3.0 * radius) : 1.0;
+
+    if (l == levels.size()-1) {
+      break;
+    }
+
+    // P = T - omega*D^-1*A*T
+    BlockCSR& P = level->P;
+    P.vals.assign(P.colIdx.size() * bs, 0.0);
+    vector<int> loc(P.cols, -1);
+    for (int i = 0; i < n; ++i) {
+      // An empty row of A gives an empty row of A*T, which has no block for
+      // the aggregate of the row either
+      if (P.rowPtr[i] == P.rowPtr[i+1]) {
+        continue;
+      }
+      for (int p = P.rowPtr[i]; p < P.rowPtr[i+1]; ++p) {
+        loc[P.colIdx[p]] = p;
+      }
+      const int ci = level->aggregates[i];
+      iassert(loc[ci] != -1);
+      double *pii = &P.vals[(size_t)loc[ci] * bs];
+      for (int bi = 0; bi < nn; ++bi) {
+        pii[bi*nn + bi] += level->aggregateScales[ci];
+      }
+      for (int k = Al.rowPtr[i]; k < Al.rowPtr[i+1]; ++k) {
+        const int cj = level->aggregates[Al.colIdx[k]];
+        multiplyAdd(nn, -level->omega * level->aggregateScales[cj],
+                    &level->invDiag[(size_t)i * bs], &Al.vals[(size_t)k * bs],
+                    &P.vals[(size_t)loc[cj] * bs]);
+      }
+      for (int p = P.rowPtr[i]; p < P.rowPtr[i+1]; ++p) {
+        loc[P.colIdx[p]] = -1;
+      }
+    }
+    multiplyValues(nn, Al, P, &level->AP);
+
+    // A_coarse = P^T*(A*P)
+    BlockCSR& coarse = levels[l+1]->A;
+    coarse.vals.assign(coarse.colIdx.size() * bs, 0.0);
+    loc.assign(coarse.cols, -1);
+    for (int c = 0; c < coarse.rows; ++c) {
+      for (int p = coarse.rowPtr[c]; p < coarse.rowPtr[c+1]; ++p) {
+        loc[coarse.colIdx[p]] = p;
+      }
+      for (int t = level->rRowPtr[c]; t < level->rRowPtr[c+1]; ++t) {
+        const BlockCSR& AP = level->AP;
+        const int i = level->rColIdx[t];
+        for (int q = AP.rowPtr[i]; q < AP.rowPtr[i+1]; ++q) {
+          transposeMultiplyAdd(nn, &P.vals[(size_t)level->rLoc[t] * bs],
+                               &AP.vals[(size_t)q * bs],
+                               &coarse.vals[(size_t)loc[AP.colIdx[q]] * bs]);
+        }
+      }
+    }
+  }
+
+  coarseFactorized = coarseSolver->factorize(levels.back()->A.view(nn));
+}
+
+template <typename Float>
+void AMGHierarchy<Float>::apply(const Float *r, Float *z) {
+  Level *finest = levels[0].get();
+  copy(r, r + finest->b.size(), finest->b.begin());
+  cycle(0);
+  copy(finest->x.begin(), finest->x.end(), z);
+}
+
+template <typename Float>
+int AMGHierarchy<Float>::getNumRows(int level) const {
+  return levels[level]->A.rows;
+}
+
+template <typename Float>
+void AMGHierarchy<Float>::cycle(size_t l) {
+  const int nn = blockSize;
+  const int bs = nn*nn;
+  Level *level = levels[l].get();
+  fill(level->x.begin(), level->x.end(), 0.0);
+
+  if (l == levels.size()-1) {
+    if (coarseFactorized) {
+      coarseSolver->solve(level->b.data(), level->x.data());
+    }
+    else {
+      for (int s = 0; s < kSmoothingSweeps; ++s) {
+        smooth(level);
+      }
+    }
+    return;
+  }
+
+  for (int s = 0; s < kSmoothingSweeps; ++s) {
+    smooth(level);
+  }
+
+  // Restrict the residual, solve the coarse level, and prolongate its
+  // solution
+  computeResidual(level);
+  Level *coarse = levels[l+1].get();
+  fill(coarse->b.begin(), coarse->b.end(), 0.0);
+  for (int c = 0; c < coarse->A.rows; ++c) {
+    double *bc = &coarse->b[c*nn];
+    for (int t = level->rRowPtr[c]; t < level->rRowPtr[c+1]; ++t) {
+      const double *block = &level->P.vals[(size_t)level->rLoc[t] * bs];
+      const double *ri = &level->r[level->rColIdx[t]*nn];
+      for (int bi = 0; bi < nn; ++bi) {
+        for (int bj = 0; bj < nn; ++bj) {
+          bc[bj] += block[bi*nn + bj] * ri[bi];
+        }
+      }
+    }
+  }
+  cycle(l+1);
+  const BlockCSR& P = level->P;
+  for (int i = 0; i < P.rows; ++i) {
+    double *xi = &level->x[i*nn];
+    for (int p = P.rowPtr[i]; p < P.rowPtr[i+1]; ++p) {
+      const double *block = &P.vals[(size_t)p * bs];
+      const double *xc = &coarse->x[P.colIdx[p]*nn];
+      for (int bi = 0; bi < nn; ++bi) {
+        for (int bj = 0; bj < nn; ++bj) {
+          xi[bi] += block[bi*nn + bj] * xc[bj];
+        }
+      }
+    }
+  }
+
+  for (int s = 0; s < kSmoothingSweeps; ++s) {
+    smooth(level);
+  }
+}
+
+template <typename Float>
+void AMGHierarchy<Float>::smooth(Level* level) {
+  const int nn = blockSize;
+  computeResidual(level);
+  for (int i = 0; i < level->A.rows; ++i) {
+    const double *invBlock = &level->invDiag[(size_t)i * nn*nn];
+    const double *ri = &level->r[i*nn];
+    for (int bi = 0; bi < nn; ++bi) {
+      double sum = 0.0;
+      for (int bj = 0; bj < nn; ++bj) {
+        sum += invBlock[bi*nn + bj] * ri[bj];
+      }
+      level->x[i*nn + bi] += level->omega * sum;
+    }
+  }
+}
+
+template <typename Float>
+void AMGHierarchy<Float>::computeResidual(Level* level) {
+  blockSpMV(level->A.view(blockSize), level->x.data(), level->r.data());
+  for (size_t i = 0; i < level->r.size(); ++i) {
+    level->r[i] = level->b[i] - level->r[i];
+  }
+}
+
+template <typename Float>
+SolverResult directSolve(const BlockMatrix<Float>& A, const Float *b, Float *x,
+                         const SolverOptions& options) {
+  uassert(A.rows == A.cols && A.blockRows == A.blockCols)
+      << "the solver requires a square matrix with square blocks";
+
+  static PatternCache<Float,BlockLDLT<Float>> cache;
+  auto entry = cache.getEntry(A);
+  lock_guard<std::mutex> lock(entry->mutex);
+  BlockLDLT<Float> *factorization = entry->get(A);
+  if (!factorization->factorize(A)) {
+    SolverResult result = pcgSolve(A, b, x, options);
+    result.fellBack = true;
+    return result;
+  }
+  factorization->solve(b, x);
+
+  SolverResult result;
+  result.iterations = 0;
+  result.residual = 0.0;
+  result.converged = true;
+  result.fellBack = false;
+  return result;
+}
+
+// The result of the last solve of a Simit function on each thread
+static thread_local SolverResult lastSolverResult = {0, 0.0, true, false};
+
+void reportSolverResult(const SolverResult& result) {
+  lastSolverResult = result;
+  if (!result.converged) {
+    uwarning << "solve did not converge after " << result.iterations
+             << " iterations (relative residual " << result.residual << ")"
+             << std::endl;
+  }
+}
+
+SolverResult getLastSolverResult() {
+  return lastSolverResult;
+}
+
+template <typename Float>
+SolverResult blockSolve(const BlockMatrix<Float>& A, const Float *b, Float *x,
+                        const SolverOptions& options) {
+  switch (options.method) {
+    case ConjugateGradient:
+      return pcgSolve(A, b, x, options);
+    case Direct:
+      return directSolve(A, b, x, options);
+  }
+  unreachable;
+  return SolverResult();
+}
+
+/// The full pattern of a symmetric matrix whose upper block-triangle is
+/// stored, with the location in the upper matrix of every block of the full
+/// matrix and whether the block must be transposed.
+template <typename Float>
+class SymmetricExpansion {
+public:
+  SymmetricExpansion(const BlockMatrix<Float>& upper)
+      : rows(upper.rows), blockSize(upper.blockRows),
+        upperRowPtr(upper.rowPtr, upper.rowPtr + upper.rows + 1),
+        upperColIdx(upper.colIdx, upper.colIdx + upper.rowPtr[upper.rows]) {
+    uassert(upper.rows == upper.cols && upper.blockRows == upper.blockCols)
+        << "the solver requires a square matrix with square blocks";
+    const int n = rows;
+
+    // Count the blocks of each full row: the upper blocks of the row and the
+    // transposes of the off-diagonal upper blocks of the rows above it
+    vector<int> counts(n, 0);
+    for (int i = 0; i < n; ++i) {
+      for (int k = upperRowPtr[i]; k < upperRowPtr[i+1]; ++k) {
+        const int j = upperColIdx[k];
+        iassert(j >= i) << "block (" << i << "," << j << ") is below the "
+                        << "diagonal";
+        ++counts[i];
+        if (j != i) {
+          ++counts[j];
+        }
+      }
+    }
+    rowPtr.resize(n + 1);
+    rowPtr[0] = 0;
+    for (int i = 0; i < n; ++i) {
+      rowPtr[i+1] = rowPtr[i] + counts[i];
+    }
+
+    // Visiting the upper rows in order emits the transposed blocks of each
+    // full row sorted before its own upper blocks, which are sorted too
+    const int numBlocks = rowPtr[n];
+    colIdx.resize(numBlocks);
+    sources.resize(numBlocks);
+    transposed.resize(numBlocks);
+    vector<int> next(rowPtr.begin(), rowPtr.end() - 1);
+    for (int i = 0; i < n; ++i) {
+      for (int k = upperRowPtr[i]; k < upperRowPtr[i+1]; ++k) {
+        const int j = upperColIdx[k];
+        if (j != i) {
+          const int loc = next[j]++;
+          colIdx[loc] = i;
+          sources[loc] = k;
+          transposed[loc] = true;
+        }
+      }
+      for (int k = upperRowPtr[i]; k < upperRowPtr[i+1]; ++k) {
+        const int loc = next[i]++;
+        colIdx[loc] = upperColIdx[k];
+        sources[loc] = k;
+        transposed[loc] = false;
+      }
+    }
+  }
+
+  bool hasPattern(const BlockMatrix<Float>& upper) const {
+    return upper.rows == rows && upper.cols == rows &&
+           upper.blockRows == blockSize && upper.blockCols == blockSize &&
+           equal(upperRowPtr.begin(), upperRowPtr.end(), upper.rowPtr) &&
+           equal(upperColIdx.begin(), upperColIdx.end(), upper.colIdx);
+  }
+
+  /// Returns the full matrix with the values of `upper`. The view stays valid
+  /// until the next call.
+  BlockMatrix<Float> expand(const BlockMatrix<Float>& upper) {
+    iassert(hasPattern(upper));
+    const int nn = blockSize;
+    const int bs = nn*nn;
+    vals.resize(colIdx.size() * bs);
+    for (size_t loc = 0; loc < colIdx.size(); ++loc) {
+      const Float *src = &upper.vals[(size_t)sources[loc] * bs];
+      Float *dst = &vals[loc * bs];
+      if (transposed[loc]) {
+        for (int bi = 0; bi < nn; ++bi) {
+          for (int bj = 0; bj < nn; ++bj) {
+            dst[bi*nn + bj] = src[bj*nn + bi];
+          }
+        }
+      }
+      else {
+        copy(src, src + bs, dst);
+      }
+    }
+    return {rows, rows, rowPtr.data(), colIdx.data(), nn, nn, vals.data()};
+  }
+
+private:
+  int rows;
+  int blockSize;
+  vector<int> upperRowPtr;
+  vector<int> upperColIdx;
+
+  vector<int> rowPtr;
+  vector<int> colIdx;
+  vector<int> sources;
+  vector<bool> transposed;
+  vector<Float> vals;
+};
+
+template <typename Float>
+SolverResult symmetricBlockSolve(const BlockMatrix<Float>& upper,
+                                 const Float *b, Float *x,
+                                 const SolverOptions& options) {
+  // The expansion's index arrays key the caches of the solvers, so it stays
+  // locked while they are in use
+  static PatternCache<Float,SymmetricExpansion<Float>> cache;
+  auto entry = cache.getEntry(upper);
+  lock_guard<std::mutex> lock(entry->mutex);
+  BlockMatrix<Float> A = entry->get(upper)->expand(upper);
+  return blockSolve(A, b, x, options);
+}
+
+// Explicit instantiations
+template class BlockLDLT<float>;
+template class BlockLDLT<double>;
+template class AMGHierarchy<float>;
+template class AMGHierarchy<double>;
+template void blockSpMV(const BlockMatrix<float>&, const float*, float*);
+template void blockSpMV(const BlockMatrix<double>&, const double*, double*);
+template SolverResult pcgSolve(const BlockMatrix<float>&, const float*,
+                               float*, const SolverOptions&);
+template SolverResult pcgSolve(const BlockMatrix<double>&, const double*,
+                               double*, const SolverOptions&);
+template SolverResult directSolve(const BlockMatrix<float>&, const float*,
+                                  float*, const SolverOptions&);
+template SolverResult directSolve(const BlockMatrix<double>&, const double*,
+                                  double*, const SolverOptions&);
+template SolverResult blockSolve(const BlockMatrix<float>&, const float*,
+                                 float*, const SolverOptions&);
+template SolverResult blockSolve(const BlockMatrix<double>&, const double*,
+                                 double*, const SolverOptions&);
+template SolverResult symmetricBlockSolve(const BlockMatrix<float>&,
+                                          const float*, float*,
+                                          const SolverOptions&);
+template SolverResult symmetricBlockSolve(const BlockMatrix<double>&,
+                                          const double*, double*,
+                                          const SolverOptions&);
+
+}}
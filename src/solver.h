@@ -0,0 +1,218 @@
+#ifndef SIMIT_SOLVER_H
+#define SIMIT_SOLVER_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace simit {
+namespace internal {
+
+/// A view of a sparse matrix in Simit's blocked CSR (BCSR) storage. The
+/// matrix has `rows` x `cols` blocks of `blockRows` x `blockCols` components.
+/// `rowPtr[i]:rowPtr[i+1]` is the range of the blocks of block row `i`, where
+/// the block at location `k` is in block column `colIdx[k]` and its values are
+/// stored row-major at `vals[k*blockRows*blockCols]`. The column indices of
+/// each block row must be sorted.
+template <typename Float>
+struct BlockMatrix {
+  int rows;
+  int cols;
+  const int *rowPtr;
+  const int *colIdx;
+  int blockRows;
+  int blockCols;
+  const Float *vals;
+};
+
+enum SolverMethod {ConjugateGradient, Direct};
+
+/// Returns the solver method with the given name ("conjugate-gradient" or
+/// "direct").
+SolverMethod getSolverMethod(const std::string& name);
+
+enum Preconditioner {None, Jacobi, BlockJacobi, IncompleteCholesky,
+                     AlgebraicMultigrid};
+
+/// Returns the preconditioner with the given name ("none", "jacobi",
+/// "block-jacobi", "incomplete-cholesky" or "algebraic-multigrid").
+Preconditioner getPreconditioner(const std::string& name);
+
+struct SolverOptions {
+  SolverMethod method;
+
+  /// The preconditioner, tolerance and iteration limit of conjugate gradient
+  /// solves.
+  Preconditioner preconditioner;
+
+  /// Stop when the residual norm is below `tolerance` times the norm of the
+  /// right hand side.
+  double tolerance;
+
+  /// Stop after `maxIterations` iterations. 0 means the number of rows.
+  int maxIterations;
+
+  SolverOptions() : method(ConjugateGradient), preconditioner(BlockJacobi),
+                    tolerance(1e-10), maxIterations(0) {}
+};
+
+struct SolverResult {
+  int iterations;
+  double residual;  // relative residual norm
+  bool converged;
+  bool fellBack;    // a direct solve fell back to conjugate gradient
+};
+
+/// Computes y = A*x on the runtime thread pool.
+template <typename Float>
+void blockSpMV(const BlockMatrix<Float>& A, const Float *x, Float *y);
+
+/// Solves A*x = b with the preconditioned conjugate gradient method, starting
+/// from x = 0. A must be square with square blocks, and should be symmetric
+/// positive definite.
+template <typename Float>
+SolverResult pcgSolve(const BlockMatrix<Float>& A, const Float *b, Float *x,
+                      const SolverOptions& options);
+
+/// A sparse LDL^T factorization P*A*P^T = L*D*L^T of a symmetric block
+/// matrix that works on whole blocks: L is block unit lower triangular and D
+/// is block diagonal, and their blocks are dense. The fill-reducing ordering P
+/// and the pattern of L (the symbolic factorization) only depend on the
+/// sparsity pattern of A, so they are computed once, by the constructor, and
+/// reused by the numeric factorizations of every matrix with that pattern.
+template <typename Float>
+class BlockLDLT {
+public:
+  /// Computes a minimum degree ordering and the symbolic factorization of the
+  /// pattern of A, which must be square with square blocks and symmetric.
+  explicit BlockLDLT(const BlockMatrix<Float>& A);
+
+  /// Returns true if A has the sparsity pattern that was analyzed.
+  bool hasPattern(const BlockMatrix<Float>& A) const;
+
+  /// Computes the numeric factorization of A, which must have the analyzed
+  /// pattern. Returns false if a diagonal block of D is singular.
+  bool factorize(const BlockMatrix<Float>& A);
+
+  /// Solves A*x = b with the last numeric factorization.
+  void solve(const Float *b, Float *x) const;
+
+  /// Returns the number of blocks below the diagonal of L.
+  int getNumFactorBlocks() const {return lRowIdx.size();}
+
+private:
+  int rows;
+  int blockSize;
+
+  /// The analyzed pattern
+  std::vector<int> rowPtr;
+  std::vector<int> colIdx;
+
+  /// Block row i of P*A*P^T is block row perm[i] of A
+  std::vector<int> perm;
+
+  /// The upper triangle of P*A*P^T by block columns. Column k has the blocks
+  /// in rows aRowIdx[p], for p in aColPtr[k]:aColPtr[k+1], which are the
+  /// transposes of the blocks at locations aLoc[p] of A.
+  std::vector<int> aColPtr;
+  std::vector<int> aRowIdx;
+  std::vector<int> aLoc;
+
+  /// L by block columns, without its diagonal
+  std::vector<int> lColPtr;
+  std::vector<int> lRowIdx;
+  std::vector<double> lVals;
+
+  /// The blocks of each block row k of L, as the columns lRowCols[t] and the
+  /// locations lRowLocs[t] in L, for t in lRowPtr[k]:lRowPtr[k+1]. They are in
+  /// the order in which the numeric factorization computes them.
+  std::vector<int> lRowPtr;
+  std::vector<int> lRowCols;
+  std::vector<int> lRowLocs;
+
+  /// The inverted diagonal blocks of D
+  std::vector<double> dInv;
+};
+
+/// A smoothed aggregation algebraic multigrid hierarchy of a symmetric
+/// positive definite block matrix, which preconditions conjugate gradient
+/// solves with one V-cycle per iteration. The aggregates are groups of block
+/// rows, so the components of a block (e.g. the x, y and z displacements of a
+/// point) stay together and the coarse matrices have the same block size. The
+/// aggregates and the patterns of the prolongators and coarse matrices only
+/// depend on the sparsity pattern of A, so they are computed once, by the
+/// constructor, and refresh() only recomputes their values.
+template <typename Float>
+class AMGHierarchy {
+public:
+  /// Aggregates the pattern of A, which must be square with square blocks and
+  /// symmetric, and computes the patterns of the hierarchy.
+  explicit AMGHierarchy(const BlockMatrix<Float>& A);
+  ~AMGHierarchy();
+
+  /// Returns true if A has the sparsity pattern that was aggregated.
+  bool hasPattern(const BlockMatrix<Float>& A) const;
+
+  /// Recomputes the smoothers, prolongators and coarse matrices from the
+  /// values of A, which must have the aggregated pattern.
+  void refresh(const BlockMatrix<Float>& A);
+
+  /// z = M^-1 * r, where M^-1 is one V-cycle that starts from z = 0.
+  void apply(const Float *r, Float *z);
+
+  /// Returns the number of levels, including the finest.
+  int getNumLevels() const {return levels.size();}
+
+  /// Returns the number of block rows of the matrix of the given level.
+  int getNumRows(int level) const;
+
+private:
+  struct Level;
+  int blockSize;
+  std::vector<std::unique_ptr<Level>> levels;
+
+  /// The direct solver of the coarsest level, which is used if the coarsest
+  /// matrix could be factorized
+  std::unique_ptr<BlockLDLT<double>> coarseSolver;
+  bool coarseFactorized;
+
+  void cycle(size_t level);
+  void smooth(Level* level);
+  void computeResidual(Level* level);
+};
+
+/// Solves A*x = b with a BlockLDLT factorization. A must be square with square
+/// blocks and symmetric. The symbolic factorizations are cached by the
+/// location of A's index arrays, which belong to the matrix's tensor index,
+/// so repeated solves with a matrix only refactorize it numerically. Falls
+/// back to pcgSolve if the factorization breaks down, and then sets the
+/// result's `fellBack`.
+template <typename Float>
+SolverResult directSolve(const BlockMatrix<Float>& A, const Float *b, Float *x,
+                         const SolverOptions& options);
+
+/// Records the result of a solve of a Simit function on the calling thread,
+/// and warns if it did not converge.
+void reportSolverResult(const SolverResult& result);
+
+/// Returns the result of the last solve of a Simit function on the calling
+/// thread.
+SolverResult getLastSolverResult();
+
+/// Solves A*x = b with the method given by the options.
+template <typename Float>
+SolverResult blockSolve(const BlockMatrix<Float>& A, const Float *b, Float *x,
+                        const SolverOptions& options);
+
+/// Solves A*x = b with the method given by the options, where A is symmetric
+/// and `upper` stores only its upper block-triangle: the blocks of block row
+/// `i` are in block columns `j >= i`. The full pattern of A is cached by the
+/// location of upper's index arrays, so that the solvers' own caches keep
+/// hitting, and only its values are filled in on every solve.
+template <typename Float>
+SolverResult symmetricBlockSolve(const BlockMatrix<Float>& upper,
+                                 const Float *b, Float *x,
+                                 const SolverOptions& options);
+
+}}
+#endif
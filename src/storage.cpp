@@ -1,12 +1,15 @@
 #include "storage.h"
 
 #include <memory>
+#include <string>
 
+#include "compile_options.h"
 #include "ir.h"
 #include "ir_visitor.h"
 #include "path_expressions.h"
 #include "tensor_index.h"
 #include "path_expression_analysis.h"
+#include "symmetry.h"
 #include "util/collections.h"
 
 using namespace std;
@@ -48,10 +51,21 @@ const TensorIndex& TensorStorage::getTensorIndex() const {
   return content->index;
 }
 
+bool TensorStorage::isSymmetric() const {
+  return getKind() == TensorStorage::Indexed && hasTensorIndex() &&
+         content->index.isSymmetric();
+}
+
 void TensorStorage::setTensorIndex(Var tensor) {
   content->index = TensorIndex(tensor.getName()+"_index", pe::PathExpression());
 }
 
+TensorStorage TensorStorage::clone() const {
+  TensorStorage copy;
+  *copy.content = *content;
+  return copy;
+}
+
 std::ostream &operator<<(std::ostream &os, const TensorStorage &ts) {
   switch (ts.getKind()) {
     case TensorStorage::Undefined:
@@ -65,6 +79,9 @@ std::ostream &operator<<(std::ostream &os, const TensorStorage &ts) {
       break;
     case TensorStorage::Indexed:
       os << "Indexed";
+      if (ts.isSymmetric()) {
+        os << " symmetric";
+      }
       if (ts.hasTensorIndex()) {
         os << " (" << ts.getTensorIndex().getPathExpression() << ")";
       }
@@ -93,6 +110,14 @@ void Storage::add(const Storage &other) {
   }
 }
 
+Storage Storage::clone() const {
+  Storage copy;
+  for (auto &var : *this) {
+    copy.add(var, getStorage(var).clone());
+  }
+  return copy;
+}
+
 bool Storage::hasStorage(const Var &tensor) const {
   return content->storage.find(tensor) != content->storage.end();
 }
@@ -168,6 +193,11 @@ public:
       : storage{storage}, env{env} {}
 
   void get(Func func) {
+    const internal::CompileOptions& options = internal::getCompileOptions();
+    if (options.symmetricStorage && options.backend == "cpu") {
+      symmetricMatrices = findSymmetricMatrices(func);
+    }
+
     for (auto &global : func.getEnvironment().getConstants()) {
       if (global.first.getType().isTensor()) {
         determineStorage(global.first);
@@ -198,12 +228,15 @@ private:
   Environment* env;
   PathExpressionBuilder peBuilder;
 
-  TensorIndex getTensorIndex(const Var& var) {
+  /// Matrices that only store their upper block-triangle
+  std::set<Var> symmetricMatrices;
+
+  TensorIndex getTensorIndex(const Var& var, bool symmetric=false) {
     auto pexpr = peBuilder.getPathExpression(var);
-    if (!env->hasTensorIndex(pexpr)) {
-      env->addTensorIndex(pexpr, var);
+    if (!env->hasTensorIndex(pexpr, symmetric)) {
+      env->addTensorIndex(pexpr, var, symmetric);
     }
-    return env->getTensorIndex(pexpr);
+    return env->getTensorIndex(pexpr, symmetric);
   }
 
   using IRVisitor::visit;
@@ -308,7 +341,8 @@ private:
               tensorStorage = TensorStorage(TensorStorage::Diagonal);
             }
             else {
-              auto index = getTensorIndex(var);
+              bool symmetric = util::contains(symmetricMatrices, var);
+              auto index = getTensorIndex(var, symmetric);
               tensorStorage = TensorStorage(TensorStorage::Indexed, index);
 
               // Add path expression
@@ -56,9 +56,17 @@ public:
   /// indexed tensor.
   const TensorIndex& getTensorIndex() const;
 
+  /// True if the tensor is an indexed matrix that only stores its upper
+  /// block-triangle, because it is symmetric.
+  bool isSymmetric() const;
+
   /// Set the storage descriptor's tensor index.
   void setTensorIndex(Var tensor);
 
+  /// Returns a copy of the storage descriptor that can be modified without
+  /// modifying this one.
+  TensorStorage clone() const;
+
 private:
   struct Content;
   std::shared_ptr<Content> content;
@@ -77,6 +85,11 @@ public:
   /// Add the variables from the `other` storage to this storage.
   void add(const Storage &other);
 
+  /// Returns a deep copy of the storage. Copies of a Storage otherwise share
+  /// their descriptors, so each compilation clones the storage of the
+  /// functions it lowers before adding to it.
+  Storage clone() const;
+
   /// True if the tensor has a storage descriptor, false otherwise.
   bool hasStorage(const Var &tensor) const;
 
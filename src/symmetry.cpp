@@ -0,0 +1,662 @@
+#include "symmetry.h"
+
+#include <cmath>
+#include <map>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "intrinsics.h"
+#include "ir_visitor.h"
+#include "util/collections.h"
+
+using namespace std;
+
+namespace simit {
+namespace ir {
+
+bool isMatrixVectorProduct(const Expr& expr, Var* matrix, Expr* vector) {
+  if (!isa<IndexExpr>(expr)) {
+    return false;
+  }
+  const IndexExpr* iexpr = to<IndexExpr>(expr);
+  if (iexpr->resultVars.size() != 1 || !isa<Mul>(iexpr->value)) {
+    return false;
+  }
+  const Mul* mul = to<Mul>(iexpr->value);
+  if (!isa<IndexedTensor>(mul->a) || !isa<IndexedTensor>(mul->b)) {
+    return false;
+  }
+  const IndexedTensor* a = to<IndexedTensor>(mul->a);
+  const IndexedTensor* x = to<IndexedTensor>(mul->b);
+  if (!isa<VarExpr>(a->tensor) || a->indexVars.size() != 2 ||
+      x->indexVars.size() != 1) {
+    return false;
+  }
+  const IndexVar& i = a->indexVars[0];
+  const IndexVar& j = a->indexVars[1];
+  if (!(i == iexpr->resultVars[0]) || !j.isReductionVar() ||
+      !(j.getOperator() == ReductionOperator::Sum) ||
+      !(x->indexVars[0] == j)) {
+    return false;
+  }
+  *matrix = to<VarExpr>(a->tensor)->var;
+  *vector = x->tensor;
+  return true;
+}
+
+/// Counts the statements that write each variable of a function, and records
+/// the values of the variables that are assigned outside of loops.
+class Definitions : public IRVisitor {
+public:
+  Definitions(const Func& func) : writesFields(false), loopDepth(0) {
+    func.getBody().accept(this);
+    for (auto& constant : func.getEnvironment().getConstants()) {
+      constants.insert(constant.first);
+    }
+    arguments.insert(func.getArguments().begin(), func.getArguments().end());
+  }
+
+  bool writesFields;
+
+  /// True if the variable has the same value wherever it is read, i.e. if it
+  /// is an argument or a constant that is never written, or if it is assigned
+  /// once, outside of loops.
+  bool isStable(const Var& var) const {
+    int writes = getNumWrites(var);
+    if (writes == 0) {
+      return util::contains(arguments, var) || util::contains(constants, var);
+    }
+    return writes == 1 && util::contains(values, var);
+  }
+
+  /// Returns the number of statements that write the variable.
+  int getNumWrites(const Var& var) const {
+    return util::contains(numWrites, var) ? numWrites.at(var) : 0;
+  }
+
+  /// Returns the value of a variable that is assigned once, outside of loops.
+  Expr getValue(const Var& var) const {
+    return isStable(var) && util::contains(values, var) ? values.at(var)
+                                                        : Expr();
+  }
+
+private:
+  map<Var,int> numWrites;
+  map<Var,Expr> values;
+  set<Var> constants;
+  set<Var> arguments;
+  int loopDepth;
+
+  using IRVisitor::visit;
+
+  void visit(const AssignStmt* op) {
+    ++numWrites[op->var];
+    if (op->cop == CompoundOperator::None && loopDepth == 0) {
+      values[op->var] = op->value;
+    }
+    IRVisitor::visit(op);
+  }
+
+  void visit(const TensorWrite* op) {
+    Expr tensor = op->tensor;
+    while (isa<TensorRead>(tensor)) {
+      tensor = to<TensorRead>(tensor)->tensor;
+    }
+    if (isa<VarExpr>(tensor)) {
+      ++numWrites[to<VarExpr>(tensor)->var];
+    }
+    else if (isa<FieldRead>(tensor)) {
+      writesFields = true;
+    }
+    IRVisitor::visit(op);
+  }
+
+  void visit(const FieldWrite* op) {
+    writesFields = true;
+    IRVisitor::visit(op);
+  }
+
+  void visit(const CallStmt* op) {
+    for (auto& result : op->results) {
+      ++numWrites[result];
+    }
+    IRVisitor::visit(op);
+  }
+
+  void visit(const Map* op) {
+    for (auto& var : op->vars) {
+      ++numWrites[var];
+    }
+    IRVisitor::visit(op);
+  }
+
+  void visit(const ForRange* op) {
+    numWrites[op->var] += 2;
+    ++loopDepth;
+    IRVisitor::visit(op);
+    --loopDepth;
+  }
+
+  void visit(const For* op) {
+    numWrites[op->var] += 2;
+    ++loopDepth;
+    IRVisitor::visit(op);
+    --loopDepth;
+  }
+
+  void visit(const While* op) {
+    ++loopDepth;
+    IRVisitor::visit(op);
+    --loopDepth;
+  }
+};
+
+/// Collects the block writes of an assembly function to one of its results,
+/// e.g. `A(p(0),p(1)) = v`, with the rows and columns of the blocks as
+/// positions in the endpoint tuple. Writes in the same branch of the same
+/// conditional share a group, so either all or none of them run.
+class AssemblyWrites : public IRVisitor {
+public:
+  struct Write {
+    int group;
+    int row;
+    int col;
+    Expr value;
+  };
+
+  AssemblyWrites(const Var& result, const Var& endpoints)
+      : supported(true), result(result), endpoints(endpoints),
+        group(0), numGroups(1), loopDepth(0) {}
+
+  bool supported;
+  vector<Write> writes;
+
+private:
+  Var result;
+  Var endpoints;
+  int group;
+  int numGroups;
+  int loopDepth;
+
+  /// Returns the position of an endpoint read, e.g. 1 in `p(1)`, or -1.
+  int getEndpoint(const Expr& index) {
+    if (!isa<TupleRead>(index)) {
+      return -1;
+    }
+    const TupleRead* tupleRead = to<TupleRead>(index);
+    if (!isa<VarExpr>(tupleRead->tuple) ||
+        to<VarExpr>(tupleRead->tuple)->var != endpoints ||
+        !isa<Literal>(tupleRead->index)) {
+      return -1;
+    }
+    return ((int*)to<Literal>(tupleRead->index)->data)[0];
+  }
+
+  using IRVisitor::visit;
+
+  void visit(const VarExpr* op) {
+    if (op->var == result) {
+      supported = false;
+    }
+  }
+
+  void visit(const AssignStmt* op) {
+    if (op->var == result) {
+      supported = false;
+    }
+    IRVisitor::visit(op);
+  }
+
+  void visit(const TensorWrite* op) {
+    if (!isa<VarExpr>(op->tensor) || to<VarExpr>(op->tensor)->var != result) {
+      IRVisitor::visit(op);
+      return;
+    }
+    if (op->indices.size() != 2 || op->cop != CompoundOperator::None ||
+        loopDepth > 0) {
+      supported = false;
+      return;
+    }
+    Write write = {group, getEndpoint(op->indices[0]),
+                   getEndpoint(op->indices[1]), op->value};
+    if (write.row < 0 || write.col < 0) {
+      supported = false;
+      return;
+    }
+    writes.push_back(write);
+    op->value.accept(this);
+  }
+
+  void visit(const CallStmt* op) {
+    if (util::contains(op->results, result)) {
+      supported = false;
+    }
+    IRVisitor::visit(op);
+  }
+
+  void visit(const Map* op) {
+    supported = false;
+  }
+
+  void visit(const IfThenElse* op) {
+    op->condition.accept(this);
+    int parentGroup = group;
+    group = numGroups++;
+    op->thenBody.accept(this);
+    if (op->elseBody.defined()) {
+      group = numGroups++;
+      op->elseBody.accept(this);
+    }
+    group = parentGroup;
+  }
+
+  void visit(const ForRange* op) {
+    ++loopDepth;
+    IRVisitor::visit(op);
+    --loopDepth;
+  }
+
+  void visit(const For* op) {
+    ++loopDepth;
+    IRVisitor::visit(op);
+    --loopDepth;
+  }
+
+  void visit(const While* op) {
+    ++loopDepth;
+    IRVisitor::visit(op);
+    --loopDepth;
+  }
+};
+
+/// Proves that the contributions an assembly function writes to one of its
+/// results are symmetric.
+class AssemblySymmetry {
+public:
+  AssemblySymmetry(const Func& func) : func(func), definitions(func) {}
+
+  bool isSymmetricAssembly(const Var& result) {
+    if (func.getKind() != Func::Internal || func.getArguments().empty() ||
+        definitions.writesFields) {
+      return false;
+    }
+    AssemblyWrites assemblyWrites(result, func.getArguments().back());
+    func.getBody().accept(&assemblyWrites);
+    if (!assemblyWrites.supported) {
+      return false;
+    }
+
+    // Each block is written once, so no write overwrites another
+    const vector<AssemblyWrites::Write>& writes = assemblyWrites.writes;
+    set<pair<int,int>> blocks;
+    for (auto& write : writes) {
+      if (!blocks.insert({write.row, write.col}).second) {
+        return false;
+      }
+    }
+
+    for (auto& write : writes) {
+      if (!isStable(write.value) || !isSymmetric(write.value)) {
+        return false;
+      }
+      if (write.row == write.col) {
+        continue;
+      }
+
+      // The transposed block is written the same value, under the same
+      // conditions
+      bool paired = false;
+      for (auto& transposed : writes) {
+        if (transposed.row == write.col && transposed.col == write.row) {
+          paired = transposed.group == write.group &&
+                   equal(write.value, transposed.value, {});
+        }
+      }
+      if (!paired) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+private:
+  Func func;
+  Definitions definitions;
+  map<Var,bool> symmetricVars;
+
+  /// True if every variable the expression reads has one value.
+  bool isStable(const Expr& expr) {
+    bool stable = true;
+    match(expr,
+      std::function<void(const VarExpr*)>([&](const VarExpr* op) {
+        stable &= definitions.isStable(op->var);
+      })
+    );
+    return stable;
+  }
+
+  /// True if the value of the expression is a scalar or a symmetric matrix.
+  bool isSymmetric(const Expr& expr) {
+    if (isScalar(expr.type())) {
+      return true;
+    }
+    if (isa<Literal>(expr)) {
+      return isSymmetric(to<Literal>(expr));
+    }
+    if (isa<VarExpr>(expr)) {
+      return isSymmetric(to<VarExpr>(expr)->var);
+    }
+    if (isa<Neg>(expr)) {
+      return isSymmetric(to<Neg>(expr)->a);
+    }
+    if (isa<Add>(expr) || isa<Sub>(expr)) {
+      const BinaryExpr* op = static_cast<const BinaryExpr*>(expr.ptr);
+      return isSymmetric(op->a) && isSymmetric(op->b);
+    }
+    if (isa<Mul>(expr) || isa<Div>(expr)) {
+      const BinaryExpr* op = static_cast<const BinaryExpr*>(expr.ptr);
+      return (isScalar(op->a.type()) || isScalar(op->b.type())) &&
+             isSymmetric(op->a) && isSymmetric(op->b);
+    }
+    if (isa<IndexExpr>(expr)) {
+      // The value is unchanged when the result index variables are swapped,
+      // as in `(i,j x(i) * x(j))`
+      const IndexExpr* iexpr = to<IndexExpr>(expr);
+      if (iexpr->resultVars.size() != 2) {
+        return false;
+      }
+      map<IndexVar,IndexVar> swap = {
+        {iexpr->resultVars[0], iexpr->resultVars[1]},
+        {iexpr->resultVars[1], iexpr->resultVars[0]}
+      };
+      return equal(iexpr->value, iexpr->value, swap);
+    }
+    return false;
+  }
+
+  bool isSymmetric(const Literal* literal) {
+    const TensorType* type = literal->type.toTensor();
+    if (type->order() != 2) {
+      return false;
+    }
+    int n = (int)lround(sqrt((double)type->size()));
+    if ((size_t)(n*n) != type->size()) {
+      return false;
+    }
+    for (int i = 0; i < n; ++i) {
+      for (int j = i+1; j < n; ++j) {
+        switch (type->getComponentType().kind) {
+          case ScalarType::Float:
+            if (literal->getFloatVal(i*n + j) !=
+                literal->getFloatVal(j*n + i)) {
+              return false;
+            }
+            break;
+          case ScalarType::Int:
+            if (((int*)literal->data)[i*n + j] !=
+                ((int*)literal->data)[j*n + i]) {
+              return false;
+            }
+            break;
+          default:
+            return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  bool isSymmetric(const Var& var) {
+    if (isScalar(var.getType())) {
+      return true;
+    }
+    if (util::contains(symmetricVars, var)) {
+      return symmetricVars.at(var);
+    }
+    // Assume cyclic definitions are not symmetric
+    symmetricVars[var] = false;
+    Expr value = definitions.getValue(var);
+    bool symmetric = value.defined() && isSymmetric(value);
+    symmetricVars[var] = symmetric;
+    return symmetric;
+  }
+
+  /// True if the expressions are the same, after the index variables of `a`
+  /// are renamed by `swap`. Scalar additions and multiplications commute.
+  bool equal(const Expr& a, const Expr& b,
+             const map<IndexVar,IndexVar>& swap) {
+    if (isa<Literal>(a)) {
+      return isa<Literal>(b) && *to<Literal>(a) == *to<Literal>(b);
+    }
+    if (isa<VarExpr>(a)) {
+      return isa<VarExpr>(b) && to<VarExpr>(a)->var == to<VarExpr>(b)->var;
+    }
+    if (isa<FieldRead>(a)) {
+      return isa<FieldRead>(b) &&
+             to<FieldRead>(a)->fieldName == to<FieldRead>(b)->fieldName &&
+             equal(to<FieldRead>(a)->elementOrSet,
+                   to<FieldRead>(b)->elementOrSet, swap);
+    }
+    if (isa<TupleRead>(a)) {
+      return isa<TupleRead>(b) &&
+             equal(to<TupleRead>(a)->tuple, to<TupleRead>(b)->tuple, swap) &&
+             equal(to<TupleRead>(a)->index, to<TupleRead>(b)->index, swap);
+    }
+    if (isa<TensorRead>(a)) {
+      if (!isa<TensorRead>(b)) {
+        return false;
+      }
+      const TensorRead* ra = to<TensorRead>(a);
+      const TensorRead* rb = to<TensorRead>(b);
+      if (ra->indices.size() != rb->indices.size() ||
+          !equal(ra->tensor, rb->tensor, swap)) {
+        return false;
+      }
+      for (size_t i = 0; i < ra->indices.size(); ++i) {
+        if (!equal(ra->indices[i], rb->indices[i], swap)) {
+          return false;
+        }
+      }
+      return true;
+    }
+    if (isa<Neg>(a)) {
+      return isa<Neg>(b) && equal(to<Neg>(a)->a, to<Neg>(b)->a, swap);
+    }
+    if (isa<IndexExpr>(a)) {
+      // The result index variables of the expressions correspond by position
+      if (!isa<IndexExpr>(b)) {
+        return false;
+      }
+      const IndexExpr* ia = to<IndexExpr>(a);
+      const IndexExpr* ib = to<IndexExpr>(b);
+      if (ia->resultVars.size() != ib->resultVars.size()) {
+        return false;
+      }
+      map<IndexVar,IndexVar> renaming = swap;
+      for (size_t i = 0; i < ia->resultVars.size(); ++i) {
+        if (!(ia->resultVars[i].getDomain() ==
+              ib->resultVars[i].getDomain())) {
+          return false;
+        }
+        renaming[ia->resultVars[i]] = ib->resultVars[i];
+      }
+      return equal(ia->value, ib->value, renaming);
+    }
+    if (isa<IndexedTensor>(a)) {
+      if (!isa<IndexedTensor>(b)) {
+        return false;
+      }
+      const IndexedTensor* ta = to<IndexedTensor>(a);
+      const IndexedTensor* tb = to<IndexedTensor>(b);
+      if (!equal(ta->tensor, tb->tensor, swap)) {
+        return false;
+      }
+      vector<IndexVar> indexVars;
+      for (auto& indexVar : ta->indexVars) {
+        indexVars.push_back(util::contains(swap, indexVar) ? swap.at(indexVar)
+                                                           : indexVar);
+      }
+      if (indexVars == tb->indexVars) {
+        return true;
+      }
+      // A symmetric matrix may be indexed either way
+      return indexVars.size() == 2 && tb->indexVars.size() == 2 &&
+             indexVars[0] == tb->indexVars[1] &&
+             indexVars[1] == tb->indexVars[0] && isSymmetric(ta->tensor);
+    }
+
+    bool sameOperator = (isa<Add>(a) && isa<Add>(b)) ||
+                        (isa<Sub>(a) && isa<Sub>(b)) ||
+                        (isa<Mul>(a) && isa<Mul>(b)) ||
+                        (isa<Div>(a) && isa<Div>(b));
+    if (sameOperator) {
+      bool commutes = isa<Add>(a) ||
+                      (isa<Mul>(a) && (isScalar(to<Mul>(a)->a.type()) ||
+                                       isScalar(to<Mul>(a)->b.type())));
+      const BinaryExpr* ba = static_cast<const BinaryExpr*>(a.ptr);
+      const BinaryExpr* bb = static_cast<const BinaryExpr*>(b.ptr);
+      return (equal(ba->a, bb->a, swap) && equal(ba->b, bb->b, swap)) ||
+             (commutes && equal(ba->a, bb->b, swap) &&
+                          equal(ba->b, bb->a, swap));
+    }
+    return false;
+  }
+};
+
+/// Finds the maps that assemble symmetric matrices.
+class SymmetricAssemblies : public IRVisitor {
+public:
+  set<Var> matrices;
+
+private:
+  using IRVisitor::visit;
+
+  /// True if the matrix is square and has square blocks of scalars.
+  static bool hasSymmetricType(const Var& var) {
+    if (!isSystemTensorType(var.getType())) {
+      return false;
+    }
+    const TensorType* type = var.getType().toTensor();
+    if (type->order() != 2 ||
+        !(type->getDimensions()[0] == type->getDimensions()[1]) ||
+        type->getComponentType().kind != ScalarType::Float) {
+      return false;
+    }
+    Type blockType = type->getBlockType();
+    if (isScalar(blockType)) {
+      return true;
+    }
+    const TensorType* block = blockType.toTensor();
+    return block->order() == 2 && isScalar(block->getBlockType()) &&
+           block->getDimensions()[0] == block->getDimensions()[1];
+  }
+
+  void visit(const Map* op) {
+    if (op->reduction.getKind() != ReductionOperator::Sum ||
+        !op->neighbors.defined() || !isa<VarExpr>(op->neighbors)) {
+      return;
+    }
+
+    // The edges must connect elements of one set, so the sparsity is symmetric
+    const SetType* setType = op->target.type().toSet();
+    if (setType->getCardinality() < 2) {
+      return;
+    }
+    for (Expr* endpointSet : setType->endpointSets) {
+      if (!isa<VarExpr>(*endpointSet) ||
+          to<VarExpr>(*endpointSet)->var != to<VarExpr>(op->neighbors)->var) {
+        return;
+      }
+    }
+
+    const vector<Var>& results = op->function.getResults();
+    iassert(results.size() == op->vars.size());
+    AssemblySymmetry symmetry(op->function);
+    for (size_t i = 0; i < op->vars.size(); ++i) {
+      if (hasSymmetricType(op->vars[i]) &&
+          symmetry.isSymmetricAssembly(results[i])) {
+        matrices.insert(op->vars[i]);
+      }
+    }
+  }
+};
+
+/// Removes the matrices that are used other than by their assembly, by
+/// products with vectors and by solves.
+class SymmetricUses : public IRVisitor {
+public:
+  SymmetricUses(set<Var>* matrices) : matrices(matrices) {}
+
+private:
+  set<Var>* matrices;
+
+  using IRVisitor::visit;
+
+  void visit(const VarExpr* op) {
+    matrices->erase(op->var);
+  }
+
+  void visit(const AssignStmt* op) {
+    matrices->erase(op->var);
+    Var matrix;
+    Expr vector;
+    if (isMatrixVectorProduct(op->value, &matrix, &vector) &&
+        util::contains(*matrices, matrix)) {
+      vector.accept(this);
+      return;
+    }
+    IRVisitor::visit(op);
+  }
+
+  void visit(const FieldWrite* op) {
+    Var matrix;
+    Expr vector;
+    if (isMatrixVectorProduct(op->value, &matrix, &vector) &&
+        util::contains(*matrices, matrix)) {
+      op->elementOrSet.accept(this);
+      vector.accept(this);
+      return;
+    }
+    IRVisitor::visit(op);
+  }
+
+  void visit(const CallStmt* op) {
+    for (auto& result : op->results) {
+      matrices->erase(result);
+    }
+    if (op->callee == intrinsics::solve() && !op->actuals.empty() &&
+        isa<VarExpr>(op->actuals[0])) {
+      for (size_t i = 1; i < op->actuals.size(); ++i) {
+        op->actuals[i].accept(this);
+      }
+      return;
+    }
+    IRVisitor::visit(op);
+  }
+};
+
+std::set<Var> findSymmetricMatrices(const Func& func) {
+  SymmetricAssemblies assemblies;
+  func.getBody().accept(&assemblies);
+  set<Var> matrices = assemblies.matrices;
+  if (matrices.empty()) {
+    return matrices;
+  }
+
+  // The matrices must be locals that are assembled once
+  Definitions definitions(func);
+  for (auto& matrix : assemblies.matrices) {
+    if (util::contains(func.getArguments(), matrix) ||
+        util::contains(func.getResults(), matrix) ||
+        definitions.getNumWrites(matrix) != 1) {
+      matrices.erase(matrix);
+    }
+  }
+
+  SymmetricUses uses(&matrices);
+  func.getBody().accept(&uses);
+  return matrices;
+}
+
+}}
@@ -0,0 +1,25 @@
+#ifndef SIMIT_SYMMETRY_H
+#define SIMIT_SYMMETRY_H
+
+#include <set>
+
+#include "ir.h"
+
+namespace simit {
+namespace ir {
+
+/// True if `expr` multiplies a matrix variable by a vector, as in
+/// `(i A(i,+j) * x(+j))`, in which case the matrix and the vector are returned
+/// through `matrix` and `vector`.
+bool isMatrixVectorProduct(const Expr& expr, Var* matrix, Expr* vector);
+
+/// Returns the system matrices of `func` that are provably symmetric and can
+/// therefore be stored as their upper block-triangle. A matrix qualifies if it
+/// is assembled by a map over an edge set whose endpoints are in one set, if
+/// the assembly function writes every block once, outside of loops, and pairs
+/// every off-diagonal block with its transpose, and if the matrix is otherwise
+/// only multiplied by vectors and solved with.
+std::set<Var> findSymmetricMatrices(const Func& func);
+
+}}
+#endif
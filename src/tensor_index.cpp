@@ -14,14 +14,16 @@ namespace ir {
 struct TensorIndex::Content {
   std::string name;
   pe::PathExpression pexpr;
+  bool symmetric;
   Var coordArray;
   Var sinkArray;
 };
 
-TensorIndex::TensorIndex(std::string name, pe::PathExpression pexpr)
-    : content(new Content) {
+TensorIndex::TensorIndex(std::string name, pe::PathExpression pexpr,
+                         bool symmetric) : content(new Content) {
   content->name = name;
   content->pexpr = pexpr;
+  content->symmetric = symmetric;
 
   string prefix = (name == "") ? name : name + ".";
   content->coordArray = Var(prefix + "coords", ArrayType::make(ScalarType::Int));
@@ -36,6 +38,10 @@ const pe::PathExpression& TensorIndex::getPathExpression() const {
   return content->pexpr;
 }
 
+bool TensorIndex::isSymmetric() const {
+  return content->symmetric;
+}
+
 const Var& TensorIndex::getRowptrArray() const {
   return content->coordArray;
 }
@@ -47,8 +53,11 @@ const Var& TensorIndex::getColidxArray() const {
 ostream &operator<<(ostream& os, const TensorIndex& ti) {
   auto rowptr = ti.getRowptrArray();
   auto colidx = ti.getColidxArray();
-  os << "tensor-index " << ti.getName() << ": " << ti.getPathExpression()
-     << endl;
+  os << "tensor-index " << ti.getName() << ": " << ti.getPathExpression();
+  if (ti.isSymmetric()) {
+    os << " (symmetric)";
+  }
+  os << endl;
   os << "  " << rowptr << " : " << rowptr.getType() << endl;
   os << "  " << colidx << " : " << colidx.getType();
   return os;
@@ -21,11 +21,15 @@ class Var;
 /// tensors with the same sparsity.  Tensor indices without path expressions
 /// cannot be pre-assembled and must be assembled by the user if they come
 /// from an extern function, or by Simit as they are computed.
+/// Symmetric tensor indices only hold the upper block-triangle of their path
+/// expression's sparsity, so the blocks below the diagonal are the transposes
+/// of the blocks above it and are not stored.
 /// Note: only sparse matrix CSR indices are supported for now.
 class TensorIndex {
 public:
   TensorIndex() {}
-  TensorIndex(std::string name, pe::PathExpression pexpr);
+  TensorIndex(std::string name, pe::PathExpression pexpr,
+              bool symmetric=false);
 
   /// Get tensor index name
   const std::string getName() const;
@@ -37,6 +41,10 @@ public:
   /// function, or by Simit as they are computed.
   const pe::PathExpression& getPathExpression() const;
 
+  /// True if the tensor index only holds the upper block-triangle of a
+  /// symmetric matrix, i.e. if the column of every entry is at least its row.
+  bool isSymmetric() const;
+
   /// Return the tensor index's rowptr array.  A rowptr array contains the
   /// beginning and end of the column indices in the colidx array for each row
   /// of the tensor index.
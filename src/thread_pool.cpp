@@ -0,0 +1,182 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+#include "error.h"
+
+using namespace std;
+
+namespace simit {
+namespace internal {
+
+// Set while a thread executes chunks of a parallel loop, so that nested
+// parallel loops run serially instead of deadlocking on the pool.
+static thread_local bool inParallelLoop = false;
+
+// class ThreadPool
+ThreadPool& ThreadPool::getInstance() {
+  static ThreadPool instance;
+  return instance;
+}
+
+ThreadPool::ThreadPool() : numThreads(1), loop(nullptr), generation(0),
+                           activeWorkers(0), shutdown(false) {
+}
+
+ThreadPool::~ThreadPool() {
+  stopWorkers();
+}
+
+void ThreadPool::setNumThreads(unsigned numThreads) {
+  uassert(numThreads > 0) << "the number of threads must be positive";
+  if (numThreads == this->numThreads) {
+    return;
+  }
+  lock_guard<std::mutex> submitLock(submitMutex);
+  stopWorkers();
+  this->numThreads = numThreads;
+  startWorkers();
+}
+
+void ThreadPool::parallelFor(int start, int end, Task task, void **context,
+                             Schedule schedule, int chunkSize) {
+  const int size = end - start;
+  if (size <= 0) {
+    return;
+  }
+  if (numThreads <= 1 || size == 1 || inParallelLoop) {
+    task(start, end, context);
+    return;
+  }
+
+  if (chunkSize <= 0) {
+    switch (schedule) {
+      case Static:
+        chunkSize = (size + numThreads - 1) / numThreads;
+        break;
+      case Dynamic:
+        // Several chunks per thread so that threads that finish early can
+        // steal work from slow ones.
+        chunkSize = max(1, size / (int)(numThreads * 8));
+        break;
+    }
+  }
+
+  Loop loop;
+  loop.start = start;
+  loop.end = end;
+  loop.task = task;
+  loop.context = context;
+  loop.schedule = schedule;
+  loop.chunkSize = chunkSize;
+  loop.next = start;
+
+  lock_guard<std::mutex> submitLock(submitMutex);
+  {
+    lock_guard<std::mutex> lock(mutex);
+    this->loop = &loop;
+    activeWorkers = workers.size();
+    ++generation;
+  }
+  wakeWorkers.notify_all();
+
+  // The calling thread participates as thread 0
+  execute(&loop, 0);
+
+  unique_lock<std::mutex> lock(mutex);
+  loopDone.wait(lock, [this]{return activeWorkers == 0;});
+  this->loop = nullptr;
+}
+
+void ThreadPool::startWorkers() {
+  iassert(workers.empty());
+  shutdown = false;
+  for (unsigned i = 1; i < numThreads; ++i) {
+    workers.push_back(thread(&ThreadPool::workerMain, this, i, generation));
+  }
+}
+
+void ThreadPool::stopWorkers() {
+  {
+    lock_guard<std::mutex> lock(mutex);
+    shutdown = true;
+  }
+  wakeWorkers.notify_all();
+  for (auto &worker : workers) {
+    worker.join();
+  }
+  workers.clear();
+}
+
+void ThreadPool::workerMain(unsigned threadID, unsigned long seenGeneration) {
+  while (true) {
+    Loop *loop;
+    {
+      unique_lock<std::mutex> lock(mutex);
+      wakeWorkers.wait(lock, [&]{
+        return shutdown || generation != seenGeneration;
+      });
+      if (shutdown) {
+        return;
+      }
+      seenGeneration = generation;
+      loop = this->loop;
+    }
+
+    execute(loop, threadID);
+
+    bool last;
+    {
+      lock_guard<std::mutex> lock(mutex);
+      last = (--activeWorkers == 0);
+    }
+    if (last) {
+      loopDone.notify_one();
+    }
+  }
+}
+
+void ThreadPool::execute(Loop *loop, unsigned threadID) {
+  inParallelLoop = true;
+  const int chunkSize = loop->chunkSize;
+  switch (loop->schedule) {
+    case Static: {
+      // Chunks are dealt out to the threads round-robin
+      const int stride = chunkSize * numThreads;
+      for (int chunkStart = loop->start + threadID*chunkSize;
+           chunkStart < loop->end; chunkStart += stride) {
+        int chunkEnd = min(loop->end, chunkStart + chunkSize);
+        loop->task(chunkStart, chunkEnd, loop->context);
+        if (loop->end - chunkStart <= stride) {
+          break;
+        }
+      }
+      break;
+    }
+    case Dynamic: {
+      while (true) {
+        int chunkStart = loop->next.fetch_add(chunkSize);
+        if (chunkStart >= loop->end) {
+          break;
+        }
+        int chunkEnd = min(loop->end, chunkStart + chunkSize);
+        loop->task(chunkStart, chunkEnd, loop->context);
+      }
+      break;
+    }
+  }
+  inParallelLoop = false;
+}
+
+}}
+
+extern "C" {
+void simit_parallel_for(int start, int end,
+                        simit::internal::ThreadPool::Task task, void **context,
+                        int schedule, int chunkSize) {
+  using simit::internal::ThreadPool;
+  ThreadPool::getInstance().parallelFor(start, end, task, context,
+                                        (ThreadPool::Schedule)schedule,
+                                        chunkSize);
+}
+}
@@ -0,0 +1,86 @@
+#ifndef SIMIT_THREAD_POOL_H
+#define SIMIT_THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "interfaces/uncopyable.h"
+
+namespace simit {
+namespace internal {
+
+/// A pool of worker threads that execute the iteration space of parallel
+/// loops. Compiled code hands a loop to the pool through the
+/// `simit_parallel_for` runtime function, which splits the range [start,end)
+/// into chunks and calls the outlined loop body once per chunk.
+class ThreadPool : private interfaces::Uncopyable {
+public:
+  /// An outlined loop body that executes the iterations [start,end) using the
+  /// values captured in `context`.
+  typedef void (*Task)(int start, int end, void **context);
+
+  /// Static scheduling gives each thread the same share of the range up front,
+  /// while dynamic scheduling has threads grab chunks from a shared counter.
+  enum Schedule {Static, Dynamic};
+
+  static ThreadPool& getInstance();
+
+  ~ThreadPool();
+
+  /// Set the number of threads (including the calling thread) that execute
+  /// parallel loops. Must not be called while a loop is executing.
+  void setNumThreads(unsigned numThreads);
+  unsigned getNumThreads() const {return numThreads;}
+
+  /// Execute task over [start,end). If `chunkSize` is 0 a chunk size is
+  /// derived from the range size and the number of threads. Loops started
+  /// from inside a parallel loop execute serially on the calling thread.
+  void parallelFor(int start, int end, Task task, void **context,
+                   Schedule schedule, int chunkSize);
+
+private:
+  ThreadPool();
+
+  struct Loop {
+    int start;
+    int end;
+    Task task;
+    void **context;
+    Schedule schedule;
+    int chunkSize;
+    std::atomic<int> next;
+  };
+
+  unsigned numThreads;
+  std::vector<std::thread> workers;
+
+  // Serializes loops submitted from different host threads
+  std::mutex submitMutex;
+
+  std::mutex mutex;
+  std::condition_variable wakeWorkers;
+  std::condition_variable loopDone;
+  Loop *loop;
+  unsigned long generation;
+  unsigned activeWorkers;
+  bool shutdown;
+
+  void startWorkers();
+  void stopWorkers();
+  void workerMain(unsigned threadID, unsigned long seenGeneration);
+  void execute(Loop *loop, unsigned threadID);
+};
+
+}}
+
+extern "C" {
+/// Runtime entry point used by compiled code to execute a parallel loop.
+void simit_parallel_for(int start, int end,
+                        simit::internal::ThreadPool::Task task, void **context,
+                        int schedule, int chunkSize);
+}
+
+#endif
@@ -1,5 +1,15 @@
 #include "timers.h"
 
+#include <chrono>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 #include "storage.h"
 #include "ir_builder.h"
 #include "ir_rewriter.h"
@@ -8,6 +18,8 @@
 
 #include "ir.h"
 #include "intrinsics.h"
+#include "ir_visitor.h"
+#include "util/util.h"
 
 using namespace std;
 
@@ -59,113 +71,337 @@ void printTimes() {
          simit::ir::TimerStorage::getInstance().getTotalTime() / 1000000.0);
 }
 
-// Singleton
-class InsertTimers : public IRRewriter {
-  using IRRewriter::visit;
-  public: 
-    static InsertTimers& getInstance() {
-      static InsertTimers instance; 
-      return instance;
-    }
-    
-    void visit(const TensorWrite *op) {
-      Var timeStartVar = initTimer(util::toString(*op),stmt);
-      stmt = Block::make(stmt,op);
-      storeTimer(stmt, timeStartVar);
+static double getMicroseconds() {
+  using namespace std::chrono;
+  return duration<double,std::micro>(
+      steady_clock::now().time_since_epoch()).count();
+}
+
+#ifdef __linux__
+static int openCounter(uint64_t config, int group) {
+  perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = config;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_GROUP;
+  return syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+}
+#endif
+
+// class TimerStorage
+int TimerStorage::addTimer(std::string line, KernelProfile::Kind kind,
+                           double bytes, double flops) {
+  lock_guard<std::mutex> lock(mutex);
+  Timer timer;
+  timer.line = line;
+  timer.kind = kind;
+  timer.bytes = bytes;
+  timer.flops = flops;
+  timers.push_back(timer);
+  return timers.size() - 1;
+}
+
+int TimerStorage::getTimedLineIndex(std::string line) {
+  lock_guard<std::mutex> lock(mutex);
+  for (size_t i = 0; i < timers.size(); ++i) {
+    if (timers[i].line == line) {
+      return i;
     }
+  }
+  return -1;
+}
+
+void TimerStorage::storeTime(size_t index, double time) {
+  lock_guard<std::mutex> lock(mutex);
+  if (timers.size() < index + 1) {
+    timers.resize(index + 1);
+  }
+  timers[index].calls += 1;
+  timers[index].time += time;
+}
 
-    void visit(const FieldWrite *op) {
-      Var timeStartVar = initTimer(util::toString(*op),stmt);
-      stmt = Block::make(stmt,op);
-      storeTimer(stmt, timeStartVar);
+void TimerStorage::startTimer(int index) {
+  lock_guard<std::mutex> lock(mutex);
+  iassert(index >= 0 && index < (int)timers.size());
+  Timer& timer = timers[index];
+  if (!kHardwareCounters || !readCounters(timer.startCounters)) {
+    timer.startCounters[0] = -1;
+  }
+  // Read the clock last, so that reading the counters is not timed
+  timer.startTime = getMicroseconds();
+}
+
+void TimerStorage::stopTimer(int index, int iterations) {
+  double time = getMicroseconds();
+  lock_guard<std::mutex> lock(mutex);
+  iassert(index >= 0 && index < (int)timers.size());
+  Timer& timer = timers[index];
+  timer.time += time - timer.startTime;
+  timer.calls += 1;
+  timer.iterations += iterations;
+
+  long long counters[2];
+  if (timer.startCounters[0] >= 0 && readCounters(counters)) {
+    if (timer.instructions < 0) {
+      timer.instructions = 0;
+      timer.cacheMisses = 0;
     }
-    
-    void visit(const Map *op) {
-      Var timeStartVar = initTimer(util::toString(*op),stmt);
-      stmt = Block::make(stmt,op);
-      storeTimer(stmt, timeStartVar);
+    timer.instructions += counters[0] - timer.startCounters[0];
+    timer.cacheMisses += counters[1] - timer.startCounters[1];
+  }
+}
+
+double TimerStorage::getTotalTime() {
+  lock_guard<std::mutex> lock(mutex);
+  double sum = 0;
+  for (auto& timer : timers) {
+    sum += timer.time;
+  }
+  return sum;
+}
+
+Profile TimerStorage::getProfile(int begin, int end) const {
+  lock_guard<std::mutex> lock(mutex);
+  iassert(begin >= 0 && begin <= end && end <= (int)timers.size());
+  vector<KernelProfile> kernels;
+  for (int i = begin; i < end; ++i) {
+    const Timer& timer = timers[i];
+    KernelProfile kernel;
+    kernel.name = timer.line;
+    kernel.kind = timer.kind;
+    kernel.calls = timer.calls;
+    kernel.iterations = timer.iterations;
+    kernel.time = timer.time;
+    kernel.bytes = timer.bytes * timer.iterations;
+    kernel.flops = timer.flops * timer.iterations;
+    kernel.instructions = timer.instructions;
+    kernel.cacheMisses = timer.cacheMisses;
+    kernels.push_back(kernel);
+  }
+  return Profile(kernels);
+}
+
+void TimerStorage::clear(int begin, int end) {
+  lock_guard<std::mutex> lock(mutex);
+  iassert(begin >= 0 && begin <= end && end <= (int)timers.size());
+  for (int i = begin; i < end; ++i) {
+    Timer& timer = timers[i];
+    timer.calls = 0;
+    timer.iterations = 0;
+    timer.time = 0;
+    timer.instructions = -1;
+    timer.cacheMisses = -1;
+  }
+}
+
+bool TimerStorage::readCounters(long long counters[2]) {
+#ifdef __linux__
+  // The counters count the thread that opens them, which is the thread that
+  // runs the function. The descriptors stay open for the process lifetime.
+  if (counterGroup == -1) {
+    counterGroup = openCounter(PERF_COUNT_HW_INSTRUCTIONS, -1);
+    if (counterGroup >= 0 &&
+        openCounter(PERF_COUNT_HW_CACHE_MISSES, counterGroup) < 0) {
+      close(counterGroup);
+      counterGroup = -1;
     }
-    
-    void visit(const Store *op) {
-      Var timeStartVar = initTimer(util::toString(*op),stmt);
-      stmt = Block::make(stmt,op);
-      storeTimer(stmt, timeStartVar);
+    if (counterGroup < 0) {
+      counterGroup = -2;
     }
-    
-    void visit(const CallStmt *op) {
-      if (op->callee.getKind() == Func::Intrinsic) { 
-        Var timeStartVar = initTimer(util::toString(*op),stmt);
-        stmt = Block::make(stmt,op);
-        storeTimer(stmt, timeStartVar);
-      } else {
-        stmt = Block::make(stmt, op);
-      }
+  }
+  if (counterGroup < 0) {
+    return false;
+  }
+
+  // The group is read as {number of counters, instructions, cache misses}
+  uint64_t values[3];
+  if (read(counterGroup, values, sizeof(values)) != sizeof(values)) {
+    return false;
+  }
+  counters[0] = values[1];
+  counters[1] = values[2];
+  return true;
+#else
+  return false;
+#endif
+}
+
+/// Estimates the bytes moved and the floating point operations performed by
+/// one execution of a statement.
+class CostEstimator : public IRVisitor {
+public:
+  double bytes = 0.0;
+  double flops = 0.0;
+
+  CostEstimator(Stmt stmt) {
+    stmt.accept(this);
+  }
+
+private:
+  // The number of times the statement being visited runs per execution
+  double scale = 1.0;
+
+  static unsigned getComponentBytes(const Type& type) {
+    if (!type.defined() || !type.isTensor()) {
+      return 0;
     }
-    
-    void visit(const AssignStmt *op) {
-      Var timeStartVar = initTimer(util::toString(*op),stmt);
-      stmt = Block::make(stmt,op);
-      storeTimer(stmt, timeStartVar);
+    ScalarType componentType = type.toTensor()->getComponentType();
+    return componentType.isString() ? 0 : componentType.bytes();
+  }
+
+  static bool isFloatType(const Type& type) {
+    if (!type.defined() || !type.isTensor()) {
+      return false;
     }
-    
-    void visit(const IfThenElse *op) {
-      Expr start = rewrite(op->condition);
-      Stmt thenBody = rewrite(op->thenBody);
-      Stmt elseBody = rewrite(op->elseBody);
-      
-      stmt = IfThenElse::make(op->condition, thenBody, elseBody);
+    ScalarType componentType = type.toTensor()->getComponentType();
+    return componentType.isFloat() || componentType.isComplex();
+  }
+
+  void countFlop(const ExprNode* op) {
+    if (isFloatType(op->type)) {
+      flops += scale;
     }
-    
-    void visit(const ForRange *op) {
-      Expr start = rewrite(op->start);
-      Expr end = rewrite(op->end);
-      Stmt body = rewrite(op->body);
-      
-      stmt = ForRange::make(op->var, start, end, body);
+  }
+
+  using IRVisitor::visit;
+
+  void visit(const Load* op) {
+    bytes += scale * getComponentBytes(op->type);
+    IRVisitor::visit(op);
+  }
+
+  void visit(const Store* op) {
+    Type type = op->value.type();
+    if (op->cop != CompoundOperator::None) {
+      // Compound stores also load the stored location and combine it
+      bytes += scale * getComponentBytes(type);
+      if (isFloatType(type)) {
+        flops += scale;
+      }
     }
-    
-    void visit(const For *op) {
-      Stmt body = rewrite(op->body);
-      
-      stmt = For::make(op->var, op->domain, body);
+    bytes += scale * getComponentBytes(type);
+    IRVisitor::visit(op);
+  }
+
+  void visit(const Neg* op) {countFlop(op); IRVisitor::visit(op);}
+  void visit(const Add* op) {countFlop(op); IRVisitor::visit(op);}
+  void visit(const Sub* op) {countFlop(op); IRVisitor::visit(op);}
+  void visit(const Mul* op) {countFlop(op); IRVisitor::visit(op);}
+  void visit(const Div* op) {countFlop(op); IRVisitor::visit(op);}
+
+  void visit(const CallStmt* op) {
+    if (op->callee.getKind() == Func::Intrinsic) {
+      for (const Var& result : op->results) {
+        if (isFloatType(result.getType())) {
+          flops += scale;
+        }
+      }
     }
-  
-    Var getTimeVar() {
-      return timeStartVar;
+    IRVisitor::visit(op);
+  }
+
+  void visit(const ForRange* op) {
+    double outerScale = scale;
+    if (isa<Literal>(op->start) && isa<Literal>(op->end) &&
+        isScalar(op->start.type()) && isScalar(op->end.type())) {
+      int start = ((int*)to<Literal>(op->start)->data)[0];
+      int end = ((int*)to<Literal>(op->end)->data)[0];
+      scale *= max(end - start, 0);
     }
-  private:
-    int counter = 0;
-    Var timeStartVar = Var("simit_internal_time_var", Float);
-    InsertTimers() {};
-    InsertTimers(InsertTimers const&)    = delete;
-    void operator=(InsertTimers const&)  = delete;
-
-    Var initTimer(string line, Stmt& stmt) {
-      TimerStorage::getInstance().addTimedLine(line);
-      Stmt timeStartStmt =
-          CallStmt::make({getTimeVar()}, intrinsics::clock(), {});
-      stmt = Block::make(timeStartStmt, stmt);
-      return timeStartVar;
+    op->body.accept(this);
+    scale = outerScale;
+  }
+};
+
+/// Times the loops and the statements outside loops.
+class InsertTimers : public IRRewriter {
+public:
+  using IRRewriter::visit;
+
+  void visit(const TensorWrite *op) {
+    timeStatement(op);
+  }
+
+  void visit(const FieldWrite *op) {
+    timeStatement(op);
+  }
+
+  void visit(const Map *op) {
+    timeStatement(op);
+  }
+
+  void visit(const Store *op) {
+    timeStatement(op);
+  }
+
+  void visit(const CallStmt *op) {
+    if (op->callee.getKind() == Func::Intrinsic) {
+      timeStatement(op);
+    } else {
+      stmt = op;
     }
+  }
+
+  void visit(const AssignStmt *op) {
+    timeStatement(op);
+  }
 
-    void storeTimer(Stmt& stmt, Var& timeStartVar) {
-      Var clock("clock", Float);
-      Stmt clockDecl = VarDecl::make(clock);
-      Stmt clockStmt = CallStmt::make({clock}, intrinsics::clock(), {});
-      Expr subtraction = Sub::make(clock, VarExpr::make(timeStartVar));
-      Stmt store = CallStmt::make({}, intrinsics::storeTime(),
-          {counter, subtraction});
-      stmt = Block::make({clockDecl, clockStmt, stmt, store});
-      counter++;
+  // Loops are timed as a whole, and their bodies are not rewritten. The
+  // bytes and flops of a loop are estimated per iteration.
+  void visit(const ForRange *op) {
+    insertTimer(op, op->body, KernelProfile::Loop, Sub::make(op->end,op->start));
+  }
+
+  void visit(const For *op) {
+    // Loops over index structures count one iteration per call
+    Expr iterations = 1;
+    if (op->domain.kind == ForDomain::IndexSet) {
+      const IndexSet& indexSet = op->domain.indexSet;
+      switch (indexSet.getKind()) {
+        case IndexSet::Range:
+          iterations = (int)indexSet.getSize();
+          break;
+        case IndexSet::Set:
+          iterations = Length::make(indexSet);
+          break;
+        case IndexSet::Dynamic:
+        case IndexSet::Single:
+          break;
+      }
     }
+    insertTimer(op, op->body, KernelProfile::Loop, iterations);
+  }
+
+private:
+  // The first line of the statement's IR
+  static string getLine(Stmt stmt) {
+    string line = util::toString(stmt);
+    line = line.substr(0, line.find('\n'));
+    size_t first = line.find_first_not_of(' ');
+    return (first == string::npos) ? "" : line.substr(first);
+  }
+
+  void timeStatement(Stmt timed) {
+    insertTimer(timed, timed, KernelProfile::Statement, 1);
+  }
+
+  void insertTimer(Stmt timed, Stmt iteration, KernelProfile::Kind kind,
+                   Expr iterations) {
+    CostEstimator cost(iteration);
+    int index = TimerStorage::getInstance().addTimer(getLine(timed), kind,
+                                                     cost.bytes, cost.flops);
+    Stmt start = CallStmt::make({}, intrinsics::startTimer(), {index});
+    Stmt stop = CallStmt::make({}, intrinsics::stopTimer(), {index,iterations});
+    stmt = Block::make({start, timed, stop});
+  }
 };
 
 Func insertTimers(Func func) {
-  Var timeStartVar = InsertTimers::getInstance().getTimeVar();
-  Func timerFunc = Func(func, Block::make(VarDecl::make(timeStartVar), 
-        func.getBody()));
-  timerFunc = InsertTimers::getInstance().rewrite(timerFunc);
-  return timerFunc;
+  InsertTimers inserter;
+  return inserter.rewrite(func);
 }
 
 }}
@@ -1,87 +1,130 @@
 #ifndef SIMIT_TIMERS_H
 #define SIMIT_TIMERS_H
 
+#include <mutex>
+
 #include "ir.h"
+#include "profile.h"
 
 namespace simit {
+extern bool kHardwareCounters;
+
 namespace ir {
 
 void printTimes();
+
+/// Time the lowered loops of `func`, and the statements outside loops. Each
+/// loop is timed as a whole, so that its body is left untouched and can still
+/// be parallelized.
 Func insertTimers(Func func);
 
-// Singleton
+// Singleton. Timers are added and updated under a lock, since functions are
+// compiled and run from several threads.
 class TimerStorage {
 public:
   static TimerStorage& getInstance() {
-    static TimerStorage instance; 
+    static TimerStorage instance;
     return instance;
   }
 
-  inline std::vector<std::string>& getSourceLines() {
+  inline std::vector<std::string> getSourceLines() {
+    std::lock_guard<std::mutex> lock(mutex);
     return sourceLines;
   }
 
   inline void addSourceLines(std::stringstream& ss) {
+    std::lock_guard<std::mutex> lock(mutex);
     for (std::string line; getline(ss, line); sourceLines.push_back(line));
   }
 
-  inline void addTimedLine(std::string line) {
-    timedLines.push_back(line);
+  /// Add a timer for the loop or statement printed as `line`, that per
+  /// iteration moves an estimated `bytes` bytes and performs an estimated
+  /// `flops` floating point operations. Returns the index of the timer.
+  int addTimer(std::string line, KernelProfile::Kind kind,
+               double bytes, double flops);
+
+  /// The number of timers. Timers are never removed, so functions compiled
+  /// with timers own a contiguous range of timer indices.
+  inline int getNumTimers() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return timers.size();
   }
 
-  inline int getTimedLineIndex(std::string line) {
-    size_t pos = find(timedLines.begin(), timedLines.end(),
-        line.c_str()) - timedLines.begin();
-    if (pos >= timedLines.size()){
-      pos = -1;
-    }
-    return pos;
-  }
+  int getTimedLineIndex(std::string line);
 
   inline void printTimedLines() {
-    for (auto& line : timedLines) {
-      std::cout << line << std::endl;
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& timer : timers) {
+      std::cout << timer.line << std::endl;
     }
   }
 
-  inline void storeTime(size_t index, double time) {
-    while (timerCount.size() < index + 1) {
-      timerCount.push_back(0);
-      timerSums.push_back(0);
-    }
-    timerCount[index] += 1;
-    timerSums[index] += time;
-  }
+  void storeTime(size_t index, double time);
+
+  /// Start the timer `index`, and its hardware counters if kHardwareCounters
+  /// is set.
+  void startTimer(int index);
+
+  /// Stop the timer `index` after a call that ran `iterations` iterations.
+  void stopTimer(int index, int iterations);
 
   inline double getTime(int index) {
-    return timerSums[index];
+    std::lock_guard<std::mutex> lock(mutex);
+    return timers[index].time;
   }
 
   inline unsigned long long int getCounter(int index) {
-    return timerCount[index];
+    std::lock_guard<std::mutex> lock(mutex);
+    return timers[index].calls;
   }
 
-  inline double getTotalTime() {
-    double sum = 0;
-    for(auto const &time : timerSums) {
-      sum += time;
-    }
-    return sum;
-  }
+  double getTotalTime();
 
   inline double getTimingPercentage(int index) {
-    return getTime(index) * 100.0 / getTotalTime(); 
+    return getTime(index) * 100.0 / getTotalTime();
   }
-  
+
+  /// Returns the profile of the timers in [begin, end).
+  Profile getProfile(int begin, int end) const;
+
+  /// Zero the measurements of the timers in [begin, end).
+  void clear(int begin, int end);
+
   private:
+    struct Timer {
+      std::string line;
+      KernelProfile::Kind kind;
+      double bytes;
+      double flops;
+
+      unsigned long long int calls;
+      unsigned long long int iterations;
+      double time;
+      long long instructions;
+      long long cacheMisses;
+
+      double startTime;
+      long long startCounters[2];
+
+      Timer() : kind(KernelProfile::Statement), bytes(0), flops(0), calls(0),
+                iterations(0), time(0), instructions(-1), cacheMisses(-1),
+                startTime(0) {}
+    };
+
+    mutable std::mutex mutex;
     std::vector<std::string> sourceLines;
-    std::vector<std::string> timedLines;
-    std::vector<double> timerSums;
-    std::vector<unsigned long long int> timerCount;
+    std::vector<Timer> timers;
 
-    TimerStorage() {};
+    // perf_event group of the instruction and cache miss counters, -1 if it
+    // has not been opened and -2 if it could not be opened
+    int counterGroup;
+
+    TimerStorage() : counterGroup(-1) {};
     TimerStorage(TimerStorage const&)    = delete;
     void operator=(TimerStorage const&)  = delete;
+
+    // Called with the lock held
+    bool readCounters(long long counters[2]);
 };
 
 }}
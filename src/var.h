@@ -15,8 +15,10 @@ struct VarContent {
   Type type;
 
   mutable long ref = 0;
-  friend inline void aquire(VarContent *c) {++c->ref;}
-  friend inline void release(VarContent *c) {if (--c->ref==0) delete c;}
+  friend inline void aquire(VarContent *c) {util::incRef(&c->ref);}
+  friend inline void release(VarContent *c) {
+    if (util::decRef(&c->ref)==0) delete c;
+  }
 };
 
 /// A Simit variable.
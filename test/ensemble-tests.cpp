@@ -0,0 +1,150 @@
+#include "simit-test.h"
+
+#include "ensemble.h"
+#include "graph.h"
+#include "program.h"
+
+using namespace std;
+using namespace simit;
+
+TEST(Ensemble, runSafe) {
+  Program program;
+  ASSERT_EQ(0, program.loadFile(TEST_FILE_NAME));
+  Function func = program.compile("main");
+  ASSERT_TRUE(func.defined());
+
+  // Instance 0: a chain of three points
+  Set points0;
+  FieldRef<simit_float> b0 = points0.addField<simit_float>("b");
+  FieldRef<simit_float> c0 = points0.addField<simit_float>("c");
+  ElementRef p0 = points0.add();
+  ElementRef p1 = points0.add();
+  ElementRef p2 = points0.add();
+  b0.set(p0, 1.0);
+  b0.set(p1, 2.0);
+  b0.set(p2, 3.0);
+
+  Set springs0(points0,points0);
+  FieldRef<simit_float> a0 = springs0.addField<simit_float>("a");
+  ElementRef s0 = springs0.add(p0,p1);
+  ElementRef s1 = springs0.add(p1,p2);
+  a0.set(s0, 1.0);
+  a0.set(s1, 2.0);
+
+  // Instance 1: two points connected by one spring
+  Set points1;
+  FieldRef<simit_float> b1 = points1.addField<simit_float>("b");
+  FieldRef<simit_float> c1 = points1.addField<simit_float>("c");
+  ElementRef q0 = points1.add();
+  ElementRef q1 = points1.add();
+  b1.set(q0, 1.0);
+  b1.set(q1, 1.0);
+
+  Set springs1(points1,points1);
+  FieldRef<simit_float> a1 = springs1.addField<simit_float>("a");
+  ElementRef t0 = springs1.add(q0,q1);
+  a1.set(t0, 3.0);
+
+  Ensemble ensemble(func);
+  ensemble.bind("points", {&points0, &points1});
+  ensemble.bind("springs", {&springs0, &springs1});
+  ensemble.runSafe();
+
+  ASSERT_EQ(2u, ensemble.getNumInstances());
+  ASSERT_EQ(3, ensemble.getOffset("points", 1));
+  ASSERT_EQ(2, ensemble.getOffset("springs", 1));
+  ASSERT_EQ(5, ensemble.getPackedSet("points")->getSize());
+
+  // The instances are not coupled through the packed sets
+  SIMIT_ASSERT_FLOAT_EQ(3.0,  c0.get(p0));
+  SIMIT_ASSERT_FLOAT_EQ(13.0, c0.get(p1));
+  SIMIT_ASSERT_FLOAT_EQ(10.0, c0.get(p2));
+  SIMIT_ASSERT_FLOAT_EQ(6.0,  c1.get(q0));
+  SIMIT_ASSERT_FLOAT_EQ(6.0,  c1.get(q1));
+
+  // Field updates are packed on the next run
+  b1.set(q1, 2.0);
+  ensemble.runSafe();
+  SIMIT_ASSERT_FLOAT_EQ(9.0,  c1.get(q0));
+  SIMIT_ASSERT_FLOAT_EQ(9.0,  c1.get(q1));
+  SIMIT_ASSERT_FLOAT_EQ(13.0, c0.get(p1));
+
+  // Unpacking only changes the versions of the fields whose values changed
+  auto version = [](Set& set, const string& name) -> unsigned long {
+    return set.getFields()[set.getFieldIndex(name)]->version;
+  };
+  unsigned long b0Version = version(points0, "b");
+  unsigned long c0Version = version(points0, "c");
+  unsigned long c1Version = version(points1, "c");
+  unsigned long a0Version = version(springs0, "a");
+  ensemble.runSafe();
+  ASSERT_EQ(b0Version, version(points0, "b"));
+  ASSERT_EQ(c0Version, version(points0, "c"));
+  ASSERT_EQ(c1Version, version(points1, "c"));
+  ASSERT_EQ(a0Version, version(springs0, "a"));
+
+  b1.set(q1, 1.0);
+  ensemble.runSafe();
+  ASSERT_EQ(c0Version, version(points0, "c"));
+  ASSERT_NE(c1Version, version(points1, "c"));
+  SIMIT_ASSERT_FLOAT_EQ(6.0,  c1.get(q0));
+}
+
+TEST(Ensemble, grow) {
+  Program program;
+  ASSERT_EQ(0, program.loadFile(string(TEST_INPUT_DIR) +
+                                "/ensemble/runSafe.sim"));
+  Function func = program.compile("main");
+  ASSERT_TRUE(func.defined());
+
+  // Instance 0: two points connected by one spring
+  Set points0;
+  FieldRef<simit_float> b0 = points0.addField<simit_float>("b");
+  FieldRef<simit_float> c0 = points0.addField<simit_float>("c");
+  ElementRef p0 = points0.add();
+  ElementRef p1 = points0.add();
+  b0.set(p0, 1.0);
+  b0.set(p1, 2.0);
+
+  Set springs0(points0,points0);
+  FieldRef<simit_float> a0 = springs0.addField<simit_float>("a");
+  a0.set(springs0.add(p0,p1), 1.0);
+
+  // Instance 1: two points connected by one spring
+  Set points1;
+  FieldRef<simit_float> b1 = points1.addField<simit_float>("b");
+  FieldRef<simit_float> c1 = points1.addField<simit_float>("c");
+  ElementRef q0 = points1.add();
+  ElementRef q1 = points1.add();
+  b1.set(q0, 1.0);
+  b1.set(q1, 1.0);
+
+  Set springs1(points1,points1);
+  FieldRef<simit_float> a1 = springs1.addField<simit_float>("a");
+  a1.set(springs1.add(q0,q1), 3.0);
+
+  Ensemble ensemble(func);
+  ensemble.bind("points", {&points0, &points1});
+  ensemble.bind("springs", {&springs0, &springs1});
+  ensemble.runSafe();
+  SIMIT_ASSERT_FLOAT_EQ(3.0, c0.get(p0));
+  SIMIT_ASSERT_FLOAT_EQ(3.0, c0.get(p1));
+  SIMIT_ASSERT_FLOAT_EQ(6.0, c1.get(q0));
+  SIMIT_ASSERT_FLOAT_EQ(6.0, c1.get(q1));
+
+  // Growing an instance repacks the sets, and the next run must use the
+  // indices of the new packed sets
+  ElementRef p2 = points0.add();
+  b0.set(p2, 3.0);
+  a0.set(springs0.add(p1,p2), 2.0);
+  ensemble.runSafe();
+
+  ASSERT_EQ(3, ensemble.getOffset("points", 1));
+  ASSERT_EQ(2, ensemble.getOffset("springs", 1));
+  ASSERT_EQ(5, ensemble.getPackedSet("points")->getSize());
+  SIMIT_ASSERT_FLOAT_EQ(3.0,  c0.get(p0));
+  SIMIT_ASSERT_FLOAT_EQ(13.0, c0.get(p1));
+  SIMIT_ASSERT_FLOAT_EQ(10.0, c0.get(p2));
+  SIMIT_ASSERT_FLOAT_EQ(6.0,  c1.get(q0));
+  SIMIT_ASSERT_FLOAT_EQ(6.0,  c1.get(q1));
+}
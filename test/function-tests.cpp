@@ -1,5 +1,8 @@
 #include "simit-test.h"
 
+#include <sstream>
+#include <thread>
+
 #include "tensor.h"
 #include "tensor_data.h"
 #include "graph.h"
@@ -41,6 +44,87 @@ TEST(Function, bindSet) {
   SIMIT_ASSERT_FLOAT_EQ(-44, field(p2));
 }
 
+TEST(Function, writeHeader) {
+  Type vertexType = ElementType::make("Vertex", {Field("field", Int)});
+  Type vertexSetType = SetType::make(vertexType, {});
+  Var V("V", vertexSetType);
+  Var i("i", Int);
+  Stmt neg =
+      ForRange::make(i, 0, Length::make(IndexSet(V)),
+                     Store::make(FieldRead::make(V, "field"), i,
+                                 -Load::make(FieldRead::make(V, "field"), i)));
+  Environment env;
+  env.addExtern(V);
+  simit::Function function = getTestBackend()->compile(neg, env);
+
+  // The header declares the set struct of the extern, the context object that
+  // holds it and the entry points
+  std::stringstream header;
+  function.writeHeader(header);
+  std::string headerStr = header.str();
+  ASSERT_NE(std::string::npos, headerStr.find("int32_t size;"));
+  ASSERT_NE(std::string::npos, headerStr.find("int32_t* field;"));
+  ASSERT_NE(std::string::npos,
+            headerStr.find("_V_t V __attribute__((aligned(8)));"));
+  ASSERT_NE(std::string::npos, headerStr.find("_context_t;"));
+  ASSERT_NE(std::string::npos, headerStr.find("_init(simit_"));
+  ASSERT_NE(std::string::npos, headerStr.find("_context_t* context);"));
+
+  std::stringstream object;
+  function.writeObject(object);
+  ASSERT_GT(object.str().size(), 0u);
+#ifdef __linux__
+  ASSERT_EQ("\x7f" "ELF", object.str().substr(0, 4));
+#endif
+}
+
+TEST(Function, clone) {
+  Type vertexType = ElementType::make("Vertex", {Field("field", Int)});
+  Type vertexSetType = SetType::make(vertexType, {});
+  Var V("V", vertexSetType);
+  Var i("i", Int);
+  Stmt neg =
+      ForRange::make(i, 0, Length::make(IndexSet(V)),
+                     Store::make(FieldRead::make(V, "field"), i,
+                                 -Load::make(FieldRead::make(V, "field"), i)));
+  Environment env;
+  env.addExtern(V);
+  simit::Function function = getTestBackend()->compile(neg, env);
+  simit::Function clone = function.clone();
+  ASSERT_TRUE(clone.defined());
+
+  // Bind the instances to different sets, and run them concurrently
+  simit::Set VArg0;
+  auto field0 = VArg0.addField<int>("field");
+  simit::ElementRef p0 = VArg0.add();
+  simit::ElementRef p1 = VArg0.add();
+  field0(p0) = 42;
+  field0(p1) = 43;
+  function.bind("V", &VArg0);
+
+  simit::Set VArg1;
+  auto field1 = VArg1.addField<int>("field");
+  simit::ElementRef q0 = VArg1.add();
+  simit::ElementRef q1 = VArg1.add();
+  simit::ElementRef q2 = VArg1.add();
+  field1(q0) = 1;
+  field1(q1) = 2;
+  field1(q2) = 3;
+  clone.bind("V", &VArg1);
+
+  function.init();
+  clone.init();
+  std::thread thread([&clone]() {clone.runSafe();});
+  function.runSafe();
+  thread.join();
+
+  SIMIT_ASSERT_FLOAT_EQ(-42, field0(p0));
+  SIMIT_ASSERT_FLOAT_EQ(-43, field0(p1));
+  SIMIT_ASSERT_FLOAT_EQ(-1, field1(q0));
+  SIMIT_ASSERT_FLOAT_EQ(-2, field1(q1));
+  SIMIT_ASSERT_FLOAT_EQ(-3, field1(q2));
+}
+
 TEST(Function, bindScalar) {
   Var a("a", Int);
   Var b("b", Int);
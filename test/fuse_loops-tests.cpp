@@ -0,0 +1,94 @@
+#include "simit-test.h"
+
+#include "graph.h"
+#include "ir.h"
+#include "program.h"
+#include "lower/fuse_loops.h"
+
+using namespace std;
+using namespace simit;
+using namespace simit::ir;
+
+/// Lowers `x[i] = i` and `y[j] = x[j]` in loops over `0:n`, with `between`
+/// placed between the two loops, and returns the number of loops after fusion.
+static int countFusedLoops(const Var& n, const Stmt& between) {
+  Type type = ir::TensorType::make(ir::ScalarType::Int, {IndexDomain(16)});
+  Var x("x", type);
+  Var y("y", type);
+  Var i("i", ir::Int);
+  Var j("j", ir::Int);
+
+  vector<Stmt> stmts;
+  stmts.push_back(ForRange::make(i, Literal::make(0), VarExpr::make(n),
+      Store::make(VarExpr::make(x), VarExpr::make(i), VarExpr::make(i))));
+  if (between.defined()) {
+    stmts.push_back(between);
+  }
+  stmts.push_back(ForRange::make(j, Literal::make(0), VarExpr::make(n),
+      Store::make(VarExpr::make(y), VarExpr::make(j),
+                  Load::make(VarExpr::make(x), VarExpr::make(j)))));
+  Func func = fuseLoops(Func("main", {n}, {x,y}, Block::make(stmts)));
+
+  int loops = 0;
+  match(func,
+    std::function<void(const ForRange*)>([&loops](const ForRange* op) {
+      ++loops;
+    })
+  );
+  return loops;
+}
+
+TEST(FuseLoops, fused) {
+  Var n("n", ir::Int);
+  ASSERT_EQ(1, countFusedLoops(n, Stmt()));
+}
+
+TEST(FuseLoops, hoisted) {
+  // A statement that does not touch the loops is moved above the first loop
+  Var n("n", ir::Int);
+  Var k("k", ir::Int);
+  ASSERT_EQ(1, countFusedLoops(n, AssignStmt::make(k, Literal::make(1))));
+}
+
+TEST(FuseLoops, bound_written) {
+  // Moving `n = n + 1` above the first loop would change its trip count
+  Var n("n", ir::Int);
+  Stmt increment = AssignStmt::make(n, Add::make(VarExpr::make(n),
+                                                 Literal::make(1)));
+  ASSERT_EQ(2, countFusedLoops(n, increment));
+}
+
+TEST(FuseLoops, step) {
+  Set points;
+  FieldRef<simit_float,3> v = points.addField<simit_float,3>("v");
+  FieldRef<simit_float> m = points.addField<simit_float>("m");
+
+  vector<ElementRef> pointRefs;
+  for (int i = 0; i < 100; ++i) {
+    pointRefs.push_back(points.add());
+    v.set(pointRefs.back(), {(simit_float)i, 1.0, 2.0});
+    m.set(pointRefs.back(), (simit_float)(i % 5 + 1));
+  }
+
+  // The map, the vector updates, the apply and the reduction read each
+  // other's results, and the division must not fuse with the reduction
+  simit_float s = 0.0;
+  vector<simit_float> b;
+  for (auto& p : pointRefs) {
+    simit_float mp = m.get(p);
+    b.push_back(mp*mp + mp);
+    s += b.back() * b.back();
+  }
+
+  Function func = loadFunction(TEST_FILE_NAME, "main");
+  if (!func.defined()) FAIL();
+  func.bind("points", &points);
+  func.runSafe();
+
+  for (size_t i = 0; i < pointRefs.size(); ++i) {
+    SIMIT_ASSERT_FLOAT_EQ(b[i] / s, m.get(pointRefs[i]));
+    SIMIT_ASSERT_FLOAT_EQ(0.5 * i, v.get(pointRefs[i])(0));
+    SIMIT_ASSERT_FLOAT_EQ(0.5, v.get(pointRefs[i])(1));
+    SIMIT_ASSERT_FLOAT_EQ(1.0, v.get(pointRefs[i])(2));
+  }
+}
@@ -61,6 +61,72 @@ TEST(Set, IncreaseCapacity) {
   ASSERT_EQ(count, 1029);
 }
 
+TEST(Set, Reserve) {
+  Set myset;
+  auto fld = myset.addField<double>("foo");
+  myset.reserve(5000);
+
+  void *data = myset.getFieldData("foo");
+  ASSERT_EQ(0u, (uintptr_t)data % 64);
+  for (int i=0; i<5000; i++) {
+    ElementRef item = myset.add();
+    ASSERT_EQ(0.0, (double)fld.get(item));
+    fld.set(item, i);
+  }
+  ASSERT_EQ(data, myset.getFieldData("foo"));
+
+  // Growing past the reservation keeps the values and zeroes the new elements
+  ElementRef item = myset.add();
+  ASSERT_EQ(0.0, (double)fld.get(item));
+  for (auto it : myset) {
+    if (it.getIdent() < 5000) {
+      ASSERT_EQ((double)it.getIdent(), (double)fld.get(it));
+    }
+  }
+}
+
+TEST(Set, AddN) {
+  Set myset;
+  auto fld = myset.addField<int>("foo");
+  myset.add();
+  ElementRef first = myset.addN(3000);
+  ASSERT_EQ(1, first.getIdent());
+  ASSERT_EQ(3001, myset.getSize());
+  for (auto it : myset) {
+    ASSERT_EQ(0, (int)fld.get(it));
+  }
+}
+
+TEST(Set, Remove) {
+  Set points;
+  FieldRef<simit_float,3> x =
+      points.addField<simit_float,3>("x", FieldLayout::tiled(4));
+  FieldRef<int,2> n = points.addField<int,2>("n");
+  FieldRef<simit_float> y = points.addField<simit_float>("y");
+  vector<ElementRef> elems;
+  for (int i = 0; i < 6; ++i) {
+    ElementRef p = points.add();
+    simit_float val = i;
+    x.set(p, {val, val + 10.0, val + 20.0});
+    n.set(p, {i, -i});
+    y.set(p, val);
+    elems.push_back(p);
+  }
+
+  // The last element, in another tile, takes the place of the removed one
+  points.remove(elems[1]);
+  ASSERT_EQ(5, points.getSize());
+  for (int i = 0; i < 5; ++i) {
+    const simit_float val = (i == 1) ? 5 : i;
+    SIMIT_ASSERT_FLOAT_EQ(val,        x(elems[i])(0));
+    SIMIT_ASSERT_FLOAT_EQ(val + 10.0, x(elems[i])(1));
+    SIMIT_ASSERT_FLOAT_EQ(val + 20.0, x(elems[i])(2));
+    ASSERT_EQ((int)val,  (int)n(elems[i])(0));
+    ASSERT_EQ(-(int)val, (int)n(elems[i])(1));
+    SIMIT_ASSERT_FLOAT_EQ(val, y(elems[i]));
+  }
+}
+
 TEST(Set, FieldAccessByName) {
   Set myset;
   
@@ -228,6 +294,80 @@ TEST(Field, boolean) {
   ASSERT_TRUE(b(p1));
 }
 
+TEST(Field, TiledLayout) {
+  Set points;
+  FieldRef<simit_float,3> x =
+      points.addField<simit_float,3>("x", FieldLayout::tiled(4));
+  FieldRef<simit_float> y =
+      points.addField<simit_float>("y", FieldLayout::tiled(4));
+  ASSERT_EQ(4, x.getLayout().getTile());
+
+  vector<ElementRef> elems;
+  for (int i = 0; i < 6; ++i) {
+    ElementRef p = points.add();
+    simit_float val = i;
+    x.set(p, {val, val + 10.0, val + 20.0});
+    y.set(p, val);
+    elems.push_back(p);
+  }
+
+  // Component c of element e is at ((e/4)*3 + c)*4 + e%4
+  simit_float *xData = static_cast<simit_float*>(x.getData());
+  SIMIT_ASSERT_FLOAT_EQ(3.0,  xData[3]);
+  SIMIT_ASSERT_FLOAT_EQ(10.0, xData[4]);
+  SIMIT_ASSERT_FLOAT_EQ(21.0, xData[9]);
+  SIMIT_ASSERT_FLOAT_EQ(4.0,  xData[12]);
+  SIMIT_ASSERT_FLOAT_EQ(25.0, xData[21]);
+
+  // Scalar fields are laid out the same way in every layout
+  simit_float *yData = static_cast<simit_float*>(y.getData());
+  SIMIT_ASSERT_FLOAT_EQ(5.0, yData[5]);
+
+  x(elems[5])(1) = 7.0;
+  SIMIT_ASSERT_FLOAT_EQ(7.0, xData[17]);
+
+  // Growing the set keeps the tensors where they were
+  points.reserve(4096);
+  TensorRef<simit_float,3> vec = x.get(elems[4]);
+  SIMIT_ASSERT_FLOAT_EQ(4.0,  vec(0));
+  SIMIT_ASSERT_FLOAT_EQ(14.0, vec(1));
+  SIMIT_ASSERT_FLOAT_EQ(24.0, vec(2));
+  SIMIT_ASSERT_FLOAT_EQ(7.0,  x(elems[5])(1));
+  SIMIT_ASSERT_FLOAT_EQ(5.0,  y(elems[5]));
+}
+
+TEST(Field, version) {
+  Set points;
+  FieldRef<simit_float,3> x = points.addField<simit_float,3>("x");
+  FieldRef<simit_float> y = points.addField<simit_float>("y");
+  ElementRef p = points.add();
+  Set::FieldData *xData = points.getFields()[points.getFieldIndex("x")];
+  Set::FieldData *yData = points.getFields()[points.getFieldIndex("y")];
+  unsigned long xVersion = xData->version;
+  unsigned long yVersion = yData->version;
+
+  // Reads leave the versions unchanged
+  TensorRef<simit_float,3> vec = x.get(p);
+  simit_float sum = x.get(p)(0) + x(p)(1) + vec(2) + y.get(p) + y(p);
+  SIMIT_ASSERT_FLOAT_EQ(0.0, sum);
+  ASSERT_EQ(xVersion, xData->version);
+  ASSERT_EQ(yVersion, yData->version);
+
+  // Writes change them
+  x(p)(1) = 2.0;
+  ASSERT_NE(xVersion, xData->version);
+  xVersion = xData->version;
+  vec(2) += 1.0;
+  ASSERT_NE(xVersion, xData->version);
+  xVersion = xData->version;
+  x.get(p) = {1.0, 2.0, 3.0};
+  ASSERT_NE(xVersion, xData->version);
+  y(p) = 4.0;
+  ASSERT_NE(yVersion, yData->version);
+  SIMIT_ASSERT_FLOAT_EQ(3.0, x(p)(2));
+  SIMIT_ASSERT_FLOAT_EQ(4.0, y(p));
+}
+
 TEST(EdgeSet, CreateAndGetEdge) {
   Set points;
 
@@ -254,6 +394,34 @@ TEST(EdgeSet, CreateAndGetEdge) {
   ASSERT_EQ(y.get(e), 54);
 }
 
+TEST(EdgeSet, AddEdges) {
+  Set points;
+  ElementRef p0 = points.addN(4);
+
+  Set edges(points, points);
+  FieldRef<int> y = edges.addField<int>("y");
+  ElementRef e0 = edges.add(p0, p0);
+  y.set(e0, 7);
+
+  vector<int> endpoints;
+  for (int i=0; i < 2000; ++i) {
+    endpoints.push_back(i % 4);
+    endpoints.push_back((i+1) % 4);
+  }
+  ElementRef first = edges.addEdges(endpoints.data(), 2000);
+  ASSERT_EQ(1, first.getIdent());
+  ASSERT_EQ(2001, edges.getSize());
+  ASSERT_EQ(7, (int)y.get(e0));
+  for (auto e : edges) {
+    if (e.getIdent() > 0) {
+      int i = e.getIdent() - 1;
+      ASSERT_EQ(i % 4, edges.getEndpoint(e, 0).getIdent());
+      ASSERT_EQ((i+1) % 4, edges.getEndpoint(e, 1).getIdent());
+      ASSERT_EQ(0, (int)y.get(e));
+    }
+  }
+}
+
 TEST(EdgeSet, EdgeIteratorTest) {
   Set points;
   
@@ -2,6 +2,7 @@
 
 #include "graph.h"
 #include "graph_indices.h"
+#include "thread_pool.h"
 
 using namespace std;
 using namespace simit;
@@ -77,3 +78,133 @@ TEST(NeighborIndex, triangles) {
   ASSERT_EQ(nIndex.getNumNeighbors(p1), 4);
   ASSERT_EQ(nIndex.getNeighbors(p1)[0], 0);
 }
+
+TEST(NeighborIndex, edgeLocations) {
+  Set points;
+  auto p0 = points.add();
+  auto p1 = points.add();
+  auto p2 = points.add();
+  auto p3 = points.add();
+
+  Set edges(points, points, points);
+  edges.add(p0, p1, p2);
+  edges.add(p3, p2, p1);
+
+  internal::NeighborIndex nIndex(edges);
+  ASSERT_EQ(2*3*3, nIndex.getEdgeLocationsSize());
+
+  const int *startIndex = nIndex.getStartIndex();
+  const int *neighbors = nIndex.getNeighborIndex();
+  const int *edgeLocations = nIndex.getEdgeLocations();
+  for (auto e : edges) {
+    for (int i = 0; i < 3; ++i) {
+      ElementRef ep0 = edges.getEndpoint(e, i);
+      for (int j = 0; j < 3; ++j) {
+        ElementRef ep1 = edges.getEndpoint(e, j);
+        int loc = edgeLocations[(e.getIdent()*3 + i)*3 + j];
+        ASSERT_LE(startIndex[ep0.getIdent()], loc);
+        ASSERT_GT(startIndex[ep0.getIdent()+1], loc);
+        ASSERT_EQ(ep1.getIdent(), neighbors[loc]);
+      }
+    }
+  }
+}
+
+TEST(NeighborIndex, parallel) {
+  Set points;
+  vector<ElementRef> p;
+  for (int i = 0; i < 1000; ++i) {
+    p.push_back(points.add());
+  }
+  Set edges(points, points, points);
+  for (int i = 0; i < 5000; ++i) {
+    edges.add(p[(i*7) % 1000], p[(i*13 + 1) % 1000], p[(i*31 + 2) % 1000]);
+  }
+
+  internal::NeighborIndex serial(edges);
+  internal::ThreadPool::getInstance().setNumThreads(4);
+  internal::NeighborIndex parallel(edges);
+  internal::ThreadPool::getInstance().setNumThreads(1);
+
+  ASSERT_EQ(serial.getSize(), parallel.getSize());
+  for (int i = 0; i <= 1000; ++i) {
+    ASSERT_EQ(serial.getStartIndex()[i], parallel.getStartIndex()[i]);
+  }
+  for (int i = 0; i < serial.getSize(); ++i) {
+    ASSERT_EQ(serial.getNeighborIndex()[i], parallel.getNeighborIndex()[i]);
+  }
+  for (int i = 0; i < serial.getEdgeLocationsSize(); ++i) {
+    ASSERT_EQ(serial.getEdgeLocations()[i], parallel.getEdgeLocations()[i]);
+  }
+}
+
+static void assertEqual(const NeighborIndex& expected,
+                        const NeighborIndex& actual, int numVertices) {
+  ASSERT_EQ(expected.getSize(), actual.getSize());
+  for (int i = 0; i <= numVertices; ++i) {
+    ASSERT_EQ(expected.getStartIndex()[i], actual.getStartIndex()[i]);
+  }
+  for (int i = 0; i < expected.getSize(); ++i) {
+    ASSERT_EQ(expected.getNeighborIndex()[i], actual.getNeighborIndex()[i]);
+  }
+  ASSERT_EQ(expected.getEdgeLocationsSize(), actual.getEdgeLocationsSize());
+  for (int i = 0; i < expected.getEdgeLocationsSize(); ++i) {
+    ASSERT_EQ(expected.getEdgeLocations()[i], actual.getEdgeLocations()[i]);
+  }
+}
+
+TEST(NeighborIndex, update) {
+  Set points;
+  vector<ElementRef> p;
+  for (int i = 0; i < 1000; ++i) {
+    p.push_back(points.add());
+  }
+  Set edges(points, points, points);
+  for (int i = 0; i < 5000; ++i) {
+    edges.add(p[(i*7) % 1000], p[(i*13 + 1) % 1000], p[(i*31 + 2) % 1000]);
+  }
+  const internal::NeighborIndex *index = edges.getNeighborIndex();
+
+  // Add vertices, and edges between old and new vertices
+  for (int i = 0; i < 10; ++i) {
+    p.push_back(points.add());
+  }
+  for (int i = 0; i < 20; ++i) {
+    edges.add(p[1000 + i%10], p[(i*17) % 1010], p[i]);
+  }
+  ASSERT_EQ(index, edges.getNeighborIndex());
+  assertEqual(internal::NeighborIndex(edges), *index, 1010);
+}
+
+TEST(NeighborIndex, add_remove) {
+  Set points;
+  vector<ElementRef> p;
+  for (int i = 0; i < 100; ++i) {
+    p.push_back(points.add());
+  }
+  Set edges(points, points);
+  for (int i = 0; i < 300; ++i) {
+    edges.add(p[(i*7) % 100], p[(i*13 + 1) % 100]);
+  }
+
+  for (int round = 0; round < 3; ++round) {
+    // Adding edges updates the index in place
+    const internal::NeighborIndex *index = edges.getNeighborIndex();
+    for (int i = 0; i < 10; ++i) {
+      edges.add(p[(round*11 + i) % 100], p[(round*29 + i*3) % 100]);
+    }
+    ASSERT_EQ(index, edges.getNeighborIndex());
+    assertEqual(internal::NeighborIndex(edges), *index, 100);
+
+    // Removing an edge moves the last edge into its place, and the index is
+    // rebuilt
+    vector<ElementRef> e;
+    for (ElementRef edge : edges) {
+      e.push_back(edge);
+    }
+    ElementRef last = edges.getEndpoint(e.back(), 0);
+    edges.remove(e[round*5]);
+    ASSERT_EQ(last, edges.getEndpoint(e[round*5], 0));
+    assertEqual(internal::NeighborIndex(edges), *edges.getNeighborIndex(), 100);
+  }
+}
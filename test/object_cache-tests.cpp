@@ -0,0 +1,231 @@
+#include "simit-test.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <dirent.h>
+
+#include "graph.h"
+#include "program.h"
+#include "init.h"
+#include "backend/llvm/llvm_backend.h"
+#include "backend/llvm/llvm_object_cache.h"
+
+using namespace std;
+using namespace simit;
+
+namespace {
+/// Caches compiled functions in a fresh temporary directory while in scope
+struct CacheDir {
+  string path;
+  string previous;
+
+  CacheDir() : previous(kCacheDir) {
+    char dir[] = "/tmp/simit-cache-XXXXXX";
+    path = mkdtemp(dir);
+    setCacheDir(path);
+  }
+  ~CacheDir() {
+    for (const string& file : files()) {
+      remove((path + "/" + file).c_str());
+    }
+    rmdir(path.c_str());
+    setCacheDir(previous);
+  }
+
+  vector<string> files() const {
+    vector<string> files;
+    DIR *dir = opendir(path.c_str());
+    if (dir != nullptr) {
+      while (struct dirent *entry = readdir(dir)) {
+        string name = entry->d_name;
+        if (name != "." && name != "..") {
+          files.push_back(name);
+        }
+      }
+      closedir(dir);
+    }
+    return files;
+  }
+};
+}
+
+/// Runs a program that sets the c of each point to `scale*b + offset`.
+static void runScale(Function func, simit_float scale=0.3,
+                     simit_float offset=1.7) {
+  Set points;
+  FieldRef<simit_float> b = points.addField<simit_float>("b");
+  FieldRef<simit_float> c = points.addField<simit_float>("c");
+
+  vector<ElementRef> pointRefs;
+  for (int i = 0; i < 10; ++i) {
+    pointRefs.push_back(points.add());
+    b.set(pointRefs.back(), (simit_float)i);
+  }
+
+  func.bind("points", &points);
+  func.runSafe();
+
+  for (int i = 0; i < 10; ++i) {
+    SIMIT_ASSERT_FLOAT_EQ(scale*i + offset, c.get(pointRefs[i]));
+  }
+}
+
+static const backend::LLVMObjectCache& getObjectCache() {
+  return backend::LLVMObjectCache::getInstance();
+}
+
+static string getLiteralFileName() {
+  return string(TEST_INPUT_DIR) + "/objectcache/literal.sim";
+}
+
+TEST(ObjectCache, literal) {
+  CacheDir cacheDir;
+  unsigned long hits = getObjectCache().getNumHits();
+  unsigned long misses = getObjectCache().getNumMisses();
+
+  // The first compilation generates code and stores it in the cache
+  Function func = loadFunction(TEST_FILE_NAME, "main");
+  if (!func.defined()) FAIL();
+  runScale(func);
+  ASSERT_EQ(1u, cacheDir.files().size());
+  ASSERT_EQ(hits, getObjectCache().getNumHits());
+  ASSERT_EQ(misses + 1, getObjectCache().getNumMisses());
+
+  // The second compilation loads the cached code
+  Function cachedFunc = loadFunction(TEST_FILE_NAME, "main");
+  if (!cachedFunc.defined()) FAIL();
+  runScale(cachedFunc);
+  ASSERT_EQ(1u, cacheDir.files().size());
+  ASSERT_EQ(hits + 1, getObjectCache().getNumHits());
+  ASSERT_EQ(misses + 1, getObjectCache().getNumMisses());
+}
+
+static string readFile(const string& path) {
+  ifstream file(path, ios::binary);
+  stringstream contents;
+  contents << file.rdbuf();
+  return contents.str();
+}
+
+TEST(ObjectCache, collision) {
+  CacheDir cacheDir;
+
+  // Cache the objects of two programs with different keys
+  Function otherFunc = loadFunction(TEST_FILE_NAME, "main");
+  if (!otherFunc.defined()) FAIL();
+  runScale(otherFunc, 0.5, 1.5);
+  ASSERT_EQ(1u, cacheDir.files().size());
+  string otherPath = cacheDir.path + "/" + cacheDir.files()[0];
+
+  Function func = loadFunction(getLiteralFileName(), "main");
+  if (!func.defined()) FAIL();
+  ASSERT_EQ(2u, cacheDir.files().size());
+  string path = cacheDir.path + "/" + cacheDir.files()[0];
+  if (path == otherPath) {
+    path = cacheDir.path + "/" + cacheDir.files()[1];
+  }
+  string object = readFile(path);
+
+  // Store the object of the other program under the name of the first, as if
+  // the keys of the programs had the same hash
+  {
+    ofstream file(path, ios::binary | ios::trunc);
+    file << readFile(otherPath);
+  }
+
+  // The other program's object is not loaded, and the program's own object
+  // replaces it
+  unsigned long hits = getObjectCache().getNumHits();
+  Function recompiledFunc = loadFunction(getLiteralFileName(), "main");
+  if (!recompiledFunc.defined()) FAIL();
+  runScale(recompiledFunc);
+  ASSERT_EQ(hits, getObjectCache().getNumHits());
+  ASSERT_EQ(object, readFile(path));
+}
+
+TEST(ObjectCache, release) {
+  CacheDir cacheDir;
+  backend::LLVMObjectCache& objectCache =
+      backend::LLVMObjectCache::getInstance();
+
+  // Two modules with the same code get the same identifier
+  string moduleIdentifier = objectCache.getModuleIdentifier("key");
+  ASSERT_EQ(moduleIdentifier, objectCache.getModuleIdentifier("key"));
+
+  // Storing the object of one of them keeps the key for the other
+  objectCache.addObject(moduleIdentifier, "object", 6);
+  ASSERT_TRUE(objectCache.hasObject(moduleIdentifier));
+
+  // Once both are done the key is forgotten, so the object is not verified
+  objectCache.releaseModuleIdentifier(moduleIdentifier);
+  ASSERT_FALSE(objectCache.hasObject(moduleIdentifier));
+  ASSERT_EQ(1u, cacheDir.files().size());
+}
+
+TEST(ObjectCache, loaded) {
+  CacheDir cacheDir;
+  backend::LLVMObjectCache& objectCache =
+      backend::LLVMObjectCache::getInstance();
+  string moduleIdentifier = objectCache.getModuleIdentifier("key");
+  ASSERT_FALSE(objectCache.loadObject(moduleIdentifier));
+  ASSERT_EQ(moduleIdentifier, objectCache.getModuleIdentifier("key"));
+  objectCache.addObject(moduleIdentifier, "object", 6);
+
+  // The object found when the module was compiled is kept for MCJIT, also
+  // when the object file is removed in the meantime
+  ASSERT_TRUE(objectCache.loadObject(moduleIdentifier));
+  remove((cacheDir.path + "/" + cacheDir.files()[0]).c_str());
+  ASSERT_FALSE(objectCache.hasObject(moduleIdentifier));
+  ASSERT_TRUE(objectCache.loadObject(moduleIdentifier));
+  objectCache.releaseModuleIdentifier(moduleIdentifier);
+}
+
+#ifdef __x86_64__
+TEST(ObjectCache, baseline_variant) {
+  // Creating a backend initializes LLVM's targets
+  backend::LLVMBackend backend;
+
+  // The tuning flags of a newer host do not stop it from running the
+  // baseline, which only uses extensions that every x86-64 CPU has
+  setTargetCPUs({"x86-64"});
+  string cpu = backend::getTargetCPU().name;
+  setTargetCPUs({});
+  ASSERT_EQ("x86-64", cpu);
+}
+
+TEST(ObjectCache, forced_variant) {
+  // Code is generated for a forced CPU also when the host lacks its features,
+  // as when compiling ahead of time for other machines
+  setForcedTargetCPU("skylake-avx512");
+  string cpu = backend::getTargetCPU().name;
+  setForcedTargetCPU("");
+  ASSERT_EQ("skylake-avx512", cpu);
+}
+
+TEST(ObjectCache, variants) {
+  CacheDir cacheDir;
+  setTargetCPUs({"x86-64", "generic"});
+
+  // Every x86-64 host runs the first variant, and the second variant is
+  // compiled into the cache
+  Function func = loadFunction(getLiteralFileName(), "main");
+  setTargetCPUs({});
+  if (!func.defined()) FAIL();
+  runScale(func);
+  ASSERT_EQ(2u, cacheDir.files().size());
+
+  // A host that runs the second variant loads it from the cache
+  unsigned long hits = getObjectCache().getNumHits();
+  setTargetCPUs({"generic"});
+  Function cachedFunc = loadFunction(getLiteralFileName(), "main");
+  setTargetCPUs({});
+  if (!cachedFunc.defined()) FAIL();
+  runScale(cachedFunc);
+  ASSERT_EQ(2u, cacheDir.files().size());
+  ASSERT_EQ(hits + 1, getObjectCache().getNumHits());
+}
+#endif
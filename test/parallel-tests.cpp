@@ -0,0 +1,129 @@
+#include "simit-test.h"
+
+#include "graph.h"
+#include "ir.h"
+#include "program.h"
+#include "init.h"
+
+using namespace std;
+using namespace simit;
+using namespace simit::ir;
+
+namespace {
+/// Compiles and runs functions on several threads while in scope
+struct Threads {
+  Threads(unsigned numThreads, string schedule="static", unsigned chunk=0) {
+    setNumThreads(numThreads, schedule, chunk);
+  }
+  ~Threads() {
+    setNumThreads(1);
+  }
+};
+}
+
+static void runGemvChain(Function func, int numPoints) {
+  Set points;
+  FieldRef<simit_float> b = points.addField<simit_float>("b");
+  FieldRef<simit_float> c = points.addField<simit_float>("c");
+  Set springs(points,points);
+  FieldRef<simit_float> a = springs.addField<simit_float>("a");
+
+  vector<ElementRef> pointRefs;
+  for (int i = 0; i < numPoints; ++i) {
+    pointRefs.push_back(points.add());
+    b.set(pointRefs.back(), (simit_float)(i % 4));
+  }
+  for (int i = 0; i < numPoints-1; ++i) {
+    ElementRef s = springs.add(pointRefs[i], pointRefs[i+1]);
+    a.set(s, (simit_float)(i % 3 + 1));
+  }
+
+  func.bind("points", &points);
+  func.bind("springs", &springs);
+  func.runSafe();
+
+  // c = A*b, where each spring adds a to all four entries of its block
+  for (int i = 0; i < numPoints; ++i) {
+    simit_float expected = 0.0;
+    if (i > 0) {
+      simit_float s = (simit_float)((i-1) % 3 + 1);
+      expected += s * (b.get(pointRefs[i-1]) + b.get(pointRefs[i]));
+    }
+    if (i < numPoints-1) {
+      simit_float s = (simit_float)(i % 3 + 1);
+      expected += s * (b.get(pointRefs[i]) + b.get(pointRefs[i+1]));
+    }
+    ASSERT_EQ(expected, c.get(pointRefs[i])) << "point " << i;
+  }
+}
+
+TEST(Parallel, gemv) {
+  Threads threads(4);
+  Function func = loadFunction(string(TEST_INPUT_DIR) + "/system/gemv.sim",
+                               "main");
+  if (!func.defined()) FAIL();
+  runGemvChain(func, 10000);
+}
+
+TEST(Parallel, gemv_dynamic) {
+  Threads threads(4, "dynamic", 16);
+  Function func = loadFunction(string(TEST_INPUT_DIR) + "/system/gemv.sim",
+                               "main");
+  if (!func.defined()) FAIL();
+  runGemvChain(func, 10000);
+}
+
+TEST(Parallel, vector_dot) {
+  Threads threads(4);
+  Set points;
+  FieldRef<simit_float> x = points.addField<simit_float>("x");
+  FieldRef<simit_float> z = points.addField<simit_float>("z");
+
+  simit_float expected = 0.0;
+  vector<ElementRef> pointRefs;
+  for (int i = 0; i < 10000; ++i) {
+    pointRefs.push_back(points.add());
+    x.set(pointRefs.back(), (simit_float)(i % 4));
+    expected += (i % 4) * (i % 4);
+  }
+
+  Function func = loadFunction(TEST_FILE_NAME, "main");
+  if (!func.defined()) FAIL();
+  func.bind("points", &points);
+  func.runSafe();
+
+  for (auto &p : pointRefs) {
+    ASSERT_EQ(expected, z.get(p));
+  }
+}
+
+TEST(Parallel, prefix_sum) {
+  // Each iteration reads the location the previous one writes, so the loop
+  // must stay serial even though its bounds are not known at compile time
+  Threads threads(4);
+  Type pointType = ElementType::make("Point", {ir::Field("x", ir::Float)});
+  Var points("points", SetType::make(pointType, {}));
+  Var i("i", ir::Int);
+  Expr x = FieldRead::make(points, "x");
+  Stmt prefixSum =
+      ForRange::make(i, 1, Length::make(IndexSet(points)),
+                     Store::make(x, i, Load::make(x, i) + Load::make(x, i-1)));
+
+  Environment env;
+  env.addExtern(points);
+  simit::Function func = getTestBackend()->compile(prefixSum, env);
+
+  Set pointsArg;
+  FieldRef<simit_float> xArg = pointsArg.addField<simit_float>("x");
+  vector<ElementRef> pointRefs;
+  for (int p = 0; p < 10000; ++p) {
+    pointRefs.push_back(pointsArg.add());
+    xArg.set(pointRefs.back(), 1.0);
+  }
+  func.bind("points", &pointsArg);
+  func.runSafe();
+
+  for (int p = 0; p < 10000; ++p) {
+    ASSERT_EQ(p + 1.0, xArg.get(pointRefs[p])) << "point " << p;
+  }
+}
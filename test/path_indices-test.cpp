@@ -5,10 +5,12 @@
 #include <map>
 #include <set>
 #include <iostream>
+#include <algorithm>
 
 #include "graph.h"
 #include "path_expressions.h"
 #include "path_indices.h"
+#include "thread_pool.h"
 
 using namespace simit;
 using namespace simit::pe;
@@ -306,6 +308,127 @@ TEST(PathIndex, ExistOr) {
                                  {3,4}, {3,4}}));
 }
 
+TEST(PathIndex, Parallel) {
+  // Build a vevev index over a mesh with enough vertices to be split into
+  // several blocks, with one and with four threads.
+  simit::Set V;
+  simit::Set E(V,V);
+  createBox(&V, &E, 40, 40, 2);
+
+  PathExpression ve = makeVE();
+  PathExpression ev = makeEV();
+  Var vi("vi");
+  Var e("e");
+  Var vj("vj");
+  Var vk("vk");
+  PathExpression vev = And::make({vi,vj}, {{QuantifiedVar::Exist,e}},
+                                 ve(vi, e), ev(e, vj));
+  PathExpression vevev = And::make({vi,vj}, {{QuantifiedVar::Exist,vk}},
+                                   vev(vi,vk), vev(vk, vj));
+
+  vector<vector<unsigned>> rows[2];
+  for (int i = 0; i < 2; ++i) {
+    internal::ThreadPool::getInstance().setNumThreads(i == 0 ? 1 : 4);
+    PathIndexBuilder builder;
+    builder.bind("V", &V);
+    builder.bind("E", &E);
+    PathIndex index = builder.buildSegmented(vevev, 0);
+    ASSERT_EQ((unsigned)V.getSize(), index.numElements());
+    for (unsigned elem : index) {
+      vector<unsigned> row;
+      for (unsigned nbr : index.neighbors(elem)) {
+        row.push_back(nbr);
+      }
+      ASSERT_TRUE(is_sorted(row.begin(), row.end()));
+      rows[i].push_back(row);
+    }
+  }
+  internal::ThreadPool::getInstance().setNumThreads(1);
+  ASSERT_EQ(rows[0], rows[1]);
+
+  // An interior vertex reaches the vertices within two edges: 13 in its own
+  // layer and 5 in the other layer
+  ASSERT_EQ(18u, rows[0][(20*40 + 20)*2].size());
+}
+
+TEST(PathIndex, Rebind) {
+  simit::Set V;
+  simit::Set E(V,V);
+  createBox(&V, &E, 5, 5, 1);
+
+  PathExpression ve = makeVE();
+  PathExpression ev = makeEV();
+  Var vi("vi");
+  Var e("e");
+  Var vj("vj");
+  PathExpression vev = And::make({vi,vj}, {{QuantifiedVar::Exist,e}},
+                                 ve(vi, e), ev(e, vj));
+
+  PathIndexBuilder builder;
+  builder.bind("V", &V);
+  builder.bind("E", &E);
+  PathIndex veIndex = builder.buildSegmented(ve, 0);
+  PathIndex vevIndex = builder.buildSegmented(vev, 0);
+
+  // Binding unchanged sets keeps the memoized indices
+  builder.bind("V", &V);
+  builder.bind("E", &E);
+  ASSERT_EQ(vevIndex, builder.buildSegmented(vev, 0));
+
+  // Adding elements gives new indices, that match indices built from scratch
+  ElementRef v0 = *V.begin();
+  ElementRef v = V.add();
+  E.add(v0, v);
+  E.add(v, v);
+  builder.bind("V", &V);
+  builder.bind("E", &E);
+  PathIndex veIndex2 = builder.buildSegmented(ve, 0);
+  PathIndex vevIndex2 = builder.buildSegmented(vev, 0);
+  ASSERT_NE(veIndex, veIndex2);
+  ASSERT_NE(vevIndex, vevIndex2);
+
+  PathIndexBuilder fresh;
+  fresh.bind("V", &V);
+  fresh.bind("E", &E);
+  for (auto& indices : {make_pair(veIndex2, fresh.buildSegmented(ve, 0)),
+                        make_pair(vevIndex2, fresh.buildSegmented(vev, 0))}) {
+    ASSERT_EQ(indices.second.numElements(), indices.first.numElements());
+    for (unsigned elem : indices.second) {
+      vector<unsigned> expected, actual;
+      for (unsigned nbr : indices.second.neighbors(elem)) {
+        expected.push_back(nbr);
+      }
+      for (unsigned nbr : indices.first.neighbors(elem)) {
+        actual.push_back(nbr);
+      }
+      ASSERT_EQ(expected, actual);
+    }
+  }
+
+  // Removing elements rebuilds the indices, which match indices built from
+  // scratch (the last edge, a self loop, takes the place of the removed edge)
+  E.remove(*E.begin());
+  builder.bind("E", &E);
+  PathIndexBuilder rebuilt;
+  rebuilt.bind("V", &V);
+  rebuilt.bind("E", &E);
+  PathIndex veIndex3 = builder.buildSegmented(ve, 0);
+  PathIndex expected = rebuilt.buildSegmented(ve, 0);
+  ASSERT_EQ(expected.numElements(), veIndex3.numElements());
+  ASSERT_EQ(expected.numNeighbors(), veIndex3.numNeighbors());
+  ASSERT_EQ(E.getSize()*2u - 1, veIndex3.numNeighbors());
+  for (unsigned elem : expected) {
+    vector<unsigned> expectedNbrs, actualNbrs;
+    for (unsigned nbr : expected.neighbors(elem)) {
+      expectedNbrs.push_back(nbr);
+    }
+    for (unsigned nbr : veIndex3.neighbors(elem)) {
+      actualNbrs.push_back(nbr);
+    }
+    ASSERT_EQ(expectedNbrs, actualNbrs);
+  }
+}
+
 TEST(PathIndex, Alias) {
   simit::Set V;
   simit::Set E(V,V);
@@ -0,0 +1,86 @@
+#include "simit-test.h"
+
+#include <sstream>
+
+#include "graph.h"
+#include "program.h"
+#include "profile.h"
+
+using namespace std;
+using namespace simit;
+
+TEST(Profile, loops) {
+  Set points;
+  FieldRef<simit_float> b = points.addField<simit_float>("b");
+  FieldRef<simit_float> c = points.addField<simit_float>("c");
+  for (int i = 0; i < 100; ++i) {
+    ElementRef p = points.add();
+    b.set(p, (simit_float)i);
+  }
+
+  Function func = loadFunctionWithTimers(TEST_FILE_NAME, "main");
+  if (!func.defined()) FAIL();
+  func.bind("points", &points);
+  for (int i = 0; i < 3; ++i) {
+    func.runSafe();
+  }
+
+  Profile profile = func.getProfile();
+  const KernelProfile* loop = nullptr;
+  for (auto& kernel : profile.getKernels()) {
+    if (kernel.kind == KernelProfile::Loop) {
+      loop = &kernel;
+    }
+  }
+  ASSERT_NE(nullptr, loop);
+  ASSERT_EQ(3u, loop->calls);
+  ASSERT_EQ(300u, loop->iterations);
+  ASSERT_GT(loop->bytes, 0.0);
+  ASSERT_GT(loop->flops, 0.0);
+  ASSERT_GE(profile.getTotalTime(), loop->time);
+
+  func.clearProfile();
+  for (auto& kernel : func.getProfile().getKernels()) {
+    ASSERT_EQ(0u, kernel.calls);
+    ASSERT_EQ(0.0, kernel.time);
+  }
+
+  ASSERT_EQ(0u, Function().getProfile().getKernels().size());
+}
+
+TEST(Profile, clone) {
+  Function func = loadFunctionWithTimers(string(TEST_INPUT_DIR) +
+                                         "/profile/loops.sim", "main");
+  if (!func.defined()) FAIL();
+  ASSERT_THROW(func.clone(), SimitException);
+}
+
+TEST(Profile, export) {
+  KernelProfile kernel;
+  kernel.name = "for p in \"points\":";
+  kernel.kind = KernelProfile::Loop;
+  kernel.calls = 2;
+  kernel.iterations = 200;
+  kernel.time = 50.0;
+  kernel.bytes = 4800.0;
+  kernel.flops = 400.0;
+  kernel.instructions = -1;
+  kernel.cacheMisses = -1;
+  Profile profile({kernel, kernel});
+  ASSERT_DOUBLE_EQ(100.0, profile.getTotalTime());
+  ASSERT_DOUBLE_EQ(4800.0/50e-6, kernel.getBandwidth());
+  ASSERT_DOUBLE_EQ(400.0/4800.0, kernel.getArithmeticIntensity());
+
+  stringstream json;
+  profile.writeJSON(json);
+  ASSERT_NE(string::npos,
+            json.str().find("\"name\": \"for p in \\\"points\\\":\""));
+  ASSERT_NE(string::npos, json.str().find("\"kind\": \"loop\""));
+  ASSERT_NE(string::npos, json.str().find("\"iterations\": 200"));
+  ASSERT_EQ(string::npos, json.str().find("instructions"));
+
+  stringstream trace;
+  profile.writeChromeTrace(trace);
+  ASSERT_NE(string::npos, trace.str().find("\"traceEvents\""));
+  ASSERT_NE(string::npos, trace.str().find("\"ts\": 50"));
+}
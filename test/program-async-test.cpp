@@ -0,0 +1,82 @@
+#include "simit-test.h"
+
+#include <future>
+
+#include "graph.h"
+#include "init.h"
+#include "program.h"
+
+using namespace std;
+using namespace simit;
+
+TEST(Program, compileAsync) {
+  Program program;
+  ASSERT_EQ(0, program.loadFile(TEST_FILE_NAME));
+
+  // Both functions share the IR of dist_a while they compile
+  std::future<Function> multiplyFuture = program.compileAsync("multiply");
+  std::future<Function> scaleFuture = program.compileAsync("scale");
+  Function multiply = multiplyFuture.get();
+  Function scale = scaleFuture.get();
+  ASSERT_TRUE(multiply.defined());
+  ASSERT_TRUE(scale.defined());
+
+  Set points;
+  FieldRef<simit_float> b = points.addField<simit_float>("b");
+  FieldRef<simit_float> c = points.addField<simit_float>("c");
+
+  ElementRef p0 = points.add();
+  ElementRef p1 = points.add();
+  ElementRef p2 = points.add();
+
+  b.set(p0, 1.0);
+  b.set(p1, 2.0);
+  b.set(p2, 3.0);
+
+  Set springs(points,points);
+  FieldRef<simit_float> a = springs.addField<simit_float>("a");
+
+  ElementRef s0 = springs.add(p0,p1);
+  ElementRef s1 = springs.add(p1,p2);
+
+  a.set(s0, 1.0);
+  a.set(s1, 2.0);
+
+  multiply.bind("points", &points);
+  multiply.bind("springs", &springs);
+  multiply.runSafe();
+
+  SIMIT_ASSERT_FLOAT_EQ(3.0,  c.get(p0));
+  SIMIT_ASSERT_FLOAT_EQ(13.0, c.get(p1));
+  SIMIT_ASSERT_FLOAT_EQ(10.0, c.get(p2));
+
+  scale.bind("points", &points);
+  scale.bind("springs", &springs);
+  scale.runSafe();
+
+  SIMIT_ASSERT_FLOAT_EQ(6.0,  c.get(p0));
+  SIMIT_ASSERT_FLOAT_EQ(26.0, c.get(p1));
+  SIMIT_ASSERT_FLOAT_EQ(20.0, c.get(p2));
+}
+
+#ifndef SIMIT_DEBUG
+TEST(Program, compileAsync_options) {
+  Program program;
+  ASSERT_EQ(0, program.loadFile(string(TEST_INPUT_DIR) +
+                                "/program/compileAsync.sim"));
+
+  // Options reset right after compileAsync returns still apply to the
+  // compilation (debug builds are not optimized, so they print no report)
+  string cacheDir = kCacheDir;
+  setCacheDir("");
+  setVectorizationReport(true);
+  testing::internal::CaptureStderr();
+  std::future<Function> multiplyFuture = program.compileAsync("multiply");
+  setVectorizationReport(false);
+  setCacheDir(cacheDir);
+  Function multiply = multiplyFuture.get();
+  string report = testing::internal::GetCapturedStderr();
+  ASSERT_TRUE(multiply.defined());
+  ASSERT_NE(string::npos, report.find("Vectorization report of"));
+}
+#endif
@@ -9,6 +9,8 @@
 #include "init.h"
 #include "ir.h"
 #include "util/util.h"
+#include "frontend/frontend.h"
+#include "program_context.h"
 
 #include "program.h"
 #include "backend/backend.h"
@@ -172,3 +174,15 @@ simit::Function loadFunctionWithTimers(std::string fileName, std::string funcNam
   return f;
 }
 
+simit::ir::Func loadIRFunction(std::string fileName, std::string funcName) {
+  simit::internal::ProgramContext ctx;
+  simit::internal::Frontend frontend;
+  std::vector<simit::ParseError> errors;
+  if (frontend.parseFile(fileName, &ctx, &errors)) {
+    for (auto& error : errors) {
+      std::cerr << error.toString() << std::endl;
+    }
+    return simit::ir::Func();
+  }
+  return ctx.getFunction(funcName);
+}
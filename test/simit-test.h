@@ -13,6 +13,9 @@
 namespace simit {
 namespace backend {
 class Backend;
+}
+namespace ir {
+class Func;
 }}
 
 #ifdef F32
@@ -53,6 +56,11 @@ simit::Function loadFunction(std::string fileName, std::string funcName="main");
 simit::Function loadFunctionWithTimers(std::string fileName, std::string 
     funcName="main");
 
+/// Parses `fileName` and returns the IR of `funcName` before it is lowered, or
+/// an undefined function if the file does not parse.
+simit::ir::Func loadIRFunction(std::string fileName,
+                               std::string funcName="main");
+
 #define Vec3f TensorType::make(ScalarType::Float, {IndexDomain(3)})
 
 #define Mat3f TensorType::make(ScalarType::Float, \
@@ -0,0 +1,318 @@
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "solver.h"
+#include "thread_pool.h"
+
+using namespace std;
+using namespace simit::internal;
+
+namespace {
+/// A block tridiagonal BCSR matrix with 2x2 blocks. The diagonal blocks are
+/// [4 1; 1 4] and the off-diagonal blocks -I, so the matrix is symmetric
+/// positive definite.
+struct BlockLaplacian {
+  vector<int> rowPtr;
+  vector<int> colIdx;
+  vector<double> vals;
+  BlockMatrix<double> matrix;
+
+  BlockLaplacian(int rows) {
+    rowPtr.push_back(0);
+    for (int i = 0; i < rows; ++i) {
+      for (int j = max(i-1, 0); j <= min(i+1, rows-1); ++j) {
+        colIdx.push_back(j);
+        if (i == j) {
+          vals.insert(vals.end(), {4.0, 1.0, 1.0, 4.0});
+        }
+        else {
+          vals.insert(vals.end(), {-1.0, 0.0, 0.0, -1.0});
+        }
+      }
+      rowPtr.push_back(colIdx.size());
+    }
+    matrix = {rows, rows, rowPtr.data(), colIdx.data(), 2, 2, vals.data()};
+  }
+};
+
+/// The BCSR matrix of a size x size grid with 2x2 blocks, where the diagonal
+/// blocks are [d 1; 1 d] and the blocks of neighboring grid points -I. Its
+/// factors fill in.
+struct GridLaplacian {
+  vector<int> rowPtr;
+  vector<int> colIdx;
+  vector<double> vals;
+  BlockMatrix<double> matrix;
+
+  GridLaplacian(int size, double d) {
+    rowPtr.push_back(0);
+    for (int i = 0; i < size*size; ++i) {
+      const int x = i % size;
+      const int y = i / size;
+      vector<int> cols = {i};
+      if (y > 0)      cols.push_back(i-size);
+      if (x > 0)      cols.push_back(i-1);
+      if (x < size-1) cols.push_back(i+1);
+      if (y < size-1) cols.push_back(i+size);
+      sort(cols.begin(), cols.end());
+      for (int j : cols) {
+        colIdx.push_back(j);
+        if (i == j) {
+          vals.insert(vals.end(), {d, 1.0, 1.0, d});
+        }
+        else {
+          vals.insert(vals.end(), {-1.0, 0.0, 0.0, -1.0});
+        }
+      }
+      rowPtr.push_back(colIdx.size());
+    }
+    matrix = {size*size, size*size, rowPtr.data(), colIdx.data(), 2, 2,
+              vals.data()};
+  }
+};
+}
+
+static void checkSolve(Preconditioner preconditioner) {
+  BlockLaplacian A(500);
+  const int n = 1000;
+
+  vector<double> expected(n);
+  for (int i = 0; i < n; ++i) {
+    expected[i] = sin(i * 0.01) + 1.0;
+  }
+  vector<double> b(n);
+  blockSpMV(A.matrix, expected.data(), b.data());
+
+  SolverOptions options;
+  options.preconditioner = preconditioner;
+  options.tolerance = 1e-12;
+  vector<double> x(n);
+  SolverResult result = pcgSolve(A.matrix, b.data(), x.data(), options);
+  ASSERT_TRUE(result.converged);
+  for (int i = 0; i < n; ++i) {
+    ASSERT_NEAR(expected[i], x[i], 1e-8) << "component " << i;
+  }
+}
+
+TEST(Solver, spmv) {
+  BlockLaplacian A(3);
+  vector<double> x = {1.0, 2.0, 3.0, 4.0, 5.0, 6.0};
+  vector<double> y(6);
+  blockSpMV(A.matrix, x.data(), y.data());
+  vector<double> expected = {3.0, 5.0, 10.0, 11.0, 23.0, 25.0};
+  for (int i = 0; i < 6; ++i) {
+    ASSERT_DOUBLE_EQ(expected[i], y[i]);
+  }
+}
+
+TEST(Solver, pcg) {
+  checkSolve(None);
+  checkSolve(Jacobi);
+  checkSolve(BlockJacobi);
+  checkSolve(IncompleteCholesky);
+  checkSolve(AlgebraicMultigrid);
+}
+
+TEST(Solver, pcg_parallel) {
+  ThreadPool::getInstance().setNumThreads(4);
+  checkSolve(Jacobi);
+  checkSolve(BlockJacobi);
+  ThreadPool::getInstance().setNumThreads(1);
+}
+
+TEST(Solver, multigrid) {
+  GridLaplacian grid(40, 5.0);
+  AMGHierarchy<double> amg(grid.matrix);
+  ASSERT_GT(amg.getNumLevels(), 1);
+  for (int l = 1; l < amg.getNumLevels(); ++l) {
+    ASSERT_LT(amg.getNumRows(l), amg.getNumRows(l-1));
+  }
+
+  const int n = 1600 * 2;
+  vector<double> b(n);
+  for (int i = 0; i < n; ++i) {
+    b[i] = cos(i * 0.01);
+  }
+  SolverOptions options;
+  options.tolerance = 1e-8;
+  vector<double> x(n);
+  SolverResult jacobi = pcgSolve(grid.matrix, b.data(), x.data(), options);
+  ASSERT_TRUE(jacobi.converged);
+
+  // Solve twice, where the second solve refreshes the cached hierarchy
+  options.preconditioner = AlgebraicMultigrid;
+  for (int solve = 0; solve < 2; ++solve) {
+    SolverResult result = pcgSolve(grid.matrix, b.data(), x.data(), options);
+    ASSERT_TRUE(result.converged);
+    ASSERT_LT(result.iterations, jacobi.iterations / 2);
+
+    vector<double> y(n);
+    blockSpMV(grid.matrix, x.data(), y.data());
+    for (int i = 0; i < n; ++i) {
+      ASSERT_NEAR(b[i], y[i], 1e-6) << "component " << i;
+    }
+    for (double& val : grid.vals) {
+      val *= 2.0;
+    }
+    for (double& bi : b) {
+      bi *= 2.0;
+    }
+  }
+}
+
+TEST(Solver, max_iterations) {
+  BlockLaplacian A(100);
+  vector<double> b(200, 1.0);
+  vector<double> x(200);
+  SolverOptions options;
+  options.maxIterations = 3;
+  SolverResult result = pcgSolve(A.matrix, b.data(), x.data(), options);
+  ASSERT_FALSE(result.converged);
+  ASSERT_EQ(3, result.iterations);
+}
+
+TEST(Solver, last_result) {
+  BlockLaplacian A(100);
+  vector<double> b(200, 1.0);
+  vector<double> x(200);
+  SolverOptions options;
+  options.maxIterations = 3;
+  reportSolverResult(blockSolve(A.matrix, b.data(), x.data(), options));
+  ASSERT_FALSE(getLastSolverResult().converged);
+  ASSERT_EQ(3, getLastSolverResult().iterations);
+
+  options.maxIterations = 0;
+  reportSolverResult(blockSolve(A.matrix, b.data(), x.data(), options));
+  ASSERT_TRUE(getLastSolverResult().converged);
+}
+
+static void checkDirectSolve(const BlockMatrix<double>& A) {
+  const int n = A.rows * A.blockRows;
+  vector<double> expected(n);
+  for (int i = 0; i < n; ++i) {
+    expected[i] = sin(i * 0.01) + 1.0;
+  }
+  vector<double> b(n);
+  blockSpMV(A, expected.data(), b.data());
+
+  SolverOptions options;
+  options.method = Direct;
+  vector<double> x(n);
+  SolverResult result = blockSolve(A, b.data(), x.data(), options);
+  ASSERT_TRUE(result.converged);
+  for (int i = 0; i < n; ++i) {
+    ASSERT_NEAR(expected[i], x[i], 1e-10) << "component " << i;
+  }
+}
+
+TEST(Solver, direct) {
+  BlockLaplacian tridiagonal(500);
+  checkDirectSolve(tridiagonal.matrix);
+
+  // Refactorize with the cached symbolic factorization
+  GridLaplacian grid(20, 5.0);
+  checkDirectSolve(grid.matrix);
+  for (double& val : grid.vals) {
+    val *= 2.0;
+  }
+  checkDirectSolve(grid.matrix);
+
+  // The index arrays now hold a different pattern
+  GridLaplacian smaller(10, 5.0);
+  grid.rowPtr = smaller.rowPtr;
+  grid.colIdx = smaller.colIdx;
+  grid.vals = smaller.vals;
+  grid.matrix.rows = grid.matrix.cols = 100;
+  checkDirectSolve(grid.matrix);
+}
+
+TEST(Solver, direct_fallback) {
+  BlockLaplacian A(10);
+  vector<double> b(20, 1.0);
+  vector<double> x(20);
+  SolverOptions options;
+  options.method = Direct;
+  ASSERT_FALSE(blockSolve(A.matrix, b.data(), x.data(), options).fellBack);
+
+  // The zero diagonal breaks down the factorization without pivoting
+  vector<int> rowPtr = {0, 2, 4};
+  vector<int> colIdx = {0, 1, 0, 1};
+  vector<double> vals = {0.0, 1.0, 1.0, 0.0};
+  BlockMatrix<double> indefinite = {2, 2, rowPtr.data(), colIdx.data(), 1, 1,
+                                    vals.data()};
+  SolverResult result = blockSolve(indefinite, b.data(), x.data(), options);
+  ASSERT_TRUE(result.fellBack);
+}
+
+TEST(Solver, direct_symbolic) {
+  GridLaplacian grid(20, 5.0);
+  BlockLDLT<double> ldlt(grid.matrix);
+  ASSERT_TRUE(ldlt.hasPattern(grid.matrix));
+
+  // The ordering keeps the fill well below that of the natural ordering,
+  // which fills in the band of 20 blocks below the diagonal
+  ASSERT_GT(ldlt.getNumFactorBlocks(), 760);
+  ASSERT_LT(ldlt.getNumFactorBlocks(), 400*20/2);
+
+  GridLaplacian other(20, 5.0);
+  other.colIdx[1] = 0;
+  ASSERT_FALSE(ldlt.hasPattern(other.matrix));
+}
+
+TEST(Solver, symmetric) {
+  // Make the off-diagonal blocks non-symmetric, so that the blocks below the
+  // diagonal are the transposes of those above it
+  GridLaplacian grid(10, 8.0);
+  for (int i = 0; i < grid.matrix.rows; ++i) {
+    for (int k = grid.rowPtr[i]; k < grid.rowPtr[i+1]; ++k) {
+      if (grid.colIdx[k] != i) {
+        grid.vals[k*4 + (grid.colIdx[k] > i ? 1 : 2)] = 0.5;
+      }
+    }
+  }
+
+  // The upper block-triangle
+  vector<int> rowPtr = {0};
+  vector<int> colIdx;
+  vector<double> vals;
+  for (int i = 0; i < grid.matrix.rows; ++i) {
+    for (int k = grid.rowPtr[i]; k < grid.rowPtr[i+1]; ++k) {
+      if (grid.colIdx[k] >= i) {
+        colIdx.push_back(grid.colIdx[k]);
+        vals.insert(vals.end(), &grid.vals[k*4], &grid.vals[(k+1)*4]);
+      }
+    }
+    rowPtr.push_back(colIdx.size());
+  }
+  BlockMatrix<double> upper = {grid.matrix.rows, grid.matrix.cols,
+                               rowPtr.data(), colIdx.data(), 2, 2,
+                               vals.data()};
+
+  const int n = grid.matrix.rows * 2;
+  vector<double> expected(n);
+  for (int i = 0; i < n; ++i) {
+    expected[i] = sin(i * 0.01) + 1.0;
+  }
+  vector<double> b(n);
+  blockSpMV(grid.matrix, expected.data(), b.data());
+
+  // Solve twice with each method, where the second solves reuse the cached
+  // expansion of the upper block-triangle
+  SolverOptions options;
+  options.tolerance = 1e-12;
+  for (SolverMethod method : {ConjugateGradient, Direct}) {
+    options.method = method;
+    for (int solve = 0; solve < 2; ++solve) {
+      vector<double> x(n);
+      SolverResult result = symmetricBlockSolve(upper, b.data(), x.data(),
+                                                options);
+      ASSERT_TRUE(result.converged);
+      for (int i = 0; i < n; ++i) {
+        ASSERT_NEAR(expected[i], x[i], 1e-8) << "component " << i;
+      }
+    }
+  }
+}
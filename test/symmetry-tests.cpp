@@ -0,0 +1,49 @@
+#include "simit-test.h"
+
+#include <set>
+
+#include "ir.h"
+#include "symmetry.h"
+#include "flatten.h"
+#include "temps.h"
+
+using namespace std;
+using namespace simit;
+using namespace simit::ir;
+
+/// Returns the names of the matrices of `main` that may be stored as their
+/// upper block-triangle, analysed at the point in lowering where it happens.
+static set<string> findSymmetricMatrices(string fileName) {
+  Func func = loadIRFunction(fileName, "main");
+  iassert(func.defined()) << "could not load " << fileName;
+  func = flattenIndexExpressions(func);
+  func = insertTemporaries(func);
+
+  set<string> names;
+  for (const Var& matrix : ir::findSymmetricMatrices(func)) {
+    names.insert(matrix.getName());
+  }
+  return names;
+}
+
+TEST(Symmetry, spring) {
+  ASSERT_EQ(set<string>({"K"}), findSymmetricMatrices(TEST_FILE_NAME));
+}
+
+TEST(Symmetry, asymmetric) {
+  // A(p(0),p(1)) = s.a is not paired with A(p(1),p(0)) = s.b
+  ASSERT_TRUE(findSymmetricMatrices(TEST_FILE_NAME).empty());
+}
+
+TEST(Symmetry, loop) {
+  // A(p(0),p(0)) is written inside a loop
+  ASSERT_TRUE(findSymmetricMatrices(TEST_FILE_NAME).empty());
+}
+
+TEST(Symmetry, transposed) {
+  ASSERT_TRUE(findSymmetricMatrices(TEST_FILE_NAME).empty());
+}
+
+TEST(Symmetry, product) {
+  ASSERT_TRUE(findSymmetricMatrices(TEST_FILE_NAME).empty());
+}
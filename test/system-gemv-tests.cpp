@@ -4,56 +4,126 @@
 #include "tensor.h"
 #include "program.h"
 #include "error.h"
+#include "init.h"
+#include "profile.h"
+#include "ir.h"
+#include "tensor_index.h"
+#include "lower/lower.h"
 
 using namespace std;
 using namespace simit;
 
-TEST(System, gemv) {
-  // Points
+namespace {
+/// The points and springs of the gemv tests: three points with b = (1,2,3)
+/// and a tainted c, and two springs with a = (1,2) between them. The second
+/// spring goes from p1 to p2, or from p2 to p1 if `descending`.
+struct GemvSystem {
   Set points;
-  FieldRef<simit_float> b = points.addField<simit_float>("b");
-  FieldRef<simit_float> c = points.addField<simit_float>("c");
-
-  ElementRef p0 = points.add();
-  ElementRef p1 = points.add();
-  ElementRef p2 = points.add();
-
-  b.set(p0, 1.0);
-  b.set(p1, 2.0);
-  b.set(p2, 3.0);
-
-  // Taint c
-  c.set(p0, 42.0);
-  c.set(p2, 42.0);
-
-  // Springs
-  Set springs(points,points);
-  FieldRef<simit_float> a = springs.addField<simit_float>("a");
-
-  ElementRef s0 = springs.add(p0,p1);
-  ElementRef s1 = springs.add(p1,p2);
+  FieldRef<simit_float> b;
+  FieldRef<simit_float> c;
+  ElementRef p0, p1, p2;
+
+  Set springs;
+  FieldRef<simit_float> a;
+  ElementRef s0, s1;
+
+  explicit GemvSystem(bool descending=false)
+      : b(points.addField<simit_float>("b")),
+        c(points.addField<simit_float>("c")),
+        p0(points.add()), p1(points.add()), p2(points.add()),
+        springs(points,points),
+        a(springs.addField<simit_float>("a")),
+        s0(springs.add(p0,p1)),
+        s1(descending ? springs.add(p2,p1) : springs.add(p1,p2)) {
+    b.set(p0, 1.0);
+    b.set(p1, 2.0);
+    b.set(p2, 3.0);
+
+    c.set(p0, 42.0);
+    c.set(p2, 42.0);
+
+    a.set(s0, 1.0);
+    a.set(s1, 2.0);
+  }
+
+  void bind(Function& func) {
+    func.bind("points", &points);
+    func.bind("springs", &springs);
+  }
+};
+
+/// The system of the blocked gemv tests, with 2-vectors b and c and 2x2
+/// blocks a.
+struct BlockedGemvSystem {
+  Set points;
+  FieldRef<simit_float,2> b;
+  FieldRef<simit_float,2> c;
+  ElementRef p0, p1, p2;
+
+  Set springs;
+  FieldRef<simit_float,2,2> a;
+  ElementRef s0, s1;
+
+  BlockedGemvSystem()
+      : b(points.addField<simit_float,2>("b")),
+        c(points.addField<simit_float,2>("c")),
+        p0(points.add()), p1(points.add()), p2(points.add()),
+        springs(points,points),
+        a(springs.addField<simit_float,2,2>("a")),
+        s0(springs.add(p0,p1)), s1(springs.add(p1,p2)) {
+    b.set(p0, {1.0, 2.0});
+    b.set(p1, {3.0, 4.0});
+    b.set(p2, {5.0, 6.0});
+
+    c.set(p0, {42.0, 42.0});
+    c.set(p2, {42.0, 42.0});
+
+    a.set(s0, {1.0, 2.0, 3.0, 4.0});
+    a.set(s1, {5.0, 6.0, 7.0, 8.0});
+  }
+
+  void bind(Function& func) {
+    func.bind("points", &points);
+    func.bind("springs", &springs);
+  }
+
+  /// Check that c = A*b
+  void assertProduct() {
+    // TODO: add support for comparing a tensorref like so: b0 == {1.0, 2.0}
+    TensorRef<simit_float,2> c0 = c.get(p0);
+    ASSERT_EQ(16.0, c0(0));
+    ASSERT_EQ(36.0, c0(1));
+
+    TensorRef<simit_float,2> c1 = c.get(p1);
+    ASSERT_EQ(116.0, c1(0));
+    ASSERT_EQ(172.0, c1(1));
+
+    TensorRef<simit_float,2> c2 = c.get(p2);
+    ASSERT_EQ(100.0, c2(0));
+    ASSERT_EQ(136.0, c2(1));
+  }
+};
+}
 
-  a.set(s0, 1.0);
-  a.set(s1, 2.0);
+TEST(System, gemv) {
+  GemvSystem system;
 
   // Compile program and bind arguments
   Function func = loadFunction(TEST_FILE_NAME, "main");
   if (!func.defined()) FAIL();
-
-  func.bind("points", &points);
-  func.bind("springs", &springs);
+  system.bind(func);
 
   func.runSafe();
 
   // Check that inputs are preserved
-  ASSERT_EQ(1.0, b.get(p0));
-  ASSERT_EQ(2.0, b.get(p1));
-  ASSERT_EQ(3.0, b.get(p2));
+  ASSERT_EQ(1.0, system.b.get(system.p0));
+  ASSERT_EQ(2.0, system.b.get(system.p1));
+  ASSERT_EQ(3.0, system.b.get(system.p2));
 
   // Check that outputs are correct
-  ASSERT_EQ(3.0, c.get(p0));
-  ASSERT_EQ(13.0, c.get(p1));
-  ASSERT_EQ(10.0, c.get(p2));
+  ASSERT_EQ(3.0, system.c.get(system.p0));
+  ASSERT_EQ(13.0, system.c.get(system.p1));
+  ASSERT_EQ(10.0, system.c.get(system.p2));
 }
 
 TEST(System, gemv_add) {
@@ -569,55 +639,186 @@ TEST(System, gemv_inplace) {
 }
 
 TEST(System, gemv_blocked) {
-  // Points
-  Set points;
-  FieldRef<simit_float,2> b = points.addField<simit_float,2>("b");
-  FieldRef<simit_float,2> c = points.addField<simit_float,2>("c");
+  BlockedGemvSystem system;
 
-  ElementRef p0 = points.add();
-  ElementRef p1 = points.add();
-  ElementRef p2 = points.add();
-
-  b.set(p0, {1.0, 2.0});
-  b.set(p1, {3.0, 4.0});
-  b.set(p2, {5.0, 6.0});
-
-  // Taint c
-  c.set(p0, {42.0, 42.0});
-  c.set(p2, {42.0, 42.0});
+  // Compile program and bind arguments
+  Function func = loadFunction(TEST_FILE_NAME, "main");
+  if (!func.defined()) FAIL();
+  system.bind(func);
 
-  // Springs
-  Set springs(points,points);
-  FieldRef<simit_float,2,2> a = springs.addField<simit_float,2,2>("a");
+  func.runSafe();
 
-  ElementRef s0 = springs.add(p0,p1);
-  ElementRef s1 = springs.add(p1,p2);
+  // Check that outputs are correct
+  system.assertProduct();
+}
 
-  a.set(s0, {1.0, 2.0, 3.0, 4.0});
-  a.set(s1, {5.0, 6.0, 7.0, 8.0});
+TEST(System, gemv_matrix_free) {
+  GemvSystem system;
 
   // Compile program and bind arguments
+  setMatrixFree(true);
   Function func = loadFunction(TEST_FILE_NAME, "main");
+  setMatrixFree(false);
   if (!func.defined()) FAIL();
+  system.bind(func);
 
-  func.bind("points", &points);
-  func.bind("springs", &springs);
+  func.runSafe();
+
+  // Check that inputs are preserved
+  ASSERT_EQ(1.0, system.b.get(system.p0));
+  ASSERT_EQ(2.0, system.b.get(system.p1));
+  ASSERT_EQ(3.0, system.b.get(system.p2));
+
+  // Check that outputs are correct (c = A*A*b)
+  ASSERT_EQ(16.0, system.c.get(system.p0));
+  ASSERT_EQ(62.0, system.c.get(system.p1));
+  ASSERT_EQ(46.0, system.c.get(system.p2));
+}
+
+TEST(System, gemv_blocked_matrix_free) {
+  BlockedGemvSystem system;
+
+  // Compile the blocked gemv program and bind arguments
+  setMatrixFree(true);
+  Function func = loadFunction(string(TEST_INPUT_DIR) +
+                               "/system/gemv_blocked.sim", "main");
+  setMatrixFree(false);
+  if (!func.defined()) FAIL();
+  system.bind(func);
 
   func.runSafe();
 
   // Check that outputs are correct
-  // TODO: add support for comparing a tensorref like so: b0 == {1.0, 2.0, 3.0}
-  TensorRef<simit_float,2> c0 = c.get(p0);
-  ASSERT_EQ(16.0, c0(0));
-  ASSERT_EQ(36.0, c0(1));
+  system.assertProduct();
+}
 
-  TensorRef<simit_float,2> c1 = c.get(p1);
-  ASSERT_EQ(116.0, c1(0));
-  ASSERT_EQ(172.0, c1(1));
+TEST(System, gemv_cached_assembly) {
+  GemvSystem system;
+  Set& springs = system.springs;
+  FieldRef<simit_float>& a = system.a;
+  FieldRef<simit_float>& b = system.b;
+  FieldRef<simit_float>& c = system.c;
+  ElementRef p0 = system.p0, p1 = system.p1, p2 = system.p2;
+
+  // Compile the gemv program and bind arguments
+  setCacheAssemblies(true);
+  Function func = loadFunction(string(TEST_INPUT_DIR) + "/system/gemv.sim",
+                               "main");
+  setCacheAssemblies(false);
+  if (!func.defined()) FAIL();
+  system.bind(func);
+
+  // Run twice, the second time with the matrix of the first
+  for (int i = 0; i < 2; ++i) {
+    func.runSafe();
+    ASSERT_EQ(3.0, c.get(p0));
+    ASSERT_EQ(13.0, c.get(p1));
+    ASSERT_EQ(10.0, c.get(p2));
+  }
+
+  // Changing a field the matrix is assembled from assembles it again
+  a.set(system.s0, 3.0);
+  func.runSafe();
+  ASSERT_EQ(9.0, c.get(p0));
+  ASSERT_EQ(19.0, c.get(p1));
+  ASSERT_EQ(10.0, c.get(p2));
 
-  TensorRef<simit_float,2> c2 = c.get(p2);
-  ASSERT_EQ(100.0, c2(0));
-  ASSERT_EQ(136.0, c2(1));
+  // Changing the vector does not
+  b.set(p0, 2.0);
+  func.runSafe();
+  ASSERT_EQ(12.0, c.get(p0));
+  ASSERT_EQ(22.0, c.get(p1));
+  ASSERT_EQ(10.0, c.get(p2));
+
+  // Fields written through their data are compared too
+  ((simit_float*)springs.getFieldData("a"))[1] = 1.0;
+  func.runSafe();
+  ASSERT_EQ(12.0, c.get(p0));
+  ASSERT_EQ(17.0, c.get(p1));
+  ASSERT_EQ(5.0, c.get(p2));
+}
+
+/// Returns the number of runs of the assembly loop over springs.
+static unsigned long long getSpringAssemblies(const Function& func) {
+  for (auto& kernel : func.getProfile().getKernels()) {
+    if (kernel.kind == KernelProfile::Loop &&
+        kernel.name.find("springs") != string::npos) {
+      return kernel.calls;
+    }
+  }
+  return 0;
+}
+
+/// Compiles the gemv program with timers and cached assemblies, and binds it
+/// to the system.
+static Function loadCachedAssembly(GemvSystem* system) {
+  setCacheAssemblies(true);
+  Function func = loadFunctionWithTimers(string(TEST_INPUT_DIR) +
+                                         "/system/gemv.sim", "main");
+  setCacheAssemblies(false);
+  if (func.defined()) {
+    system->bind(func);
+  }
+  return func;
+}
+
+TEST(System, gemv_cached_assembly_unchanged) {
+  GemvSystem system;
+  Function func = loadCachedAssembly(&system);
+  if (!func.defined()) FAIL();
+  func.runSafe();
+  ASSERT_EQ(1u, getSpringAssemblies(func));
+
+  // Writing a field the matrix is not assembled from skips the assembly
+  system.b.set(system.p2, 4.0);
+  func.runSafe();
+  ASSERT_EQ(1u, getSpringAssemblies(func));
+  ASSERT_EQ(15.0, (simit_float)system.c.get(system.p1));
+  ASSERT_EQ(12.0, (simit_float)system.c.get(system.p2));
+}
+
+TEST(System, gemv_cached_assembly_changed) {
+  GemvSystem system;
+  Function func = loadCachedAssembly(&system);
+  if (!func.defined()) FAIL();
+  func.runSafe();
+  ASSERT_EQ(1u, getSpringAssemblies(func));
+
+  // Writing a field the matrix is assembled from assembles it again
+  system.a.set(system.s0, 3.0);
+  func.runSafe();
+  ASSERT_EQ(2u, getSpringAssemblies(func));
+  ASSERT_EQ(9.0, (simit_float)system.c.get(system.p0));
+  ASSERT_EQ(19.0, (simit_float)system.c.get(system.p1));
+}
+
+TEST(System, gemv_symmetric) {
+  // The second spring's endpoints are in descending order
+  GemvSystem system(true);
+
+  // Compile the gemv program and bind arguments
+  const string fileName = string(TEST_INPUT_DIR) + "/system/gemv.sim";
+  setSymmetricStorage(true);
+  Function func = loadFunction(fileName, "main");
+  ir::Func lowered = ir::lower(loadIRFunction(fileName, "main"));
+  setSymmetricStorage(false);
+  if (!func.defined()) FAIL();
+
+  // A is stored as its upper triangle
+  vector<string> indices;
+  for (const ir::TensorIndex& index :
+           lowered.getEnvironment().getTensorIndices()) {
+    indices.push_back(index.getName());
+  }
+  ASSERT_EQ(vector<string>({"A_upper_index"}), indices);
+
+  system.bind(func);
+  func.runSafe();
+
+  // Check outputs
+  ASSERT_EQ(3.0, system.c.get(system.p0));
+  ASSERT_EQ(13.0, system.c.get(system.p1));
+  ASSERT_EQ(10.0, system.c.get(system.p2));
 }
 
 TEST(System, gemv_blocked_nw) {
@@ -1,12 +1,28 @@
 #include "simit-test.h"
 
+#include <sstream>
+
 #include "graph.h"
 #include "program.h"
 #include "error.h"
+#include "init.h"
 
 using namespace std;
 using namespace simit;
 
+namespace {
+/// Restores the solver method and options when it goes out of scope, so that
+/// a test that changes them does not leak them into later tests when it fails
+struct SolverOptionsScope {
+  internal::SolverOptions previous;
+
+  SolverOptionsScope() : previous(kSolverOptions) {}
+  ~SolverOptionsScope() {
+    kSolverOptions = previous;
+  }
+};
+}
+
 TEST(System, swap) {
   Set V;
   FieldRef<simit_float> val = V.addField<simit_float>("val");
@@ -669,7 +685,6 @@ TEST(System, DISABLED_map_vec_assign) {
   SIMIT_ASSERT_FLOAT_EQ(9.1, x(p2)(2));
 }
 
-#ifdef EIGEN
 TEST(System, solve_external) {
   // Points
   Set points;
@@ -718,10 +733,92 @@ TEST(System, solve_external) {
   ASSERT_NEAR(4.0, (double)c.get(p2), 0.00001);
 }
 
-// the test doesn't get very close to the correct answer
-// due to the low # of CG iterations.
-// SK has tested with more iterations and it does indeed
-// get a reasonable answer.
+TEST(System, solve_direct) {
+  SolverOptionsScope solverOptions;
+  setSolverMethod("direct");
+
+  // Points
+  Set points;
+  FieldRef<simit_float> b = points.addField<simit_float>("b");
+  FieldRef<simit_float> c = points.addField<simit_float>("c");
+
+  ElementRef p0 = points.add();
+  ElementRef p1 = points.add();
+  ElementRef p2 = points.add();
+
+  b.set(p0, 2.0);
+  b.set(p1, 1.0);
+  b.set(p2, 4.0);
+
+  // Springs
+  Set springs(points,points);
+  FieldRef<simit_float> a = springs.addField<simit_float>("a");
+
+  ElementRef s0 = springs.add(p0,p1);
+  ElementRef s1 = springs.add(p1,p2);
+
+  a.set(s0, 2.0);
+  a.set(s1, 1.0);
+
+  // Compile program and bind arguments
+  Function func = loadFunction(string(TEST_INPUT_DIR) +
+                               "/system/solve_external.sim", "main");
+  if (!func.defined()) FAIL();
+
+  func.bind("points", &points);
+  func.bind("springs", &springs);
+
+  // The second run refactorizes new values with the same pattern
+  for (int run = 0; run < 2; ++run) {
+    c.set(p0, 42.0);
+    c.set(p2, 42.0);
+    a.set(s1, 1.0 + run);
+    func.runSafe();
+
+    ASSERT_NEAR(2.0, (double)c.get(p0), 0.00001);
+    ASSERT_NEAR(1.0, (double)c.get(p1), 0.00001);
+    ASSERT_NEAR(4.0, (double)c.get(p2), 0.00001);
+  }
+}
+
+TEST(System, solve_not_converged) {
+  SolverOptionsScope solverOptions;
+  setSolverOptions("none", 1e-10, 1);
+
+  Set points;
+  FieldRef<simit_float> b = points.addField<simit_float>("b");
+  points.addField<simit_float>("c");
+  vector<ElementRef> p;
+  for (int i = 0; i < 10; ++i) {
+    p.push_back(points.add());
+    b.set(p.back(), (simit_float)(i + 1));
+  }
+  Set springs(points,points);
+  FieldRef<simit_float> a = springs.addField<simit_float>("a");
+  for (int i = 0; i < 9; ++i) {
+    a.set(springs.add(p[i], p[i+1]), 1.0);
+  }
+
+  Function func = loadFunction(string(TEST_INPUT_DIR) +
+                               "/system/solve_external.sim", "main");
+  if (!func.defined()) FAIL();
+  func.bind("points", &points);
+  func.bind("springs", &springs);
+
+  // A single iteration does not solve the system, which the result reports
+  func.runSafe();
+  internal::SolverResult result = getLastSolverResult();
+  ASSERT_FALSE(result.converged);
+  ASSERT_EQ(1, result.iterations);
+  ASSERT_GT(result.residual, 1e-10);
+
+  setSolverOptions();
+  func.runSafe();
+  ASSERT_TRUE(getLastSolverResult().converged);
+}
+
+// The matrix is not symmetric, so conjugate gradient only gets close to the
+// correct answer.
 TEST(System, solve_external_blocked) {
   // Points
   Set points;
@@ -774,7 +871,6 @@ TEST(System, solve_external_blocked) {
   ASSERT_NEAR(2.0, c2(0), 1.0);
   ASSERT_NEAR(4.0, c2(1), 1.0);
 }
-#endif
 
 TEST(System, DISABLED_if_reassign) {
   // Points
@@ -816,3 +912,222 @@ TEST(System, DISABLED_if_reassign) {
   SIMIT_ASSERT_FLOAT_EQ(0.0, x2(1));
   SIMIT_ASSERT_FLOAT_EQ(0.0, x2(2));
 }
+
+TEST(System, field_aliasing) {
+  Set points;
+  FieldRef<simit_float> a = points.addField<simit_float>("a");
+  FieldRef<simit_float> b = points.addField<simit_float>("b");
+  vector<ElementRef> pointRefs;
+  for (int i = 0; i < 1000; ++i) {
+    pointRefs.push_back(points.add());
+    a.set(pointRefs.back(), (simit_float)i);
+    b.set(pointRefs.back(), 1.0);
+  }
+
+  // Fields and temporaries are compiled as never overlapping, which lets
+  // LLVM vectorize the loops that read some of them and write others. Code
+  // loaded from the object cache is not optimized, so the cache is disabled.
+  string cacheDir = kCacheDir;
+  setCacheDir("");
+  Function func = loadFunction(TEST_FILE_NAME, "main");
+  setCacheDir(cacheDir);
+  if (!func.defined()) FAIL();
+
+  // The loads and stores of the buffers carry TBAA metadata, and alias scope
+  // metadata where LLVM has alias scopes (3.6 and later)
+  stringstream ir;
+  func.print(ir);
+  ASSERT_NE(string::npos, ir.str().find("!tbaa"));
+  if (ir.str().find("!alias.scope") != string::npos) {
+    ASSERT_NE(string::npos, ir.str().find("!noalias"));
+  }
+
+  // The loop vectorizer vectorized at least one of the loops (debug builds
+  // are not optimized)
+#ifndef SIMIT_DEBUG
+  ASSERT_NE(string::npos, ir.str().find("vector.body"));
+#endif
+
+  func.bind("points", &points);
+  func.runSafe();
+
+  for (int i = 0; i < 1000; ++i) {
+    SIMIT_ASSERT_FLOAT_EQ(2.0*(i+1), a.get(pointRefs[i]));
+    SIMIT_ASSERT_FLOAT_EQ(3.0*(i+1), b.get(pointRefs[i]));
+  }
+}
+
+TEST(System, vectorize_blocks) {
+  Set points;
+  FieldRef<simit_float,3> x = points.addField<simit_float,3>("x");
+  FieldRef<simit_float,3,3> M = points.addField<simit_float,3,3>("M");
+  FieldRef<simit_float,3> y = points.addField<simit_float,3>("y");
+
+  ElementRef p0 = points.add();
+  ElementRef p1 = points.add();
+
+  x.set(p0, {1.0, 2.0, 3.0});
+  M.set(p0, {1.0, 2.0, 0.0,
+             0.0, 1.0, 3.0,
+             2.0, 0.0, 1.0});
+  x.set(p1, {1.0, -1.0, 0.5});
+  M.set(p1, {2.0, 0.0, 0.0,
+             0.0, 2.0, 0.0,
+             0.0, 0.0, 2.0});
+
+  // The block loops (transpose, matrix-matrix and matrix-vector products)
+  // must compute the same with and without vector code
+  for (bool vectorize : {true, false}) {
+    setVectorizeBlocks(vectorize);
+    Function func = loadFunction(TEST_FILE_NAME, "main");
+    setVectorizeBlocks(true);
+    if (!func.defined()) FAIL();
+
+    y.set(p0, {0.0, 0.0, 0.0});
+    y.set(p1, {0.0, 0.0, 0.0});
+    func.bind("points", &points);
+    func.runSafe();
+
+    SIMIT_ASSERT_FLOAT_EQ(17.0, y(p0)(0));
+    SIMIT_ASSERT_FLOAT_EQ(35.0, y(p0)(1));
+    SIMIT_ASSERT_FLOAT_EQ(29.0, y(p0)(2));
+    SIMIT_ASSERT_FLOAT_EQ(6.0,  y(p1)(0));
+    SIMIT_ASSERT_FLOAT_EQ(-6.0, y(p1)(1));
+    SIMIT_ASSERT_FLOAT_EQ(3.0,  y(p1)(2));
+  }
+}
+
+TEST(System, vectorize_maps) {
+  Set points;
+  FieldRef<simit_float> x = points.addField<simit_float>("x");
+  FieldRef<simit_float> b = points.addField<simit_float>("b");
+
+  ElementRef p0 = points.add();
+  ElementRef p1 = points.add();
+  ElementRef p2 = points.add();
+  ElementRef p3 = points.add();
+  ElementRef p4 = points.add();
+
+  x.set(p0, 0.0);
+  x.set(p1, 1.0);
+  x.set(p2, 3.0);
+  x.set(p3, 2.0);
+  x.set(p4, 5.0);
+
+  Set springs(points,points);
+  FieldRef<simit_float> k = springs.addField<simit_float>("k");
+
+  ElementRef s0 = springs.add(p0,p1);
+  ElementRef s1 = springs.add(p1,p2);
+  ElementRef s2 = springs.add(p2,p3);
+  ElementRef s3 = springs.add(p0,p3);
+  ElementRef s4 = springs.add(p4,p0);
+
+  k.set(s0, 1.0);
+  k.set(s1, 2.0);
+  k.set(s2, 3.0);
+  k.set(s3, 4.0);
+  k.set(s4, 5.0);
+
+  // With four lanes, the first four springs take both branches and two of
+  // them add to p0, and the last spring runs in the scalar loop
+  for (unsigned width : {4u, 1u}) {
+    setMapVectorWidth(width);
+    Function func = loadFunction(TEST_FILE_NAME, "main");
+    setMapVectorWidth(1);
+    if (!func.defined()) FAIL();
+
+    func.bind("points", &points);
+    func.bind("springs", &springs);
+    func.runSafe();
+
+    SIMIT_ASSERT_FLOAT_EQ(9.0,  b.get(p0));
+    SIMIT_ASSERT_FLOAT_EQ(5.0,  b.get(p1));
+    SIMIT_ASSERT_FLOAT_EQ(5.0,  b.get(p2));
+    SIMIT_ASSERT_FLOAT_EQ(4.0,  b.get(p3));
+    SIMIT_ASSERT_FLOAT_EQ(25.0, b.get(p4));
+  }
+}
+
+TEST(System, field_layout) {
+  // Tiles of four points let the lanes of the vectorized point map load and
+  // store whole vectors, while the spring map gathers its endpoints' tensors
+  for (int tile : {4, 1}) {
+    for (unsigned width : {4u, 1u}) {
+      FieldLayout layout = FieldLayout::tiled(tile);
+      Set points;
+      FieldRef<simit_float,3> x = points.addField<simit_float,3>("x", layout);
+      FieldRef<simit_float,3> v = points.addField<simit_float,3>("v", layout);
+      FieldRef<simit_float,3> y = points.addField<simit_float,3>("y", layout);
+
+      ElementRef p0 = points.add();
+      ElementRef p1 = points.add();
+      ElementRef p2 = points.add();
+      ElementRef p3 = points.add();
+      ElementRef p4 = points.add();
+
+      x.set(p0, {0.0, 0.0, 0.0});
+      x.set(p1, {1.0, 0.0, 0.0});
+      x.set(p2, {1.0, 2.0, 0.0});
+      x.set(p3, {0.0, 2.0, 1.0});
+      x.set(p4, {3.0, 0.0, 0.0});
+
+      v.set(p0, {0.0, 0.0, 0.0});
+      v.set(p1, {1.0, -1.0, 2.0});
+      v.set(p2, {2.0, -2.0, 4.0});
+      v.set(p3, {3.0, -3.0, 6.0});
+      v.set(p4, {4.0, -4.0, 8.0});
+
+      Set springs(points,points);
+      FieldRef<simit_float> k = springs.addField<simit_float>("k", layout);
+
+      ElementRef s0 = springs.add(p0,p1);
+      ElementRef s1 = springs.add(p1,p2);
+      ElementRef s2 = springs.add(p2,p3);
+      ElementRef s3 = springs.add(p0,p3);
+      ElementRef s4 = springs.add(p4,p0);
+
+      k.set(s0, 1.0);
+      k.set(s1, 2.0);
+      k.set(s2, 3.0);
+      k.set(s3, 4.0);
+      k.set(s4, 5.0);
+
+      setFieldLayout(layout);
+      setMapVectorWidth(width);
+      Function func = loadFunction(TEST_FILE_NAME, "main");
+      setMapVectorWidth(1);
+      setFieldLayout(FieldLayout());
+      if (!func.defined()) FAIL();
+
+      func.bind("points", &points);
+      func.bind("springs", &springs);
+      func.runSafe();
+
+      SIMIT_ASSERT_FLOAT_EQ(0.0,  y(p0)(0));
+      SIMIT_ASSERT_FLOAT_EQ(3.0,  y(p1)(0));
+      SIMIT_ASSERT_FLOAT_EQ(-2.0, y(p1)(1));
+      SIMIT_ASSERT_FLOAT_EQ(4.0,  y(p1)(2));
+      SIMIT_ASSERT_FLOAT_EQ(5.0,  y(p2)(0));
+      SIMIT_ASSERT_FLOAT_EQ(8.0,  y(p2)(2));
+      SIMIT_ASSERT_FLOAT_EQ(-4.0, y(p3)(1));
+      SIMIT_ASSERT_FLOAT_EQ(13.0, y(p3)(2));
+      SIMIT_ASSERT_FLOAT_EQ(11.0, y(p4)(0));
+      SIMIT_ASSERT_FLOAT_EQ(-8.0, y(p4)(1));
+      SIMIT_ASSERT_FLOAT_EQ(16.0, y(p4)(2));
+
+      SIMIT_ASSERT_FLOAT_EQ(16.0,  v(p0)(0));
+      SIMIT_ASSERT_FLOAT_EQ(8.0,   v(p0)(1));
+      SIMIT_ASSERT_FLOAT_EQ(4.0,   v(p0)(2));
+      SIMIT_ASSERT_FLOAT_EQ(-1.0,  v(p1)(0));
+      SIMIT_ASSERT_FLOAT_EQ(4.0,   v(p1)(1));
+      SIMIT_ASSERT_FLOAT_EQ(-3.0,  v(p2)(0));
+      SIMIT_ASSERT_FLOAT_EQ(-4.0,  v(p2)(1));
+      SIMIT_ASSERT_FLOAT_EQ(3.0,   v(p2)(2));
+      SIMIT_ASSERT_FLOAT_EQ(3.0,   v(p3)(0));
+      SIMIT_ASSERT_FLOAT_EQ(-8.0,  v(p3)(1));
+      SIMIT_ASSERT_FLOAT_EQ(-7.0,  v(p3)(2));
+      SIMIT_ASSERT_FLOAT_EQ(-15.0, v(p4)(0));
+    }
+  }
+}
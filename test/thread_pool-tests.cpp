@@ -0,0 +1,63 @@
+#include "gtest/gtest.h"
+
+#include <atomic>
+#include <vector>
+
+#include "thread_pool.h"
+
+using namespace std;
+using namespace simit::internal;
+
+static void countIterations(int start, int end, void **context) {
+  auto counts = static_cast<vector<atomic<int>>*>(context[0]);
+  for (int i = start; i < end; ++i) {
+    (*counts)[i]++;
+  }
+}
+
+static void checkEachIterationOnce(ThreadPool::Schedule schedule,
+                                   int chunkSize) {
+  const int size = 10007;
+  vector<atomic<int>> counts(size);
+  for (auto &count : counts) {
+    count = 0;
+  }
+  void *context[] = {&counts};
+  ThreadPool::getInstance().parallelFor(0, size, countIterations, context,
+                                        schedule, chunkSize);
+  for (int i = 0; i < size; ++i) {
+    ASSERT_EQ(1, counts[i]) << "iteration " << i;
+  }
+}
+
+TEST(ThreadPool, static_schedule) {
+  ThreadPool::getInstance().setNumThreads(4);
+  checkEachIterationOnce(ThreadPool::Static, 0);
+  checkEachIterationOnce(ThreadPool::Static, 7);
+  ThreadPool::getInstance().setNumThreads(1);
+}
+
+TEST(ThreadPool, dynamic_schedule) {
+  ThreadPool::getInstance().setNumThreads(4);
+  checkEachIterationOnce(ThreadPool::Dynamic, 0);
+  checkEachIterationOnce(ThreadPool::Dynamic, 13);
+  ThreadPool::getInstance().setNumThreads(1);
+}
+
+static void nestedLoop(int start, int end, void **context) {
+  for (int i = start; i < end; ++i) {
+    ThreadPool::getInstance().parallelFor(0, 1, countIterations, context,
+                                          ThreadPool::Static, 0);
+  }
+}
+
+TEST(ThreadPool, nested) {
+  ThreadPool::getInstance().setNumThreads(3);
+  vector<atomic<int>> counts(1);
+  counts[0] = 0;
+  void *context[] = {&counts};
+  ThreadPool::getInstance().parallelFor(0, 100, nestedLoop, context,
+                                        ThreadPool::Dynamic, 1);
+  ASSERT_EQ(100, counts[0]);
+  ThreadPool::getInstance().setNumThreads(1);
+}
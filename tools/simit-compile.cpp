@@ -0,0 +1,182 @@
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "init.h"
+#include "program.h"
+#include "function.h"
+#include "util/util.h"
+
+using namespace std;
+using namespace simit;
+
+void printUsage(); // GCC shut up
+int runCommand(const vector<string>& args);
+
+void printUsage() {
+  cerr << "Usage: simit-compile [options] <simit-source>" << endl << endl
+       << "Compiles a Simit function ahead of time to <output>.o, and writes"
+       << endl
+       << "the C header <output>.h that declares its entry points and context"
+       << endl
+       << "object."
+       << endl << endl
+       << "Options:"              << endl
+       << "-function=<function> (default: main)" << endl
+       << "-o=<output>"           << endl
+       << "-cpu=<cpu>"            << endl
+       << "-shared"               << endl;
+}
+
+/// Runs the program args[0] with the arguments, without going through a shell,
+/// and returns its exit status.
+int runCommand(const vector<string>& args) {
+  vector<char*> argv;
+  for (const string& arg : args) {
+    argv.push_back(const_cast<char*>(arg.c_str()));
+  }
+  argv.push_back(nullptr);
+
+  pid_t pid = fork();
+  if (pid < 0) {
+    return -1;
+  }
+  if (pid == 0) {
+    execvp(argv[0], argv.data());
+    _exit(127);
+  }
+  int status;
+  if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status)) {
+    return -1;
+  }
+  return WEXITSTATUS(status);
+}
+
+int main(int argc, const char* argv[]) {
+  if (argc < 2) {
+    printUsage();
+    return 3;
+  }
+
+  bool shared = false;
+
+  string function;
+  string output;
+  string cpu;
+  string sourceFile;
+
+  // Parse Arguments
+  for (int i=1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg[0] == '-') {
+      std::vector<std::string> keyValPair = simit::util::split(arg, "=");
+      if (keyValPair.size() == 1 && arg == "-shared") {
+        shared = true;
+      }
+      else if (keyValPair.size() == 2 && keyValPair[0] == "-function") {
+        function = keyValPair[1];
+      }
+      else if (keyValPair.size() == 2 && keyValPair[0] == "-o") {
+        output = keyValPair[1];
+      }
+      else if (keyValPair.size() == 2 && keyValPair[0] == "-cpu") {
+        cpu = keyValPair[1];
+      }
+      else {
+        printUsage();
+        return 3;
+      }
+    }
+    else {
+      if (sourceFile != "") {
+        printUsage();
+        return 3;
+      }
+      sourceFile = arg;
+    }
+  }
+  if (sourceFile == "") {
+    printUsage();
+    return 3;
+  }
+
+#ifdef F32
+  simit::init("cpu", sizeof(float));
+#else
+  simit::init("cpu", sizeof(double));
+#endif
+
+  // Cached code is not optimized, so always generate it
+  setCacheDir("");
+
+  // Generate code for the given CPU instead of the host, e.g. a baseline CPU
+  // that all the machines the program is deployed to support. The build
+  // machine need not support it, since the code is not run here.
+  if (cpu != "") {
+    setForcedTargetCPU(cpu);
+  }
+
+  Program program;
+  if (program.loadFile(sourceFile) != 0) {
+    cerr << program.getDiagnostics().getMessage() << endl;
+    return 1;
+  }
+
+  if (function == "") {
+    vector<string> functionNames = program.getFunctionNames();
+    if (std::find(functionNames.begin(), functionNames.end(), "main") ==
+        functionNames.end()) {
+      cerr << "Error: choose which function to compile using "
+           << "-function=<function>" << endl;
+      return 5;
+    }
+    function = "main";
+  }
+  if (output == "") {
+    output = function;
+  }
+
+  Function func = program.compile(function);
+  if (!func.defined()) {
+    cerr << "Error: Could not compile function " << function << " in "
+         << sourceFile << endl;
+    return 4;
+  }
+
+  string objectFile = output + ".o";
+  ofstream object(objectFile, ios::binary | ios::trunc);
+  func.writeObject(object);
+  object.close();
+
+  ofstream header(output + ".h", ios::trunc);
+  func.writeHeader(header);
+  header.close();
+
+  if (!object || !header) {
+    cerr << "Error: Could not write " << output << ".o and " << output << ".h"
+         << endl;
+    return 2;
+  }
+
+  // Link the object into a shared library with the system compiler. The
+  // library leaves the Simit runtime functions it calls (the thread pool,
+  // solvers and timers) to be resolved against libsimit when it is loaded.
+  if (shared) {
+    const char* cc = getenv("CC");
+    // Paths are passed as separate arguments, so spaces and shell
+    // metacharacters in them are not interpreted, and a leading dash cannot
+    // be taken for an option
+    string objectArg = (objectFile[0] == '-') ? "./" + objectFile : objectFile;
+    vector<string> command = {(cc != nullptr) ? cc : "cc", "-shared", "-o",
+                              output + ".so", objectArg};
+    if (runCommand(command) != 0) {
+      cerr << "Error: Could not link " << output << ".so" << endl;
+      return 2;
+    }
+  }
+
+  return 0;
+}